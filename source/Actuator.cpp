@@ -0,0 +1,495 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Actuator.h"
+#include "Servo.h"
+#include "Calibration.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Tracer.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <pthread.h>
+#include <sched.h>
+#include <string.h>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+LOGGER_TAG("actuator")
+
+namespace actuator
+{
+    extern const unsigned int control_rate_hz = 50; // one step per 20ms servo PWM frame
+    extern const double max_speed_dps = 90.0;
+    extern const double max_accel_dps2 = 240.0;
+    extern const double home_angle = 90.0;
+    extern const unsigned int velocity_hold_ms = 500;
+
+    namespace
+    {
+        const int rt_priority = 10;
+        // closer than this the axis snaps to the target
+        const double arrive_epsilon = 0.05;
+
+        enum Mode
+        {
+            MODE_ABSOLUTE,
+            MODE_RELATIVE,
+            MODE_VELOCITY,
+            MODE_STOP,
+        };
+
+        struct Command
+        {
+            Mode mode;
+            unsigned int axes;
+            double pan; // degrees, or degrees per second
+            double tilt;
+            struct timespec queued;
+        };
+
+        /// State of one axis, only touched by the actuation thread
+        struct AxisState
+        {
+            double position;
+            double velocity;
+            double target;
+            double maxSpeed;
+            double maxAccel;
+            bool moving;
+            bool armed; // the servo is only driven once it was commanded
+            unsigned int pulsewidth; // 0 while no pulses are generated
+            struct timespec pulseStart;
+        };
+
+        std::mutex s_lock;
+        std::condition_variable s_wakeup;
+        std::deque<Command> s_queue;
+        bool s_stopping = false;
+        std::thread s_thread;
+        unsigned int s_settleMs = 0;
+
+        AxisState s_axes[2];
+        std::atomic<double> s_panPosition(home_angle);
+        std::atomic<double> s_tiltPosition(home_angle);
+        struct timespec s_moveStart;
+        // queue time of the oldest command not turned into a pulse yet, tv_sec 0 when there is none
+        struct timespec s_commandQueued;
+
+        // held while the listener runs, so clearing it waits for a running call
+        std::mutex s_listenerLock;
+        Listener s_listener;
+        std::vector<Listener> s_moreListeners;
+
+        uint64_t elapsedMs(const struct timespec &from, const struct timespec &to)
+        {
+            return (uint64_t)((to.tv_sec - from.tv_sec) * 1000 + (to.tv_nsec - from.tv_nsec) / 1000000);
+        }
+
+        uint64_t elapsedUs(const struct timespec &from, const struct timespec &to)
+        {
+            return (uint64_t)((to.tv_sec - from.tv_sec) * 1000000 + (to.tv_nsec - from.tv_nsec) / 1000);
+        }
+
+        void addNs(struct timespec &ts, long ns)
+        {
+            ts.tv_nsec += ns;
+            while (ts.tv_nsec >= 1000000000L)
+            {
+                ts.tv_nsec -= 1000000000L;
+                ts.tv_sec++;
+            }
+        }
+
+        bool anyMoving()
+        {
+            return s_axes[0].moving || s_axes[1].moving;
+        }
+
+        /// Where the axis comes to rest when it brakes now
+        double restingPoint(int i)
+        {
+            const AxisState &axis = s_axes[i];
+            if (axis.velocity == 0)
+            {
+                return axis.position;
+            }
+            return calibration::clamp((calibration::Axis)i, axis.position + axis.velocity * fabs(axis.velocity) / (2.0 * max_accel_dps2));
+        }
+
+        /// Absolute target of one axis for a command
+        double targetOf(const Command &command, int i, double value)
+        {
+            switch (command.mode)
+            {
+            case MODE_RELATIVE:
+                return calibration::clamp((calibration::Axis)i, s_axes[i].target + value);
+            case MODE_VELOCITY:
+                // the target runs ahead by the hold time, without a new command the axis brakes to a stop there
+                return value == 0 ? restingPoint(i) : calibration::clamp((calibration::Axis)i, s_axes[i].position + value * velocity_hold_ms / 1000.0);
+            case MODE_STOP:
+                return restingPoint(i);
+            default:
+                return value;
+            }
+        }
+
+        /// Plan the new target from the current position and velocity of each axis
+        void plan(const Command &command)
+        {
+            const bool selected[2] = {(command.axes & AXIS_PAN) != 0 && (command.mode != MODE_STOP || s_axes[0].armed),
+                                      (command.axes & AXIS_TILT) != 0 && (command.mode != MODE_STOP || s_axes[1].armed)};
+            const double targets[2] = {targetOf(command, 0, command.pan), targetOf(command, 1, command.tilt)};
+            const double speeds[2] = {fabs(command.pan), fabs(command.tilt)};
+            // velocity and stop targets follow the axis, the deadband would hold them back
+            const bool exact = command.mode == MODE_VELOCITY || command.mode == MODE_STOP;
+            double distance[2] = {0, 0};
+            double longest = 0;
+
+            if (s_commandQueued.tv_sec == 0)
+            {
+                s_commandQueued = command.queued;
+            }
+
+            if (anyMoving())
+            {
+                metrics::counter("servo.preemptions").add();
+            }
+            else
+            {
+                clock_gettime(CLOCK_MONOTONIC, &s_moveStart);
+            }
+
+            for (int i = 0; i < 2; i++)
+            {
+                // the deadband keeps jitter of the commanded angle from hunting the servo
+                if (selected[i] && (exact || !s_axes[i].armed || fabs(targets[i] - s_axes[i].target) >= calibration::deadband((calibration::Axis)i)))
+                {
+                    s_axes[i].target = targets[i];
+                    s_axes[i].armed = true;
+                }
+                distance[i] = fabs(s_axes[i].target - s_axes[i].position);
+                longest = distance[i] > longest ? distance[i] : longest;
+            }
+
+            // Same profile shape on both axes: the shorter move gets proportionally lower limits and arrives with the longer one
+            for (int i = 0; i < 2; i++)
+            {
+                double scale = longest > 0 ? distance[i] / longest : 1.0;
+                // an axis preempted while moving needs its full limits to brake
+                if (s_axes[i].velocity != 0)
+                {
+                    scale = 1.0;
+                }
+                s_axes[i].maxSpeed = max_speed_dps * scale;
+                s_axes[i].maxAccel = max_accel_dps2 * scale;
+                if (selected[i] && command.mode == MODE_VELOCITY)
+                {
+                    // each axis keeps its own commanded speed
+                    s_axes[i].maxSpeed = speeds[i] == 0 ? max_speed_dps : std::min(speeds[i], max_speed_dps);
+                    s_axes[i].maxAccel = max_accel_dps2;
+                }
+                // a servo never driven before needs one step even when it is assumed to be at the target already
+                s_axes[i].moving = distance[i] > arrive_epsilon || fabs(s_axes[i].velocity) > 0 || (s_axes[i].armed && s_axes[i].pulsewidth == 0);
+            }
+        }
+
+        /// Advance one axis by one control period
+        void step(AxisState &axis, double dt)
+        {
+            double remaining = axis.target - axis.position;
+            double direction = remaining >= 0 ? 1.0 : -1.0;
+            double limit = axis.maxAccel * dt;
+
+            // fastest speed that still allows to brake before the target
+            double desired = direction * std::min(axis.maxSpeed, sqrt(2.0 * axis.maxAccel * fabs(remaining)));
+            double change = desired - axis.velocity;
+            change = change > limit ? limit : (change < -limit ? -limit : change);
+            axis.velocity += change;
+            axis.position += axis.velocity * dt;
+
+            double left = axis.target - axis.position;
+            if (fabs(left) <= arrive_epsilon || (left >= 0 ? 1.0 : -1.0) != direction)
+            {
+                axis.position = axis.target;
+                axis.velocity = 0;
+                axis.moving = false;
+            }
+        }
+
+        /// Account the time since the pulses of an axis were switched on
+        void pulsesOff(int i, const struct timespec &now)
+        {
+            if (s_axes[i].pulsewidth != 0)
+            {
+                metrics::counter(i == 0 ? "servo.pan_pulse_on_ms" : "servo.tilt_pulse_on_ms").add(elapsedMs(s_axes[i].pulseStart, now));
+                s_axes[i].pulsewidth = 0;
+            }
+        }
+
+        /// Switch the pulses off once the target was held for the settle time, the next command switches them on again
+        void detach()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            if (s_axes[0].pulsewidth != 0)
+            {
+                servo::panServo(0);
+            }
+            if (s_axes[1].pulsewidth != 0)
+            {
+                servo::tiltServo(0);
+            }
+            pulsesOff(0, now);
+            pulsesOff(1, now);
+            metrics::counter("servo.detaches").add();
+            LOG_DEBUG("[ACTUATOR] Servo pulses off after holding for " << s_settleMs << "ms");
+        }
+
+        bool attached()
+        {
+            return s_axes[0].pulsewidth != 0 || s_axes[1].pulsewidth != 0;
+        }
+
+        void output()
+        {
+            unsigned int pulsewidth;
+            unsigned int sent = 0;
+            struct timespec now;
+            clock_gettime(CLOCK_MONOTONIC, &now);
+
+            pulsewidth = calibration::pulsewidth(calibration::AXIS_PAN, s_axes[0].position);
+            if (s_axes[0].armed && pulsewidth != s_axes[0].pulsewidth)
+            {
+                if (s_axes[0].pulsewidth == 0)
+                {
+                    s_axes[0].pulseStart = now;
+                }
+                servo::panServo(pulsewidth);
+                s_axes[0].pulsewidth = pulsewidth;
+                sent++;
+                metrics::gauge("servo.pan_deg").set(s_axes[0].position);
+            }
+            pulsewidth = calibration::pulsewidth(calibration::AXIS_TILT, s_axes[1].position);
+            if (s_axes[1].armed && pulsewidth != s_axes[1].pulsewidth)
+            {
+                if (s_axes[1].pulsewidth == 0)
+                {
+                    s_axes[1].pulseStart = now;
+                }
+                servo::tiltServo(pulsewidth);
+                s_axes[1].pulsewidth = pulsewidth;
+                sent++;
+                metrics::gauge("servo.tilt_deg").set(s_axes[1].position);
+            }
+            s_panPosition.store(s_axes[0].position);
+            s_tiltPosition.store(s_axes[1].position);
+
+            if (sent > 0 && s_commandQueued.tv_sec != 0)
+            {
+                metrics::histogram("servo.command_to_motion_us").record(elapsedUs(s_commandQueued, now));
+                s_commandQueued.tv_sec = 0;
+            }
+        }
+
+        void enqueue(Mode mode, unsigned int axes, double pan, double tilt)
+        {
+            Command command;
+            command.mode = mode;
+            command.axes = axes;
+            command.pan = pan;
+            command.tilt = tilt;
+            clock_gettime(CLOCK_MONOTONIC, &command.queued);
+            {
+                std::lock_guard<std::mutex> lock(s_lock);
+                s_queue.push_back(command);
+            }
+            s_wakeup.notify_one();
+            TRACE_INSTANT("actuator.command");
+        }
+
+        void notifyListener()
+        {
+            std::lock_guard<std::mutex> lock(s_listenerLock);
+            if (s_listener)
+            {
+                s_listener(s_axes[0].position, s_axes[1].position);
+            }
+            for (size_t i = 0; i < s_moreListeners.size(); i++)
+            {
+                s_moreListeners[i](s_axes[0].position, s_axes[1].position);
+            }
+        }
+
+        void run()
+        {
+            threadstats::nameThread("c3-actuator");
+
+            struct sched_param param;
+            memset(&param, 0, sizeof(param));
+            param.sched_priority = rt_priority;
+            int err = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+            if (err != 0)
+            {
+                LOG_INFO("[ACTUATOR] Real-time priority not available (" << strerror(err) << "), running at normal priority");
+            }
+
+            const long period_ns = 1000000000L / control_rate_hz;
+            const double dt = 1.0 / control_rate_hz;
+            struct timespec next;
+            struct timespec now;
+
+            while (true)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(s_lock);
+                    // sleep until there is something to do, the control loop only ticks while moving
+                    std::chrono::steady_clock::time_point settled = std::chrono::steady_clock::now() + std::chrono::milliseconds(s_settleMs);
+                    while (!s_stopping && s_queue.empty() && !anyMoving())
+                    {
+                        if (s_settleMs == 0 || !attached())
+                        {
+                            s_wakeup.wait(lock);
+                        }
+                        else if (s_wakeup.wait_until(lock, settled) == std::cv_status::timeout && s_queue.empty() && !s_stopping)
+                        {
+                            detach();
+                        }
+                    }
+                    if (s_stopping)
+                    {
+                        struct timespec now;
+                        clock_gettime(CLOCK_MONOTONIC, &now);
+                        pulsesOff(0, now);
+                        pulsesOff(1, now);
+                        break;
+                    }
+                    if (!anyMoving())
+                    {
+                        clock_gettime(CLOCK_MONOTONIC, &next);
+                    }
+                    // commands are applied in order, so the latest target wins
+                    while (!s_queue.empty())
+                    {
+                        plan(s_queue.front());
+                        s_queue.pop_front();
+                    }
+                    if (!anyMoving())
+                    {
+                        // already at the target
+                        s_commandQueued.tv_sec = 0;
+                        continue;
+                    }
+                }
+
+                {
+                    TRACE_SCOPE("actuator.step");
+                    step(s_axes[0], dt);
+                    step(s_axes[1], dt);
+                    output();
+                }
+
+                if (!anyMoving())
+                {
+                    clock_gettime(CLOCK_MONOTONIC, &now);
+                    metrics::histogram("servo.move_ms").record(elapsedMs(s_moveStart, now));
+                    notifyListener();
+                    continue;
+                }
+
+                // absolute deadlines keep the control rate free of drift
+                addNs(next, period_ns);
+                clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+            }
+        }
+    } // namespace
+
+    void start(double panDeg, double tiltDeg)
+    {
+        const double initial[2] = {panDeg, tiltDeg};
+        for (int i = 0; i < 2; i++)
+        {
+            s_axes[i].position = initial[i];
+            s_axes[i].velocity = 0;
+            s_axes[i].target = initial[i];
+            s_axes[i].maxSpeed = max_speed_dps;
+            s_axes[i].maxAccel = max_accel_dps2;
+            s_axes[i].moving = false;
+            s_axes[i].armed = false;
+            s_axes[i].pulsewidth = 0;
+        }
+        s_panPosition.store(panDeg);
+        s_tiltPosition.store(tiltDeg);
+        s_commandQueued.tv_sec = 0;
+        s_stopping = false;
+        s_thread = std::thread(run);
+        LOG_INFO("[ACTUATOR] Started at " << control_rate_hz << "Hz, " << max_speed_dps << " deg/s, " << max_accel_dps2 << " deg/s^2");
+    }
+
+    void stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_lock);
+            s_stopping = true;
+            s_queue.clear();
+        }
+        s_wakeup.notify_all();
+        if (s_thread.joinable())
+        {
+            s_thread.join();
+        }
+    }
+
+    void moveTo(unsigned int axes, double panDeg, double tiltDeg)
+    {
+        enqueue(MODE_ABSOLUTE, axes, panDeg, tiltDeg);
+    }
+
+    void moveBy(unsigned int axes, double panDeg, double tiltDeg)
+    {
+        enqueue(MODE_RELATIVE, axes, panDeg, tiltDeg);
+    }
+
+    void moveAt(unsigned int axes, double panDps, double tiltDps)
+    {
+        enqueue(MODE_VELOCITY, axes, panDps, tiltDps);
+    }
+
+    void halt(unsigned int axes)
+    {
+        enqueue(MODE_STOP, axes, 0, 0);
+    }
+
+    void position(double &panDeg, double &tiltDeg)
+    {
+        panDeg = s_panPosition.load();
+        tiltDeg = s_tiltPosition.load();
+    }
+
+    void setSettleTime(unsigned int settleMs)
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        s_settleMs = settleMs;
+    }
+
+    void setListener(Listener listener)
+    {
+        std::lock_guard<std::mutex> lock(s_listenerLock);
+        s_listener = listener;
+    }
+
+    void addListener(Listener listener)
+    {
+        std::lock_guard<std::mutex> lock(s_listenerLock);
+        s_moreListeners.push_back(listener);
+    }
+} // namespace actuator
@@ -0,0 +1,58 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __ACTUATOR_H__
+#define __ACTUATOR_H__
+
+#include <functional>
+
+/// Pan/tilt actuation on a dedicated real-time thread.
+/// Callers only queue targets, the actuation thread plans a slew rate and acceleration limited trajectory
+/// (ease-in, cruise, ease-out) and steps the servos at a fixed control rate. A new target preempts the running
+/// motion from the current position and velocity, and when both axes move they are scaled to arrive together.
+namespace actuator
+{
+    extern const unsigned int control_rate_hz;
+    extern const double max_speed_dps;   // degrees per second
+    extern const double max_accel_dps2;  // degrees per second squared
+    extern const double home_angle;      // assumed position before the first command
+    extern const unsigned int velocity_hold_ms;
+
+    enum Axis
+    {
+        AXIS_PAN = 1,
+        AXIS_TILT = 2,
+    };
+
+    /// Start the actuation thread with the servos assumed at the given angles, needs gpio::initialise() to have succeeded
+    void start(double panDeg = home_angle, double tiltDeg = home_angle);
+    /// Stop the actuation thread, queued commands are dropped and the servos stay where they are
+    void stop();
+
+    /// Queue an absolute target in degrees for the axes in the mask (AXIS_PAN | AXIS_TILT)
+    void moveTo(unsigned int axes, double panDeg, double tiltDeg);
+
+    /// Queue a move relative to the current target
+    void moveBy(unsigned int axes, double panDeg, double tiltDeg);
+    /// Queue continuous motion in degrees per second, the axes brake to a stop unless the command is repeated
+    /// within velocity_hold_ms, so a lost connection cannot leave them running
+    void moveAt(unsigned int axes, double panDps, double tiltDps);
+    /// Brake the axes to a stop at the acceleration limit
+    void halt(unsigned int axes);
+
+    /// Switch the servo pulses off once a target was held this long, which stops the buzz and holding current of
+    /// the servos. The next command switches them on again. 0, the default, keeps them on.
+    void setSettleTime(unsigned int settleMs);
+
+    /// Current commanded position in degrees
+    void position(double &panDeg, double &tiltDeg);
+
+    /// Called on the actuation thread with the position each time the axes came to rest, empty to remove it
+    typedef std::function<void(double panDeg, double tiltDeg)> Listener;
+    void setListener(Listener listener);
+    /// Another listener for the lifetime of the process, called after the one of setListener()
+    void addListener(Listener listener);
+} // namespace actuator
+
+#endif //__ACTUATOR_H__
@@ -0,0 +1,317 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#define LOG_CLASS "AllocStats"
+#include "AllocStats.h"
+#include "Metrics.h"
+
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+namespace
+{
+    // Shards of the block registry, frees on different threads rarely wait for each other
+    const UINT32 ALLOC_STATS_REGISTRY_SHARDS = 64;
+
+    struct BlockInfo
+    {
+        UINT64 size;
+        UINT32 subsystem;
+    };
+
+    /// Blocks handed out through the wrappers by address. Ownership is decided by a lookup, so blocks of the wrapped
+    /// allocator are passed through without touching their memory, and the SDK gets the wrapped allocator's pointers
+    /// unchanged. The nodes come from the C++ heap, never from the allocators being wrapped.
+    struct RegistryShard
+    {
+        std::mutex lock;
+        std::unordered_map<PVOID, BlockInfo> blocks;
+    };
+
+    struct SubsystemStats
+    {
+        CHAR name[ALLOC_STATS_MAX_NAME_LEN + 1];
+        std::atomic<INT64> liveBytes;
+        std::atomic<INT64> peakBytes;
+        std::atomic<UINT64> allocs;
+        UINT64 publishedAllocs;
+    };
+
+    SubsystemStats gSubsystems[ALLOC_STATS_MAX_SUBSYSTEMS];
+    std::atomic<UINT32> gSubsystemCount(0);
+    std::mutex gRegisterLock;
+    thread_local UINT32 tSubsystem = 0;
+    RegistryShard gRegistry[ALLOC_STATS_REGISTRY_SHARDS];
+    std::atomic<bool> gStopped(false);
+
+    memAlloc gWrappedMemAlloc = NULL;
+    memAlignAlloc gWrappedMemAlignAlloc = NULL;
+    memCalloc gWrappedMemCalloc = NULL;
+    memFree gWrappedMemFree = NULL;
+    memRealloc gWrappedMemRealloc = NULL;
+
+    UINT32 findSubsystem(PCHAR name)
+    {
+        UINT32 count = gSubsystemCount.load(std::memory_order_acquire);
+        for (UINT32 i = 0; i < count; i++)
+        {
+            if (STRNCMP(gSubsystems[i].name, name, ALLOC_STATS_MAX_NAME_LEN) == 0)
+            {
+                return i;
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(gRegisterLock);
+        count = gSubsystemCount.load(std::memory_order_relaxed);
+        for (UINT32 i = 0; i < count; i++)
+        {
+            if (STRNCMP(gSubsystems[i].name, name, ALLOC_STATS_MAX_NAME_LEN) == 0)
+            {
+                return i;
+            }
+        }
+        if (count == ALLOC_STATS_MAX_SUBSYSTEMS)
+        {
+            return 0;
+        }
+        STRNCPY(gSubsystems[count].name, name, ALLOC_STATS_MAX_NAME_LEN);
+        gSubsystems[count].name[ALLOC_STATS_MAX_NAME_LEN] = '\0';
+        gSubsystemCount.store(count + 1, std::memory_order_release);
+        return count;
+    }
+
+    VOID account(UINT32 subsystem, INT64 bytes)
+    {
+        SubsystemStats &stats = gSubsystems[subsystem];
+        INT64 live = stats.liveBytes.fetch_add(bytes, std::memory_order_relaxed) + bytes;
+        if (bytes > 0)
+        {
+            stats.allocs.fetch_add(1, std::memory_order_relaxed);
+            INT64 peak = stats.peakBytes.load(std::memory_order_relaxed);
+            while (live > peak && !stats.peakBytes.compare_exchange_weak(peak, live, std::memory_order_relaxed))
+            {
+            }
+        }
+    }
+
+    RegistryShard &shardOf(PVOID ptr)
+    {
+        // the low bits are the same for every block of an alignment class
+        UINT64 address = (UINT64) (UINT_PTR) ptr;
+        return gRegistry[((address >> 4) ^ (address >> 12)) % ALLOC_STATS_REGISTRY_SHARDS];
+    }
+
+    PVOID track(PVOID ptr, SIZE_T size)
+    {
+        BlockInfo info;
+        if (ptr == NULL)
+        {
+            return NULL;
+        }
+        info.size = size;
+        info.subsystem = tSubsystem;
+        RegistryShard &shard = shardOf(ptr);
+        {
+            std::lock_guard<std::mutex> lock(shard.lock);
+            shard.blocks[ptr] = info;
+        }
+        account(info.subsystem, (INT64) size);
+        return ptr;
+    }
+
+    BOOL untrack(PVOID ptr, BlockInfo &info)
+    {
+        RegistryShard &shard = shardOf(ptr);
+        std::lock_guard<std::mutex> lock(shard.lock);
+        std::unordered_map<PVOID, BlockInfo>::iterator it = shard.blocks.find(ptr);
+        if (it == shard.blocks.end())
+        {
+            return FALSE;
+        }
+        info = it->second;
+        shard.blocks.erase(it);
+        return TRUE;
+    }
+
+    PVOID statsMemAlloc(SIZE_T size)
+    {
+        return track(gWrappedMemAlloc(size), size);
+    }
+
+    PVOID statsMemAlignAlloc(SIZE_T size, SIZE_T alignment)
+    {
+        return track(gWrappedMemAlignAlloc(size, alignment), size);
+    }
+
+    PVOID statsMemCalloc(SIZE_T num, SIZE_T size)
+    {
+        // a product which overflows makes the wrapped calloc fail
+        return track(gWrappedMemCalloc(num, size), num * size);
+    }
+
+    VOID statsMemFree(PVOID ptr)
+    {
+        BlockInfo info;
+        if (ptr == NULL)
+        {
+            return;
+        }
+        // blocks allocated before the wrappers were installed are not in the registry
+        if (untrack(ptr, info))
+        {
+            account(info.subsystem, -(INT64) info.size);
+        }
+        gWrappedMemFree(ptr);
+    }
+
+    PVOID statsMemRealloc(PVOID ptr, SIZE_T size)
+    {
+        BlockInfo info;
+        BOOL owned;
+        PVOID pNew;
+        if (ptr == NULL)
+        {
+            return statsMemAlloc(size);
+        }
+        owned = untrack(ptr, info);
+        pNew = gWrappedMemRealloc(ptr, size);
+        if (pNew == NULL)
+        {
+            if (owned && size != 0)
+            {
+                // the old block is still valid
+                RegistryShard &shard = shardOf(ptr);
+                std::lock_guard<std::mutex> lock(shard.lock);
+                shard.blocks[ptr] = info;
+            }
+            else if (owned)
+            {
+                account(info.subsystem, -(INT64) info.size);
+            }
+            return NULL;
+        }
+        if (owned)
+        {
+            account(info.subsystem, -(INT64) info.size);
+        }
+        // a block from before the wrappers were installed is attributed from now on
+        return track(pNew, size);
+    }
+} // namespace
+
+STATUS allocStatsInstall()
+{
+    STATUS retStatus = STATUS_SUCCESS;
+
+    CHK(gWrappedMemAlloc == NULL, STATUS_INVALID_OPERATION);
+    // subsystem 0 collects everything running on threads nobody attributed
+    findSubsystem((PCHAR) "sdk");
+
+    gWrappedMemAlloc = globalMemAlloc;
+    gWrappedMemAlignAlloc = globalMemAlignAlloc;
+    gWrappedMemCalloc = globalMemCalloc;
+    gWrappedMemFree = globalMemFree;
+    gWrappedMemRealloc = globalMemRealloc;
+
+    globalMemAlloc = statsMemAlloc;
+    globalMemAlignAlloc = statsMemAlignAlloc;
+    globalMemCalloc = statsMemCalloc;
+    globalMemFree = statsMemFree;
+    globalMemRealloc = statsMemRealloc;
+
+CleanUp:
+
+    return retStatus;
+}
+
+STATUS allocStatsUninstall()
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    UINT32 count = gSubsystemCount.load(std::memory_order_acquire);
+    UINT64 leakedBlocks = 0;
+
+    CHK(gWrappedMemAlloc != NULL && globalMemAlloc == statsMemAlloc, STATUS_INVALID_OPERATION);
+    allocStatsPublish();
+    gStopped.store(true, std::memory_order_relaxed);
+
+    // the SDK gets the pointers of the wrapped allocator, so a block freed after this goes straight to its owner
+    globalMemAlloc = gWrappedMemAlloc;
+    globalMemAlignAlloc = gWrappedMemAlignAlloc;
+    globalMemCalloc = gWrappedMemCalloc;
+    globalMemFree = gWrappedMemFree;
+    globalMemRealloc = gWrappedMemRealloc;
+
+    // everything was freed by now, whatever is left leaked
+    for (UINT32 i = 0; i < ALLOC_STATS_REGISTRY_SHARDS; i++)
+    {
+        std::lock_guard<std::mutex> lock(gRegistry[i].lock);
+        leakedBlocks += gRegistry[i].blocks.size();
+    }
+    for (UINT32 i = 0; i < count; i++)
+    {
+        if (gSubsystems[i].liveBytes.load(std::memory_order_relaxed) != 0)
+        {
+            DLOGW("[Allocations] %s: possible memory leak of %" PRId64 " bytes", gSubsystems[i].name,
+                  gSubsystems[i].liveBytes.load(std::memory_order_relaxed));
+        }
+    }
+    if (leakedBlocks != 0)
+    {
+        DLOGW("[Allocations] %" PRIu64 " blocks were not freed", leakedBlocks);
+    }
+
+CleanUp:
+
+    return retStatus;
+}
+
+UINT32 allocStatsSetSubsystem(PCHAR name)
+{
+    UINT32 previous = tSubsystem;
+    tSubsystem = findSubsystem(name);
+    return previous;
+}
+
+VOID allocStatsRestoreSubsystem(UINT32 subsystem)
+{
+    tSubsystem = subsystem;
+}
+
+VOID allocStatsPublish()
+{
+    UINT32 count = gSubsystemCount.load(std::memory_order_acquire);
+    std::string metricName;
+    UINT64 allocs;
+
+    if (gStopped.load(std::memory_order_relaxed))
+    {
+        return;
+    }
+    for (UINT32 i = 0; i < count; i++)
+    {
+        SubsystemStats &stats = gSubsystems[i];
+        metricName = std::string("alloc.") + stats.name;
+        allocs = stats.allocs.load(std::memory_order_relaxed);
+        metrics::gauge(metricName + ".live_bytes").set((DOUBLE) stats.liveBytes.load(std::memory_order_relaxed));
+        metrics::gauge(metricName + ".peak_bytes").set((DOUBLE) stats.peakBytes.load(std::memory_order_relaxed));
+        metrics::counter(metricName + ".allocs").add(allocs - stats.publishedAllocs);
+        stats.publishedAllocs = allocs;
+
+        DLOGD("[Allocations] %s: live %" PRId64 " bytes, peak %" PRId64 " bytes, %" PRIu64 " allocations", stats.name,
+              stats.liveBytes.load(std::memory_order_relaxed), stats.peakBytes.load(std::memory_order_relaxed), allocs);
+    }
+}
+
+STATUS allocStatsReportTimerCallback(UINT32 timerId, UINT64 currentTime, UINT64 customData)
+{
+    UNUSED_PARAM(timerId);
+    UNUSED_PARAM(currentTime);
+    UNUSED_PARAM(customData);
+
+    allocStatsPublish();
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __KINESIS_WEBRTC_ALLOC_STATS_INCLUDE__
+#define __KINESIS_WEBRTC_ALLOC_STATS_INCLUDE__
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <com/amazonaws/kinesis/video/webrtcclient/Include.h>
+
+// Number of distinct subsystems allocations are attributed to, allocations of the others go to "sdk"
+#define ALLOC_STATS_MAX_SUBSYSTEMS 16
+#define ALLOC_STATS_MAX_NAME_LEN   32
+#define ALLOC_STATS_REPORT_PERIOD  (10 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+    /*
+     * Wraps the PIC allocators (on top of the instrumented allocators when SET_INSTRUMENTED_ALLOCATORS is in effect)
+     * and attributes every MEMALLOC/MEMCALLOC/MEMREALLOC to the subsystem of the calling thread. The size and
+     * subsystem of every block are kept in a registry beside the heap so that frees are credited back to the subsystem
+     * which allocated it, blocks from before the install are passed through. Install before the first SDK allocation
+     * and uninstall after the last free, before RESET_INSTRUMENTED_ALLOCATORS; bytes still live then are logged as leaks.
+     * Exported as metrics "alloc.<subsystem>.live_bytes", "alloc.<subsystem>.peak_bytes" and "alloc.<subsystem>.allocs".
+     */
+    STATUS allocStatsInstall();
+    STATUS allocStatsUninstall();
+    // Attribute the following allocations of the calling thread to the subsystem, returns the previous subsystem
+    UINT32 allocStatsSetSubsystem(PCHAR);
+    VOID allocStatsRestoreSubsystem(UINT32);
+    VOID allocStatsPublish();
+    STATUS allocStatsReportTimerCallback(UINT32, UINT64, UINT64);
+
+#ifdef __cplusplus
+}
+
+/// Attribution to a subsystem bound to a C++ scope, for callbacks running on SDK owned threads
+class AllocStatsScope
+{
+public:
+    explicit AllocStatsScope(PCHAR name) : m_previous(allocStatsSetSubsystem(name)) {}
+    ~AllocStatsScope() { allocStatsRestoreSubsystem(m_previous); }
+
+private:
+    AllocStatsScope(const AllocStatsScope &);
+    AllocStatsScope &operator=(const AllocStatsScope &);
+    UINT32 m_previous;
+};
+#endif
+#endif /* __KINESIS_WEBRTC_ALLOC_STATS_INCLUDE__ */
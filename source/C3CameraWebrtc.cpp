@@ -24,7 +24,15 @@
 #endif // COMMANDLINE_UTIL_H
 
 #include "DeviceManager.h"
+#include "Encoding.h"
+#include "Calibration.h"
+#include "Preset.h"
+#include "Snapshot.h"
+#include "Fov.h"
+#include "GpioSim.h"
 #include "Logger.h"
+#include "Tracer.h"
+#include "ThreadStats.h"
 #include "WebRtcCommon.h"
 
 LOGGER_TAG("main")
@@ -44,12 +52,50 @@ int main(int argc, char **argv)
      * See the Utils/CommandLineUtils for more information.
      */
     Utils::cmdData cmdData = Utils::parseSampleInputShadow(argc, argv, &apiHandle);
+    trace::installDumpSignal(cmdData.input_traceFile.c_str());
+
+    // without --gpio_sim the servos are driven through pigpio
+    gpio::SimulatedBackend simulatedGpio;
+    gpio::install(cmdData.input_gpioSim ? (gpio::Backend *)&simulatedGpio : gpio::pigpioBackend());
+
+    // the calibration is compiled before anything can drive the servos
+    calibration::Profile servoProfile = calibration::defaultProfile();
+    if (!calibration::load(cmdData.input_servoProfile.c_str(), servoProfile))
+    {
+        LOG_INFO("[DEVICE] No usable servo calibration in " << cmdData.input_servoProfile.c_str() << ", nominal values are used");
+    }
+    calibration::install(servoProfile);
+    if (cmdData.input_calibrate)
+    {
+        return calibration::run(cmdData.input_servoProfile.c_str());
+    }
+    if (!preset::load(cmdData.input_ptzPresets.c_str()))
+    {
+        LOG_INFO("[DEVICE] No PTZ presets in " << cmdData.input_ptzPresets.c_str());
+    }
+    fov::Model cameraModel = fov::defaultModel();
+    if (!fov::load(cmdData.input_cameraModel.c_str(), cameraModel))
+    {
+        LOG_INFO("[DEVICE] No usable camera model in " << cmdData.input_cameraModel.c_str() << ", nominal values are used");
+    }
+    fov::install(cameraModel);
+
+    // RPI_SOURCE stream settings until the shadow changes them, baseline profile for the browsers
+    encoding::Settings streamSettings = {1280, 720, 25, 620000, 0, "baseline"};
+    encoding::configure(streamSettings);
+    // thumbnails come from the analytics substream, which is built with the first pipeline
+    snapshot::subscribe();
 
     /* ------------------------------------------------ */
     /// device shadow
     std::thread thread_shadow([&cmdData]
-                              { mamageDeviceShadow(cmdData); });
+                              {
+                                  threadstats::nameThread("c3-shadow");
+                                  mamageDeviceShadow(cmdData); });
     LOG_INFO("[DEVICE] thread_shadow started");
+
+    threadstats::Sampler threadSampler;
+    threadSampler.start();
     // /* ------------------------------------------------ */
 
     // for KVS WebRTC
@@ -59,6 +105,9 @@ int main(int argc, char **argv)
     IotCoreCredential pIotCoreCredential;
 
     SET_INSTRUMENTED_ALLOCATORS();
+#ifdef KVS_ENABLE_ALLOC_STATS
+    allocStatsInstall();
+#endif
     UINT32 logLevel = setLogLevel();
 
     signal(SIGINT, sigintHandler);
@@ -88,6 +137,7 @@ int main(int argc, char **argv)
     pSampleConfiguration->onDataChannel = onDataChannel;
     pSampleConfiguration->customData = (UINT64)pSampleConfiguration;
     pSampleConfiguration->srcType = DEVICE_SOURCE; // Default to device source (autovideosrc and autoaudiosrc)
+    pSampleConfiguration->joinSloMs = cmdData.input_ttffSloMs;
     /* Initialize GStreamer */
     gst_init(&argc, &argv);
     LOG_INFO("[KVS Gstreamer Master] Finished initializing GStreamer and handlers");
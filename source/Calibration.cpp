@@ -0,0 +1,476 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Calibration.h"
+#include "Servo.h"
+#include "Gpio.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+LOGGER_TAG("calibration")
+
+namespace calibration
+{
+    extern const unsigned int lut_steps_per_degree = 10;
+
+    namespace
+    {
+        const double reference_angles[] = {0, 45, 90, 135, 180};
+        const unsigned int sweep_step_ms = 20;
+
+        Profile s_profile = defaultProfile();
+        std::vector<uint16_t> s_luts[AXIS_COUNT];
+
+        std::string trim(const std::string &text)
+        {
+            size_t begin = text.find_first_not_of(" \t\r");
+            size_t end = text.find_last_not_of(" \t\r");
+            return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+        }
+
+        bool writeAll(int fd, const std::string &text)
+        {
+            size_t written = 0;
+            while (written < text.size())
+            {
+                ssize_t result = ::write(fd, text.data() + written, text.size() - written);
+                if (result < 0 && errno != EINTR)
+                {
+                    return false;
+                }
+                written += result > 0 ? result : 0;
+            }
+            return true;
+        }
+
+        /// The rename is only durable once the directory entry is on disk
+        void syncDirectory(const std::string &path)
+        {
+            size_t slash = path.find_last_of('/');
+            std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+            int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd >= 0)
+            {
+                fsync(fd);
+                close(fd);
+            }
+        }
+
+        /// The whole text is a number, unlike atof which reads a typo as 0
+        bool parseNumber(const std::string &text, double &value)
+        {
+            char *end = NULL;
+            errno = 0;
+            double parsed = strtod(text.c_str(), &end);
+            if (text.empty() || *end != '\0' || errno == ERANGE || !std::isfinite(parsed))
+            {
+                return false;
+            }
+            value = parsed;
+            return true;
+        }
+
+        bool parseInteger(const std::string &text, long &value)
+        {
+            char *end = NULL;
+            errno = 0;
+            long parsed = strtol(text.c_str(), &end, 10);
+            if (text.empty() || *end != '\0' || errno == ERANGE)
+            {
+                return false;
+            }
+            value = parsed;
+            return true;
+        }
+
+        bool parsePulse(const std::string &text, unsigned int &pulse)
+        {
+            long value;
+            if (!parseInteger(text, value) || value < 0 || value > (long)servo::pulse_width_360)
+            {
+                return false;
+            }
+            pulse = (unsigned int)value;
+            return true;
+        }
+
+        bool parseCorrection(const std::string &text, std::vector<std::pair<double, int>> &correction)
+        {
+            std::istringstream entries(text);
+            std::string entry;
+            correction.clear();
+            while (std::getline(entries, entry, ','))
+            {
+                entry = trim(entry);
+                if (entry.empty())
+                {
+                    continue;
+                }
+                size_t colon = entry.find(':');
+                if (colon == std::string::npos)
+                {
+                    return false;
+                }
+                double deg;
+                long offset;
+                if (!parseNumber(trim(entry.substr(0, colon)), deg) || !parseInteger(trim(entry.substr(colon + 1)), offset) ||
+                    offset < INT_MIN || offset > INT_MAX)
+                {
+                    return false;
+                }
+                correction.push_back(std::make_pair(deg, (int)offset));
+            }
+            std::sort(correction.begin(), correction.end());
+            return true;
+        }
+
+        bool valid(const AxisProfile &axis)
+        {
+            if (!(axis.minDeg < axis.maxDeg && axis.minPulse < axis.maxPulse && axis.minPulse >= (unsigned int)servo::pulse_width_0 &&
+                  axis.maxPulse <= (unsigned int)servo::pulse_width_360 && axis.deadbandDeg >= 0))
+            {
+                return false;
+            }
+            // the correction is zero at the endpoints, a point on or beyond them would bend the line outside the range
+            for (size_t i = 0; i < axis.correction.size(); i++)
+            {
+                if (!(axis.correction[i].first > axis.minDeg && axis.correction[i].first < axis.maxDeg))
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        /// Linear pulse width between the endpoints plus the interpolated correction, which is zero at the endpoints
+        double evaluate(const AxisProfile &axis, double deg)
+        {
+            double pulse = axis.minPulse + (deg - axis.minDeg) * ((double)axis.maxPulse - axis.minPulse) / (axis.maxDeg - axis.minDeg);
+            double fromDeg = axis.minDeg, fromOffset = 0;
+            for (size_t i = 0; i <= axis.correction.size(); i++)
+            {
+                double toDeg = i < axis.correction.size() ? axis.correction[i].first : axis.maxDeg;
+                double toOffset = i < axis.correction.size() ? axis.correction[i].second : 0;
+                if (deg <= toDeg)
+                {
+                    double t = toDeg > fromDeg ? (deg - fromDeg) / (toDeg - fromDeg) : 1.0;
+                    return pulse + fromOffset + t * (toOffset - fromOffset);
+                }
+                fromDeg = toDeg;
+                fromOffset = toOffset;
+            }
+            return pulse;
+        }
+
+        void driveAxis(Axis axis, unsigned int pulse)
+        {
+            if (axis == AXIS_PAN)
+            {
+                servo::panServo(pulse);
+            }
+            else
+            {
+                servo::tiltServo(pulse);
+            }
+        }
+
+        void sweep(Axis axis)
+        {
+            const AxisProfile &profile = s_profile.axes[axis];
+            std::cout << "Sweeping " << axisName(axis) << " over " << profile.minDeg << "~" << profile.maxDeg << " degrees" << std::endl;
+            for (double deg = profile.minDeg; deg <= profile.maxDeg; deg += 1.0)
+            {
+                driveAxis(axis, pulsewidth(axis, deg));
+                std::this_thread::sleep_for(std::chrono::milliseconds(sweep_step_ms));
+            }
+            for (double deg = profile.maxDeg; deg >= profile.minDeg; deg -= 1.0)
+            {
+                driveAxis(axis, pulsewidth(axis, deg));
+                std::this_thread::sleep_for(std::chrono::milliseconds(sweep_step_ms));
+            }
+        }
+
+        /// Jog the axis until the operator confirms it points at the reference angle
+        bool jog(Axis axis, double deg, unsigned int &pulse)
+        {
+            std::string input;
+            while (true)
+            {
+                driveAxis(axis, pulse);
+                std::cout << axisName(axis) << " " << deg << " deg at " << pulse << "us [+ - ++ -- ok quit]: " << std::flush;
+                if (!(std::cin >> input) || input == "quit")
+                {
+                    return false;
+                }
+                if (input == "ok")
+                {
+                    return true;
+                }
+                int delta = input == "+" ? 5 : input == "-" ? -5 : input == "++" ? 25 : input == "--" ? -25 : 0;
+                int next = (int)pulse + delta;
+                pulse = (unsigned int)std::max(servo::pulse_width_0, std::min(servo::pulse_width_360, next));
+            }
+        }
+    } // namespace
+
+    Profile defaultProfile()
+    {
+        Profile profile;
+        for (int i = 0; i < AXIS_COUNT; i++)
+        {
+            profile.axes[i].minDeg = 0;
+            profile.axes[i].maxDeg = 180;
+            profile.axes[i].minPulse = servo::angleToPulsewidth(0);
+            profile.axes[i].maxPulse = servo::angleToPulsewidth(180);
+            profile.axes[i].deadbandDeg = 0;
+        }
+        return profile;
+    }
+
+    bool load(const std::string &path, Profile &profile)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            return false;
+        }
+
+        Profile parsed = profile;
+        // an axis with a value that does not parse keeps the nominal profile as a whole
+        bool broken[AXIS_COUNT] = {};
+        std::string line;
+        bool ok = true;
+        while (std::getline(file, line))
+        {
+            line = trim(line);
+            size_t equals = line.find('=');
+            if (line.empty() || line[0] == '#' || equals == std::string::npos)
+            {
+                continue;
+            }
+            std::string key = trim(line.substr(0, equals));
+            std::string value = trim(line.substr(equals + 1));
+            size_t dot = key.find('.');
+            std::string name = key.substr(0, dot);
+            std::string field = dot == std::string::npos ? "" : key.substr(dot + 1);
+
+            AxisProfile *pAxis = name == "pan" ? &parsed.axes[AXIS_PAN] : name == "tilt" ? &parsed.axes[AXIS_TILT] : NULL;
+            if (pAxis == NULL)
+            {
+                LOG_ERROR("[CALIBRATION] Unknown key " << key << " in " << path);
+                continue;
+            }
+            bool parsedValue = true;
+            if (field == "min_deg")
+                parsedValue = parseNumber(value, pAxis->minDeg);
+            else if (field == "max_deg")
+                parsedValue = parseNumber(value, pAxis->maxDeg);
+            else if (field == "min_pulse")
+                parsedValue = parsePulse(value, pAxis->minPulse);
+            else if (field == "max_pulse")
+                parsedValue = parsePulse(value, pAxis->maxPulse);
+            else if (field == "deadband_deg")
+                parsedValue = parseNumber(value, pAxis->deadbandDeg);
+            else if (field == "correction")
+                parsedValue = parseCorrection(value, pAxis->correction);
+            else
+                LOG_ERROR("[CALIBRATION] Unknown key " << key << " in " << path);
+            if (!parsedValue)
+            {
+                LOG_ERROR("[CALIBRATION] Invalid value of " << key << " in " << path);
+                broken[pAxis - parsed.axes] = true;
+            }
+        }
+
+        for (int i = 0; i < AXIS_COUNT; i++)
+        {
+            if (!broken[i] && valid(parsed.axes[i]))
+            {
+                profile.axes[i] = parsed.axes[i];
+            }
+            else
+            {
+                LOG_ERROR("[CALIBRATION] Invalid " << axisName((Axis)i) << " profile in " << path << ", keeping the nominal one");
+                ok = false;
+            }
+        }
+        return ok;
+    }
+
+    bool save(const std::string &path, const Profile &profile)
+    {
+        std::ostringstream content;
+        content << "# Servo calibration, written by --calibrate" << std::endl;
+        for (int i = 0; i < AXIS_COUNT; i++)
+        {
+            const AxisProfile &axis = profile.axes[i];
+            const char *name = axisName((Axis)i);
+            content << name << ".min_deg = " << axis.minDeg << std::endl;
+            content << name << ".max_deg = " << axis.maxDeg << std::endl;
+            content << name << ".min_pulse = " << axis.minPulse << std::endl;
+            content << name << ".max_pulse = " << axis.maxPulse << std::endl;
+            content << name << ".deadband_deg = " << axis.deadbandDeg << std::endl;
+            content << name << ".correction = ";
+            for (size_t j = 0; j < axis.correction.size(); j++)
+            {
+                content << (j == 0 ? "" : ", ") << axis.correction[j].first << ":" << axis.correction[j].second;
+            }
+            content << std::endl;
+        }
+
+        // a crash while writing keeps the previous profile
+        std::string temporary = path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            LOG_ERROR("[CALIBRATION] Unable to write " << temporary << ": " << strerror(errno));
+            return false;
+        }
+        bool ok = writeAll(fd, content.str()) && fsync(fd) == 0;
+        close(fd);
+        if (!ok || rename(temporary.c_str(), path.c_str()) != 0)
+        {
+            LOG_ERROR("[CALIBRATION] Unable to update " << path << ": " << strerror(errno));
+            unlink(temporary.c_str());
+            return false;
+        }
+        syncDirectory(path);
+        return true;
+    }
+
+    void install(const Profile &profile)
+    {
+        s_profile = profile;
+        for (int i = 0; i < AXIS_COUNT; i++)
+        {
+            const AxisProfile &axis = profile.axes[i];
+            size_t steps = (size_t)lround((axis.maxDeg - axis.minDeg) * lut_steps_per_degree) + 1;
+            s_luts[i].resize(steps);
+            for (size_t step = 0; step < steps; step++)
+            {
+                s_luts[i][step] = (uint16_t)lround(evaluate(axis, axis.minDeg + (double)step / lut_steps_per_degree));
+            }
+            LOG_INFO("[CALIBRATION] " << axisName((Axis)i) << ": " << axis.minDeg << "~" << axis.maxDeg << " deg, " << axis.minPulse << "~"
+                                      << axis.maxPulse << "us, " << axis.correction.size() << " correction points, deadband "
+                                      << axis.deadbandDeg << " deg");
+        }
+    }
+
+    const Profile &installed()
+    {
+        return s_profile;
+    }
+
+    const char *axisName(Axis axis)
+    {
+        return axis == AXIS_PAN ? "pan" : "tilt";
+    }
+
+    double clamp(Axis axis, double deg)
+    {
+        const AxisProfile &profile = s_profile.axes[axis];
+        // NaN compares false everywhere and would slip through, park it at the lower end
+        if (!(deg >= profile.minDeg))
+        {
+            return profile.minDeg;
+        }
+        return deg > profile.maxDeg ? profile.maxDeg : deg;
+    }
+
+    double deadband(Axis axis)
+    {
+        return s_profile.axes[axis].deadbandDeg;
+    }
+
+    unsigned int pulsewidth(Axis axis, double deg)
+    {
+        const std::vector<uint16_t> &lut = s_luts[axis];
+        if (lut.empty())
+        {
+            return servo::angleToPulsewidth(deg);
+        }
+        size_t step = (size_t)lround((clamp(axis, deg) - s_profile.axes[axis].minDeg) * lut_steps_per_degree);
+        return lut[std::min(step, lut.size() - 1)];
+    }
+
+    int run(const std::string &path)
+    {
+        Profile profile = s_profile;
+
+        if (gpio::initialise() < 0)
+        {
+            return -1;
+        }
+
+        std::cout << "Servo calibration. Jog each axis until the camera points at the requested angle, then enter ok." << std::endl;
+        for (int i = 0; i < AXIS_COUNT; i++)
+        {
+            Axis axis = (Axis)i;
+            const size_t count = sizeof(reference_angles) / sizeof(reference_angles[0]);
+            unsigned int measured[count];
+
+            install(profile);
+            for (size_t j = 0; j < count; j++)
+            {
+                measured[j] = pulsewidth(axis, reference_angles[j]);
+                if (!jog(axis, reference_angles[j], measured[j]))
+                {
+                    std::cout << "Calibration aborted, " << path << " is unchanged" << std::endl;
+                    gpio::terminate();
+                    return 1;
+                }
+            }
+
+            AxisProfile &result = profile.axes[i];
+            result.minDeg = reference_angles[0];
+            result.maxDeg = reference_angles[count - 1];
+            result.minPulse = measured[0];
+            result.maxPulse = measured[count - 1];
+            result.correction.clear();
+            for (size_t j = 1; j + 1 < count; j++)
+            {
+                AxisProfile line = result;
+                line.correction.clear();
+                result.correction.push_back(std::make_pair(reference_angles[j], (int)measured[j] - (int)lround(evaluate(line, reference_angles[j]))));
+            }
+
+            std::cout << axisName(axis) << " deadband in degrees [" << result.deadbandDeg << "]: " << std::flush;
+            std::string input;
+            if (std::cin >> input && input != "-")
+            {
+                double deadband;
+                if (parseNumber(input, deadband))
+                {
+                    result.deadbandDeg = std::max(0.0, deadband);
+                }
+                else
+                {
+                    std::cout << "Not a number, keeping " << result.deadbandDeg << std::endl;
+                }
+            }
+
+            install(profile);
+            sweep(axis);
+        }
+
+        bool saved = save(path, profile);
+        gpio::terminate();
+        std::cout << (saved ? "Calibration written to " : "Failed to write ") << path << std::endl;
+        return saved ? 0 : 1;
+    }
+} // namespace calibration
@@ -0,0 +1,62 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __CALIBRATION_H__
+#define __CALIBRATION_H__
+
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Per-axis servo calibration.
+/// A profile maps the mechanical range of an axis onto servo pulse widths: the endpoints give a straight line and the
+/// correction table adds piecewise linear offsets in microseconds on top of it. The profile is compiled into a
+/// lookup table with a resolution of 0.1 degree, so the control loop never evaluates it.
+namespace calibration
+{
+    extern const unsigned int lut_steps_per_degree;
+
+    enum Axis
+    {
+        AXIS_PAN = 0,
+        AXIS_TILT = 1,
+        AXIS_COUNT = 2,
+    };
+
+    struct AxisProfile
+    {
+        double minDeg;
+        double maxDeg;
+        unsigned int minPulse; // pulse width in microseconds at minDeg
+        unsigned int maxPulse; // pulse width in microseconds at maxDeg
+        double deadbandDeg;    // target changes smaller than this are ignored
+        std::vector<std::pair<double, int>> correction; // degree, offset in microseconds, sorted by degree
+    };
+
+    struct Profile
+    {
+        AxisProfile axes[AXIS_COUNT];
+    };
+
+    /// Nominal profile from the servo specification, 0~180 degrees without correction
+    Profile defaultProfile();
+
+    /// Read a profile, axes missing or invalid in the file keep the nominal values
+    bool load(const std::string &path, Profile &profile);
+    bool save(const std::string &path, const Profile &profile);
+
+    /// Compile the profile into the lookup tables used by pulsewidth()
+    void install(const Profile &profile);
+    const Profile &installed();
+
+    const char *axisName(Axis axis);
+    double clamp(Axis axis, double deg);
+    double deadband(Axis axis);
+    unsigned int pulsewidth(Axis axis, double deg);
+
+    /// Interactive calibration: jog each axis to reference angles, sweep the result and write the profile
+    int run(const std::string &path);
+} // namespace calibration
+
+#endif //__CALIBRATION_H__
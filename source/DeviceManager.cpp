@@ -4,517 +4,829 @@
  */
 #include "DeviceManager.h"
 #include "Servo.h"
+#include "Actuator.h"
+#include "Gpio.h"
+#include "Calibration.h"
+#include "Encoding.h"
+#include "Keyframe.h"
+#include "Preset.h"
+#include "ShadowAgent.h"
+#include "Snapshot.h"
+#include "Tracer.h"
+#include "Telemetry.h"
+#include "ThreadStats.h"
 #include "Logger.h"
 
+#include <algorithm>
+#include <condition_variable>
+#include <future>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <thread>
+
+#include <aws/crt/JsonObject.h>
+#include <aws/crt/UUID.h>
+#include <aws/crt/io/HostResolver.h>
+#include <aws/iot/MqttClient.h>
+#include <aws/iotshadow/ErrorResponse.h>
+#include <aws/iotshadow/IotShadowClient.h>
+#include <aws/iotshadow/ShadowDeltaUpdatedEvent.h>
+#include <aws/iotshadow/ShadowDeltaUpdatedSubscriptionRequest.h>
+#include <aws/iotshadow/UpdateShadowRequest.h>
+#include <aws/iotshadow/UpdateShadowResponse.h>
+#include <aws/iotshadow/UpdateShadowSubscriptionRequest.h>
+#include <aws/iotshadow/GetShadowRequest.h>
+#include <aws/iotshadow/GetShadowResponse.h>
+#include <aws/iotshadow/GetShadowSubscriptionRequest.h>
+
 LOGGER_TAG("devicemanager")
 
-/// Change shadow value
-static void s_changeShadowValue(
-    IotShadowClient &client,
-    const String &thingName,
-    JsonObject &shadowPropertyObject)
-{
-    ShadowState state;
-    JsonObject desired;
-    JsonObject reported;
-    unsigned int angle;
-    unsigned int pulsewidth;
+using namespace Aws::Crt;
+using namespace Aws::Iotshadow;
 
-    Map<String, JsonView> shadowPropertyMap = shadowPropertyObject.View().GetAllObjects();
+namespace device
+{
+    extern const unsigned int initial_connect_backoff_ms = 1000;
+    extern const unsigned int max_connect_backoff_ms = 60000;
 
-    for (const auto &ele : shadowPropertyMap)
+    namespace
     {
-        if (ele.second.AsString() == "null")
+        /// Watched properties, the list of --shadow_property
+        std::vector<std::string> parseProperties(const std::string &list)
         {
-            JsonObject nullObject;
-            nullObject.AsNull();
-            desired.WithObject(ele.first, nullObject);
-            reported.WithObject(ele.first, nullObject);
+            std::vector<std::string> properties;
+            std::stringstream stream(list);
+            while (stream.good())
+            {
+                std::string property;
+                getline(stream, property, ',');
+                properties.push_back(property);
+            }
+            return properties;
         }
-        else if (ele.second.AsString() == "clear_shadow")
+
+        /// Properties kept in the shadow cache
+        std::vector<std::string> cachedProperties()
         {
-            desired.AsNull();
-            reported.AsNull();
+            std::vector<std::string> properties;
+            // the servos return to the last applied position before the network is up, the shadow is reconciled once connected
+            properties.push_back("pan");
+            properties.push_back("tilt");
+            // a camera which boots offline streams with the quality it was last given
+            properties.push_back("resolution");
+            properties.push_back("framerate");
+            properties.push_back("video_bitrate");
+            properties.push_back("gop");
+            properties.push_back("h264_profile");
+            return properties;
         }
-        else
+
+        /// Drive the device with the new shadow values, returns the properties whose values were rejected
+        shadow::Properties applyValues(const shadow::Properties &properties, const Hooks &hooks)
         {
-            desired.WithString(ele.first, ele.second.AsString());
-            reported.WithString(ele.first, ele.second.AsString());
+            shadow::Properties rejected;
+            double angle;
+            // pan and tilt of one update are moved together
+            unsigned int axes = 0;
+            double panTarget = 0, tiltTarget = 0;
 
-            if (ele.first == "pan" || ele.first == "tilt")
+            for (shadow::Properties::const_iterator it = properties.begin(); it != properties.end(); ++it)
             {
-                angle = std::stoi(ele.second.AsString().c_str());
-                // pan angle range: 0~180 0 left, 90 middle, 180 right
-                // tilt angle range: 0~180 0 floor, 90 front, 180 up
-                if (angle <= 0)
+                const std::string &name = it->first;
+                const std::string &value = it->second;
+                if (value == shadow::null_value || value == "clear_shadow")
+                {
+                    continue;
+                }
+
+                if (name == "trace")
                 {
-                    angle = 0;
+                    // any new value of the trace property requests a dump of the trace buffers
+                    trace::requestDump();
                 }
-                else if (angle >= 180)
+                else if (name == "snapshot")
                 {
-                    angle = 180;
+                    // any new value publishes a snapshot, a thumbnail unless the value starts with "full"
+                    snapshot::request(value.compare(0, 4, "full") == 0 ? snapshot::SIZE_FULL : snapshot::SIZE_THUMBNAIL);
                 }
-                pulsewidth = servo::angleToPulsewidth(angle);
-                if (ele.first == "pan")
+                else if (name == "resolution" || name == "framerate" || name == "video_bitrate" || name == "gop" || name == "h264_profile")
                 {
-                    servo::panServo(pulsewidth);
+                    // bitrate and GOP change on the running encoder, the others rebuild the pipeline
+                    if (!encoding::apply(name, value))
+                    {
+                        rejected[name] = value;
+                    }
                 }
-                else
+                else if (name == "preset" || name == "tour")
                 {
-                    servo::tiltServo(pulsewidth);
+                    // same commands as the data channel, e.g. preset=home or tour=home:10,door:5
+                    std::string reply;
+                    preset::execute(name + " " + value, reply);
+                    LOG_INFO("[DEVICE] " << name << " " << value << ": " << reply);
                 }
+                else if (name == "pan" || name == "tilt")
+                {
+                    calibration::Axis axis = name == "pan" ? calibration::AXIS_PAN : calibration::AXIS_TILT;
+                    try
+                    {
+                        angle = std::stod(value);
+                    }
+                    catch (const std::exception &)
+                    {
+                        LOG_ERROR("[DEVICE] Ignoring invalid " << name << " value " << value);
+                        rejected[name] = value;
+                        continue;
+                    }
+                    // pan angle range: 0~180 0 left, 90 middle, 180 right
+                    // tilt angle range: 0~180 0 floor, 90 front, 180 up
+                    // the calibrated range of the axis may be narrower, fractions of a degree are kept
+                    angle = calibration::clamp(axis, angle);
+                    if (axis == calibration::AXIS_PAN)
+                    {
+                        axes |= actuator::AXIS_PAN;
+                        panTarget = angle;
+                    }
+                    else
+                    {
+                        axes |= actuator::AXIS_TILT;
+                        tiltTarget = angle;
+                    }
+                }
+                else if (hooks.apply)
+                {
+                    hooks.apply(name, value);
+                }
+            }
+
+            if (axes != 0)
+            {
+                // explicit angles take over from a running tour
+                preset::stopTour();
+                actuator::moveTo(axes, panTarget, tiltTarget);
             }
+            return rejected;
         }
-    }
 
-    state.Desired = desired;
-    state.Reported = reported;
+        /// Report shadow values as reported state, and as desired state when they were changed locally
+        void publishValues(IotShadowClient &client, const String &thingName, const shadow::Properties &properties, const String &clientToken,
+                           bool withDesired)
+        {
+            ShadowState state;
+            JsonObject desired;
+            JsonObject reported;
+
+            for (shadow::Properties::const_iterator it = properties.begin(); it != properties.end(); ++it)
+            {
+                if (it->second == shadow::null_value)
+                {
+                    JsonObject nullObject;
+                    nullObject.AsNull();
+                    desired.WithObject(it->first.c_str(), nullObject);
+                    reported.WithObject(it->first.c_str(), nullObject);
+                }
+                else if (it->second == "clear_shadow")
+                {
+                    desired.AsNull();
+                    reported.AsNull();
+                }
+                else
+                {
+                    desired.WithString(it->first.c_str(), it->second.c_str());
+                    reported.WithString(it->first.c_str(), it->second.c_str());
+                }
+            }
 
-    UpdateShadowRequest updateShadowRequest;
-    Aws::Crt::UUID uuid;
-    updateShadowRequest.ClientToken = uuid.ToString();
-    updateShadowRequest.ThingName = thingName;
-    updateShadowRequest.State = state;
+            // reporting a delta back as desired state could overwrite a newer desired value
+            if (withDesired)
+            {
+                state.Desired = desired;
+            }
+            state.Reported = reported;
 
-    auto publishCompleted = [thingName](int ioErr)
-    {
-        if (ioErr != AWS_OP_SUCCESS)
+            UpdateShadowRequest updateShadowRequest;
+            updateShadowRequest.ClientToken = clientToken;
+            updateShadowRequest.ThingName = thingName;
+            updateShadowRequest.State = state;
+
+            auto publishCompleted = [thingName](int ioErr)
+            {
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Failed to update " << thingName.c_str() << " shadow state: error " << ErrorDebugString(ioErr));
+                    return;
+                }
+                LOG_DEBUG("[DEVICE] Successfully updated shadow state for " << thingName.c_str());
+            };
+            client.PublishUpdateShadow(updateShadowRequest, AWS_MQTT_QOS_AT_LEAST_ONCE, std::move(publishCompleted));
+        }
+
+        /// Change shadow values from the console, only the accepted ones are published
+        void changeValues(IotShadowClient &client, const String &thingName, const shadow::Properties &properties, const Hooks &hooks)
         {
-            LOG_FATAL("[DEVICE] Failed to update " << thingName.c_str() << " shadow state: error " << ErrorDebugString(ioErr));
-            return;
+            shadow::Properties rejected = applyValues(properties, hooks);
+            shadow::Properties accepted = properties;
+            for (shadow::Properties::const_iterator it = rejected.begin(); it != rejected.end(); ++it)
+            {
+                LOG_INFO("[DEVICE] Rejected " << it->first << " value " << it->second << " is not published");
+                accepted.erase(it->first);
+            }
+            if (!accepted.empty())
+            {
+                publishValues(client, thingName, accepted, UUID().ToString(), true);
+            }
         }
-        LOG_DEBUG("[DEVICE] changeShadowValue: Successfully updated shadow state for " << thingName.c_str());
-    };
-    client.PublishUpdateShadow(updateShadowRequest, AWS_MQTT_QOS_AT_LEAST_ONCE, std::move(publishCompleted));
-}
 
-/* ------------------------------------------------ */
-/// device shadow
-int mamageDeviceShadow(
-    Utils::cmdData &cmdData)
-{
-    Map<String, String> currentShadowValue;
-    std::vector<std::string> vShadowProprty;
+        /// Values applied when the desired value of a watched property is deleted: the home position of the servos and
+        /// the stream settings the binary started with
+        shadow::Properties defaultValues(const std::vector<std::string> &properties)
+        {
+            shadow::Properties defaults;
+            encoding::Settings configured = encoding::configured();
+            for (size_t i = 0; i < properties.size(); i++)
+            {
+                std::ostringstream value;
+                if (properties[i] == "pan" || properties[i] == "tilt")
+                {
+                    value << actuator::home_angle;
+                }
+                else
+                {
+                    value << encoding::value(properties[i], configured);
+                }
+                if (!value.str().empty())
+                {
+                    defaults[properties[i]] = value.str();
+                }
+            }
+            return defaults;
+        }
 
-    // Parse shadowPropery and store it to vector
-    std::stringstream s_stream(cmdData.input_shadowProperty.c_str()); // create string stream from the string
-    while (s_stream.good())
+        /// Values of a shadow state object, null values as shadow::null_value
+        shadow::Properties toProperties(const JsonView &state)
+        {
+            shadow::Properties properties;
+            Map<String, JsonView> shadowPropertyMap = state.GetAllObjects();
+            for (const auto &ele : shadowPropertyMap)
+            {
+                if (ele.second.IsNull())
+                {
+                    properties[ele.first.c_str()] = shadow::null_value;
+                }
+                else if (ele.second.IsString())
+                {
+                    properties[ele.first.c_str()] = ele.second.AsString().c_str();
+                }
+                else
+                {
+                    properties[ele.first.c_str()] = ele.second.WriteCompact().c_str();
+                }
+            }
+            return properties;
+        }
+    } // namespace
+
+    Manager::Manager(Utils::cmdData &cmdData, const Hooks &hooks)
+        : m_cmdData(cmdData),
+          m_hooks(hooks),
+          m_properties(parseProperties(cmdData.input_shadowProperty.c_str())),
+          m_cache(cmdData.input_shadowCache.c_str(), cachedProperties()),
+          m_stopping(false)
     {
-        std::string substr;
-        getline(s_stream, substr, ','); // get first string delimited by comma
-        vShadowProprty.push_back(substr);
     }
 
-    // Create the MQTT builder and populate it with data from cmdData.
-    auto clientConfigBuilder =
-        Aws::Iot::MqttClientConnectionConfigBuilder(cmdData.input_cert.c_str(), cmdData.input_key.c_str());
-    clientConfigBuilder.WithEndpoint(cmdData.input_endpoint);
-    if (cmdData.input_ca != "")
-    {
-        clientConfigBuilder.WithCertificateAuthority(cmdData.input_ca.c_str());
-    }
-    if (cmdData.input_proxyHost != "")
+    bool Manager::restore()
     {
-        Http::HttpClientConnectionProxyOptions proxyOptions;
-        proxyOptions.HostName = cmdData.input_proxyHost;
-        proxyOptions.Port = static_cast<uint16_t>(cmdData.input_proxyPort);
-        proxyOptions.AuthType = Http::AwsHttpProxyAuthenticationType::None;
-        clientConfigBuilder.WithHttpProxyOptions(proxyOptions);
+        m_cache.load(m_lastApplied);
+
+        if (gpio::initialise() < 0)
+            return false;
+        actuator::setSettleTime(m_cmdData.input_servoSettleMs);
+        actuator::start(
+            m_lastApplied.count("pan") ? calibration::clamp(calibration::AXIS_PAN, atof(m_lastApplied["pan"].c_str())) : actuator::home_angle,
+            m_lastApplied.count("tilt") ? calibration::clamp(calibration::AXIS_TILT, atof(m_lastApplied["tilt"].c_str())) : actuator::home_angle);
+        // the keyframe policy forces an IDR once the servos come to rest after a large move
+        double restPan, restTilt;
+        actuator::position(restPan, restTilt);
+        keyframe::stream().onServoRest(restPan, restTilt);
+        actuator::addListener([](double panDeg, double tiltDeg)
+                              { keyframe::stream().onServoRest(panDeg, tiltDeg); });
+        if (!m_lastApplied.empty())
+        {
+            applyValues(m_lastApplied, m_hooks);
+        }
+        m_cache.start();
+        return true;
     }
-    if (cmdData.input_port != 0)
+
+    void Manager::setOnline(bool online)
     {
-        clientConfigBuilder.WithPortOverride(static_cast<uint16_t>(cmdData.input_port));
+        if (m_hooks.online)
+        {
+            m_hooks.online(online);
+        }
     }
 
-    // Create the MQTT connection from the MQTT builder
-    auto clientConfig = clientConfigBuilder.Build();
-    if (!clientConfig)
+    void Manager::readConsole()
     {
-        LOG_FATAL("[DEVICE] Client Configuration initialization failed with error " << ErrorDebugString(clientConfig.LastError()));
-        exit(-1);
+        LOG_INFO("[DEVICE] Enter Desired state of " << m_properties.at(0).c_str());
+        while (true)
+        {
+            std::string input;
+            std::cin >> input;
+
+            if (input == "exit" || input == "quit")
+            {
+                LOG_INFO("[DEVICE] Exiting...");
+                break;
+            }
+
+            std::function<void(const std::string &)> change;
+            {
+                std::lock_guard<std::mutex> lock(m_lock);
+                change = m_change;
+            }
+            if (!change)
+            {
+                LOG_INFO("[DEVICE] Not connected to AWS IoT yet, " << input << " is ignored");
+                continue;
+            }
+            change(input);
+        }
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+        m_wakeup.notify_all();
     }
-    Aws::Iot::MqttClient client = Aws::Iot::MqttClient();
-    auto connection = client.NewConnection(clientConfig);
-    if (!*connection)
+
+    bool Manager::backoff(unsigned int &waitMs)
     {
-        LOG_FATAL("[DEVICE] MQTT Connection Creation failed with error " << ErrorDebugString(connection->LastError()));
-        exit(-1);
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_wakeup.wait_for(lock, std::chrono::milliseconds(waitMs), [this]()
+                          { return m_stopping; });
+        waitMs = std::min(waitMs * 2, max_connect_backoff_ms);
+        return !m_stopping;
     }
 
-    /**
-     * In a real world application you probably don't want to enforce synchronous behavior
-     * but this is a sample console application, so we'll just do that with a condition variable.
-     */
-    std::promise<bool> connectionCompletedPromise;
-    std::promise<void> connectionClosedPromise;
-
-    auto onConnectionCompleted =
-        [&](Mqtt::MqttConnection &, int errorCode, Mqtt::ReturnCode returnCode, bool)
+    void Manager::run()
     {
-        if (errorCode)
+        // Create the MQTT builder and populate it with data from m_cmdData.
+        auto clientConfigBuilder =
+            Aws::Iot::MqttClientConnectionConfigBuilder(m_cmdData.input_cert.c_str(), m_cmdData.input_key.c_str());
+        clientConfigBuilder.WithEndpoint(m_cmdData.input_endpoint);
+        if (m_cmdData.input_ca != "")
+        {
+            clientConfigBuilder.WithCertificateAuthority(m_cmdData.input_ca.c_str());
+        }
+        if (m_cmdData.input_proxyHost != "")
         {
-            LOG_FATAL("[DEVICE] Connection failed with error " << ErrorDebugString(errorCode));
-            connectionCompletedPromise.set_value(false);
+            Http::HttpClientConnectionProxyOptions proxyOptions;
+            proxyOptions.HostName = m_cmdData.input_proxyHost;
+            proxyOptions.Port = static_cast<uint16_t>(m_cmdData.input_proxyPort);
+            proxyOptions.AuthType = Http::AwsHttpProxyAuthenticationType::None;
+            clientConfigBuilder.WithHttpProxyOptions(proxyOptions);
         }
-        else
+        if (m_cmdData.input_port != 0)
         {
-            LOG_INFO("[DEVICE] Connection completed with return code " << returnCode);
-            connectionCompletedPromise.set_value(true);
+            clientConfigBuilder.WithPortOverride(static_cast<uint16_t>(m_cmdData.input_port));
         }
-    };
 
-    // Invoked when a disconnect message has completed.
-    auto onDisconnect = [&](Mqtt::MqttConnection &)
-    {
-        LOG_INFO("[DEVICE] Disconnect completed");
-        connectionClosedPromise.set_value();
-    };
+        // Create the MQTT connection from the MQTT builder
+        auto clientConfig = clientConfigBuilder.Build();
+        if (!clientConfig)
+        {
+            LOG_FATAL("[DEVICE] Client Configuration initialization failed with error " << ErrorDebugString(clientConfig.LastError()));
+            exit(-1);
+        }
+        Aws::Iot::MqttClient client = Aws::Iot::MqttClient();
 
-    // Assign callbacks
-    connection->OnConnectionCompleted = std::move(onConnectionCompleted);
-    connection->OnDisconnect = std::move(onDisconnect);
+        // exit or quit on the console ends run(), also while the connection is still retried
+        std::thread console([this]()
+                            {
+                                threadstats::nameThread("c3-console");
+                                readConsole(); });
 
-    // Connect
-    LOG_INFO("[DEVICE] Connecting...");
-    if (!connection->Connect(cmdData.input_clientId.c_str(), true, 0))
-    {
-        LOG_FATAL("[DEVICE] MQTT Connection failed with error " << ErrorDebugString(connection->LastError()));
-        exit(-1);
-    }
+        /**
+         * In a real world application you probably don't want to enforce synchronous behavior
+         * but this is a sample console application, so we'll just do that with a condition variable.
+         */
+        std::shared_ptr<Mqtt::MqttConnection> connection;
+        std::promise<void> connectionClosedPromise;
 
-    if (connectionCompletedPromise.get_future().get())
-    {
-        Aws::Iotshadow::IotShadowClient shadowClient(connection);
+        // The device keeps running on the cached values while AWS IoT cannot be reached, the connect is retried until
+        // shutdown and the shadow is reconciled once it succeeds
+        unsigned int backoffMs = initial_connect_backoff_ms;
+        while (true)
+        {
+            auto connectionCompletedPromise = std::make_shared<std::promise<bool>>();
+            auto attempt = client.NewConnection(clientConfig);
+            if (!attempt || !*attempt)
+            {
+                LOG_ERROR("[DEVICE] MQTT Connection Creation failed with error "
+                          << ErrorDebugString(attempt ? attempt->LastError() : client.LastError()));
+                LOG_INFO("[DEVICE] Connecting again in " << backoffMs << " ms");
+                if (!backoff(backoffMs))
+                {
+                    break;
+                }
+                continue;
+            }
 
-        if (gpioInitialise() < 0)
-            return -1;
-        gpioSetSignalFunc(SIGINT, servo::stop);
+            // Invoked when a MQTT connect has completed or failed
+            auto onConnectionCompleted =
+                [this, connectionCompletedPromise](Mqtt::MqttConnection &, int errorCode, Mqtt::ReturnCode returnCode, bool)
+            {
+                if (errorCode)
+                {
+                    LOG_ERROR("[DEVICE] Connection failed with error " << ErrorDebugString(errorCode));
+                    connectionCompletedPromise->set_value(false);
+                }
+                else
+                {
+                    LOG_INFO("[DEVICE] Connection completed with return code " << returnCode);
+                    setOnline(true);
+                    connectionCompletedPromise->set_value(true);
+                }
+            };
 
-        /********************** Shadow Delta Updates ********************/
-        // This section is for when a Shadow document updates/changes, whether it is on the server side or client side.
+            auto onInterrupted = [this](Mqtt::MqttConnection &, int error)
+            {
+                LOG_ERROR("[DEVICE] Connection interrupted with error " << ErrorDebugString(error));
+                setOnline(false);
+            };
 
-        std::promise<void> subscribeDeltaCompletedPromise;
-        std::promise<void> subscribeDeltaAcceptedCompletedPromise;
-        std::promise<void> subscribeDeltaRejectedCompletedPromise;
+            auto onResumed = [this](Mqtt::MqttConnection &, Mqtt::ReturnCode, bool)
+            {
+                LOG_INFO("[DEVICE] Connection resumed");
+                setOnline(true);
+            };
 
-        auto onDeltaUpdatedSubAck = [&](int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            // Invoked when a disconnect message has completed.
+            auto onDisconnect = [&connectionClosedPromise](Mqtt::MqttConnection &)
+            {
+                LOG_INFO("[DEVICE] Disconnect completed");
+                connectionClosedPromise.set_value();
+            };
+
+            // Assign callbacks
+            attempt->OnConnectionCompleted = std::move(onConnectionCompleted);
+            attempt->OnDisconnect = std::move(onDisconnect);
+            attempt->OnConnectionInterrupted = std::move(onInterrupted);
+            attempt->OnConnectionResumed = std::move(onResumed);
+
+            // Connect
+            LOG_INFO("[DEVICE] Connecting...");
+            bool connected = false;
+            if (!attempt->Connect(m_cmdData.input_clientId.c_str(), true, 0))
             {
-                LOG_FATAL("[DEVICE] Error subscribing to shadow delta: " << ErrorDebugString(ioErr));
-                exit(-1);
+                LOG_ERROR("[DEVICE] MQTT Connection failed with error " << ErrorDebugString(attempt->LastError()));
             }
-            subscribeDeltaCompletedPromise.set_value();
-        };
-
-        auto onDeltaUpdatedAcceptedSubAck = [&](int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            else
             {
-                LOG_FATAL("[DEVICE] Error subscribing to shadow delta accepted: " << ErrorDebugString(ioErr));
-                exit(-1);
+                connected = connectionCompletedPromise->get_future().get();
             }
-            subscribeDeltaAcceptedCompletedPromise.set_value();
-        };
-
-        auto onDeltaUpdatedRejectedSubAck = [&](int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            if (connected)
             {
-                LOG_FATAL("[DEVICE] Error subscribing to shadow delta rejected: " << ErrorDebugString(ioErr));
-                exit(-1);
+                connection = attempt;
+                break;
             }
-            subscribeDeltaRejectedCompletedPromise.set_value();
-        };
-
-        auto onDeltaUpdated = [&](ShadowDeltaUpdatedEvent *event, int ioErr)
-        {
-            if (ioErr)
+            LOG_INFO("[DEVICE] Connecting again in " << backoffMs << " ms");
+            if (!backoff(backoffMs))
             {
-                LOG_FATAL("[DEVICE] Error processing shadow delta: " << ErrorDebugString(ioErr));
-                exit(-1);
+                break;
             }
+        }
 
-            if (event)
-            {
-                LOG_DEBUG("[DEVICE] Received shadow delta event.");
-                if (event->State && vShadowProprty.size() > 0)
-                {
-                    JsonObject shadowPropertyObject;
-                    bool processShadow;
+        if (connection)
+        {
+            Aws::Iotshadow::IotShadowClient shadowClient(connection);
 
-                    for (size_t i = 0; i < vShadowProprty.size(); i++)
-                    {
-                        if (event->State->View().ValueExists(vShadowProprty.at(i).c_str()))
-                        {
-                            processShadow = true;
-                            JsonView objectView = event->State->View().GetJsonObject(vShadowProprty.at(i).c_str());
-                            if (objectView.IsNull())
-                            {
-                                LOG_DEBUG("[DEVICE] Delta reports that " << vShadowProprty.at(i).c_str() << " was deleted. Resetting defaults...");
-                                shadowPropertyObject.WithString(vShadowProprty.at(i).c_str(), SHADOW_VALUE_DEFAULT);
-                            }
-                            else
-                            {
-                                LOG_DEBUG("[DEVICE] Delta reports that " << vShadowProprty.at(i).c_str() << " has a desired value of " << event->State->View().GetString(vShadowProprty.at(i).c_str()).c_str() << ", Changing local value...");
-                                shadowPropertyObject.WithString(vShadowProprty.at(i).c_str(),
-                                                                event->State->View().GetString(vShadowProprty.at(i).c_str()).c_str());
-                            }
+            // Telemetry shares the shadow connection and stops before it is closed
+            telemetry::Publisher telemetryPublisher(connection, m_cmdData.input_thingName.c_str(), m_cmdData.input_telemetryInterval);
+            telemetryPublisher.start();
 
-                            if (event->ClientToken)
-                            {
-                                LOG_DEBUG("[DEVICE] ClientToken: " << event->ClientToken->c_str());
-                            }
-                        }
-                        else
+            // Snapshots asked for through the shadow are published on the same connection, AWS IoT takes up to 128 kB
+            std::string snapshotTopic = std::string("c3/") + m_cmdData.input_thingName.c_str() + "/snapshot";
+            snapshot::startDelivery(
+                [connection, snapshotTopic](const snapshot::ImagePtr &image)
+                {
+                    if (image->jpeg.size() > 128 * 1024)
+                    {
+                        LOG_WARN("[DEVICE] Snapshot of " << image->jpeg.size() << " bytes is too large to publish");
+                        return;
+                    }
+                    Aws::Crt::ByteBuf buffer = Aws::Crt::ByteBufFromArray(image->jpeg.data(), image->jpeg.size());
+                    // the completion callback holds the image until the asynchronous publish is done
+                    auto onPublishComplete = [image](Aws::Crt::Mqtt::MqttConnection &, uint16_t, int errorCode)
+                    {
+                        if (errorCode != AWS_OP_SUCCESS)
                         {
-                            LOG_DEBUG("[DEVICE] Delta did not report a change in " << vShadowProprty.at(i).c_str() << ".");
+                            LOG_ERROR("[DEVICE] Snapshot publish failed with error " << ErrorDebugString(errorCode));
                         }
-                    }
-                    if (processShadow)
+                    };
+                    connection->Publish(snapshotTopic.c_str(), AWS_MQTT_QOS_AT_MOST_ONCE, false, buffer, std::move(onPublishComplete));
+                });
+
+            // Deltas only record the newest value per property, the agent applies and reports them in batches
+            shadow::Agent shadowAgent(
+                m_properties,
+                defaultValues(m_properties),
+                [this](const shadow::Properties &properties) -> shadow::Properties
+                {
+                    shadow::Properties rejected = applyValues(properties, m_hooks);
+                    // rejected values stay out of the cache, the device keeps running with the previous ones
+                    shadow::Properties applied = properties;
+                    for (shadow::Properties::const_iterator it = rejected.begin(); it != rejected.end(); ++it)
                     {
-                        s_changeShadowValue(
-                            shadowClient,
-                            cmdData.input_thingName,
-                            shadowPropertyObject);
+                        applied.erase(it->first);
                     }
+                    m_cache.update(applied);
+                    return rejected;
+                },
+                [this, &shadowClient](const shadow::Properties &properties, const std::string &clientToken)
+                { publishValues(shadowClient, m_cmdData.input_thingName, properties, clientToken.c_str(), false); },
+                m_cmdData.input_shadowReportInterval);
+            // the values restored above are reported if the shadow missed them
+            shadowAgent.restore(m_lastApplied);
+            shadowAgent.start();
+
+            // moves the device makes on its own, presets, tours and data channel commands, are reported asynchronously
+            actuator::setListener([this, &shadowAgent](double panDeg, double tiltDeg)
+                                  {
+                                      std::ostringstream pan, tilt;
+                                      pan << panDeg;
+                                      tilt << tiltDeg;
+                                      shadow::Properties position;
+                                      position["pan"] = pan.str();
+                                      position["tilt"] = tilt.str();
+                                      shadowAgent.onLocalChange(position);
+                                      m_cache.update(position); });
+
+            /********************** Shadow Delta Updates ********************/
+            // This section is for when a Shadow document updates/changes, whether it is on the server side or client side.
+
+            std::promise<void> subscribeDeltaCompletedPromise;
+            std::promise<void> subscribeDeltaAcceptedCompletedPromise;
+            std::promise<void> subscribeDeltaRejectedCompletedPromise;
+
+            auto onDeltaUpdatedSubAck = [&](int ioErr)
+            {
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Error subscribing to shadow delta: " << ErrorDebugString(ioErr));
+                    exit(-1);
                 }
-                else
+                subscribeDeltaCompletedPromise.set_value();
+            };
+
+            auto onDeltaUpdatedAcceptedSubAck = [&](int ioErr)
+            {
+                if (ioErr != AWS_OP_SUCCESS)
                 {
-                    LOG_INFO("[DEVICE] Delta did not report a change in " << cmdData.input_shadowProperty.c_str() << ".");
+                    LOG_FATAL("[DEVICE] Error subscribing to shadow delta accepted: " << ErrorDebugString(ioErr));
+                    exit(-1);
                 }
-            }
-        };
+                subscribeDeltaAcceptedCompletedPromise.set_value();
+            };
 
-        auto onUpdateShadowAccepted = [&](UpdateShadowResponse *response, int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            auto onDeltaUpdatedRejectedSubAck = [&](int ioErr)
             {
-                LOG_FATAL("[DEVICE] Error on subscription: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Error subscribing to shadow delta rejected: " << ErrorDebugString(ioErr));
+                    exit(-1);
+                }
+                subscribeDeltaRejectedCompletedPromise.set_value();
+            };
 
-            if (response->State->Reported)
+            auto onDeltaUpdated = [&](ShadowDeltaUpdatedEvent *event, int ioErr)
             {
-                for (size_t i = 0; i < vShadowProprty.size(); i++)
+                if (ioErr)
                 {
-                    currentShadowValue[vShadowProprty.at(i).c_str()] = response->State->Reported->View().GetString(vShadowProprty.at(i).c_str());
+                    LOG_FATAL("[DEVICE] Error processing shadow delta: " << ErrorDebugString(ioErr));
+                    exit(-1);
                 }
-            }
-            else
+
+                if (event)
+                {
+                    LOG_DEBUG("[DEVICE] Received shadow delta event.");
+                    if (event->ClientToken)
+                    {
+                        LOG_DEBUG("[DEVICE] ClientToken: " << event->ClientToken->c_str());
+                    }
+                    if (event->State)
+                    {
+                        shadowAgent.onDelta(toProperties(event->State->View()));
+                    }
+                }
+            };
+
+            auto onUpdateShadowAccepted = [&](UpdateShadowResponse *response, int ioErr)
             {
-                for (size_t i = 0; i < vShadowProprty.size(); i++)
+                if (ioErr != AWS_OP_SUCCESS)
                 {
-                    currentShadowValue[vShadowProprty.at(i).c_str()] = "";
+                    LOG_FATAL("[DEVICE] Error on subscription: " << ErrorDebugString(ioErr));
+                    exit(-1);
                 }
-                LOG_DEBUG("[DEVICE] Finished clearing shadow properties");
-            }
 
-            LOG_INFO("[DEVICE] Enter Desired state of " << vShadowProprty.at(0).c_str());
-        };
+                shadow::Properties reported;
+                if (response->State && response->State->Reported)
+                {
+                    reported = toProperties(response->State->Reported->View());
+                }
+                shadowAgent.onUpdateAccepted(reported, response->ClientToken ? response->ClientToken->c_str() : "");
 
-        auto onUpdateShadowRejected = [&](ErrorResponse *error, int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+                LOG_INFO("[DEVICE] Enter Desired state of " << m_properties.at(0).c_str());
+            };
+
+            auto onUpdateShadowRejected = [&](ErrorResponse *error, int ioErr)
             {
-                LOG_FATAL("[DEVICE] Error on subscription: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
-            LOG_INFO("[DEVICE] Update of shadow state failed with message " << error->Message->c_str() << " and code " << *error->Code << ".");
-        };
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Error on subscription: " << ErrorDebugString(ioErr));
+                    exit(-1);
+                }
+                shadowAgent.onUpdateRejected(*error->Code, error->Message->c_str(), error->ClientToken ? error->ClientToken->c_str() : "");
+            };
 
-        ShadowDeltaUpdatedSubscriptionRequest shadowDeltaUpdatedRequest;
-        shadowDeltaUpdatedRequest.ThingName = cmdData.input_thingName;
+            ShadowDeltaUpdatedSubscriptionRequest shadowDeltaUpdatedRequest;
+            shadowDeltaUpdatedRequest.ThingName = m_cmdData.input_thingName;
 
-        shadowClient.SubscribeToShadowDeltaUpdatedEvents(
-            shadowDeltaUpdatedRequest, AWS_MQTT_QOS_AT_LEAST_ONCE, onDeltaUpdated, onDeltaUpdatedSubAck);
+            shadowClient.SubscribeToShadowDeltaUpdatedEvents(
+                shadowDeltaUpdatedRequest, AWS_MQTT_QOS_AT_LEAST_ONCE, onDeltaUpdated, onDeltaUpdatedSubAck);
 
-        UpdateShadowSubscriptionRequest updateShadowSubscriptionRequest;
-        updateShadowSubscriptionRequest.ThingName = cmdData.input_thingName;
+            UpdateShadowSubscriptionRequest updateShadowSubscriptionRequest;
+            updateShadowSubscriptionRequest.ThingName = m_cmdData.input_thingName;
 
-        shadowClient.SubscribeToUpdateShadowAccepted(
-            updateShadowSubscriptionRequest,
-            AWS_MQTT_QOS_AT_LEAST_ONCE,
-            onUpdateShadowAccepted,
-            onDeltaUpdatedAcceptedSubAck);
+            shadowClient.SubscribeToUpdateShadowAccepted(
+                updateShadowSubscriptionRequest,
+                AWS_MQTT_QOS_AT_LEAST_ONCE,
+                onUpdateShadowAccepted,
+                onDeltaUpdatedAcceptedSubAck);
 
-        shadowClient.SubscribeToUpdateShadowRejected(
-            updateShadowSubscriptionRequest,
-            AWS_MQTT_QOS_AT_LEAST_ONCE,
-            onUpdateShadowRejected,
-            onDeltaUpdatedRejectedSubAck);
+            shadowClient.SubscribeToUpdateShadowRejected(
+                updateShadowSubscriptionRequest,
+                AWS_MQTT_QOS_AT_LEAST_ONCE,
+                onUpdateShadowRejected,
+                onDeltaUpdatedRejectedSubAck);
 
-        subscribeDeltaCompletedPromise.get_future().wait();
-        subscribeDeltaAcceptedCompletedPromise.get_future().wait();
-        subscribeDeltaRejectedCompletedPromise.get_future().wait();
+            subscribeDeltaCompletedPromise.get_future().wait();
+            subscribeDeltaAcceptedCompletedPromise.get_future().wait();
+            subscribeDeltaRejectedCompletedPromise.get_future().wait();
 
-        /********************** Shadow Value Get ********************/
-        // This section is to get the initial value of the Shadow document.
+            /********************** Shadow Value Get ********************/
+            // This section is to get the initial value of the Shadow document.
 
-        std::promise<void> subscribeGetShadowAcceptedCompletedPromise;
-        std::promise<void> subscribeGetShadowRejectedCompletedPromise;
-        std::promise<void> onGetShadowRequestCompletedPromise;
-        std::promise<void> gotInitialShadowPromise;
+            std::promise<void> subscribeGetShadowAcceptedCompletedPromise;
+            std::promise<void> subscribeGetShadowRejectedCompletedPromise;
+            std::promise<void> onGetShadowRequestCompletedPromise;
+            std::promise<void> gotInitialShadowPromise;
 
-        auto onGetShadowUpdatedAcceptedSubAck = [&](int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            auto onGetShadowUpdatedAcceptedSubAck = [&](int ioErr)
             {
-                LOG_FATAL("[DEVICE] Error subscribing to get shadow document accepted: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
-            subscribeGetShadowAcceptedCompletedPromise.set_value();
-        };
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Error subscribing to get shadow document accepted: " << ErrorDebugString(ioErr));
+                    exit(-1);
+                }
+                subscribeGetShadowAcceptedCompletedPromise.set_value();
+            };
 
-        auto onGetShadowUpdatedRejectedSubAck = [&](int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            auto onGetShadowUpdatedRejectedSubAck = [&](int ioErr)
             {
-                LOG_FATAL("[DEVICE] Error subscribing to get shadow document rejected: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
-            subscribeGetShadowRejectedCompletedPromise.set_value();
-        };
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Error subscribing to get shadow document rejected: " << ErrorDebugString(ioErr));
+                    exit(-1);
+                }
+                subscribeGetShadowRejectedCompletedPromise.set_value();
+            };
 
-        auto onGetShadowRequestSubAck = [&](int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
+            auto onGetShadowRequestSubAck = [&](int ioErr)
             {
-                LOG_FATAL("[DEVICE] Error getting shadow document: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
-            onGetShadowRequestCompletedPromise.set_value();
-        };
+                if (ioErr != AWS_OP_SUCCESS)
+                {
+                    LOG_FATAL("[DEVICE] Error getting shadow document: " << ErrorDebugString(ioErr));
+                    exit(-1);
+                }
+                onGetShadowRequestCompletedPromise.set_value();
+            };
 
-        auto onGetShadowAccepted = [&](GetShadowResponse *response, int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
-            {
-                LOG_FATAL("[DEVICE] Error getting shadow value from document: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
-            if (response)
+            auto onGetShadowAccepted = [&](GetShadowResponse *response, int ioErr)
             {
-                LOG_INFO("[DEVICE] Received shadow document. ");
-                if (response->State && vShadowProprty.size() > 0)
+                if (ioErr != AWS_OP_SUCCESS)
                 {
-                    JsonObject shadowPropertyObject;
-                    bool processShadow;
-                    for (size_t i = 0; i < vShadowProprty.size(); i++)
+                    LOG_FATAL("[DEVICE] Error getting shadow value from document: " << ErrorDebugString(ioErr));
+                    exit(-1);
+                }
+                if (response)
+                {
+                    LOG_INFO("[DEVICE] Received shadow document. ");
+                    if (response->State && response->State->Reported)
                     {
-                        if (response->State->Reported->View().ValueExists(vShadowProprty.at(i).c_str()))
-                        {
-                            JsonView objectView = response->State->Reported->View().GetJsonObject(vShadowProprty.at(i).c_str());
-                            processShadow = true;
-                            if (objectView.IsNull())
-                            {
-                                LOG_DEBUG("[DEVICE] Shadow contains " << vShadowProprty.at(i).c_str() << " but is null.");
-                                currentShadowValue[vShadowProprty.at(i).c_str()] = "";
-                            }
-                            else
-                            {
-                                LOG_DEBUG("[DEVICE] Shadow contains " << vShadowProprty.at(i).c_str() << ". Updating local value to " << response->State->Reported->View().GetString(vShadowProprty.at(i).c_str()).c_str() << "...");
-                                currentShadowValue[vShadowProprty.at(i).c_str()] = response->State->Reported->View().GetString(vShadowProprty.at(i).c_str());
-                            }
-                        }
+                        shadowAgent.onGetAccepted(toProperties(response->State->Reported->View()));
+                    }
+                    else
+                    {
+                        LOG_INFO("[DEVICE] Shadow currently does not contain " << m_cmdData.input_shadowProperty.c_str() << ".");
                     }
-                    if (processShadow)
+                    // desired values changed while the device was offline
+                    if (response->State && response->State->Delta)
                     {
-                        s_changeShadowValue(
-                            shadowClient,
-                            cmdData.input_thingName,
-                            shadowPropertyObject);
+                        shadowAgent.onDelta(toProperties(response->State->Delta->View()));
                     }
+                    gotInitialShadowPromise.set_value();
                 }
-                else
+            };
+
+            auto onGetShadowRejected = [&](ErrorResponse *error, int ioErr)
+            {
+                if (ioErr != AWS_OP_SUCCESS)
                 {
-                    LOG_INFO("[DEVICE] Shadow currently does not contain " << cmdData.input_shadowProperty.c_str() << ".");
+                    LOG_FATAL("[DEVICE] Error on getting shadow document: " << ErrorDebugString(ioErr));
+                    exit(-1);
                 }
+                LOG_INFO("[DEVICE] Getting shadow document failed with message " << error->Message->c_str() << " and code " << *error->Code);
                 gotInitialShadowPromise.set_value();
-            }
-        };
+            };
 
-        auto onGetShadowRejected = [&](ErrorResponse *error, int ioErr)
-        {
-            if (ioErr != AWS_OP_SUCCESS)
-            {
-                LOG_FATAL("[DEVICE] Error on getting shadow document: " << ErrorDebugString(ioErr));
-                exit(-1);
-            }
-            LOG_INFO("[DEVICE] Getting shadow document failed with message " << error->Message->c_str() << " and code " << *error->Code);
-            gotInitialShadowPromise.set_value();
-        };
+            GetShadowSubscriptionRequest shadowSubscriptionRequest;
+            shadowSubscriptionRequest.ThingName = m_cmdData.input_thingName;
 
-        GetShadowSubscriptionRequest shadowSubscriptionRequest;
-        shadowSubscriptionRequest.ThingName = cmdData.input_thingName;
+            shadowClient.SubscribeToGetShadowAccepted(
+                shadowSubscriptionRequest,
+                AWS_MQTT_QOS_AT_LEAST_ONCE,
+                onGetShadowAccepted,
+                onGetShadowUpdatedAcceptedSubAck);
 
-        shadowClient.SubscribeToGetShadowAccepted(
-            shadowSubscriptionRequest,
-            AWS_MQTT_QOS_AT_LEAST_ONCE,
-            onGetShadowAccepted,
-            onGetShadowUpdatedAcceptedSubAck);
+            shadowClient.SubscribeToGetShadowRejected(
+                shadowSubscriptionRequest,
+                AWS_MQTT_QOS_AT_LEAST_ONCE,
+                onGetShadowRejected,
+                onGetShadowUpdatedRejectedSubAck);
 
-        shadowClient.SubscribeToGetShadowRejected(
-            shadowSubscriptionRequest,
-            AWS_MQTT_QOS_AT_LEAST_ONCE,
-            onGetShadowRejected,
-            onGetShadowUpdatedRejectedSubAck);
+            subscribeGetShadowAcceptedCompletedPromise.get_future().wait();
+            subscribeGetShadowRejectedCompletedPromise.get_future().wait();
 
-        subscribeGetShadowAcceptedCompletedPromise.get_future().wait();
-        subscribeGetShadowRejectedCompletedPromise.get_future().wait();
+            GetShadowRequest shadowGetRequest;
+            shadowGetRequest.ThingName = m_cmdData.input_thingName;
 
-        GetShadowRequest shadowGetRequest;
-        shadowGetRequest.ThingName = cmdData.input_thingName;
+            // Get the current shadow document so we start with the correct value
+            shadowClient.PublishGetShadow(shadowGetRequest, AWS_MQTT_QOS_AT_LEAST_ONCE, onGetShadowRequestSubAck);
 
-        // Get the current shadow document so we start with the correct value
-        shadowClient.PublishGetShadow(shadowGetRequest, AWS_MQTT_QOS_AT_LEAST_ONCE, onGetShadowRequestSubAck);
+            onGetShadowRequestCompletedPromise.get_future().wait();
+            gotInitialShadowPromise.get_future().wait();
 
-        onGetShadowRequestCompletedPromise.get_future().wait();
-        gotInitialShadowPromise.get_future().wait();
-
-        /********************** Shadow change value input loop ********************/
-        /**
-         * This section is to getting user input and changing the shadow value passed to that input.
-         * If in CI, then input is automatically passed
-         */
-
-        LOG_INFO("[DEVICE] Enter Desired state of " << vShadowProprty.at(0).c_str());
-        while (true)
-        {
-            String input;
-            JsonObject shadowPropertyObject;
-            std::cin >> input;
-
-            if (input == "exit" || input == "quit")
-            {
-                LOG_INFO("[DEVICE] Exiting...");
-                break;
-            }
-
-            if (input == currentShadowValue[vShadowProprty.at(0).c_str()])
-            {
-                LOG_INFO("[DEVICE] Shadow is already set to " << input.c_str());
-                LOG_INFO("[DEVICE] Enter Desired state of " << vShadowProprty.at(0).c_str());
-            }
-            else
+            /********************** Shadow change value input loop ********************/
+            // console input changes the shadow from now on, until exit or quit
             {
-                LOG_INFO("[DEVICE] input is " << input.c_str() << " property is " << vShadowProprty.at(0).c_str());
-                shadowPropertyObject.WithString(vShadowProprty.at(0).c_str(), input);
-
-                s_changeShadowValue(
-                    shadowClient,
-                    cmdData.input_thingName,
-                    shadowPropertyObject);
+                std::unique_lock<std::mutex> lock(m_lock);
+                m_change = [this, &shadowAgent, &shadowClient](const std::string &input)
+                {
+                    if (input == shadowAgent.current(m_properties.at(0)))
+                    {
+                        LOG_INFO("[DEVICE] Shadow is already set to " << input);
+                        LOG_INFO("[DEVICE] Enter Desired state of " << m_properties.at(0).c_str());
+                        return;
+                    }
+                    LOG_INFO("[DEVICE] input is " << input << " property is " << m_properties.at(0).c_str());
+                    shadow::Properties properties;
+                    properties[m_properties.at(0)] = input;
+
+                    changeValues(
+                        shadowClient,
+                        m_cmdData.input_thingName,
+                        properties,
+                        m_hooks);
+                };
+                m_wakeup.wait(lock, [this]()
+                              { return m_stopping; });
+                m_change = std::function<void(const std::string &)>();
             }
+            snapshot::stopDelivery();
+            actuator::setListener(actuator::Listener());
         }
-    }
 
-    // Disconnect
-    if (connection->Disconnect())
-    {
-        connectionClosedPromise.get_future().wait();
+        // Disconnect
+        if (connection && connection->Disconnect())
+        {
+            connectionClosedPromise.get_future().wait();
+        }
+        console.join();
+        preset::stopTour();
+        actuator::stop();
+        gpio::terminate();
     }
-    gpioTerminate();
+} // namespace device
 
+/* ------------------------------------------------ */
+/// device shadow
+int mamageDeviceShadow(
+    Utils::cmdData &cmdData)
+{
+    device::Manager manager(cmdData, device::Hooks());
+    if (!manager.restore())
+        return -1;
+    manager.run();
     return 0;
 }
@@ -2,45 +2,77 @@
  * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
  * SPDX-License-Identifier: Apache-2.0.
  */
-#pragma once
+#ifndef __DEVICE_MANAGER_H__
+#define __DEVICE_MANAGER_H__
 
-#include <string>
-#include <algorithm>
 #include <condition_variable>
-#include <iostream>
+#include <functional>
 #include <mutex>
-
-// #include <aws/crt/Api.h>
-#include <aws/crt/JsonObject.h>
-#include <aws/crt/UUID.h>
-#include <aws/crt/io/HostResolver.h>
-#include <aws/iot/MqttClient.h>
-#include <aws/iotshadow/ErrorResponse.h>
-#include <aws/iotshadow/IotShadowClient.h>
-#include <aws/iotshadow/ShadowDeltaUpdatedEvent.h>
-#include <aws/iotshadow/ShadowDeltaUpdatedSubscriptionRequest.h>
-#include <aws/iotshadow/UpdateShadowRequest.h>
-#include <aws/iotshadow/UpdateShadowResponse.h>
-#include <aws/iotshadow/UpdateShadowSubscriptionRequest.h>
-#include <aws/iotshadow/GetShadowRequest.h>
-#include <aws/iotshadow/GetShadowResponse.h>
-#include <aws/iotshadow/GetShadowSubscriptionRequest.h>
-#include <aws/iotshadow/UpdateShadowSubscriptionRequest.h>
+#include <string>
+#include <vector>
 
 #ifndef COMMANDLINE_UTIL_H
 #define COMMANDLINE_UTIL_H
 #include "utils/CommandLineUtils.h"
 #endif // COMMANDLINE_UTIL_H
 
-using namespace Aws::Crt;
-using namespace Aws::Iotshadow;
+#include "ShadowCache.h"
+
+/// Device shadow of both executables.
+/// Restores the servos and the stream settings from the local shadow cache before the network is up, then connects to
+/// AWS IoT, applies the shadow deltas through a shadow::Agent, reports the applied values and publishes telemetry and
+/// snapshots on the same connection. The console takes new values of the first watched property.
+/// A failed connect leaves the servos and the cached values in place. It is retried after initial_connect_backoff_ms,
+/// and the wait doubles on every failed attempt up to max_connect_backoff_ms.
+namespace device
+{
+    extern const unsigned int initial_connect_backoff_ms;
+    extern const unsigned int max_connect_backoff_ms;
+
+    /// What an executable adds to the shared shadow path
+    struct Hooks
+    {
+        /// Called for watched properties the device manager does not handle itself, e.g. record
+        std::function<void(const std::string &name, const std::string &value)> apply;
+        /// The shadow connection came up or went down, it stands in for the uplink
+        std::function<void(bool online)> online;
+    };
+
+    class Manager
+    {
+    public:
+        Manager(Utils::cmdData &cmdData, const Hooks &hooks);
+
+        /// Move the servos to the last applied position and apply the cached values, false when the GPIO cannot be
+        /// initialised
+        bool restore();
+        /// Connect and serve the shadow until exit or quit is entered on the console, then release the servos
+        void run();
+
+    private:
+        Manager(const Manager &);
+        Manager &operator=(const Manager &);
+
+        void setOnline(bool online);
+        /// Console input until exit or quit, which stops run()
+        void readConsole();
+        /// Wait before the next connect, false once stopped
+        bool backoff(unsigned int &waitMs);
+
+        Utils::cmdData &m_cmdData;
+        Hooks m_hooks;
+        std::vector<std::string> m_properties; // watched, from --shadow_property
+        shadow::Cache m_cache;
+        shadow::Properties m_lastApplied; // from the cache
 
-static const char *SHADOW_VALUE_DEFAULT = "90";
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        bool m_stopping;
+        std::function<void(const std::string &input)> m_change; // console input to the shadow, set while connected
+    };
+} // namespace device
 
-/// Change shadow value
-static void s_changeShadowValue(IotShadowClient &client,
-                                const String &thingName,
-                                JsonObject &shadowPropertyObject);
+/// device shadow of c3-camera-webrtc, run on its own thread
+int mamageDeviceShadow(Utils::cmdData &cmdData);
 
-/// device shadow
-int mamageDeviceShadow(Utils::cmdData &cmdData);
\ No newline at end of file
+#endif //__DEVICE_MANAGER_H__
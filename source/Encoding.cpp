@@ -0,0 +1,249 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Encoding.h"
+#include "Keyframe.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <atomic>
+#include <gst/video/video.h>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+
+LOGGER_TAG("encoding")
+
+namespace encoding
+{
+    extern const int min_width = 160;
+    extern const int max_width = 1920;
+    extern const int min_height = 120;
+    extern const int max_height = 1080;
+    extern const int max_fps = 60;
+    extern const int min_bitrate = 64000;
+    // highest rate of the Raspberry Pi encoder
+    extern const int max_bitrate = 25000000;
+    extern const int max_gop = 600;
+
+    namespace
+    {
+        std::mutex s_lock;
+        Settings s_settings = {1280, 720, 30, 620000, 0, "high"};
+        Settings s_configured = s_settings;
+        // the settings the bound pipeline was built from
+        Settings s_built;
+        GstElement *s_encoder = NULL;
+        std::atomic<bool> s_rebuild(false);
+
+        /// V4L2_CID_MPEG_VIDEO_H264_PROFILE, -1 for unknown names
+        int v4l2Profile(const std::string &profile)
+        {
+            if (profile == "baseline")
+                return 0;
+            if (profile == "main")
+                return 2;
+            if (profile == "high")
+                return 4;
+            return -1;
+        }
+
+        bool parseInt(const std::string &value, int low, int high, int &parsed)
+        {
+            char *end;
+            long number = strtol(value.c_str(), &end, 10);
+            if (value.empty() || *end != '\0' || number < low || number > high)
+            {
+                return false;
+            }
+            parsed = (int)number;
+            return true;
+        }
+
+        /// Changes the running encoder cannot take
+        bool needsRebuild(const Settings &built, const Settings &next)
+        {
+            return built.width != next.width || built.height != next.height || built.fps != next.fps || built.profile != next.profile;
+        }
+
+        /// Bitrate on the running encoder and GOP of the keyframe policy, with the lock held
+        void setLive(const Settings &settings)
+        {
+            GstStructure *live = gst_structure_new("controls", "video_bitrate", G_TYPE_INT, settings.bitrate, NULL);
+            // v4l2h264enc sets the controls on the open device right away
+            g_object_set(G_OBJECT(s_encoder), "extra-controls", live, NULL);
+            gst_structure_free(live);
+            keyframe::stream().setBaseGop(settings.gop);
+        }
+    } // namespace
+
+    void configure(const Settings &settings)
+    {
+        std::lock_guard<std::mutex> guard(s_lock);
+        s_settings = settings;
+        s_configured = settings;
+    }
+
+    Settings current()
+    {
+        std::lock_guard<std::mutex> guard(s_lock);
+        return s_settings;
+    }
+
+    Settings configured()
+    {
+        std::lock_guard<std::mutex> guard(s_lock);
+        return s_configured;
+    }
+
+    bool apply(const std::string &name, const std::string &value)
+    {
+        static metrics::Counter &liveChanges = metrics::counter("encoding.live_changes");
+        static metrics::Counter &rebuilds = metrics::counter("encoding.rebuilds");
+
+        std::lock_guard<std::mutex> guard(s_lock);
+        Settings next = s_settings;
+        bool valid;
+        if (name == "resolution")
+        {
+            char extra;
+            valid = sscanf(value.c_str(), "%dx%d%c", &next.width, &next.height, &extra) == 2 && next.width >= min_width &&
+                    next.width <= max_width && next.height >= min_height && next.height <= max_height && next.width % 2 == 0 &&
+                    next.height % 2 == 0;
+        }
+        else if (name == "framerate")
+        {
+            // 25 or 25/1
+            std::string numerator = value.size() > 2 && value.compare(value.size() - 2, 2, "/1") == 0 ? value.substr(0, value.size() - 2) : value;
+            valid = parseInt(numerator, 1, max_fps, next.fps);
+        }
+        else if (name == "video_bitrate")
+        {
+            valid = parseInt(value, min_bitrate, max_bitrate, next.bitrate);
+        }
+        else if (name == "gop")
+        {
+            valid = parseInt(value, 0, max_gop, next.gop);
+        }
+        else if (name == "h264_profile")
+        {
+            next.profile = value;
+            valid = v4l2Profile(value) >= 0;
+        }
+        else
+        {
+            return false;
+        }
+        if (!valid)
+        {
+            LOG_ERROR("[ENCODING] Ignoring invalid " << name << " value " << value);
+            return false;
+        }
+
+        s_settings = next;
+        if (s_encoder == NULL)
+        {
+            LOG_INFO("[ENCODING] " << name << " " << value << " is used from the next pipeline");
+        }
+        else if (needsRebuild(s_built, next))
+        {
+            // the owner of the pipeline polls for this and rebuilds it without backoff
+            if (!s_rebuild)
+            {
+                rebuilds.add();
+                s_rebuild = true;
+            }
+            LOG_INFO("[ENCODING] " << name << " " << value << ", rebuilding the pipeline");
+        }
+        else if (next.bitrate != s_built.bitrate || next.gop != s_built.gop)
+        {
+            liveChanges.add();
+            setLive(next);
+            s_built.bitrate = next.bitrate;
+            s_built.gop = next.gop;
+            LOG_INFO("[ENCODING] " << name << " " << value << " set on the running stream");
+        }
+        return true;
+    }
+
+    std::string value(const std::string &name, const Settings &settings)
+    {
+        std::ostringstream text;
+        if (name == "resolution")
+            text << settings.width << "x" << settings.height;
+        else if (name == "framerate")
+            text << settings.fps;
+        else if (name == "video_bitrate")
+            text << settings.bitrate;
+        else if (name == "gop")
+            text << settings.gop;
+        else if (name == "h264_profile")
+            text << settings.profile;
+        return text.str();
+    }
+
+    void bind(GstElement *encoder, const Settings &settings)
+    {
+        std::lock_guard<std::mutex> guard(s_lock);
+        if (s_encoder != NULL)
+        {
+            gst_object_unref(s_encoder);
+        }
+        s_encoder = encoder != NULL ? (GstElement *)gst_object_ref(encoder) : NULL;
+        s_built = settings;
+        // a change may have come in while the pipeline was built
+        s_rebuild = s_encoder != NULL && needsRebuild(s_built, s_settings);
+        if (s_encoder != NULL && !s_rebuild && (s_settings.bitrate != s_built.bitrate || s_settings.gop != s_built.gop))
+        {
+            setLive(s_settings);
+            s_built.bitrate = s_settings.bitrate;
+            s_built.gop = s_settings.gop;
+        }
+    }
+
+    void unbind()
+    {
+        std::lock_guard<std::mutex> guard(s_lock);
+        if (s_encoder != NULL)
+        {
+            gst_object_unref(s_encoder);
+            s_encoder = NULL;
+        }
+        s_rebuild = false;
+    }
+
+    bool rebuildRequested()
+    {
+        return s_rebuild;
+    }
+
+    void forceKeyframe()
+    {
+        std::lock_guard<std::mutex> guard(s_lock);
+        if (s_encoder != NULL)
+        {
+            // handled by the encoder base class, which flags the next frame it takes
+            gst_element_send_event(s_encoder, gst_video_event_new_upstream_force_key_unit(GST_CLOCK_TIME_NONE, TRUE, 0));
+        }
+    }
+
+    GstStructure *controls(const Settings &settings)
+    {
+        // the keyframe policy places the IDRs, the period of the encoder is only a fallback
+        return gst_structure_new("controls",
+                                 "h264_profile", G_TYPE_INT, v4l2Profile(settings.profile),
+                                 "video_bitrate", G_TYPE_INT, settings.bitrate,
+                                 "h264_i_frame_period", G_TYPE_INT, keyframe::encoderPeriod(settings.fps),
+                                 NULL);
+    }
+
+    std::string describeControls(const Settings &settings)
+    {
+        char description[128];
+        snprintf(description, sizeof(description), "controls,h264_profile=%d,video_bitrate=%d,h264_i_frame_period=%u", v4l2Profile(settings.profile),
+                 settings.bitrate, keyframe::encoderPeriod(settings.fps));
+        return description;
+    }
+} // namespace encoding
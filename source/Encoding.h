@@ -0,0 +1,66 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __ENCODING_H__
+#define __ENCODING_H__
+
+#include <gst/gst.h>
+#include <string>
+
+/// Capture and encoder settings of the main stream, changed at runtime from the shadow.
+/// The pipeline is built from current(). Once it plays, its v4l2h264enc is bound, so a new bitrate is set on the
+/// running encoder through its extra-controls without renegotiation, and a new GOP length goes to the keyframe policy
+/// of Keyframe.h, which places the IDRs. The camera and the encoder cannot change the frame size, frame rate or
+/// profile while streaming, so such a change asks the owner of the pipeline for a rebuild instead: it leaves its bus
+/// loop without waiting for a backoff, and the new pipeline starts on a keyframe.
+/// Exported as "encoding.live_changes" and "encoding.rebuilds".
+namespace encoding
+{
+    extern const int min_width;
+    extern const int max_width;
+    extern const int min_height;
+    extern const int max_height;
+    extern const int max_fps;
+    extern const int min_bitrate;
+    extern const int max_bitrate;
+    extern const int max_gop;
+
+    struct Settings
+    {
+        int width;
+        int height;
+        int fps;
+        int bitrate;         // bits per second
+        int gop;             // base GOP of the keyframe policy in frames, 0 for its default
+        std::string profile; // baseline, main or high
+    };
+
+    /// Start values of the binary, before any shadow value is applied
+    void configure(const Settings &settings);
+    Settings current();
+    /// The start values given to configure(), applied when the desired value of a property is deleted
+    Settings configured();
+
+    /// Apply a shadow property: resolution (e.g. 1280x720), framerate, video_bitrate, gop or h264_profile. Returns
+    /// false when name is none of them or the value is invalid, invalid values are logged and ignored.
+    bool apply(const std::string &name, const std::string &value);
+    /// Shadow value of the property name in settings, in the form apply() takes, empty when name is none of them
+    std::string value(const std::string &name, const Settings &settings);
+
+    /// The pipeline built from settings plays with this v4l2h264enc, NULL when it has none
+    void bind(GstElement *encoder, const Settings &settings);
+    /// Before the bound pipeline is freed
+    void unbind();
+    /// The bound pipeline has to be rebuilt to take the current settings
+    bool rebuildRequested();
+    /// Make the bound encoder produce an IDR as soon as it can, from any thread
+    void forceKeyframe();
+
+    /// extra-controls of v4l2h264enc, free with gst_structure_free()
+    GstStructure *controls(const Settings &settings);
+    /// The same for gst_parse_launch
+    std::string describeControls(const Settings &settings);
+} // namespace encoding
+
+#endif //__ENCODING_H__
@@ -0,0 +1,190 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Fov.h"
+#include "Actuator.h"
+#include "Calibration.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <stdlib.h>
+#include <vector>
+
+LOGGER_TAG("fov")
+
+namespace fov
+{
+    // capture size of the pipelines in WebRtcSink.cpp and ProducerSink.cpp
+    extern const unsigned int frame_width = 1280;
+    extern const unsigned int frame_height = 720;
+
+    namespace
+    {
+        const unsigned int atan_table_size = 1024;
+        const unsigned int undistort_iterations = 10;
+        const double rad_to_deg = 180.0 / M_PI;
+
+        Model s_model = defaultModel();
+        // indexed by pixel column and row, one entry more than pixels so both frame edges are covered
+        std::vector<double> s_panDeg;
+        std::vector<double> s_panCos;
+        std::vector<double> s_rowTan;
+        // atan in degrees over [-s_atanRange, s_atanRange]
+        std::vector<double> s_atanDeg;
+        double s_atanRange = 1.0;
+
+        std::string trim(const std::string &text)
+        {
+            size_t begin = text.find_first_not_of(" \t\r");
+            size_t end = text.find_last_not_of(" \t\r");
+            return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+        }
+
+        /// Undistorted coordinate of a distorted one along an axis, by Newton iteration.
+        /// The radius is taken along the axis only, which keeps the tables separable.
+        double undistort(double distorted, double k1)
+        {
+            double u = distorted;
+            for (unsigned int i = 0; i < undistort_iterations; i++)
+            {
+                double f = u * (1 + k1 * u * u) - distorted;
+                double slope = 1 + 3 * k1 * u * u;
+                if (slope <= 0)
+                {
+                    break;
+                }
+                u -= f / slope;
+            }
+            return u;
+        }
+
+        /// Linear interpolation at a fractional index, clamped to the table
+        inline double lookup(const std::vector<double> &table, double index)
+        {
+            const double last = (double)(table.size() - 1);
+            index = index < 0 ? 0 : (index > last ? last : index);
+            size_t i = (size_t)index;
+            if (i >= table.size() - 1)
+            {
+                return table.back();
+            }
+            double fraction = index - i;
+            return table[i] + (table[i + 1] - table[i]) * fraction;
+        }
+    } // namespace
+
+    Model defaultModel()
+    {
+        Model model;
+        // Raspberry Pi camera module v2, the 16:9 mode keeps the full sensor width
+        model.hfovDeg = 62.2;
+        model.vfovDeg = 2 * atan(tan(model.hfovDeg / 2 / rad_to_deg) * frame_height / frame_width) * rad_to_deg;
+        model.k1 = 0;
+        model.panSign = 1;
+        model.tiltSign = 1;
+        return model;
+    }
+
+    bool load(const std::string &path, Model &model)
+    {
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            return false;
+        }
+
+        Model parsed = model;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = trim(line);
+            size_t equals = line.find('=');
+            if (line.empty() || line[0] == '#' || equals == std::string::npos)
+            {
+                continue;
+            }
+            std::string key = trim(line.substr(0, equals));
+            std::string value = trim(line.substr(equals + 1));
+            if (key == "hfov_deg")
+                parsed.hfovDeg = atof(value.c_str());
+            else if (key == "vfov_deg")
+                parsed.vfovDeg = atof(value.c_str());
+            else if (key == "k1")
+                parsed.k1 = atof(value.c_str());
+            else if (key == "pan_sign")
+                parsed.panSign = atoi(value.c_str()) < 0 ? -1 : 1;
+            else if (key == "tilt_sign")
+                parsed.tiltSign = atoi(value.c_str()) < 0 ? -1 : 1;
+            else
+                LOG_ERROR("[FOV] Unknown key " << key << " in " << path);
+        }
+
+        if (!(parsed.hfovDeg > 0 && parsed.hfovDeg < 180 && parsed.vfovDeg > 0 && parsed.vfovDeg < 180))
+        {
+            LOG_ERROR("[FOV] Invalid field of view in " << path << ", keeping " << model.hfovDeg << "x" << model.vfovDeg << " deg");
+            return false;
+        }
+        model = parsed;
+        return true;
+    }
+
+    void install(const Model &model)
+    {
+        s_model = model;
+        const double halfWidth = tan(model.hfovDeg / 2 / rad_to_deg);
+        const double halfHeight = tan(model.vfovDeg / 2 / rad_to_deg);
+
+        s_panDeg.resize(frame_width + 1);
+        s_panCos.resize(frame_width + 1);
+        double widest = 0;
+        for (unsigned int column = 0; column <= frame_width; column++)
+        {
+            double u = undistort((2.0 * column / frame_width - 1) * halfWidth, model.k1);
+            s_panDeg[column] = model.panSign * atan(u) * rad_to_deg;
+            s_panCos[column] = 1 / sqrt(1 + u * u);
+        }
+        s_rowTan.resize(frame_height + 1);
+        for (unsigned int row = 0; row <= frame_height; row++)
+        {
+            // rows count downwards, up is positive
+            s_rowTan[row] = undistort((1 - 2.0 * row / frame_height) * halfHeight, model.k1);
+            widest = std::max(widest, fabs(s_rowTan[row]));
+        }
+
+        // tilt is the elevation of the point once the pan brought it to the middle column
+        s_atanRange = widest > 0 ? widest : 1.0;
+        s_atanDeg.resize(atan_table_size + 1);
+        for (unsigned int i = 0; i <= atan_table_size; i++)
+        {
+            s_atanDeg[i] = atan((2.0 * i / atan_table_size - 1) * s_atanRange) * rad_to_deg;
+        }
+        LOG_INFO("[FOV] " << frame_width << "x" << frame_height << ", " << model.hfovDeg << "x" << model.vfovDeg << " deg, k1 " << model.k1);
+    }
+
+    const Model &installed()
+    {
+        return s_model;
+    }
+
+    void offset(double x, double y, double &panDeg, double &tiltDeg)
+    {
+        const double column = x * frame_width;
+        const double elevation = lookup(s_rowTan, y * frame_height) * lookup(s_panCos, column);
+        panDeg = lookup(s_panDeg, column);
+        tiltDeg = s_model.tiltSign * lookup(s_atanDeg, (elevation / s_atanRange + 1) * atan_table_size / 2);
+    }
+
+    void center(double x, double y)
+    {
+        double panDeg, tiltDeg, panOffset, tiltOffset;
+        actuator::position(panDeg, tiltDeg);
+        offset(x, y, panOffset, tiltOffset);
+        actuator::moveTo(actuator::AXIS_PAN | actuator::AXIS_TILT, calibration::clamp(calibration::AXIS_PAN, panDeg + panOffset),
+                         calibration::clamp(calibration::AXIS_TILT, tiltDeg + tiltOffset));
+        metrics::counter("ptz.centers").add();
+    }
+} // namespace fov
@@ -0,0 +1,48 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __FOV_H__
+#define __FOV_H__
+
+#include <string>
+
+/// Camera field of view model for click-to-center.
+/// A point of the 1280x720 frame is mapped to the pan/tilt offset which brings it to the image center. The lens is
+/// a pinhole with one radial distortion term. install() compiles the model into per-column and per-row tables and
+/// an arctangent table, so offset() only does lookups with linear interpolation and never allocates.
+namespace fov
+{
+    extern const unsigned int frame_width;
+    extern const unsigned int frame_height;
+
+    struct Model
+    {
+        double hfovDeg; // horizontal field of view across frame_width
+        double vfovDeg; // vertical field of view across frame_height
+        double k1;      // radial distortion, distorted = undistorted * (1 + k1 * r^2) in focal length units
+        int panSign;    // +1 when a point right of the center needs a larger pan angle
+        int tiltSign;   // +1 when a point above the center needs a larger tilt angle
+    };
+
+    /// Nominal model of the camera module, without distortion
+    Model defaultModel();
+
+    /// Read a model, values missing in the file keep the given ones
+    bool load(const std::string &path, Model &model);
+
+    /// Compile the model into the tables used by offset()
+    void install(const Model &model);
+    const Model &installed();
+
+    /// Pan/tilt offset in degrees of a point from the image center, x and y are 0~1 from the top left corner.
+    /// Needs install() to have been called.
+    void offset(double x, double y, double &panDeg, double &tiltDeg);
+
+    /// Move the axes so that the point comes to the image center.
+    /// The offset applies to the current position, which is where the camera was when the frame was taken. A click
+    /// on a moving camera preempts the running move, so clicks in quick succession only leave the newest target.
+    void center(double x, double y);
+} // namespace fov
+
+#endif //__FOV_H__
@@ -0,0 +1,57 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Gpio.h"
+#include "Logger.h"
+
+#include <stddef.h>
+
+LOGGER_TAG("gpio")
+
+namespace gpio
+{
+    namespace
+    {
+        Backend *s_backend = NULL;
+    } // namespace
+
+    void install(Backend *backend)
+    {
+        s_backend = backend;
+        LOG_INFO("[GPIO] Using the " << backend->name() << " backend");
+    }
+
+    Backend *installed()
+    {
+        return s_backend;
+    }
+
+    int initialise()
+    {
+        if (s_backend == NULL)
+        {
+            LOG_FATAL("[GPIO] No backend installed");
+            return -1;
+        }
+        int result = s_backend->initialise();
+        if (result < 0)
+        {
+            LOG_FATAL("[GPIO] " << s_backend->name() << " initialisation failed with " << result);
+        }
+        return result;
+    }
+
+    void terminate()
+    {
+        if (s_backend != NULL)
+        {
+            s_backend->terminate();
+        }
+    }
+
+    int servo(unsigned int gpio, unsigned int pulsewidth)
+    {
+        return s_backend->servo(gpio, pulsewidth);
+    }
+} // namespace gpio
@@ -0,0 +1,38 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __GPIO_H__
+#define __GPIO_H__
+
+/// GPIO access behind a backend.
+/// The executables install the pigpio backend, tools and benchmarks the simulated one from GpioSim.h, so the servo
+/// control path runs on any Linux machine.
+namespace gpio
+{
+    class Backend
+    {
+    public:
+        virtual ~Backend() {}
+
+        virtual const char *name() const = 0;
+        /// 0 on success, negative on failure like gpioInitialise()
+        virtual int initialise() = 0;
+        virtual void terminate() = 0;
+        /// Servo pulse width in microseconds, 0 switches the pulses off
+        virtual int servo(unsigned int gpio, unsigned int pulsewidth) = 0;
+    };
+
+    /// Backend driving the GPIO pins through pigpio, defined in GpioPigpio.cpp
+    Backend *pigpioBackend();
+
+    /// Select the backend used by the functions below, before initialise()
+    void install(Backend *backend);
+    Backend *installed();
+
+    int initialise();
+    void terminate();
+    int servo(unsigned int gpio, unsigned int pulsewidth);
+} // namespace gpio
+
+#endif //__GPIO_H__
@@ -0,0 +1,55 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Gpio.h"
+#include "Servo.h"
+#include "Tracer.h"
+
+#include <signal.h>
+#include <pigpio.h>
+
+namespace gpio
+{
+    namespace
+    {
+        class PigpioBackend : public Backend
+        {
+        public:
+            const char *name() const
+            {
+                return "pigpio";
+            }
+
+            int initialise()
+            {
+                int result = gpioInitialise();
+                if (result < 0)
+                {
+                    return result;
+                }
+                gpioSetSignalFunc(SIGINT, servo::stop);
+                // pigpio takes over every signal in gpioInitialise(), hand the trace dump signal back
+                gpioSetSignalFunc(SIGUSR1, trace::onDumpSignal);
+                return 0;
+            }
+
+            void terminate()
+            {
+                gpioTerminate();
+            }
+
+            int servo(unsigned int gpio, unsigned int pulsewidth)
+            {
+                return gpioServo(gpio, pulsewidth);
+            }
+        };
+
+        PigpioBackend s_pigpio;
+    } // namespace
+
+    Backend *pigpioBackend()
+    {
+        return &s_pigpio;
+    }
+} // namespace gpio
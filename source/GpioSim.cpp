@@ -0,0 +1,172 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "GpioSim.h"
+#include "Servo.h"
+
+#include <algorithm>
+#include <cmath>
+#include <time.h>
+
+namespace gpio
+{
+    // typical hobby servo: 0.12s per 60 degrees without load
+    extern const double default_slew_dps = 500.0;
+    // a new pulse width takes effect with the next 20ms PWM frame
+    extern const unsigned int default_response_ms = 20;
+    // pigpio drives servos at 50Hz
+    extern const unsigned int pwm_period_us = 20000;
+
+    namespace
+    {
+        // pigpio accepts 0 (off) and 500~2500us
+        const unsigned int min_pulsewidth = 500;
+        const unsigned int max_pulsewidth = 2500;
+
+        void turn(double &position, double target, double maxStep)
+        {
+            double remaining = target - position;
+            position = fabs(remaining) <= maxStep ? target : position + (remaining > 0 ? maxStep : -maxStep);
+        }
+    } // namespace
+
+    SimulatedBackend::SimulatedBackend(double slewDps, unsigned int responseMs)
+        : m_slewDps(slewDps), m_responseNs((uint64_t)responseMs * 1000000ULL)
+    {
+    }
+
+    const char *SimulatedBackend::name() const
+    {
+        return "simulated";
+    }
+
+    int SimulatedBackend::initialise()
+    {
+        clear();
+        return 0;
+    }
+
+    void SimulatedBackend::terminate()
+    {
+    }
+
+    int SimulatedBackend::servo(unsigned int gpio, unsigned int pulsewidth)
+    {
+        if (pulsewidth != 0 && (pulsewidth < min_pulsewidth || pulsewidth > max_pulsewidth))
+        {
+            return -1;
+        }
+        Pulse pulse;
+        pulse.timeNs = now();
+        pulse.gpio = gpio;
+        pulse.pulsewidth = pulsewidth;
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pulses.push_back(pulse);
+        return 0;
+    }
+
+    std::vector<SimulatedBackend::Pulse> SimulatedBackend::pulses() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_pulses;
+    }
+
+    void SimulatedBackend::clear()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_pulses.clear();
+    }
+
+    double SimulatedBackend::angleAt(unsigned int gpio, uint64_t timeNs) const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        bool known = false;
+        double position = 0;
+        double target = 0;
+        uint64_t last = 0;
+
+        for (size_t i = 0; i < m_pulses.size(); i++)
+        {
+            const Pulse &pulse = m_pulses[i];
+            uint64_t effective = pulse.timeNs + m_responseNs;
+            if (pulse.gpio != gpio)
+            {
+                continue;
+            }
+            if (effective > timeNs)
+            {
+                break;
+            }
+            turn(position, target, m_slewDps * (effective - last) / 1e9);
+            last = effective;
+            // without pulses the horn is not driven and stays where it is
+            if (pulse.pulsewidth == 0)
+            {
+                target = position;
+            }
+            else
+            {
+                target = servo::pulsewidthToAngle(pulse.pulsewidth);
+                if (!known)
+                {
+                    // the horn position before the first command is unknown, assume it was there already
+                    position = target;
+                    known = true;
+                }
+            }
+        }
+        if (known && timeNs > last)
+        {
+            turn(position, target, m_slewDps * (timeNs - last) / 1e9);
+        }
+        return position;
+    }
+
+    uint64_t SimulatedBackend::pulseOnNs(unsigned int gpio, uint64_t fromNs, uint64_t toNs) const
+    {
+        return (uint64_t)integrate(gpio, fromNs, toNs, false);
+    }
+
+    double SimulatedBackend::dutyCycle(unsigned int gpio, uint64_t fromNs, uint64_t toNs) const
+    {
+        return toNs > fromNs ? integrate(gpio, fromNs, toNs, true) / (toNs - fromNs) : 0;
+    }
+
+    double SimulatedBackend::integrate(unsigned int gpio, uint64_t fromNs, uint64_t toNs, bool dutyWeighted) const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        double total = 0;
+        unsigned int pulsewidth = 0;
+        uint64_t since = fromNs;
+
+        for (size_t i = 0; i <= m_pulses.size(); i++)
+        {
+            bool end = i == m_pulses.size() || m_pulses[i].timeNs >= toNs;
+            uint64_t at = end ? toNs : m_pulses[i].timeNs;
+            if (!end && m_pulses[i].gpio != gpio)
+            {
+                continue;
+            }
+            if (at > since && pulsewidth != 0)
+            {
+                // each 20ms frame is high for the pulse width
+                total += (at - since) * (dutyWeighted ? (double)pulsewidth / pwm_period_us : 1.0);
+            }
+            if (end)
+            {
+                break;
+            }
+            since = std::max(since, at);
+            pulsewidth = m_pulses[i].pulsewidth;
+        }
+        return total;
+    }
+
+    uint64_t SimulatedBackend::now()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+    }
+} // namespace gpio
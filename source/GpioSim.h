@@ -0,0 +1,67 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __GPIO_SIM_H__
+#define __GPIO_SIM_H__
+
+#include "Gpio.h"
+
+#include <mutex>
+#include <stdint.h>
+#include <vector>
+
+namespace gpio
+{
+    extern const double default_slew_dps;
+    extern const unsigned int default_response_ms;
+    extern const unsigned int pwm_period_us;
+
+    /// Simulated servos.
+    /// Every pulse width command is recorded with a CLOCK_MONOTONIC timestamp. The servo horn follows a command after
+    /// the response time and turns towards it at the slew rate, which is what a hobby servo does with its own
+    /// position loop. A pulse width of 0 switches the pulses off, the horn is no longer driven and stops.
+    class SimulatedBackend : public Backend
+    {
+    public:
+        struct Pulse
+        {
+            uint64_t timeNs;
+            unsigned int gpio;
+            unsigned int pulsewidth;
+        };
+
+        explicit SimulatedBackend(double slewDps = default_slew_dps, unsigned int responseMs = default_response_ms);
+
+        const char *name() const;
+        int initialise();
+        void terminate();
+        int servo(unsigned int gpio, unsigned int pulsewidth);
+
+        std::vector<Pulse> pulses() const;
+        void clear();
+        /// Angle of the horn at the given time, from the pulses recorded before it
+        double angleAt(unsigned int gpio, uint64_t timeNs) const;
+        /// Time within [fromNs, toNs) during which the pin generated pulses
+        uint64_t pulseOnNs(unsigned int gpio, uint64_t fromNs, uint64_t toNs) const;
+        /// Fraction of [fromNs, toNs) during which the pin was high
+        double dutyCycle(unsigned int gpio, uint64_t fromNs, uint64_t toNs) const;
+
+        static uint64_t now();
+
+    private:
+        SimulatedBackend(const SimulatedBackend &);
+        SimulatedBackend &operator=(const SimulatedBackend &);
+
+        /// Time with pulses on within the window, or high time when duty weighted
+        double integrate(unsigned int gpio, uint64_t fromNs, uint64_t toNs, bool dutyWeighted) const;
+
+        double m_slewDps;
+        uint64_t m_responseNs;
+
+        mutable std::mutex m_lock;
+        std::vector<Pulse> m_pulses;
+    };
+} // namespace gpio
+
+#endif //__GPIO_SIM_H__
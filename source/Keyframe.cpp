@@ -0,0 +1,217 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Keyframe.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <math.h>
+
+namespace keyframe
+{
+    extern const unsigned int default_gop_ms = 2000;
+    // KVS and the players handle fragments up to 10 s well
+    extern const unsigned int max_gop_ms = 10000;
+    extern const unsigned int min_spacing_ms = 1000;
+    extern const unsigned int static_after_ms = 4000;
+    extern const float scene_change_share = 0.5f;
+    extern const float static_share = 0.02f;
+    extern const double servo_move_deg = 10.0;
+
+    namespace
+    {
+        // encoded frame sizes are averaged over about this many frames
+        const double size_smoothing = 1.0 / 16;
+
+        Policy s_stream;
+    } // namespace
+
+    const char *reasonName(Reason reason)
+    {
+        switch (reason)
+        {
+        case REASON_SCHEDULE:
+            return "schedule";
+        case REASON_SCENE:
+            return "scene";
+        case REASON_SERVO:
+            return "servo";
+        case REASON_VIEWER:
+            return "viewer";
+        default:
+            return "none";
+        }
+    }
+
+    unsigned int encoderPeriod(unsigned int fps)
+    {
+        return 2 * max_gop_ms * std::max(1u, fps) / 1000;
+    }
+
+    Policy::Policy()
+        : m_baseGop(0), m_informed(false), m_active(false), m_scene(false), m_servo(false), m_viewer(false), m_restPan(0), m_restTilt(0),
+          m_rested(false), m_lastShare(0), m_fps(0), m_target(0), m_sinceKey(0), m_quiet(0), m_waiting(0), m_frames(0), m_keyframes(0),
+          m_sinceFixed(0), m_fixedKeyframes(0), m_keyBytes(0), m_deltaBytes(0)
+    {
+    }
+
+    unsigned int Policy::framesOf(unsigned int ms) const
+    {
+        return std::max(1u, ms * m_fps / 1000);
+    }
+
+    void Policy::configure(unsigned int fps, unsigned int baseGop)
+    {
+        m_fps = fps;
+        setBaseGop(baseGop);
+        m_target = m_baseGop;
+        m_sinceKey = 0;
+        m_quiet = 0;
+        m_waiting = 0;
+        m_sinceFixed = 0;
+    }
+
+    void Policy::setBaseGop(unsigned int baseGop)
+    {
+        // the base GOP has to fit the stretch at least once
+        unsigned int frames = baseGop != 0 ? baseGop : framesOf(default_gop_ms);
+        m_baseGop = std::min(frames, framesOf(max_gop_ms));
+    }
+
+    void Policy::onActivity(float share)
+    {
+        m_informed = true;
+        if (share > static_share)
+        {
+            m_active = true;
+        }
+        // the background of the detector takes a while to follow a cut, only the rising edge is a scene change
+        if (share >= scene_change_share && m_lastShare < scene_change_share)
+        {
+            m_scene = true;
+        }
+        m_lastShare = share;
+    }
+
+    void Policy::onServoRest(double panDeg, double tiltDeg)
+    {
+        if (m_rested && std::max(fabs(panDeg - m_restPan), fabs(tiltDeg - m_restTilt)) >= servo_move_deg)
+        {
+            m_servo = true;
+        }
+        m_restPan = panDeg;
+        m_restTilt = tiltDeg;
+        m_rested = true;
+    }
+
+    void Policy::request(Reason reason)
+    {
+        if (reason == REASON_SCENE)
+            m_scene = true;
+        else if (reason == REASON_SERVO)
+            m_servo = true;
+        else if (reason == REASON_VIEWER)
+            m_viewer = true;
+    }
+
+    Reason Policy::onFrame(bool keyframe, size_t bytes)
+    {
+        static metrics::Counter &scheduled = metrics::counter("keyframe.scheduled");
+        static metrics::Counter &scene = metrics::counter("keyframe.scene");
+        static metrics::Counter &servo = metrics::counter("keyframe.servo");
+        static metrics::Counter &viewer = metrics::counter("keyframe.viewer");
+        static metrics::Gauge &gopMs = metrics::gauge("keyframe.gop_ms");
+        static metrics::Gauge &saved = metrics::gauge("keyframe.saved_bytes");
+        if (m_fps == 0)
+        {
+            return REASON_NONE;
+        }
+
+        unsigned int base = m_baseGop;
+        bool still = m_informed && m_quiet >= framesOf(static_after_ms);
+        m_quiet = m_active.exchange(false) ? 0 : m_quiet + 1;
+
+        // the fixed GOP of the comparison, an IDR every base GOP from the first frame on
+        if (m_frames++ == 0 || ++m_sinceFixed >= base)
+        {
+            m_fixedKeyframes++;
+            m_sinceFixed = 0;
+        }
+        if (keyframe)
+        {
+            m_keyframes++;
+            m_keyBytes = m_keyframes == 1 ? bytes : m_keyBytes + (bytes - m_keyBytes) * size_smoothing;
+            // doubled in whole base GOPs while nothing moves
+            unsigned int longest = std::max(base, framesOf(max_gop_ms) / base * base);
+            m_target = still ? std::min(longest, std::max(base, m_target * 2)) : base;
+            m_sinceKey = 0;
+            m_waiting = 0;
+            // one IDR covers every pending reason
+            m_scene = false;
+            m_servo = false;
+            m_viewer = false;
+            gopMs.set(m_target * 1000.0 / m_fps);
+            saved.set(savedBytes());
+            return REASON_NONE;
+        }
+        m_deltaBytes = m_deltaBytes == 0 ? bytes : m_deltaBytes + (bytes - m_deltaBytes) * size_smoothing;
+        m_sinceKey++;
+        if (!still)
+        {
+            m_target = base;
+        }
+
+        // the encoder was asked already, give it a second before asking again
+        if (m_waiting != 0 && ++m_waiting <= m_fps)
+        {
+            return REASON_NONE;
+        }
+        m_waiting = 0;
+
+        Reason reason = REASON_NONE;
+        if (m_sinceKey + 1 >= m_target)
+        {
+            reason = REASON_SCHEDULE;
+            scheduled.add();
+        }
+        else if (m_sinceKey + 1 >= framesOf(min_spacing_ms))
+        {
+            if (m_viewer)
+            {
+                reason = REASON_VIEWER;
+                viewer.add();
+            }
+            else if (m_servo)
+            {
+                reason = REASON_SERVO;
+                servo.add();
+            }
+            else if (m_scene)
+            {
+                reason = REASON_SCENE;
+                scene.add();
+            }
+        }
+        if (reason != REASON_NONE)
+        {
+            m_waiting = 1;
+        }
+        return reason;
+    }
+
+    double Policy::savedBytes() const
+    {
+        if (m_keyframes == 0 || m_deltaBytes == 0)
+        {
+            return 0;
+        }
+        // each IDR left out would have replaced a delta frame
+        return ((double)m_fixedKeyframes - (double)m_keyframes) * (m_keyBytes - m_deltaBytes);
+    }
+
+    Policy &stream()
+    {
+        return s_stream;
+    }
+} // namespace keyframe
@@ -0,0 +1,108 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __KEYFRAME_H__
+#define __KEYFRAME_H__
+
+#include <atomic>
+#include <stddef.h>
+
+/// Keyframe placement of the main stream.
+/// The encoder's own keyframe period is set beyond the longest GOP, and the policy forces every IDR itself. An IDR
+/// is due one base GOP after the previous one. kvssink starts a fragment at every keyframe, so each GOP is one KVS
+/// fragment. While the scene is static, every GOP that ends doubles the next one, in whole base GOPs up to
+/// max_gop_ms, which saves the bits of the skipped IDRs. Activity brings the base GOP back at once. A scene change
+/// in the analytics frames, a servo move of servo_move_deg or more, and a new viewer each force an IDR. Forced IDRs
+/// are at least min_spacing_ms apart, so fragments never get too short, and the schedule starts over from them.
+/// Exported as "keyframe.scheduled", "keyframe.scene", "keyframe.servo", "keyframe.viewer", "keyframe.gop_ms" and
+/// "keyframe.saved_bytes", an estimate of the bytes saved compared with an IDR every base GOP.
+namespace keyframe
+{
+    extern const unsigned int default_gop_ms;
+    extern const unsigned int max_gop_ms;
+    extern const unsigned int min_spacing_ms;
+    extern const unsigned int static_after_ms;
+    extern const float scene_change_share;
+    extern const float static_share;
+    extern const double servo_move_deg;
+
+    enum Reason
+    {
+        REASON_NONE,
+        REASON_SCHEDULE,
+        REASON_SCENE,
+        REASON_SERVO,
+        REASON_VIEWER,
+    };
+    const char *reasonName(Reason reason);
+
+    /// Keyframe period for the encoder itself, longer than any GOP of the policy
+    unsigned int encoderPeriod(unsigned int fps);
+
+    class Policy
+    {
+    public:
+        Policy();
+
+        /// Frame rate and base GOP in frames of a new pipeline, 0 for default_gop_ms. Nothing is forced before.
+        void configure(unsigned int fps, unsigned int baseGop);
+        /// Base GOP in frames of the running pipeline, from any thread
+        void setBaseGop(unsigned int baseGop);
+
+        /// Fraction of the blocks of an analytics frame which changed, from any thread. The GOP is only stretched
+        /// once activity is reported.
+        void onActivity(float share);
+        /// The servos came to rest, from the actuation thread
+        void onServoRest(double panDeg, double tiltDeg);
+        /// Ask for an IDR, e.g. REASON_VIEWER for a new viewer, from any thread
+        void request(Reason reason);
+
+        /// Streaming thread, every encoded frame. Returns why the encoder should be made to produce an IDR now,
+        /// REASON_NONE to leave it alone.
+        Reason onFrame(bool keyframe, size_t bytes);
+
+        /// Target of the running GOP in frames
+        unsigned int gopFrames() const { return m_target; }
+        unsigned long keyframes() const { return m_keyframes; }
+        /// Estimated bytes saved compared with an IDR every base GOP, negative when more IDRs were sent
+        double savedBytes() const;
+
+    private:
+        Policy(const Policy &);
+        Policy &operator=(const Policy &);
+
+        unsigned int framesOf(unsigned int ms) const;
+
+        std::atomic<unsigned int> m_baseGop;
+        std::atomic<bool> m_informed;
+        std::atomic<bool> m_active;
+        std::atomic<bool> m_scene;
+        std::atomic<bool> m_servo;
+        std::atomic<bool> m_viewer;
+        // actuation thread only
+        double m_restPan;
+        double m_restTilt;
+        bool m_rested;
+        // analytics thread only
+        float m_lastShare;
+
+        // streaming thread only
+        unsigned int m_fps;
+        unsigned int m_target;
+        unsigned int m_sinceKey;
+        unsigned int m_quiet;
+        unsigned int m_waiting;
+        unsigned long m_frames;
+        unsigned long m_keyframes;
+        unsigned int m_sinceFixed;
+        unsigned long m_fixedKeyframes;
+        double m_keyBytes;
+        double m_deltaBytes;
+    };
+
+    /// Policy of the main stream of this process
+    Policy &stream();
+} // namespace keyframe
+
+#endif //__KEYFRAME_H__
@@ -0,0 +1,396 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#define LOG_CLASS "LockProfiler"
+#include "LockProfiler.h"
+#include "Metrics.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <time.h>
+
+// Only the PIC global mutex functions are used in this file, never the MUTEX_* macros which may point back here.
+
+namespace
+{
+    struct SiteStats
+    {
+        std::atomic<UINT64> key;
+        std::atomic<BOOL> ready;
+        PCHAR file;
+        UINT32 line;
+        PCHAR function;
+        std::atomic<UINT64> acquisitions;
+        std::atomic<UINT64> contended;
+        std::atomic<UINT64> totalWaitNs;
+        std::atomic<UINT64> maxWaitNs;
+        std::atomic<UINT64> totalHoldNs;
+        std::atomic<UINT64> maxHoldNs;
+    };
+
+    struct LockStats
+    {
+        std::atomic<MUTEX> mutex;
+        std::atomic<BOOL> ready;
+        CHAR name[LOCK_PROFILER_MAX_NAME_LEN + 1];
+        metrics::Histogram *pWaitNs;
+        metrics::Histogram *pHoldNs;
+        std::atomic<UINT64> acquisitions;
+        std::atomic<UINT64> contended;
+        std::atomic<UINT64> tryLockFailures;
+        SiteStats sites[LOCK_PROFILER_MAX_SITES];
+    };
+
+    /// Lock held by the current thread, only touched by that thread
+    struct HeldLock
+    {
+        MUTEX mutex;
+        LockStats *pLock;
+        SiteStats *pSite;
+        UINT64 acquiredNs;
+        UINT32 depth;
+    };
+
+    LockStats gLocks[LOCK_PROFILER_MAX_LOCKS];
+    thread_local HeldLock tHeldLocks[LOCK_PROFILER_MAX_HELD_LOCKS];
+    thread_local UINT32 tHeldLockCount = 0;
+
+    UINT64 nowNs()
+    {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (UINT64) ts.tv_sec * 1000000000ULL + (UINT64) ts.tv_nsec;
+    }
+
+    VOID updateMax(std::atomic<UINT64> &max, UINT64 value)
+    {
+        UINT64 current = max.load(std::memory_order_relaxed);
+        while (value > current && !max.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    LockStats *findLock(MUTEX mutex)
+    {
+        for (UINT32 i = 0; i < LOCK_PROFILER_MAX_LOCKS; i++)
+        {
+            if (gLocks[i].ready.load(std::memory_order_acquire) && gLocks[i].mutex.load(std::memory_order_relaxed) == mutex)
+            {
+                return &gLocks[i];
+            }
+        }
+        return NULL;
+    }
+
+    SiteStats *findSite(LockStats *pLock, PCHAR file, UINT32 line, PCHAR function)
+    {
+        // File names are string literals, so the pointer together with the line identifies the call site
+        UINT64 key = ((UINT64) line << 48) ^ (UINT64) (uintptr_t) file;
+        for (UINT32 i = 0; i < LOCK_PROFILER_MAX_SITES; i++)
+        {
+            SiteStats &site = pLock->sites[i];
+            UINT64 current = site.key.load(std::memory_order_acquire);
+            if (current == key)
+            {
+                return &site;
+            }
+            if (current == 0 && site.key.compare_exchange_strong(current, key))
+            {
+                site.file = file;
+                site.line = line;
+                site.function = function;
+                site.ready.store(TRUE, std::memory_order_release);
+                return &site;
+            }
+            if (current == key)
+            {
+                return &site;
+            }
+        }
+        // Out of site slots, the lock level histograms still count this acquisition
+        return NULL;
+    }
+
+    HeldLock *findHeld(MUTEX mutex)
+    {
+        for (UINT32 i = 0; i < tHeldLockCount; i++)
+        {
+            if (tHeldLocks[i].mutex == mutex)
+            {
+                return &tHeldLocks[i];
+            }
+        }
+        return NULL;
+    }
+
+    VOID pushHeld(MUTEX mutex, LockStats *pLock, SiteStats *pSite, UINT64 acquiredNs)
+    {
+        if (tHeldLockCount < LOCK_PROFILER_MAX_HELD_LOCKS)
+        {
+            HeldLock &held = tHeldLocks[tHeldLockCount++];
+            held.mutex = mutex;
+            held.pLock = pLock;
+            held.pSite = pSite;
+            held.acquiredNs = acquiredNs;
+            held.depth = 1;
+        }
+    }
+
+    VOID popHeld(HeldLock *pHeld)
+    {
+        *pHeld = tHeldLocks[--tHeldLockCount];
+    }
+
+    VOID recordAcquisition(LockStats *pLock, SiteStats *pSite, BOOL contended, UINT64 waitNs)
+    {
+        pLock->acquisitions.fetch_add(1, std::memory_order_relaxed);
+        pLock->pWaitNs->record(waitNs);
+        if (contended)
+        {
+            pLock->contended.fetch_add(1, std::memory_order_relaxed);
+        }
+        if (pSite != NULL)
+        {
+            pSite->acquisitions.fetch_add(1, std::memory_order_relaxed);
+            if (contended)
+            {
+                pSite->contended.fetch_add(1, std::memory_order_relaxed);
+            }
+            pSite->totalWaitNs.fetch_add(waitNs, std::memory_order_relaxed);
+            updateMax(pSite->maxWaitNs, waitNs);
+        }
+    }
+
+    VOID recordHold(HeldLock *pHeld, UINT64 releasedNs)
+    {
+        UINT64 holdNs = releasedNs - pHeld->acquiredNs;
+        pHeld->pLock->pHoldNs->record(holdNs);
+        if (pHeld->pSite != NULL)
+        {
+            pHeld->pSite->totalHoldNs.fetch_add(holdNs, std::memory_order_relaxed);
+            updateMax(pHeld->pSite->maxHoldNs, holdNs);
+        }
+    }
+
+    VOID logLockReport(LockStats *pLock)
+    {
+        UINT64 acquisitions = pLock->acquisitions.load(std::memory_order_relaxed);
+        UINT64 contended = pLock->contended.load(std::memory_order_relaxed);
+        SiteStats *pSites[LOCK_PROFILER_MAX_SITES];
+        UINT32 siteCount = 0, i;
+
+        DLOGI("[Lock %s] %" PRIu64 " acquisitions, %" PRIu64 " contended (%.1f%%), %" PRIu64 " failed trylocks", pLock->name, acquisitions,
+              contended, acquisitions == 0 ? 0.0 : 100.0 * contended / acquisitions, pLock->tryLockFailures.load(std::memory_order_relaxed));
+        DLOGI("[Lock %s] wait us p50 %.1f p99 %.1f max %.1f, hold us p50 %.1f p99 %.1f max %.1f", pLock->name,
+              pLock->pWaitNs->percentile(50) / 1000.0, pLock->pWaitNs->percentile(99) / 1000.0, pLock->pWaitNs->max() / 1000.0,
+              pLock->pHoldNs->percentile(50) / 1000.0, pLock->pHoldNs->percentile(99) / 1000.0, pLock->pHoldNs->max() / 1000.0);
+
+        for (i = 0; i < LOCK_PROFILER_MAX_SITES; i++)
+        {
+            if (pLock->sites[i].ready.load(std::memory_order_acquire))
+            {
+                pSites[siteCount++] = &pLock->sites[i];
+            }
+        }
+
+        // Worst holders first: the call sites keeping everybody else waiting the longest in total
+        std::sort(pSites, pSites + siteCount, [](SiteStats *a, SiteStats *b) {
+            return a->totalHoldNs.load(std::memory_order_relaxed) > b->totalHoldNs.load(std::memory_order_relaxed);
+        });
+
+        for (i = 0; i < siteCount && i < LOCK_PROFILER_TOP_HOLDERS; i++)
+        {
+            DLOGI("[Lock %s] holder #%u %s:%u %s(): %" PRIu64 " acquisitions, hold total %.1f us max %.1f us, "
+                  "%" PRIu64 " contended, wait total %.1f us max %.1f us",
+                  pLock->name, i + 1, pSites[i]->file, pSites[i]->line, pSites[i]->function,
+                  pSites[i]->acquisitions.load(std::memory_order_relaxed), pSites[i]->totalHoldNs.load(std::memory_order_relaxed) / 1000.0,
+                  pSites[i]->maxHoldNs.load(std::memory_order_relaxed) / 1000.0, pSites[i]->contended.load(std::memory_order_relaxed),
+                  pSites[i]->totalWaitNs.load(std::memory_order_relaxed) / 1000.0, pSites[i]->maxWaitNs.load(std::memory_order_relaxed) / 1000.0);
+        }
+    }
+} // namespace
+
+VOID lockProfilerRegister(MUTEX mutex, PCHAR name)
+{
+    std::string metricName;
+    MUTEX expected;
+
+    for (UINT32 i = 0; i < LOCK_PROFILER_MAX_LOCKS; i++)
+    {
+        LockStats &lock = gLocks[i];
+        expected = INVALID_MUTEX_VALUE;
+        if (lock.mutex.compare_exchange_strong(expected, mutex))
+        {
+            STRNCPY(lock.name, name, LOCK_PROFILER_MAX_NAME_LEN);
+            lock.name[LOCK_PROFILER_MAX_NAME_LEN] = '\0';
+            metricName = std::string("lock.") + lock.name;
+            lock.pWaitNs = &metrics::histogram(metricName + ".wait_ns");
+            lock.pHoldNs = &metrics::histogram(metricName + ".hold_ns");
+            lock.acquisitions.store(0);
+            lock.contended.store(0);
+            lock.tryLockFailures.store(0);
+            for (UINT32 j = 0; j < LOCK_PROFILER_MAX_SITES; j++)
+            {
+                SiteStats &site = lock.sites[j];
+                site.ready.store(FALSE);
+                site.acquisitions.store(0);
+                site.contended.store(0);
+                site.totalWaitNs.store(0);
+                site.maxWaitNs.store(0);
+                site.totalHoldNs.store(0);
+                site.maxHoldNs.store(0);
+                site.key.store(0);
+            }
+            lock.ready.store(TRUE, std::memory_order_release);
+            return;
+        }
+    }
+    DLOGW("No lock profiler slot left for %s", name);
+}
+
+VOID lockProfilerUnregister(MUTEX mutex)
+{
+    LockStats *pLock = findLock(mutex);
+    if (pLock != NULL)
+    {
+        logLockReport(pLock);
+        pLock->ready.store(FALSE, std::memory_order_release);
+        pLock->mutex.store(INVALID_MUTEX_VALUE, std::memory_order_release);
+    }
+}
+
+VOID lockProfilerLock(MUTEX mutex, PCHAR file, UINT32 line, PCHAR function)
+{
+    LockStats *pLock = findLock(mutex);
+    HeldLock *pHeld;
+    UINT64 startNs, acquiredNs;
+    BOOL contended;
+
+    if (pLock == NULL)
+    {
+        globalLockMutex(mutex);
+        return;
+    }
+
+    // Recursive acquisition by the owner never waits and is accounted to the outermost call site
+    if ((pHeld = findHeld(mutex)) != NULL)
+    {
+        globalLockMutex(mutex);
+        pHeld->depth++;
+        return;
+    }
+
+    startNs = nowNs();
+    contended = !globalTryLockMutex(mutex);
+    if (contended)
+    {
+        globalLockMutex(mutex);
+    }
+    acquiredNs = contended ? nowNs() : startNs;
+
+    SiteStats *pSite = findSite(pLock, file, line, function);
+    recordAcquisition(pLock, pSite, contended, acquiredNs - startNs);
+    pushHeld(mutex, pLock, pSite, acquiredNs);
+}
+
+BOOL lockProfilerTryLock(MUTEX mutex, PCHAR file, UINT32 line, PCHAR function)
+{
+    LockStats *pLock = findLock(mutex);
+    HeldLock *pHeld;
+    BOOL locked;
+
+    if (pLock == NULL)
+    {
+        return globalTryLockMutex(mutex);
+    }
+
+    locked = globalTryLockMutex(mutex);
+    if ((pHeld = findHeld(mutex)) != NULL)
+    {
+        if (locked)
+        {
+            pHeld->depth++;
+        }
+    }
+    else if (locked)
+    {
+        SiteStats *pSite = findSite(pLock, file, line, function);
+        recordAcquisition(pLock, pSite, FALSE, 0);
+        pushHeld(mutex, pLock, pSite, nowNs());
+    }
+    else
+    {
+        pLock->tryLockFailures.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    return locked;
+}
+
+VOID lockProfilerUnlock(MUTEX mutex)
+{
+    HeldLock *pHeld = findHeld(mutex);
+    UINT64 releasedNs;
+
+    if (pHeld == NULL)
+    {
+        globalUnlockMutex(mutex);
+        return;
+    }
+
+    if (--pHeld->depth > 0)
+    {
+        globalUnlockMutex(mutex);
+        return;
+    }
+
+    releasedNs = nowNs();
+    globalUnlockMutex(mutex);
+    recordHold(pHeld, releasedNs);
+    popHeld(pHeld);
+}
+
+STATUS lockProfilerConditionWait(CVAR cvar, MUTEX mutex, UINT64 timeout, PCHAR file, UINT32 line, PCHAR function)
+{
+    HeldLock *pHeld = findHeld(mutex);
+    STATUS retStatus;
+
+    UNUSED_PARAM(file);
+    UNUSED_PARAM(line);
+    UNUSED_PARAM(function);
+
+    if (pHeld == NULL)
+    {
+        return globalConditionVariableWait(cvar, mutex, timeout);
+    }
+
+    // The mutex is released while waiting, so the wait splits the hold into two segments
+    recordHold(pHeld, nowNs());
+    retStatus = globalConditionVariableWait(cvar, mutex, timeout);
+    pHeld->acquiredNs = nowNs();
+
+    return retStatus;
+}
+
+VOID lockProfilerLogReport()
+{
+    for (UINT32 i = 0; i < LOCK_PROFILER_MAX_LOCKS; i++)
+    {
+        if (gLocks[i].ready.load(std::memory_order_acquire))
+        {
+            logLockReport(&gLocks[i]);
+        }
+    }
+}
+
+STATUS lockProfilerReportTimerCallback(UINT32 timerId, UINT64 currentTime, UINT64 customData)
+{
+    UNUSED_PARAM(timerId);
+    UNUSED_PARAM(currentTime);
+    UNUSED_PARAM(customData);
+
+    lockProfilerLogReport();
+
+    return STATUS_SUCCESS;
+}
@@ -0,0 +1,45 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __KINESIS_WEBRTC_LOCK_PROFILER_INCLUDE__
+#define __KINESIS_WEBRTC_LOCK_PROFILER_INCLUDE__
+
+#pragma once
+
+#ifdef __cplusplus
+extern "C"
+{
+#endif
+
+#include <com/amazonaws/kinesis/video/webrtcclient/Include.h>
+
+// Number of locks that can be profiled at the same time
+#define LOCK_PROFILER_MAX_LOCKS 8
+// Number of distinct MUTEX_LOCK call sites tracked per lock
+#define LOCK_PROFILER_MAX_SITES 32
+// Number of locks one thread can hold at the same time and still be tracked
+#define LOCK_PROFILER_MAX_HELD_LOCKS 8
+// Number of holders printed per lock in the report
+#define LOCK_PROFILER_TOP_HOLDERS 5
+#define LOCK_PROFILER_MAX_NAME_LEN 64
+#define LOCK_PROFILER_REPORT_PERIOD (60 * HUNDREDS_OF_NANOS_IN_A_SECOND)
+
+    /*
+     * Wait time, hold time and holder call site of every registered lock are recorded into histograms
+     * (metrics "lock.<name>.wait_ns" and "lock.<name>.hold_ns"). Locks which are not registered go straight
+     * to the PIC mutex functions. Recursive locking only counts the outermost acquisition.
+     */
+    VOID lockProfilerRegister(MUTEX, PCHAR);
+    VOID lockProfilerUnregister(MUTEX);
+    VOID lockProfilerLock(MUTEX, PCHAR, UINT32, PCHAR);
+    BOOL lockProfilerTryLock(MUTEX, PCHAR, UINT32, PCHAR);
+    VOID lockProfilerUnlock(MUTEX);
+    STATUS lockProfilerConditionWait(CVAR, MUTEX, UINT64, PCHAR, UINT32, PCHAR);
+    VOID lockProfilerLogReport();
+    STATUS lockProfilerReportTimerCallback(UINT32, UINT64, UINT64);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* __KINESIS_WEBRTC_LOCK_PROFILER_INCLUDE__ */
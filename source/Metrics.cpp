@@ -0,0 +1,215 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+
+LOGGER_TAG("metrics")
+
+namespace metrics
+{
+    namespace
+    {
+        std::mutex s_lock;
+        std::map<std::string, std::unique_ptr<Counter>> s_counters;
+        std::map<std::string, std::unique_ptr<Gauge>> s_gauges;
+        std::map<std::string, std::unique_ptr<Histogram>> s_histograms;
+
+        template <typename T>
+        T &lookup(std::map<std::string, std::unique_ptr<T>> &metrics, const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(s_lock);
+            std::unique_ptr<T> &metric = metrics[name];
+            if (!metric)
+            {
+                metric.reset(new T());
+            }
+            return *metric;
+        }
+
+        template <typename T>
+        T *find(std::map<std::string, std::unique_ptr<T>> &metrics, const std::string &name)
+        {
+            std::lock_guard<std::mutex> lock(s_lock);
+            auto it = metrics.find(name);
+            return it == metrics.end() ? NULL : it->second.get();
+        }
+
+        unsigned int highestBit(uint64_t value)
+        {
+            return 63 - __builtin_clzll(value);
+        }
+    } // namespace
+
+    Histogram::Histogram()
+    {
+        reset();
+    }
+
+    unsigned int Histogram::bucketIndex(uint64_t value)
+    {
+        if (value < 4)
+        {
+            return (unsigned int)value;
+        }
+        unsigned int msb = highestBit(value);
+        unsigned int sub = (unsigned int)(value >> (msb - 2)) & 3;
+        return (msb - 1) * 4 + sub;
+    }
+
+    uint64_t Histogram::bucketUpperBound(unsigned int index)
+    {
+        if (index < 4)
+        {
+            return index;
+        }
+        unsigned int msb = index / 4 + 1;
+        uint64_t sub = index % 4;
+        uint64_t lower = (4 + sub) << (msb - 2);
+        return lower + (1ULL << (msb - 2)) - 1;
+    }
+
+    void Histogram::record(uint64_t value)
+    {
+        m_buckets[bucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_count.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void Histogram::reset()
+    {
+        for (unsigned int i = 0; i < bucket_count; i++)
+        {
+            m_buckets[i].store(0, std::memory_order_relaxed);
+        }
+        m_count.store(0, std::memory_order_relaxed);
+        m_sum.store(0, std::memory_order_relaxed);
+        m_max.store(0, std::memory_order_relaxed);
+    }
+
+    uint64_t Histogram::mean() const
+    {
+        uint64_t n = count();
+        return n == 0 ? 0 : sum() / n;
+    }
+
+    uint64_t Histogram::percentile(double percent) const
+    {
+        uint64_t n = count();
+        if (n == 0)
+        {
+            return 0;
+        }
+        uint64_t rank = (uint64_t)(percent / 100.0 * (double)n);
+        if (rank >= n)
+        {
+            rank = n - 1;
+        }
+        uint64_t seen = 0;
+        for (unsigned int i = 0; i < bucket_count; i++)
+        {
+            seen += m_buckets[i].load(std::memory_order_relaxed);
+            if (seen > rank)
+            {
+                uint64_t bound = bucketUpperBound(i);
+                return bound < max() ? bound : max();
+            }
+        }
+        return max();
+    }
+
+    Counter &counter(const std::string &name)
+    {
+        return lookup(s_counters, name);
+    }
+
+    Gauge &gauge(const std::string &name)
+    {
+        return lookup(s_gauges, name);
+    }
+
+    Histogram &histogram(const std::string &name)
+    {
+        return lookup(s_histograms, name);
+    }
+
+    Counter *findCounter(const std::string &name)
+    {
+        return find(s_counters, name);
+    }
+
+    Gauge *findGauge(const std::string &name)
+    {
+        return find(s_gauges, name);
+    }
+
+    void visit(Visitor &visitor)
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        for (auto it = s_counters.begin(); it != s_counters.end(); ++it)
+        {
+            visitor.onCounter(it->first, *it->second);
+        }
+        for (auto it = s_gauges.begin(); it != s_gauges.end(); ++it)
+        {
+            visitor.onGauge(it->first, *it->second);
+        }
+        for (auto it = s_histograms.begin(); it != s_histograms.end(); ++it)
+        {
+            visitor.onHistogram(it->first, *it->second);
+        }
+    }
+
+    void writeJson(std::ostream &out)
+    {
+        struct JsonVisitor : public Visitor
+        {
+            std::ostream &out;
+            bool first;
+            explicit JsonVisitor(std::ostream &o) : out(o), first(true) {}
+            void separator()
+            {
+                out << (first ? "" : ",");
+                first = false;
+            }
+            void onCounter(const std::string &name, const Counter &counter)
+            {
+                separator();
+                out << "\"" << name << "\":" << counter.value();
+            }
+            void onGauge(const std::string &name, const Gauge &gauge)
+            {
+                separator();
+                out << "\"" << name << "\":" << gauge.value();
+            }
+            void onHistogram(const std::string &name, const Histogram &histogram)
+            {
+                separator();
+                out << "\"" << name << "\":{\"count\":" << histogram.count() << ",\"mean\":" << histogram.mean()
+                    << ",\"p50\":" << histogram.percentile(50) << ",\"p90\":" << histogram.percentile(90)
+                    << ",\"p99\":" << histogram.percentile(99) << ",\"max\":" << histogram.max() << "}";
+            }
+        } visitor(out);
+
+        out << "{";
+        visit(visitor);
+        out << "}";
+    }
+
+    void logSnapshot()
+    {
+        std::ostringstream out;
+        writeJson(out);
+        LOG_INFO("[METRICS] " << out.str());
+    }
+} // namespace metrics
@@ -0,0 +1,94 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __METRICS_H__
+#define __METRICS_H__
+
+#include <atomic>
+#include <ostream>
+#include <stdint.h>
+#include <string>
+
+/// Process wide metrics registry.
+/// Metrics are created on first lookup and live until the process exits, so callers can keep the returned
+/// reference (typically in a function local static) and update it without any locking.
+namespace metrics
+{
+    /// Monotonic counter
+    class Counter
+    {
+    public:
+        Counter() : m_value(0) {}
+        void add(uint64_t value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+        uint64_t value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<uint64_t> m_value;
+    };
+
+    /// Last value of a sampled quantity
+    class Gauge
+    {
+    public:
+        Gauge() : m_value(0) {}
+        void set(double value) { m_value.store(value, std::memory_order_relaxed); }
+        double value() const { return m_value.load(std::memory_order_relaxed); }
+
+    private:
+        std::atomic<double> m_value;
+    };
+
+    /// Lock-free log-linear histogram, four buckets per power of two (relative error below 25%)
+    class Histogram
+    {
+    public:
+        static const unsigned int bucket_count = 252;
+
+        Histogram();
+        void record(uint64_t value);
+        void reset();
+
+        uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+        uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+        uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+        uint64_t mean() const;
+        /// Upper bound of the bucket holding the given percentile (0-100)
+        uint64_t percentile(double percent) const;
+
+        static unsigned int bucketIndex(uint64_t value);
+        static uint64_t bucketUpperBound(unsigned int index);
+
+    private:
+        std::atomic<uint64_t> m_buckets[bucket_count];
+        std::atomic<uint64_t> m_count;
+        std::atomic<uint64_t> m_sum;
+        std::atomic<uint64_t> m_max;
+    };
+
+    Counter &counter(const std::string &name);
+    Gauge &gauge(const std::string &name);
+    Histogram &histogram(const std::string &name);
+
+    /// Lookup without creating, NULL when nobody recorded the metric yet
+    Counter *findCounter(const std::string &name);
+    Gauge *findGauge(const std::string &name);
+
+    /// Visit all metrics, used by the exporters
+    struct Visitor
+    {
+        virtual ~Visitor() {}
+        virtual void onCounter(const std::string &name, const Counter &counter) = 0;
+        virtual void onGauge(const std::string &name, const Gauge &gauge) = 0;
+        virtual void onHistogram(const std::string &name, const Histogram &histogram) = 0;
+    };
+    void visit(Visitor &visitor);
+
+    /// Write a JSON snapshot of every metric
+    void writeJson(std::ostream &out);
+
+    /// Log a one line summary of every metric
+    void logSnapshot();
+} // namespace metrics
+
+#endif //__METRICS_H__
@@ -0,0 +1,405 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Motion.h"
+
+#include <algorithm>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define C3_MOTION_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define C3_MOTION_SSE2
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define C3_MOTION_AVX2
+#endif
+#endif
+
+namespace motion
+{
+    extern const unsigned int block_width = 16;
+    extern const unsigned int block_height = 12;
+    extern const unsigned int background_interval = 4;
+
+    namespace
+    {
+        // All implementations round the same way: the four rows are averaged pairwise with rounding up, the four
+        // columns are summed and rounded to nearest, and the background takes three rounding averages with the frame.
+
+        inline uint8_t average(uint8_t a, uint8_t b)
+        {
+            return (uint8_t)((a + b + 1) >> 1);
+        }
+
+        void decimateScalar(const uint8_t *src, size_t stride, unsigned int width, unsigned int height, uint8_t *dst)
+        {
+            for (unsigned int y = 0; y < height; y++)
+            {
+                const uint8_t *r0 = src + 4 * y * stride;
+                const uint8_t *r1 = r0 + stride;
+                const uint8_t *r2 = r1 + stride;
+                const uint8_t *r3 = r2 + stride;
+                for (unsigned int x = 0; x < width; x++)
+                {
+                    unsigned int sum = 0;
+                    for (unsigned int i = 4 * x; i < 4 * x + 4; i++)
+                    {
+                        sum += average(average(r0[i], r1[i]), average(r2[i], r3[i]));
+                    }
+                    *dst++ = (uint8_t)((sum + 2) >> 2);
+                }
+            }
+        }
+
+        void differenceScalar(const uint8_t *current, size_t stride, uint8_t *background, unsigned int width, unsigned int blockColumns,
+                              unsigned int blockRows, bool update, uint32_t *sad)
+        {
+            for (unsigned int by = 0; by < blockRows; by++)
+            {
+                for (unsigned int bx = 0; bx < blockColumns; bx++)
+                {
+                    uint32_t sum = 0;
+                    for (unsigned int row = 0; row < block_height; row++)
+                    {
+                        const uint8_t *c = current + (by * block_height + row) * stride + bx * block_width;
+                        uint8_t *b = background + (by * block_height + row) * width + bx * block_width;
+                        for (unsigned int i = 0; i < block_width; i++)
+                        {
+                            sum += c[i] > b[i] ? c[i] - b[i] : b[i] - c[i];
+                            if (update)
+                            {
+                                b[i] = average(b[i], average(b[i], average(b[i], c[i])));
+                            }
+                        }
+                    }
+                    *sad++ = sum;
+                }
+            }
+        }
+
+#ifdef C3_MOTION_NEON
+        void decimateNeon(const uint8_t *src, size_t stride, unsigned int width, unsigned int height, uint8_t *dst)
+        {
+            for (unsigned int y = 0; y < height; y++)
+            {
+                const uint8_t *r0 = src + 4 * y * stride;
+                const uint8_t *r1 = r0 + stride;
+                const uint8_t *r2 = r1 + stride;
+                const uint8_t *r3 = r2 + stride;
+                for (unsigned int x = 0; x < 4 * width; x += 64)
+                {
+                    uint16x4_t sums[4];
+                    for (unsigned int i = 0; i < 4; i++)
+                    {
+                        unsigned int at = x + 16 * i;
+                        uint8x16_t v = vrhaddq_u8(vrhaddq_u8(vld1q_u8(r0 + at), vld1q_u8(r1 + at)),
+                                                  vrhaddq_u8(vld1q_u8(r2 + at), vld1q_u8(r3 + at)));
+                        uint16x8_t pairs = vpaddlq_u8(v);
+                        sums[i] = vpadd_u16(vget_low_u16(pairs), vget_high_u16(pairs));
+                    }
+                    uint8x8_t low = vrshrn_n_u16(vcombine_u16(sums[0], sums[1]), 2);
+                    uint8x8_t high = vrshrn_n_u16(vcombine_u16(sums[2], sums[3]), 2);
+                    vst1q_u8(dst, vcombine_u8(low, high));
+                    dst += 16;
+                }
+            }
+        }
+
+        void differenceNeon(const uint8_t *current, size_t stride, uint8_t *background, unsigned int width, unsigned int blockColumns,
+                            unsigned int blockRows, bool update, uint32_t *sad)
+        {
+            for (unsigned int by = 0; by < blockRows; by++)
+            {
+                for (unsigned int bx = 0; bx < blockColumns; bx++)
+                {
+                    uint16x8_t acc = vdupq_n_u16(0);
+                    for (unsigned int row = 0; row < block_height; row++)
+                    {
+                        size_t offset = (by * block_height + row) * width + bx * block_width;
+                        uint8x16_t c = vld1q_u8(current + (by * block_height + row) * stride + bx * block_width);
+                        uint8x16_t b = vld1q_u8(background + offset);
+                        acc = vpadalq_u8(acc, vabdq_u8(c, b));
+                        if (update)
+                        {
+                            vst1q_u8(background + offset, vrhaddq_u8(b, vrhaddq_u8(b, vrhaddq_u8(b, c))));
+                        }
+                    }
+                    uint64x2_t total = vpaddlq_u32(vpaddlq_u16(acc));
+                    *sad++ = (uint32_t)(vgetq_lane_u64(total, 0) + vgetq_lane_u64(total, 1));
+                }
+            }
+        }
+#endif
+
+#ifdef C3_MOTION_SSE2
+        /// 64 source columns of four rows into 16 decimated pixels
+        inline __m128i decimate16(const uint8_t *r0, const uint8_t *r1, const uint8_t *r2, const uint8_t *r3)
+        {
+            const __m128i lowBytes = _mm_set1_epi16(0x00ff);
+            const __m128i ones = _mm_set1_epi16(1);
+            __m128i quads[4];
+            for (unsigned int i = 0; i < 4; i++)
+            {
+                __m128i v = _mm_avg_epu8(
+                    _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(r0 + 16 * i)), _mm_loadu_si128((const __m128i *)(r1 + 16 * i))),
+                    _mm_avg_epu8(_mm_loadu_si128((const __m128i *)(r2 + 16 * i)), _mm_loadu_si128((const __m128i *)(r3 + 16 * i))));
+                __m128i pairs = _mm_add_epi16(_mm_and_si128(v, lowBytes), _mm_srli_epi16(v, 8));
+                quads[i] = _mm_madd_epi16(pairs, ones);
+            }
+            const __m128i two = _mm_set1_epi16(2);
+            __m128i low = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(quads[0], quads[1]), two), 2);
+            __m128i high = _mm_srli_epi16(_mm_add_epi16(_mm_packs_epi32(quads[2], quads[3]), two), 2);
+            return _mm_packus_epi16(low, high);
+        }
+
+        inline __m128i approach(__m128i background, __m128i frame)
+        {
+            return _mm_avg_epu8(background, _mm_avg_epu8(background, _mm_avg_epu8(background, frame)));
+        }
+
+        void decimateSse2(const uint8_t *src, size_t stride, unsigned int width, unsigned int height, uint8_t *dst)
+        {
+            for (unsigned int y = 0; y < height; y++)
+            {
+                const uint8_t *r0 = src + 4 * y * stride;
+                for (unsigned int x = 0; x < 4 * width; x += 64)
+                {
+                    _mm_storeu_si128((__m128i *)dst, decimate16(r0 + x, r0 + stride + x, r0 + 2 * stride + x, r0 + 3 * stride + x));
+                    dst += 16;
+                }
+            }
+        }
+
+        /// One block of 16 columns, the sum of absolute differences is left in both 64 bit halves
+        inline __m128i difference16(const uint8_t *current, size_t stride, uint8_t *background, unsigned int width, bool update)
+        {
+            __m128i acc = _mm_setzero_si128();
+            for (unsigned int row = 0; row < block_height; row++)
+            {
+                __m128i c = _mm_loadu_si128((const __m128i *)(current + row * stride));
+                __m128i b = _mm_loadu_si128((const __m128i *)(background + row * width));
+                acc = _mm_add_epi64(acc, _mm_sad_epu8(c, b));
+                if (update)
+                {
+                    _mm_storeu_si128((__m128i *)(background + row * width), approach(b, c));
+                }
+            }
+            return acc;
+        }
+
+        void differenceSse2(const uint8_t *current, size_t stride, uint8_t *background, unsigned int width, unsigned int blockColumns,
+                            unsigned int blockRows, bool update, uint32_t *sad)
+        {
+            for (unsigned int by = 0; by < blockRows; by++)
+            {
+                for (unsigned int bx = 0; bx < blockColumns; bx++)
+                {
+                    __m128i acc = difference16(current + by * block_height * stride + bx * block_width, stride,
+                                               background + by * block_height * width + bx * block_width, width, update);
+                    *sad++ = (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+                }
+            }
+        }
+#endif
+
+#ifdef C3_MOTION_AVX2
+        __attribute__((target("avx2"))) void decimateAvx2(const uint8_t *src, size_t stride, unsigned int width, unsigned int height,
+                                                          uint8_t *dst)
+        {
+            const __m256i lowBytes = _mm256_set1_epi16(0x00ff);
+            const __m256i ones = _mm256_set1_epi16(1);
+            const __m256i two = _mm256_set1_epi16(2);
+            for (unsigned int y = 0; y < height; y++)
+            {
+                const uint8_t *r0 = src + 4 * y * stride;
+                const uint8_t *r1 = r0 + stride;
+                const uint8_t *r2 = r1 + stride;
+                const uint8_t *r3 = r2 + stride;
+                unsigned int x = 0;
+                for (; x + 128 <= 4 * width; x += 128)
+                {
+                    __m256i quads[4];
+                    for (unsigned int i = 0; i < 4; i++)
+                    {
+                        unsigned int at = x + 32 * i;
+                        __m256i v = _mm256_avg_epu8(
+                            _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(r0 + at)), _mm256_loadu_si256((const __m256i *)(r1 + at))),
+                            _mm256_avg_epu8(_mm256_loadu_si256((const __m256i *)(r2 + at)), _mm256_loadu_si256((const __m256i *)(r3 + at))));
+                        __m256i pairs = _mm256_add_epi16(_mm256_and_si256(v, lowBytes), _mm256_srli_epi16(v, 8));
+                        quads[i] = _mm256_madd_epi16(pairs, ones);
+                    }
+                    // packs works within 128 bit lanes, the permutes put the 64 bit groups back in order
+                    __m256i low = _mm256_permute4x64_epi64(_mm256_packs_epi32(quads[0], quads[1]), _MM_SHUFFLE(3, 1, 2, 0));
+                    __m256i high = _mm256_permute4x64_epi64(_mm256_packs_epi32(quads[2], quads[3]), _MM_SHUFFLE(3, 1, 2, 0));
+                    low = _mm256_srli_epi16(_mm256_add_epi16(low, two), 2);
+                    high = _mm256_srli_epi16(_mm256_add_epi16(high, two), 2);
+                    __m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), _MM_SHUFFLE(3, 1, 2, 0));
+                    _mm256_storeu_si256((__m256i *)dst, packed);
+                    dst += 32;
+                }
+                for (; x < 4 * width; x += 64)
+                {
+                    _mm_storeu_si128((__m128i *)dst, decimate16(r0 + x, r1 + x, r2 + x, r3 + x));
+                    dst += 16;
+                }
+            }
+        }
+
+        __attribute__((target("avx2"))) void differenceAvx2(const uint8_t *current, size_t stride, uint8_t *background, unsigned int width,
+                                                            unsigned int blockColumns, unsigned int blockRows, bool update, uint32_t *sad)
+        {
+            for (unsigned int by = 0; by < blockRows; by++)
+            {
+                unsigned int bx = 0;
+                // two neighbouring blocks per register
+                for (; bx + 2 <= blockColumns; bx += 2)
+                {
+                    size_t offset = by * block_height * width + bx * block_width;
+                    const uint8_t *c0 = current + by * block_height * stride + bx * block_width;
+                    __m256i acc = _mm256_setzero_si256();
+                    for (unsigned int row = 0; row < block_height; row++)
+                    {
+                        __m256i c = _mm256_loadu_si256((const __m256i *)(c0 + row * stride));
+                        __m256i b = _mm256_loadu_si256((const __m256i *)(background + offset + row * width));
+                        acc = _mm256_add_epi64(acc, _mm256_sad_epu8(c, b));
+                        if (update)
+                        {
+                            __m256i moved = _mm256_avg_epu8(b, _mm256_avg_epu8(b, _mm256_avg_epu8(b, c)));
+                            _mm256_storeu_si256((__m256i *)(background + offset + row * width), moved);
+                        }
+                    }
+                    *sad++ = (uint32_t)(_mm256_extract_epi64(acc, 0) + _mm256_extract_epi64(acc, 1));
+                    *sad++ = (uint32_t)(_mm256_extract_epi64(acc, 2) + _mm256_extract_epi64(acc, 3));
+                }
+                for (; bx < blockColumns; bx++)
+                {
+                    __m128i acc = difference16(current + by * block_height * stride + bx * block_width, stride,
+                                               background + by * block_height * width + bx * block_width, width, update);
+                    *sad++ = (uint32_t)(_mm_cvtsi128_si32(acc) + _mm_cvtsi128_si32(_mm_srli_si128(acc, 8)));
+                }
+            }
+        }
+
+        bool hasAvx2()
+        {
+            static const bool supported = __builtin_cpu_supports("avx2");
+            return supported;
+        }
+#endif
+    } // namespace
+
+    const char *simdName()
+    {
+#if defined(C3_MOTION_NEON)
+        return "neon";
+#elif defined(C3_MOTION_AVX2)
+        return hasAvx2() ? "avx2" : "sse2";
+#elif defined(C3_MOTION_SSE2)
+        return "sse2";
+#else
+        return "none";
+#endif
+    }
+
+    Detector::Detector(unsigned int width, unsigned int height, unsigned int decimation, Implementation implementation)
+        : m_decimation(decimation), m_width(0), m_height(0), m_blockColumns(0), m_blockRows(0), m_sadThreshold(0), m_frames(0),
+          m_decimate(decimateScalar), m_difference(differenceScalar)
+    {
+        // the SIMD kernels decimate 64 source columns at a time and blocks never straddle the edges
+        if ((decimation != 1 && decimation != 4) || width == 0 || height == 0 || (decimation == 4 && width % 64 != 0) ||
+            width % (decimation * block_width) != 0 || height % (decimation * block_height) != 0)
+        {
+            return;
+        }
+        m_width = width / decimation;
+        m_height = height / decimation;
+        m_blockColumns = m_width / block_width;
+        m_blockRows = m_height / block_height;
+        if (decimation != 1)
+        {
+            m_current.resize(m_width * m_height);
+        }
+        m_background.resize(m_width * m_height);
+        m_sad.resize(m_blockColumns * m_blockRows);
+        setThreshold(12);
+
+        if (implementation == IMPL_SIMD)
+        {
+#if defined(C3_MOTION_NEON)
+            m_decimate = decimateNeon;
+            m_difference = differenceNeon;
+#elif defined(C3_MOTION_SSE2)
+            m_decimate = decimateSse2;
+            m_difference = differenceSse2;
+#if defined(C3_MOTION_AVX2)
+            if (hasAvx2())
+            {
+                m_decimate = decimateAvx2;
+                m_difference = differenceAvx2;
+            }
+#endif
+#endif
+        }
+    }
+
+    void Detector::setThreshold(unsigned int meanDifference)
+    {
+        m_sadThreshold = meanDifference * block_width * block_height;
+    }
+
+    void Detector::process(const uint8_t *luma, size_t stride, Result &result)
+    {
+        result.movingBlocks = 0;
+        result.score = 0;
+        result.region.x = result.region.y = result.region.width = result.region.height = 0;
+        if (!valid())
+        {
+            return;
+        }
+
+        const uint8_t *current = luma;
+        if (m_decimation != 1)
+        {
+            m_decimate(luma, stride, m_width, m_height, m_current.data());
+            current = m_current.data();
+            stride = m_width;
+        }
+        if (m_frames++ == 0)
+        {
+            // the first frame is the background
+            for (unsigned int y = 0; y < m_height; y++)
+            {
+                std::copy(current + y * stride, current + y * stride + m_width, m_background.begin() + y * m_width);
+            }
+        }
+        m_difference(current, stride, m_background.data(), m_width, m_blockColumns, m_blockRows, m_frames % background_interval == 0,
+                     m_sad.data());
+
+        unsigned int left = m_blockColumns, top = m_blockRows, right = 0, bottom = 0;
+        for (unsigned int by = 0; by < m_blockRows; by++)
+        {
+            for (unsigned int bx = 0; bx < m_blockColumns; bx++)
+            {
+                if (m_sad[by * m_blockColumns + bx] > m_sadThreshold)
+                {
+                    result.movingBlocks++;
+                    left = std::min(left, bx);
+                    right = std::max(right, bx + 1);
+                    top = std::min(top, by);
+                    bottom = std::max(bottom, by + 1);
+                }
+            }
+        }
+        if (result.movingBlocks != 0)
+        {
+            result.score = (float)result.movingBlocks / (m_blockColumns * m_blockRows);
+            result.region.x = (float)left / m_blockColumns;
+            result.region.y = (float)top / m_blockRows;
+            result.region.width = (float)(right - left) / m_blockColumns;
+            result.region.height = (float)(bottom - top) / m_blockRows;
+        }
+    }
+} // namespace motion
@@ -0,0 +1,91 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __MOTION_H__
+#define __MOTION_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/// Motion detection on the luma plane of the raw frames.
+/// A full resolution plane is decimated by 4 in both directions (4x4 box average), a plane which is small already, like
+/// the analytics substream, is read in place. The plane is split into blocks of 16x12 pixels and every block is
+/// compared to a running background by its sum of absolute differences. The background moves an eighth
+/// of the way towards the frame every background_interval frames. The kernels use NEON on ARM, AVX2 or SSE2 on x86,
+/// and a scalar reference which gives bit-identical results.
+namespace motion
+{
+    extern const unsigned int block_width;
+    extern const unsigned int block_height;
+    extern const unsigned int background_interval;
+
+    enum Implementation
+    {
+        IMPL_SCALAR,
+        IMPL_SIMD,
+    };
+
+    /// Instruction set used by IMPL_SIMD on this machine
+    const char *simdName();
+
+    /// Bounding box of the moving blocks, 0~1 of the frame from the top left corner
+    struct Region
+    {
+        float x, y, width, height;
+    };
+
+    struct Result
+    {
+        unsigned int movingBlocks;
+        float score; // fraction of the blocks which moved
+        Region region;
+    };
+
+    class Detector
+    {
+    public:
+        /// Frame size in pixels and decimation, 1 or 4. The decimated width must be a multiple of 16 and the height of
+        /// 12, decimating by 4 also needs a width which is a multiple of 64.
+        Detector(unsigned int width, unsigned int height, unsigned int decimation, Implementation implementation = IMPL_SIMD);
+
+        bool valid() const { return m_blockColumns != 0; }
+
+        /// Mean absolute luma difference above which a block counts as moving
+        void setThreshold(unsigned int meanDifference);
+
+        /// The next frame becomes the background
+        void reset() { m_frames = 0; }
+
+        /// Analyse the luma plane of one frame, never allocates
+        void process(const uint8_t *luma, size_t stride, Result &result);
+
+        /// Decimated plane, empty without decimation, background and per-block differences of the last frame
+        const std::vector<uint8_t> &decimated() const { return m_current; }
+        const std::vector<uint8_t> &background() const { return m_background; }
+        const std::vector<uint32_t> &differences() const { return m_sad; }
+        unsigned int blockColumns() const { return m_blockColumns; }
+        unsigned int blockRows() const { return m_blockRows; }
+
+    private:
+        typedef void (*DecimateFunction)(const uint8_t *src, size_t stride, unsigned int width, unsigned int height, uint8_t *dst);
+        typedef void (*DifferenceFunction)(const uint8_t *current, size_t stride, uint8_t *background, unsigned int width,
+                                           unsigned int blockColumns, unsigned int blockRows, bool update, uint32_t *sad);
+
+        unsigned int m_decimation;
+        unsigned int m_width;
+        unsigned int m_height;
+        unsigned int m_blockColumns;
+        unsigned int m_blockRows;
+        uint32_t m_sadThreshold;
+        unsigned int m_frames;
+        DecimateFunction m_decimate;
+        DifferenceFunction m_difference;
+        std::vector<uint8_t> m_current;
+        std::vector<uint8_t> m_background;
+        std::vector<uint32_t> m_sad;
+    };
+} // namespace motion
+
+#endif //__MOTION_H__
@@ -0,0 +1,750 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Nvr.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+LOGGER_TAG("nvr")
+
+namespace nvr
+{
+    // the erase block of SD cards is much larger, but their controllers write in pages of 4 to 16 kB
+    extern const size_t block_size = 16 * 1024;
+    extern const size_t batch_size = 256 * 1024;
+    extern const uint64_t flush_interval_ms = 5000;
+    // the offsets of the index are 32 bit
+    extern const uint64_t max_segment_bytes = 1024ull * 1024 * 1024;
+
+    namespace
+    {
+        const char *const segment_suffix = ".mkv";
+        const char *const index_suffix = ".idx";
+        const char *const writing_app = "c3-camera-producer";
+
+        // Matroska elements
+        const uint32_t id_ebml = 0x1A45DFA3;
+        const uint32_t id_ebml_version = 0x4286;
+        const uint32_t id_ebml_read_version = 0x42F7;
+        const uint32_t id_ebml_max_id_length = 0x42F2;
+        const uint32_t id_ebml_max_size_length = 0x42F3;
+        const uint32_t id_doc_type = 0x4282;
+        const uint32_t id_doc_type_version = 0x4287;
+        const uint32_t id_doc_type_read_version = 0x4285;
+        const uint32_t id_segment = 0x18538067;
+        const uint32_t id_info = 0x1549A966;
+        const uint32_t id_timestamp_scale = 0x2AD7B1;
+        const uint32_t id_muxing_app = 0x4D80;
+        const uint32_t id_writing_app = 0x5741;
+        const uint32_t id_date_utc = 0x4461;
+        const uint32_t id_tracks = 0x1654AE6B;
+        const uint32_t id_track_entry = 0xAE;
+        const uint32_t id_track_number = 0xD7;
+        const uint32_t id_track_uid = 0x73C5;
+        const uint32_t id_track_type = 0x83;
+        const uint32_t id_flag_lacing = 0x9C;
+        const uint32_t id_codec_id = 0x86;
+        const uint32_t id_codec_private = 0x63A2;
+        const uint32_t id_video = 0xE0;
+        const uint32_t id_pixel_width = 0xB0;
+        const uint32_t id_pixel_height = 0xBA;
+        const uint32_t id_cluster = 0x1F43B675;
+        const uint32_t id_cluster_timestamp = 0xE7;
+        const uint32_t id_simple_block = 0xA3;
+
+        const uint64_t unknown_size = 0x01FFFFFFFFFFFFFFull;
+        const uint8_t block_keyframe = 0x80;
+        // block times are 16 bit relative to their cluster
+        const uint64_t max_block_offset_ms = 32767;
+        // DateUTC counts from 2001-01-01
+        const int64_t matroska_epoch_s = 978307200;
+
+        void putId(std::vector<uint8_t> &out, uint32_t id)
+        {
+            int bytes = id > 0xFFFFFF ? 4 : id > 0xFFFF ? 3 : id > 0xFF ? 2 : 1;
+            for (int i = bytes - 1; i >= 0; i--)
+            {
+                out.push_back((uint8_t)(id >> (8 * i)));
+            }
+        }
+
+        void putSize(std::vector<uint8_t> &out, uint64_t size)
+        {
+            if (size == unknown_size)
+            {
+                out.push_back(0x01);
+                out.insert(out.end(), 7, 0xFF);
+                return;
+            }
+            int bytes = 1;
+            while (bytes < 8 && size >= (1ull << (7 * bytes)) - 1)
+            {
+                bytes++;
+            }
+            uint64_t coded = size | (1ull << (7 * bytes));
+            for (int i = bytes - 1; i >= 0; i--)
+            {
+                out.push_back((uint8_t)(coded >> (8 * i)));
+            }
+        }
+
+        void putBinary(std::vector<uint8_t> &out, uint32_t id, const void *data, size_t size)
+        {
+            putId(out, id);
+            putSize(out, size);
+            out.insert(out.end(), (const uint8_t *)data, (const uint8_t *)data + size);
+        }
+
+        void putString(std::vector<uint8_t> &out, uint32_t id, const std::string &value)
+        {
+            putBinary(out, id, value.data(), value.size());
+        }
+
+        void putUint(std::vector<uint8_t> &out, uint32_t id, uint64_t value, int bytes = 0)
+        {
+            if (bytes == 0)
+            {
+                bytes = 1;
+                while (bytes < 8 && value >> (8 * bytes) != 0)
+                {
+                    bytes++;
+                }
+            }
+            putId(out, id);
+            putSize(out, bytes);
+            for (int i = bytes - 1; i >= 0; i--)
+            {
+                out.push_back((uint8_t)(value >> (8 * i)));
+            }
+        }
+
+        void putMaster(std::vector<uint8_t> &out, uint32_t id, const std::vector<uint8_t> &children)
+        {
+            putBinary(out, id, children.data(), children.size());
+        }
+
+        /// EBML header, Segment of unknown size, Info and Tracks
+        std::vector<uint8_t> segmentHeader(const Track &track, uint64_t startMs)
+        {
+            std::vector<uint8_t> out, ebml, info, entry, video, tracks;
+            putUint(ebml, id_ebml_version, 1);
+            putUint(ebml, id_ebml_read_version, 1);
+            putUint(ebml, id_ebml_max_id_length, 4);
+            putUint(ebml, id_ebml_max_size_length, 8);
+            putString(ebml, id_doc_type, "matroska");
+            putUint(ebml, id_doc_type_version, 4);
+            putUint(ebml, id_doc_type_read_version, 2);
+            putMaster(out, id_ebml, ebml);
+
+            // sizes stay unknown, the segment is playable however far it got
+            putId(out, id_segment);
+            putSize(out, unknown_size);
+
+            putUint(info, id_timestamp_scale, 1000000);
+            putString(info, id_muxing_app, writing_app);
+            putString(info, id_writing_app, writing_app);
+            putUint(info, id_date_utc, (uint64_t)(((int64_t)startMs - matroska_epoch_s * 1000) * 1000000), 8);
+            putMaster(out, id_info, info);
+
+            putUint(video, id_pixel_width, track.width);
+            putUint(video, id_pixel_height, track.height);
+            putUint(entry, id_track_number, 1);
+            putUint(entry, id_track_uid, 1);
+            putUint(entry, id_track_type, 1);
+            putUint(entry, id_flag_lacing, 0);
+            putString(entry, id_codec_id, "V_MPEG4/ISO/AVC");
+            putString(entry, id_codec_private, track.codecPrivate);
+            putMaster(entry, id_video, video);
+            putMaster(tracks, id_track_entry, entry);
+            putMaster(out, id_tracks, tracks);
+            return out;
+        }
+
+        /// Element header at data, false when it is not complete or not valid
+        bool parseElement(const uint8_t *data, size_t available, uint32_t &id, uint64_t &size, size_t &headerLength)
+        {
+            if (available == 0 || data[0] < 0x10)
+            {
+                return false;
+            }
+            size_t idLength = data[0] >= 0x80 ? 1 : data[0] >= 0x40 ? 2 : data[0] >= 0x20 ? 3 : 4;
+            if (available <= idLength || data[idLength] == 0)
+            {
+                return false;
+            }
+            id = 0;
+            for (size_t i = 0; i < idLength; i++)
+            {
+                id = id << 8 | data[i];
+            }
+            size_t sizeLength = 1;
+            while ((data[idLength] & (0x80 >> (sizeLength - 1))) == 0)
+            {
+                sizeLength++;
+            }
+            if (available < idLength + sizeLength)
+            {
+                return false;
+            }
+            size = data[idLength] & (0xFF >> sizeLength);
+            bool unknown = size == (0xFFu >> sizeLength);
+            for (size_t i = 1; i < sizeLength; i++)
+            {
+                size = size << 8 | data[idLength + i];
+                unknown = unknown && data[idLength + i] == 0xFF;
+            }
+            if (unknown)
+            {
+                size = unknown_size;
+            }
+            headerLength = idLength + sizeLength;
+            return true;
+        }
+
+        bool writeAll(int fd, const uint8_t *data, size_t size)
+        {
+            while (size > 0)
+            {
+                ssize_t written = write(fd, data, size);
+                if (written < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (written <= 0)
+                {
+                    return false;
+                }
+                data += written;
+                size -= written;
+            }
+            return true;
+        }
+
+        bool readAll(int fd, uint8_t *data, size_t size, uint64_t offset)
+        {
+            while (size > 0)
+            {
+                ssize_t got = pread(fd, data, size, offset);
+                if (got < 0 && errno == EINTR)
+                {
+                    continue;
+                }
+                if (got <= 0)
+                {
+                    return false;
+                }
+                data += got;
+                size -= got;
+                offset += got;
+            }
+            return true;
+        }
+
+        uint64_t realtimeNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+        }
+
+        bool sameTrack(const Track &a, const Track &b)
+        {
+            return a.width == b.width && a.height == b.height && a.codecPrivate == b.codecPrivate;
+        }
+
+        bool startsBefore(uint64_t timeMs, const Entry &entry)
+        {
+            return timeMs < entry.timeMs;
+        }
+    } // namespace
+
+    Archive::Archive(const std::string &directory, uint64_t quotaBytes, uint64_t segmentMs)
+        : m_directory(directory), m_quotaBytes(quotaBytes), m_segmentMs(std::max((uint64_t)1000, segmentMs)), m_anchorPts(0),
+          m_anchorEpochNs(0), m_lastPts(0), m_clusterMs(0), m_flushedAtMs(0), m_fd(-1), m_written(0), m_gopOpen(false), m_usedBytes(0)
+    {
+        m_track.width = 0;
+        m_track.height = 0;
+        m_pending.reserve(batch_size + block_size);
+    }
+
+    Archive::~Archive()
+    {
+        close();
+    }
+
+    std::string Archive::segmentPath(uint64_t startMs) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%013llu", (unsigned long long)startMs);
+        return m_directory + name + segment_suffix;
+    }
+
+    std::string Archive::indexPath(uint64_t startMs) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%013llu", (unsigned long long)startMs);
+        return m_directory + name + index_suffix;
+    }
+
+    bool Archive::open()
+    {
+        if (mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            LOG_ERROR("[NVR] Cannot create " << m_directory << ": " << strerror(errno));
+            return false;
+        }
+        DIR *dir = opendir(m_directory.c_str());
+        if (dir == NULL)
+        {
+            LOG_ERROR("[NVR] Cannot open " << m_directory << ": " << strerror(errno));
+            return false;
+        }
+        std::vector<uint64_t> starts;
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            std::string name = entry->d_name;
+            size_t suffix = name.size() > strlen(segment_suffix) ? name.size() - strlen(segment_suffix) : 0;
+            if (suffix != 0 && name.compare(suffix, std::string::npos, segment_suffix) == 0)
+            {
+                starts.push_back(strtoull(name.c_str(), NULL, 10));
+            }
+        }
+        closedir(dir);
+        std::sort(starts.begin(), starts.end());
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        size_t recovered = 0;
+        for (size_t i = 0; i < starts.size(); i++)
+        {
+            Segment segment;
+            segment.startMs = starts[i];
+            struct stat media, index;
+            if (stat(segmentPath(segment.startMs).c_str(), &media) != 0)
+            {
+                continue;
+            }
+            int fd = ::open(indexPath(segment.startMs).c_str(), O_RDONLY);
+            if (fd >= 0 && fstat(fd, &index) == 0 && index.st_size > 0 && index.st_size % sizeof(Entry) == 0)
+            {
+                segment.index.resize(index.st_size / sizeof(Entry));
+                if (!readAll(fd, (uint8_t *)&segment.index[0], index.st_size, 0))
+                {
+                    segment.index.clear();
+                }
+            }
+            if (fd >= 0)
+            {
+                ::close(fd);
+            }
+            // the index is written when a segment is closed, after a power cut it is rebuilt from the clusters
+            if (segment.index.empty())
+            {
+                if (!recover(segment))
+                {
+                    continue;
+                }
+                recovered++;
+            }
+            else
+            {
+                segment.bytes = media.st_size + segment.index.size() * sizeof(Entry);
+            }
+            m_usedBytes += segment.bytes;
+            m_segments.push_back(segment);
+        }
+        while (m_usedBytes > m_quotaBytes && !m_segments.empty())
+        {
+            dropOldest();
+        }
+        updateUsage();
+        LOG_INFO("[NVR] " << m_segments.size() << " segments, " << m_usedBytes / (1024 * 1024) << " of " << m_quotaBytes / (1024 * 1024)
+                          << " MB in " << m_directory << (recovered != 0 ? ", rebuilt the index of an unclosed segment" : ""));
+        return true;
+    }
+
+    bool Archive::recover(Segment &segment)
+    {
+        std::string path = segmentPath(segment.startMs);
+        int fd = ::open(path.c_str(), O_RDWR);
+        struct stat info;
+        if (fd < 0 || fstat(fd, &info) != 0)
+        {
+            if (fd >= 0)
+                ::close(fd);
+            return false;
+        }
+
+        // walk the elements, Segment and Cluster are entered, everything else is skipped
+        uint64_t offset = 0, valid = 0, clusterOffset = 0, clusterMs = 0;
+        uint8_t head[16];
+        while (offset < (uint64_t)info.st_size)
+        {
+            size_t available = (size_t)std::min((uint64_t)sizeof(head), (uint64_t)info.st_size - offset);
+            uint32_t id;
+            uint64_t size;
+            size_t headerLength;
+            if (!readAll(fd, head, available, offset) || !parseElement(head, available, id, size, headerLength))
+            {
+                break;
+            }
+            if (id == id_segment || id == id_cluster)
+            {
+                if (id == id_cluster)
+                {
+                    clusterOffset = offset;
+                }
+                offset += headerLength;
+                valid = offset;
+                continue;
+            }
+            if (size == unknown_size || offset + headerLength + size > (uint64_t)info.st_size)
+            {
+                // torn by the power cut
+                break;
+            }
+            if (id == id_cluster_timestamp && size <= 8 && headerLength + size <= available)
+            {
+                clusterMs = 0;
+                for (size_t i = 0; i < size; i++)
+                {
+                    clusterMs = clusterMs << 8 | head[headerLength + i];
+                }
+            }
+            else if (id == id_simple_block && size >= 4 && headerLength + 4 <= available && (head[headerLength + 3] & block_keyframe) != 0)
+            {
+                int16_t relative = (int16_t)(head[headerLength + 1] << 8 | head[headerLength + 2]);
+                Entry entry;
+                entry.timeMs = segment.startMs + clusterMs + relative;
+                entry.offset = (uint32_t)clusterOffset;
+                entry.size = 0;
+                segment.index.push_back(entry);
+            }
+            offset += headerLength + size;
+            valid = offset;
+        }
+        // a GOP ends where the next one starts, the last one at the last complete element
+        for (size_t i = 0; i < segment.index.size(); i++)
+        {
+            uint64_t end = i + 1 < segment.index.size() ? segment.index[i + 1].offset : valid;
+            segment.index[i].size = (uint32_t)(end - segment.index[i].offset);
+        }
+
+        bool usable = !segment.index.empty() && ftruncate(fd, valid) == 0;
+        ::close(fd);
+        if (!usable)
+        {
+            LOG_ERROR("[NVR] Discarding unreadable " << path);
+            unlink(path.c_str());
+            unlink(indexPath(segment.startMs).c_str());
+            return false;
+        }
+        fd = ::open(indexPath(segment.startMs).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd >= 0)
+        {
+            writeAll(fd, (const uint8_t *)&segment.index[0], segment.index.size() * sizeof(Entry));
+            ::close(fd);
+        }
+        segment.bytes = valid + segment.index.size() * sizeof(Entry);
+        LOG_WARN("[NVR] Rebuilt the index of " << path << ", " << segment.index.size() << " GOPs");
+        return true;
+    }
+
+    bool Archive::create(const Track &track, uint64_t timeMs)
+    {
+        std::string path = segmentPath(timeMs);
+        int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            LOG_ERROR("[NVR] Cannot create " << path << ": " << strerror(errno));
+            return false;
+        }
+        // reserve about what the previous segment took, so the card gets long runs of blocks
+        if (!m_segments.empty())
+        {
+            uint64_t expected = std::min(m_segments.back().bytes, max_segment_bytes);
+            fallocate(fd, FALLOC_FL_KEEP_SIZE, 0, (off_t)expected);
+        }
+
+        Segment segment;
+        segment.startMs = timeMs;
+        segment.bytes = 0;
+        m_segments.push_back(segment);
+        m_fd = fd;
+        m_written = 0;
+        m_track = track;
+        std::vector<uint8_t> header = segmentHeader(track, timeMs);
+        m_pending.assign(header.begin(), header.end());
+        m_gopOpen = false;
+        m_clusterMs = timeMs;
+        m_flushedAtMs = timeMs;
+        return true;
+    }
+
+    bool Archive::append(const Track &track, uint64_t ptsNs, bool keyframe, const uint8_t *data, size_t size)
+    {
+        static metrics::Counter &frames = metrics::counter("nvr.frames");
+        static metrics::Counter &dropped = metrics::counter("nvr.dropped_frames");
+
+        // capture time: the pipeline clock keeps the spacing, the wall clock is read once per pipeline
+        if (m_anchorEpochNs == 0 || ptsNs < m_lastPts)
+        {
+            m_anchorPts = ptsNs;
+            m_anchorEpochNs = realtimeNs();
+        }
+        m_lastPts = ptsNs;
+        uint64_t timeMs = (m_anchorEpochNs + (ptsNs - m_anchorPts)) / 1000000;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_fd >= 0 && keyframe)
+        {
+            uint64_t length = m_written + m_pending.size();
+            uint64_t longest = std::min(max_segment_bytes, std::max((uint64_t)batch_size, m_quotaBytes / 4));
+            if (timeMs >= m_segments.back().startMs + m_segmentMs || length >= longest || !sameTrack(track, m_track))
+            {
+                seal();
+            }
+        }
+        if (m_fd < 0 && (!keyframe || track.codecPrivate.empty() || !create(track, timeMs)))
+        {
+            dropped.add();
+            return false;
+        }
+
+        // times never go back within a segment, the wall clock is read again when the pipeline restarts
+        timeMs = std::max(timeMs, m_clusterMs);
+        if (keyframe || timeMs - m_clusterMs > max_block_offset_ms)
+        {
+            uint64_t offset = m_written + m_pending.size();
+            if (keyframe)
+            {
+                endGop();
+                Entry entry;
+                entry.timeMs = timeMs;
+                entry.offset = (uint32_t)offset;
+                entry.size = 0;
+                m_segments.back().index.push_back(entry);
+                m_gopOpen = true;
+            }
+            // every GOP is a cluster, a long one is split where the block times would overflow
+            m_clusterMs = timeMs;
+            putId(m_pending, id_cluster);
+            putSize(m_pending, unknown_size);
+            putUint(m_pending, id_cluster_timestamp, timeMs - m_segments.back().startMs);
+        }
+        uint16_t relative = (uint16_t)(timeMs - m_clusterMs);
+        putId(m_pending, id_simple_block);
+        putSize(m_pending, 4 + size);
+        m_pending.push_back(0x81); // track 1
+        m_pending.push_back((uint8_t)(relative >> 8));
+        m_pending.push_back((uint8_t)relative);
+        m_pending.push_back(keyframe ? block_keyframe : 0);
+        m_pending.insert(m_pending.end(), data, data + size);
+        frames.add();
+
+        if (m_pending.size() >= batch_size || timeMs >= m_flushedAtMs + flush_interval_ms)
+        {
+            m_flushedAtMs = timeMs;
+            flush(false);
+        }
+        return true;
+    }
+
+    void Archive::endGop()
+    {
+        if (m_gopOpen)
+        {
+            Entry &last = m_segments.back().index.back();
+            last.size = (uint32_t)(m_written + m_pending.size() - last.offset);
+            m_gopOpen = false;
+        }
+    }
+
+    void Archive::flush(bool all)
+    {
+        static metrics::Counter &writes = metrics::counter("nvr.writes");
+        static metrics::Counter &writtenBytes = metrics::counter("nvr.written_bytes");
+
+        // whole blocks only, the rest waits for more data, so no block is written twice
+        size_t length = all ? m_pending.size() : m_pending.size() / block_size * block_size;
+        if (m_fd < 0 || length == 0)
+        {
+            return;
+        }
+        if (!writeAll(m_fd, &m_pending[0], length))
+        {
+            LOG_ERROR("[NVR] Cannot write " << segmentPath(m_segments.back().startMs) << ": " << strerror(errno));
+            // keep what made it to the card, its index is rebuilt by the next open()
+            Segment &segment = m_segments.back();
+            while (!segment.index.empty() && (segment.index.back().size == 0 || segment.index.back().offset + segment.index.back().size > m_written))
+            {
+                segment.index.pop_back();
+            }
+            m_pending.clear();
+            m_gopOpen = false;
+            ::close(m_fd);
+            m_fd = -1;
+            segment.bytes = m_written;
+            m_usedBytes += m_written;
+            m_written = 0;
+            updateUsage();
+            return;
+        }
+        m_pending.erase(m_pending.begin(), m_pending.begin() + length);
+        m_written += length;
+        writes.add();
+        writtenBytes.add(length);
+
+        // ring: the oldest segments make room for the one being recorded
+        while (m_usedBytes + m_written > m_quotaBytes && m_segments.size() > 1)
+        {
+            dropOldest();
+        }
+        updateUsage();
+    }
+
+    void Archive::seal()
+    {
+        if (m_fd < 0)
+        {
+            return;
+        }
+        endGop();
+        flush(true);
+        if (m_fd < 0)
+        {
+            return;
+        }
+        Segment &segment = m_segments.back();
+        // give back what was reserved beyond the end
+        if (ftruncate(m_fd, m_written) != 0 || fdatasync(m_fd) != 0)
+        {
+            LOG_WARN("[NVR] Cannot finish " << segmentPath(segment.startMs) << ": " << strerror(errno));
+        }
+        ::close(m_fd);
+        m_fd = -1;
+
+        int fd = ::open(indexPath(segment.startMs).c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0 || segment.index.empty() || !writeAll(fd, (const uint8_t *)&segment.index[0], segment.index.size() * sizeof(Entry)))
+        {
+            LOG_ERROR("[NVR] Cannot write the index of " << segmentPath(segment.startMs));
+        }
+        if (fd >= 0)
+        {
+            ::close(fd);
+        }
+        segment.bytes = m_written + segment.index.size() * sizeof(Entry);
+        m_usedBytes += segment.bytes;
+        m_written = 0;
+        updateUsage();
+    }
+
+    void Archive::close()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        seal();
+        // the next pipeline reads the wall clock again
+        m_anchorEpochNs = 0;
+    }
+
+    void Archive::dropOldest()
+    {
+        static metrics::Counter &droppedSegments = metrics::counter("nvr.dropped_segments");
+        Segment &oldest = m_segments.front();
+        unlink(segmentPath(oldest.startMs).c_str());
+        unlink(indexPath(oldest.startMs).c_str());
+        LOG_INFO("[NVR] Quota reached, dropped " << segmentPath(oldest.startMs));
+        m_usedBytes -= std::min(m_usedBytes, oldest.bytes);
+        m_segments.pop_front();
+        droppedSegments.add();
+    }
+
+    void Archive::updateUsage()
+    {
+        metrics::gauge("nvr.used_bytes").set((double)(m_usedBytes + m_written));
+    }
+
+    bool Archive::locate(uint64_t timeMs, Span &span)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        // the last segment and then the last GOP starting at or before the time
+        size_t segment = m_segments.size();
+        while (segment > 0 && m_segments[segment - 1].startMs > timeMs)
+        {
+            segment--;
+        }
+        if (segment == 0)
+        {
+            return false;
+        }
+        const Segment &found = m_segments[segment - 1];
+        std::vector<Entry>::const_iterator entry = std::upper_bound(found.index.begin(), found.index.end(), timeMs, startsBefore);
+        if (entry == found.index.begin() || (entry - 1)->size == 0)
+        {
+            return false;
+        }
+        --entry;
+        span.path = segmentPath(found.startMs);
+        span.timeMs = entry->timeMs;
+        span.offset = entry->offset;
+        span.size = entry->size;
+        return true;
+    }
+
+    bool Archive::read(const Span &span, std::vector<uint8_t> &data)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        data.resize(span.size);
+        // the end of the segment being recorded may still be collected in memory
+        uint64_t onDisk = span.size;
+        if (m_fd >= 0 && span.path == segmentPath(m_segments.back().startMs))
+        {
+            onDisk = std::min((uint64_t)span.size, m_written > span.offset ? m_written - span.offset : 0);
+            if (onDisk < span.size)
+            {
+                uint64_t pendingFrom = span.offset + onDisk - m_written;
+                if (pendingFrom + (span.size - onDisk) > m_pending.size())
+                {
+                    return false;
+                }
+                memcpy(&data[onDisk], &m_pending[pendingFrom], span.size - onDisk);
+            }
+        }
+        if (onDisk == 0)
+        {
+            return true;
+        }
+        int fd = ::open(span.path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return false;
+        }
+        bool ok = readAll(fd, &data[0], onDisk, span.offset);
+        ::close(fd);
+        return ok;
+    }
+
+    uint64_t Archive::usedBytes()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_usedBytes + m_written + (m_fd >= 0 ? m_pending.size() : 0);
+    }
+
+    size_t Archive::segments()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_segments.size();
+    }
+} // namespace nvr
@@ -0,0 +1,126 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __NVR_H__
+#define __NVR_H__
+
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// Local recording of the encoded stream (NVR mode).
+/// The stream is written to Matroska segments of a fixed duration, each named after the capture time of its first
+/// frame in milliseconds since the epoch and starting with a keyframe. Every GOP is one cluster. Next to each segment an
+/// index file holds one 16 byte entry per GOP: the capture time of its keyframe, and the offset and length of the GOP in
+/// the segment. The index of all segments is kept in memory, so seeking to a time is one binary search plus one read
+/// of the GOP which covers it. Writes are collected and go out in whole blocks, so every block of the card is written
+/// once and only the end of a segment is written short. When the recordings exceed their quota the oldest segment is
+/// dropped. Exported as "nvr.frames", "nvr.writes", "nvr.written_bytes", "nvr.dropped_frames",
+/// "nvr.dropped_segments" and the gauge "nvr.used_bytes".
+namespace nvr
+{
+    extern const size_t block_size;
+    extern const size_t batch_size;
+    extern const uint64_t flush_interval_ms;
+    extern const uint64_t max_segment_bytes;
+
+    /// Video track of a segment, a change starts a new segment
+    struct Track
+    {
+        int width;
+        int height;
+        std::string codecPrivate; // avcC of the stream, the codec_data of its caps
+    };
+
+    /// One GOP in the index file
+    struct Entry
+    {
+        uint64_t timeMs; // capture time of the keyframe since the epoch
+        uint32_t offset; // of its cluster in the segment
+        uint32_t size;   // up to the next keyframe or the end of the segment
+    };
+
+    /// Where a GOP is stored
+    struct Span
+    {
+        std::string path;
+        uint64_t timeMs;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    class Archive
+    {
+    public:
+        /// segmentMs is the duration after which a keyframe starts a new segment
+        Archive(const std::string &directory, uint64_t quotaBytes, uint64_t segmentMs);
+        ~Archive();
+
+        /// Load the segments of a previous run and rebuild the index of the one which was not closed, false when the
+        /// directory cannot be used
+        bool open();
+
+        /// Record an encoded frame in the AVC format of its track, from one streaming thread. ptsNs is the buffer time
+        /// of the pipeline. Delta frames are dropped until a keyframe opens a segment.
+        bool append(const Track &track, uint64_t ptsNs, bool keyframe, const uint8_t *data, size_t size);
+        /// Write what is collected and close the segment being recorded
+        void close();
+
+        /// The GOP covering a capture time, false when none was recorded. The GOP being recorded is found once the
+        /// next keyframe arrived.
+        bool locate(uint64_t timeMs, Span &span);
+        /// Read a located GOP, a Matroska cluster starting with the keyframe
+        bool read(const Span &span, std::vector<uint8_t> &data);
+
+        /// Bytes of all segments, including what is still collected
+        uint64_t usedBytes();
+        size_t segments();
+
+    private:
+        Archive(const Archive &);
+        Archive &operator=(const Archive &);
+
+        struct Segment
+        {
+            uint64_t startMs;
+            uint64_t bytes;
+            std::vector<Entry> index;
+        };
+
+        std::string segmentPath(uint64_t startMs) const;
+        std::string indexPath(uint64_t startMs) const;
+        bool create(const Track &track, uint64_t timeMs);
+        void seal();
+        void flush(bool all);
+        void endGop();
+        void dropOldest();
+        void updateUsage();
+        bool recover(Segment &segment);
+
+        std::string m_directory;
+        uint64_t m_quotaBytes;
+        uint64_t m_segmentMs;
+
+        // streaming thread only
+        uint64_t m_anchorPts;
+        uint64_t m_anchorEpochNs;
+        uint64_t m_lastPts;
+        Track m_track;
+        uint64_t m_clusterMs;
+        uint64_t m_flushedAtMs;
+
+        std::mutex m_lock;
+        std::deque<Segment> m_segments; // oldest first, the last one is being recorded while m_fd is open
+        int m_fd;
+        uint64_t m_written; // bytes of the open segment on disk
+        std::vector<uint8_t> m_pending;
+        bool m_gopOpen;
+        uint64_t m_usedBytes; // of the closed segments
+    };
+} // namespace nvr
+
+#endif //__NVR_H__
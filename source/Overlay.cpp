@@ -0,0 +1,206 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Overlay.h"
+
+#include <algorithm>
+#include <string.h>
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define C3_OVERLAY_NEON
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define C3_OVERLAY_SSE2
+#endif
+
+namespace overlay
+{
+    extern const int margin = 24;
+    extern const int glyph_scale = 3;
+    // the 5x7 glyph with a border of one font pixel for the outline, the height padded to an even number of rows
+    extern const int cell_width = 7 * glyph_scale;
+    extern const int cell_height = 9 * glyph_scale + 1;
+
+    namespace
+    {
+        const int font_width = 5;
+        const int font_height = 7;
+        const int outline = 2;
+        const uint8_t text_luma = 235;
+        const uint8_t outline_luma = 16;
+        const uint8_t neutral_chroma = 128;
+        const size_t max_cells = 63;
+        /// Strip rows are as wide as the most cells, rounded to whole chroma pairs
+        const size_t strip_stride = (max_cells * cell_width + 1) & ~(size_t)1;
+
+        const char glyph_chars[] = " 0123456789/:-.";
+        const int glyph_count = sizeof(glyph_chars) - 1;
+        // one row per byte, the leftmost font pixel in bit 4
+        const uint8_t glyph_rows[glyph_count][font_height] = {
+            {0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00}, // ' '
+            {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+            {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+            {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+            {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+            {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+            {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+            {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+            {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+            {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+            {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+            {0x01, 0x01, 0x02, 0x04, 0x08, 0x10, 0x10}, // /
+            {0x00, 0x0c, 0x0c, 0x00, 0x0c, 0x0c, 0x00}, // :
+            {0x00, 0x00, 0x00, 0x1f, 0x00, 0x00, 0x00}, // -
+            {0x00, 0x00, 0x00, 0x00, 0x00, 0x0c, 0x0c}, // .
+        };
+
+        int glyphIndex(char c)
+        {
+            const char *found = strchr(glyph_chars, c);
+            return found != NULL && c != '\0' ? (int)(found - glyph_chars) : 0;
+        }
+
+        /// Font pixel under a pixel of the cell
+        bool lit(int glyph, int x, int y)
+        {
+            if (x < 0 || y < 0)
+            {
+                return false;
+            }
+            int fx = x / glyph_scale - 1;
+            int fy = y / glyph_scale - 1;
+            if (fx < 0 || fx >= font_width || fy < 0 || fy >= font_height)
+            {
+                return false;
+            }
+            return (glyph_rows[glyph][fy] >> (font_width - 1 - fx)) & 1;
+        }
+
+        void blendScalar(uint8_t *dst, const uint8_t *src, const uint8_t *mask, size_t count)
+        {
+            for (size_t i = 0; i < count; i++)
+            {
+                dst[i] = (uint8_t)((dst[i] & ~mask[i]) | (src[i] & mask[i]));
+            }
+        }
+
+        void blendSimd(uint8_t *dst, const uint8_t *src, const uint8_t *mask, size_t count)
+        {
+            size_t i = 0;
+#if defined(C3_OVERLAY_NEON)
+            for (; i + 16 <= count; i += 16)
+            {
+                vst1q_u8(dst + i, vbslq_u8(vld1q_u8(mask + i), vld1q_u8(src + i), vld1q_u8(dst + i)));
+            }
+#elif defined(C3_OVERLAY_SSE2)
+            for (; i + 16 <= count; i += 16)
+            {
+                __m128i m = _mm_loadu_si128((const __m128i *)(mask + i));
+                __m128i s = _mm_and_si128(m, _mm_loadu_si128((const __m128i *)(src + i)));
+                __m128i d = _mm_andnot_si128(m, _mm_loadu_si128((const __m128i *)(dst + i)));
+                _mm_storeu_si128((__m128i *)(dst + i), _mm_or_si128(d, s));
+            }
+#endif
+            blendScalar(dst + i, src + i, mask + i, count - i);
+        }
+    } // namespace
+
+    Clock::Clock(const std::string &format, Implementation implementation)
+        : m_format(format), m_simd(implementation == IMPL_SIMD), m_length(0), m_second(-1), m_redrawn(0)
+    {
+        memset(m_text, 0, sizeof(m_text));
+        m_atlasLuma.resize(glyph_count * cell_width * cell_height);
+        m_atlasMask.resize(m_atlasLuma.size());
+        for (int g = 0; g < glyph_count; g++)
+        {
+            for (int y = 0; y < cell_height; y++)
+            {
+                for (int x = 0; x < cell_width; x++)
+                {
+                    size_t at = (g * cell_height + y) * cell_width + x;
+                    bool near = false;
+                    for (int dy = -outline; dy <= outline && !near; dy++)
+                    {
+                        for (int dx = -outline; dx <= outline && !near; dx++)
+                        {
+                            near = lit(g, x + dx, y + dy);
+                        }
+                    }
+                    m_atlasLuma[at] = lit(g, x, y) ? text_luma : near ? outline_luma : 0;
+                    m_atlasMask[at] = near ? 0xff : 0;
+                }
+            }
+        }
+        m_stripLuma.resize(strip_stride * cell_height);
+        m_stripMask.resize(strip_stride * cell_height);
+        m_stripChroma.assign(strip_stride, neutral_chroma);
+        m_stripChromaMask.resize(strip_stride * cell_height / 2);
+    }
+
+    void Clock::render(const char *text, size_t length)
+    {
+        for (size_t i = 0; i < length; i++)
+        {
+            if (i < m_length && text[i] == m_text[i])
+            {
+                continue;
+            }
+            m_redrawn++;
+            int glyph = glyphIndex(text[i]);
+            for (int y = 0; y < cell_height; y++)
+            {
+                size_t from = (glyph * cell_height + y) * cell_width;
+                size_t to = y * strip_stride + i * cell_width;
+                memcpy(&m_stripLuma[to], &m_atlasLuma[from], cell_width);
+                memcpy(&m_stripMask[to], &m_atlasMask[from], cell_width);
+            }
+            // the chroma pairs touching the cell, a pair may straddle two cells
+            size_t first = i * cell_width / 2;
+            size_t last = ((i + 1) * cell_width + 1) / 2;
+            for (int y = 0; y < cell_height / 2; y++)
+            {
+                const uint8_t *top = &m_stripMask[2 * y * strip_stride];
+                const uint8_t *bottom = top + strip_stride;
+                for (size_t pair = first; pair < last; pair++)
+                {
+                    uint8_t covered = top[2 * pair] | top[2 * pair + 1] | bottom[2 * pair] | bottom[2 * pair + 1];
+                    m_stripChromaMask[y * strip_stride + 2 * pair] = covered;
+                    m_stripChromaMask[y * strip_stride + 2 * pair + 1] = covered;
+                }
+            }
+        }
+        memcpy(m_text, text, length);
+        m_length = length;
+    }
+
+    void Clock::stamp(uint8_t *luma, size_t lumaStride, uint8_t *chroma, size_t chromaStride, int width, int height, time_t now)
+    {
+        if (now != m_second)
+        {
+            m_second = now;
+            struct tm local;
+            char text[sizeof(m_text)];
+            localtime_r(&now, &local);
+            size_t length = strftime(text, sizeof(text), m_format.c_str(), &local);
+            render(text, std::min(length, max_cells));
+        }
+
+        size_t stripWidth = (m_length * cell_width + 1) & ~(size_t)1;
+        if (m_length == 0 || margin + (int)stripWidth > width || margin + cell_height > height)
+        {
+            return;
+        }
+        void (*blend)(uint8_t *, const uint8_t *, const uint8_t *, size_t) = m_simd ? blendSimd : blendScalar;
+        for (int y = 0; y < cell_height; y++)
+        {
+            blend(luma + (margin + y) * lumaStride + margin, &m_stripLuma[y * strip_stride], &m_stripMask[y * strip_stride], stripWidth);
+        }
+        // interleaved U and V at half the height, the margin in bytes is the same as in luma
+        for (int y = 0; y < cell_height / 2; y++)
+        {
+            blend(chroma + (margin / 2 + y) * chromaStride + margin, &m_stripChroma[0], &m_stripChromaMask[y * strip_stride], stripWidth);
+        }
+    }
+} // namespace overlay
@@ -0,0 +1,65 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __OVERLAY_H__
+#define __OVERLAY_H__
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+/// Timestamp burned into the raw NV12 frames, in place of clockoverlay.
+/// The glyphs of the digits and separators are rendered once into an atlas from a built-in 5x7 font, scaled up and
+/// outlined so the text reads on any background. When the second changes, only the cells of the characters which
+/// changed are copied from the atlas into a text strip. Every frame gets the strip blended into its luma plane with a
+/// mask, and the chroma under the text is set to neutral, so the text is white rather than tinted by the scene.
+/// The blend uses NEON on ARM, SSE2 on x86 and a scalar reference which gives the same pixels.
+namespace overlay
+{
+    extern const int margin;
+    extern const int glyph_scale;
+    extern const int cell_width;
+    extern const int cell_height;
+
+    enum Implementation
+    {
+        IMPL_SCALAR,
+        IMPL_SIMD,
+    };
+
+    class Clock
+    {
+    public:
+        /// strftime format of the text, digits, '/', ':', '-', '.' and spaces are drawn
+        explicit Clock(const std::string &format, Implementation implementation = IMPL_SIMD);
+
+        /// Burn the local time into the top left corner of an NV12 frame, never allocates. Frames too small for the
+        /// text are left alone.
+        void stamp(uint8_t *luma, size_t lumaStride, uint8_t *chroma, size_t chromaStride, int width, int height, time_t now);
+
+        /// Characters redrawn into the strip since construction
+        unsigned long redrawnCells() const { return m_redrawn; }
+
+    private:
+        void render(const char *text, size_t length);
+
+        std::string m_format;
+        bool m_simd;
+        std::vector<uint8_t> m_atlasLuma;
+        std::vector<uint8_t> m_atlasMask;
+        // text strip, one row of cells, and its chroma at half the height
+        std::vector<uint8_t> m_stripLuma;
+        std::vector<uint8_t> m_stripMask;
+        std::vector<uint8_t> m_stripChroma;
+        std::vector<uint8_t> m_stripChromaMask;
+        char m_text[64];
+        size_t m_length;
+        time_t m_second;
+        unsigned long m_redrawn;
+    };
+} // namespace overlay
+
+#endif //__OVERLAY_H__
@@ -0,0 +1,84 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "PipelineSupervisor.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <algorithm>
+
+LOGGER_TAG("pipeline")
+
+namespace pipeline
+{
+    extern const unsigned int initial_backoff_ms = 500;
+    extern const unsigned int max_backoff_ms = 30000;
+    extern const unsigned int stable_after_ms = 60000;
+
+    Supervisor::Supervisor(const std::string &name)
+        : m_name(name), m_down(false), m_upSince(std::chrono::steady_clock::now()), m_backoffMs(initial_backoff_ms), m_stopping(false)
+    {
+    }
+
+    void Supervisor::failed(const std::string &reason)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        metrics::counter("pipeline." + m_name + ".errors").add();
+        if (!m_down.load(std::memory_order_relaxed))
+        {
+            // a pipeline which ran long enough is restarted quickly again, a flapping one keeps its backoff
+            if (now - m_upSince >= std::chrono::milliseconds(stable_after_ms))
+            {
+                m_backoffMs = initial_backoff_ms;
+            }
+            m_downSince = now;
+            m_down.store(true, std::memory_order_relaxed);
+        }
+        LOG_ERROR("[PIPELINE] " << m_name << " failed: " << reason << ", restarting in " << m_backoffMs << " ms");
+    }
+
+    bool Supervisor::backoff()
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        unsigned int waitMs = m_backoffMs;
+        m_backoffMs = std::min(m_backoffMs * 2, max_backoff_ms);
+        m_wakeup.wait_for(lock, std::chrono::milliseconds(waitMs), [this]()
+                          { return m_stopping; });
+        if (m_stopping)
+        {
+            return false;
+        }
+        metrics::counter("pipeline." + m_name + ".restarts").add();
+        LOG_INFO("[PIPELINE] Rebuilding " << m_name);
+        return true;
+    }
+
+    void Supervisor::recovered()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (!m_down.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        m_upSince = std::chrono::steady_clock::now();
+        m_down.store(false, std::memory_order_relaxed);
+        uint64_t recoverMs = std::chrono::duration_cast<std::chrono::milliseconds>(m_upSince - m_downSince).count();
+        metrics::histogram("pipeline." + m_name + ".recover_ms").record(recoverMs);
+        LOG_INFO("[PIPELINE] " << m_name << " recovered after " << recoverMs << " ms");
+    }
+
+    void Supervisor::stop()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+        m_wakeup.notify_all();
+    }
+
+    bool Supervisor::stopping()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_stopping;
+    }
+} // namespace pipeline
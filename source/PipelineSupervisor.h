@@ -0,0 +1,68 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __PIPELINE_SUPERVISOR_H__
+#define __PIPELINE_SUPERVISOR_H__
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+
+/// Restart policy of one GStreamer pipeline.
+/// The thread owning the pipeline reports bus errors with failed(), tears the pipeline down, waits in backoff() and
+/// builds it again. The wait doubles from initial_backoff_ms up to max_backoff_ms on every failed attempt and starts
+/// over once the pipeline ran for stable_after_ms. The streaming thread calls flowing() for every buffer, the first
+/// one after a failure ends the outage. Exported as "pipeline.<name>.errors", "pipeline.<name>.restarts" and
+/// "pipeline.<name>.recover_ms", the time from the error to the first buffer of the rebuilt pipeline.
+namespace pipeline
+{
+    extern const unsigned int initial_backoff_ms;
+    extern const unsigned int max_backoff_ms;
+    extern const unsigned int stable_after_ms;
+
+    class Supervisor
+    {
+    public:
+        explicit Supervisor(const std::string &name);
+
+        /// The pipeline stopped or could not be built
+        void failed(const std::string &reason);
+
+        /// Wait before the next build, false once stopped
+        bool backoff();
+
+        /// A buffer came out of the pipeline, cheap enough for every frame
+        void flowing()
+        {
+            if (m_down.load(std::memory_order_relaxed))
+            {
+                recovered();
+            }
+        }
+
+        /// Wake up backoff() for good, the owner tears the pipeline down and returns
+        void stop();
+        bool stopping();
+
+    private:
+        Supervisor(const Supervisor &);
+        Supervisor &operator=(const Supervisor &);
+
+        void recovered();
+
+        std::string m_name;
+        std::atomic<bool> m_down;
+
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        std::chrono::steady_clock::time_point m_downSince;
+        std::chrono::steady_clock::time_point m_upSince;
+        unsigned int m_backoffMs;
+        bool m_stopping;
+    };
+} // namespace pipeline
+
+#endif //__PIPELINE_SUPERVISOR_H__
@@ -0,0 +1,443 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Preset.h"
+#include "Actuator.h"
+#include "Calibration.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <unistd.h>
+
+LOGGER_TAG("preset")
+
+namespace preset
+{
+    extern const unsigned int max_presets = 32;
+    extern const unsigned int max_name_length = 32;
+
+    namespace
+    {
+        const unsigned int min_dwell_ms = 100;
+        const unsigned int max_dwell_ms = 24 * 60 * 60 * 1000;
+        // a stop whose position is not reached within this is left, e.g. when the servos were stopped
+        const std::chrono::seconds arrive_timeout(10);
+        const std::chrono::milliseconds arrive_poll(20);
+        const double arrive_tolerance = 0.5;
+
+        struct Position
+        {
+            double pan;
+            double tilt;
+        };
+
+        std::mutex s_lock;
+        std::string s_path;
+        std::map<std::string, Position> s_presets;
+
+        // serializes starting and stopping, commands arrive from the shadow and the data channel threads
+        std::mutex s_tourControl;
+        std::mutex s_tourLock;
+        std::condition_variable s_tourWakeup;
+        bool s_tourStopping = false;
+        std::thread s_tourThread;
+
+        std::string trim(const std::string &text)
+        {
+            size_t begin = text.find_first_not_of(" \t\r\n");
+            size_t end = text.find_last_not_of(" \t\r\n");
+            return begin == std::string::npos ? "" : text.substr(begin, end - begin + 1);
+        }
+
+        bool validName(const std::string &name)
+        {
+            if (name.empty() || name.size() > max_name_length || name == "save" || name == "delete" || name == "list" || name == "stop")
+            {
+                return false;
+            }
+            for (size_t i = 0; i < name.size(); i++)
+            {
+                if (!isalnum((unsigned char)name[i]) && name[i] != '_' && name[i] != '-')
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        bool writeAll(int fd, const std::string &text)
+        {
+            size_t written = 0;
+            while (written < text.size())
+            {
+                ssize_t result = ::write(fd, text.data() + written, text.size() - written);
+                if (result < 0 && errno != EINTR)
+                {
+                    return false;
+                }
+                written += result > 0 ? result : 0;
+            }
+            return true;
+        }
+
+        /// The rename is only durable once the directory entry is on disk
+        void syncDirectory(const std::string &path)
+        {
+            size_t slash = path.find_last_of('/');
+            std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+            int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd >= 0)
+            {
+                fsync(fd);
+                close(fd);
+            }
+        }
+
+        /// Caller holds s_lock, the file is replaced so a failed write keeps the previous presets
+        bool write()
+        {
+            if (s_path.empty())
+            {
+                return true;
+            }
+            std::ostringstream content;
+            content << "# PTZ presets: name = pan, tilt" << std::endl;
+            for (std::map<std::string, Position>::const_iterator it = s_presets.begin(); it != s_presets.end(); ++it)
+            {
+                content << it->first << " = " << it->second.pan << ", " << it->second.tilt << std::endl;
+            }
+
+            std::string temporary = s_path + ".tmp";
+            int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0)
+            {
+                LOG_ERROR("[PRESET] Unable to write " << temporary << ": " << strerror(errno));
+                return false;
+            }
+            bool ok = writeAll(fd, content.str()) && fsync(fd) == 0;
+            close(fd);
+            if (!ok || rename(temporary.c_str(), s_path.c_str()) != 0)
+            {
+                LOG_ERROR("[PRESET] Unable to update " << s_path << ": " << strerror(errno));
+                unlink(temporary.c_str());
+                return false;
+            }
+            syncDirectory(s_path);
+            return true;
+        }
+
+        bool arrived(double panDeg, double tiltDeg)
+        {
+            double pan, tilt;
+            actuator::position(pan, tilt);
+            // a target within the deadband of the last one is not moved to
+            return fabs(pan - panDeg) <= std::max(arrive_tolerance, calibration::deadband(calibration::AXIS_PAN)) &&
+                   fabs(tilt - tiltDeg) <= std::max(arrive_tolerance, calibration::deadband(calibration::AXIS_TILT));
+        }
+
+        void runTour(std::vector<Stop> stops)
+        {
+            threadstats::nameThread("c3-ptz-tour");
+            std::unique_lock<std::mutex> lock(s_tourLock);
+            for (size_t i = 0; !s_tourStopping; i = (i + 1) % stops.size())
+            {
+                double pan, tilt;
+                if (find(stops[i].name, pan, tilt))
+                {
+                    actuator::moveTo(actuator::AXIS_PAN | actuator::AXIS_TILT, pan, tilt);
+                    metrics::counter("ptz.tour_stops").add();
+
+                    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                    while (!s_tourStopping && !arrived(pan, tilt) && std::chrono::steady_clock::now() - begin < arrive_timeout)
+                    {
+                        s_tourWakeup.wait_for(lock, arrive_poll);
+                    }
+                    metrics::histogram("ptz.arrive_ms").record(
+                        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
+                }
+                else
+                {
+                    LOG_ERROR("[PRESET] Tour stop " << stops[i].name << " no longer exists");
+                }
+                s_tourWakeup.wait_for(lock, std::chrono::milliseconds(stops[i].dwellMs), []
+                                      { return s_tourStopping; });
+            }
+        }
+
+        std::string presetCommand(std::istringstream &arguments)
+        {
+            std::string verb, name;
+            arguments >> verb;
+            if (verb == "save")
+            {
+                double pan, tilt;
+                arguments >> name;
+                bool stored = (arguments >> pan >> tilt) ? store(name, pan, tilt) : store(name);
+                return stored ? "ok saved " + name : "error: unable to save " + name;
+            }
+            if (verb == "delete")
+            {
+                arguments >> name;
+                return remove(name) ? "ok deleted " + name : "error: no preset " + name;
+            }
+            if (verb == "list")
+            {
+                std::ostringstream reply;
+                reply << "ok";
+                std::vector<std::string> all = names();
+                for (size_t i = 0; i < all.size(); i++)
+                {
+                    double pan, tilt;
+                    if (find(all[i], pan, tilt))
+                    {
+                        reply << " " << all[i] << "=" << pan << "," << tilt;
+                    }
+                }
+                return reply.str();
+            }
+            return recall(verb) ? "ok recalled " + verb : "error: no preset " + verb;
+        }
+
+        std::string tourCommand(const std::string &arguments)
+        {
+            if (arguments == "stop" || arguments.empty())
+            {
+                stopTour();
+                return "ok tour stopped";
+            }
+            std::vector<Stop> stops;
+            if (!parseTour(arguments, stops))
+            {
+                return "error: invalid tour " + arguments;
+            }
+            return startTour(stops) ? "ok tour started" : "error: unknown preset in tour";
+        }
+    } // namespace
+
+    bool load(const std::string &path)
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        s_path = path;
+        std::ifstream file(path.c_str());
+        if (!file)
+        {
+            return false;
+        }
+
+        std::string line;
+        while (std::getline(file, line))
+        {
+            line = trim(line);
+            size_t equals = line.find('=');
+            if (line.empty() || line[0] == '#' || equals == std::string::npos)
+            {
+                continue;
+            }
+            std::string name = trim(line.substr(0, equals));
+            Position position;
+            if (!validName(name) || sscanf(line.c_str() + equals + 1, " %lf , %lf", &position.pan, &position.tilt) != 2)
+            {
+                LOG_ERROR("[PRESET] Ignoring invalid line " << line << " in " << path);
+                continue;
+            }
+            if (s_presets.size() < max_presets)
+            {
+                s_presets[name] = position;
+            }
+        }
+        LOG_INFO("[PRESET] Loaded " << s_presets.size() << " presets from " << path);
+        return true;
+    }
+
+    bool store(const std::string &name)
+    {
+        double pan, tilt;
+        actuator::position(pan, tilt);
+        return store(name, pan, tilt);
+    }
+
+    bool store(const std::string &name, double panDeg, double tiltDeg)
+    {
+        if (!validName(name) || std::isnan(panDeg) || std::isnan(tiltDeg))
+        {
+            LOG_ERROR("[PRESET] Invalid preset " << name);
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(s_lock);
+        if (s_presets.size() >= max_presets && s_presets.find(name) == s_presets.end())
+        {
+            LOG_ERROR("[PRESET] No room for preset " << name << ", " << max_presets << " are stored");
+            return false;
+        }
+        Position position;
+        position.pan = calibration::clamp(calibration::AXIS_PAN, panDeg);
+        position.tilt = calibration::clamp(calibration::AXIS_TILT, tiltDeg);
+        s_presets[name] = position;
+        LOG_INFO("[PRESET] Stored " << name << " at " << position.pan << ", " << position.tilt);
+        return write();
+    }
+
+    bool remove(const std::string &name)
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        if (s_presets.erase(name) == 0)
+        {
+            return false;
+        }
+        return write();
+    }
+
+    bool find(const std::string &name, double &panDeg, double &tiltDeg)
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        std::map<std::string, Position>::const_iterator it = s_presets.find(name);
+        if (it == s_presets.end())
+        {
+            return false;
+        }
+        panDeg = it->second.pan;
+        tiltDeg = it->second.tilt;
+        return true;
+    }
+
+    std::vector<std::string> names()
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        std::vector<std::string> all;
+        for (std::map<std::string, Position>::const_iterator it = s_presets.begin(); it != s_presets.end(); ++it)
+        {
+            all.push_back(it->first);
+        }
+        return all;
+    }
+
+    bool recall(const std::string &name)
+    {
+        double pan, tilt;
+        if (!find(name, pan, tilt))
+        {
+            LOG_ERROR("[PRESET] No preset " << name);
+            return false;
+        }
+        stopTour();
+        actuator::moveTo(actuator::AXIS_PAN | actuator::AXIS_TILT, pan, tilt);
+        metrics::counter("ptz.recalls").add();
+        LOG_DEBUG("[PRESET] Recalled " << name);
+        return true;
+    }
+
+    bool parseTour(const std::string &text, std::vector<Stop> &stops)
+    {
+        std::istringstream entries(text);
+        std::string entry;
+        stops.clear();
+        while (std::getline(entries, entry, ','))
+        {
+            entry = trim(entry);
+            size_t colon = entry.find(':');
+            if (colon == std::string::npos)
+            {
+                return false;
+            }
+            Stop stop;
+            stop.name = trim(entry.substr(0, colon));
+            std::string dwell = trim(entry.substr(colon + 1));
+            char *end = NULL;
+            double seconds = strtod(dwell.c_str(), &end);
+            // also rejects NaN, so the conversion below is always in range
+            if (!validName(stop.name) || dwell.empty() || *end != '\0' || !(seconds * 1000 >= min_dwell_ms && seconds * 1000 <= max_dwell_ms))
+            {
+                return false;
+            }
+            stop.dwellMs = (unsigned int)(seconds * 1000);
+            stops.push_back(stop);
+        }
+        return !stops.empty();
+    }
+
+    bool startTour(const std::vector<Stop> &stops)
+    {
+        double pan, tilt;
+        for (size_t i = 0; i < stops.size(); i++)
+        {
+            if (!find(stops[i].name, pan, tilt))
+            {
+                LOG_ERROR("[PRESET] Tour refers to unknown preset " << stops[i].name);
+                return false;
+            }
+        }
+        if (stops.empty())
+        {
+            return false;
+        }
+
+        std::lock_guard<std::mutex> control(s_tourControl);
+        {
+            std::lock_guard<std::mutex> lock(s_tourLock);
+            s_tourStopping = true;
+        }
+        s_tourWakeup.notify_all();
+        if (s_tourThread.joinable())
+        {
+            s_tourThread.join();
+        }
+        s_tourStopping = false;
+        s_tourThread = std::thread(runTour, stops);
+        LOG_INFO("[PRESET] Touring " << stops.size() << " presets");
+        return true;
+    }
+
+    void stopTour()
+    {
+        std::lock_guard<std::mutex> control(s_tourControl);
+        {
+            std::lock_guard<std::mutex> lock(s_tourLock);
+            s_tourStopping = true;
+        }
+        s_tourWakeup.notify_all();
+        if (s_tourThread.joinable())
+        {
+            s_tourThread.join();
+            LOG_INFO("[PRESET] Tour stopped");
+        }
+    }
+
+    bool execute(const std::string &command, std::string &reply)
+    {
+        std::istringstream arguments(trim(command));
+        std::string keyword;
+        arguments >> keyword;
+        if (keyword == "preset")
+        {
+            reply = presetCommand(arguments);
+        }
+        else if (keyword == "tour")
+        {
+            std::string rest;
+            std::getline(arguments, rest);
+            reply = tourCommand(trim(rest));
+        }
+        else
+        {
+            return false;
+        }
+        return true;
+    }
+} // namespace preset
@@ -0,0 +1,55 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __PRESET_H__
+#define __PRESET_H__
+
+#include <string>
+#include <vector>
+
+/// Named pan/tilt positions stored on the device.
+/// A recall queues the stored position on the actuator, so it costs one servo move and no cloud round trip. A tour
+/// cycles through presets on the c3-ptz-tour thread: each stop is recalled, and its dwell time starts once the servos
+/// arrived. The shadow properties `preset` and `tour` and the WebRTC data channel share the command syntax of execute().
+namespace preset
+{
+    extern const unsigned int max_presets;
+    extern const unsigned int max_name_length;
+
+    struct Stop
+    {
+        std::string name;
+        unsigned int dwellMs;
+    };
+
+    /// Read the stored presets, later changes are written back to the same file
+    bool load(const std::string &path);
+
+    /// Store the current position, or the given angles, under a name
+    bool store(const std::string &name);
+    bool store(const std::string &name, double panDeg, double tiltDeg);
+    bool remove(const std::string &name);
+    bool find(const std::string &name, double &panDeg, double &tiltDeg);
+    std::vector<std::string> names();
+
+    /// Move to a preset, a running tour is stopped
+    bool recall(const std::string &name);
+
+    /// Parse "name:seconds,name:seconds,..."
+    bool parseTour(const std::string &text, std::vector<Stop> &stops);
+    /// Replace the running tour, it repeats until stopped
+    bool startTour(const std::vector<Stop> &stops);
+    void stopTour();
+
+    /// Run a text command, false when the text is not a preset or tour command.
+    ///   preset <name>                      recall
+    ///   preset save <name> [<pan> <tilt>]  store the current or the given position
+    ///   preset delete <name>
+    ///   preset list
+    ///   tour <name>:<seconds>,...          start a tour, each dwell from 0.1 s to 24 h
+    ///   tour stop
+    bool execute(const std::string &command, std::string &reply);
+} // namespace preset
+
+#endif //__PRESET_H__
@@ -3,12 +3,316 @@
  * SPDX-License-Identifier: Apache-2.0.
  */
 #include "ProducerSink.h"
+#include "Encoding.h"
+#include "Keyframe.h"
+#include "Overlay.h"
+#include "Recorder.h"
+#include "Snapshot.h"
+#include "Substream.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
 #include "Logger.h"
 
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <list>
+#include <mutex>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
 LOGGER_TAG("videosink")
 
-/// Process a single bus message, log messages, exit on error, return false on eos
-static bool bus_process_msg(GstElement *pipeline, GstMessage *msg, const std::string &prefix)
+/// Timestamp burned into the raw frames
+static const char *const time_format = "%d/%m/%y %H:%M:%S";
+/// How often the bus thread looks at the supervisor while the pipeline is quiet
+static const GstClockTime bus_poll_interval = 100 * GST_MSECOND;
+/// Catch-up upload: frames queued ahead of kvssink, its in-memory buffer, how long it gets to drain, its nice value
+static const guint64 spool_queue_bytes = 2 * 1024 * 1024;
+static const int spool_kvssink_storage_mb = 32;
+static const GstClockTime spool_drain_timeout = 10 * GST_SECOND;
+// segments handed to the catch-up kvssink, the older one waits for the acknowledgement of its last fragment
+static const size_t spool_inflight_segments = 2;
+static const std::chrono::seconds spool_ack_timeout(20);
+// FRAGMENT_ACK_TYPE_PERSISTED of the KVS producer client
+static const int kvs_fragment_ack_persisted = 3;
+static const int spool_nice = 10;
+/// Frames the local recording may fall behind before the oldest are dropped
+static const guint nvr_queue_bytes = 8 * 1024 * 1024;
+
+/// While the uplink is down, frames go to the spool instead of kvssink. Both switches wait for a keyframe, so kvssink
+/// and every spool segment start with one.
+static GstPadProbeReturn spool_buffer(GstPad *pad, GstBuffer *buffer, KVSCustomData *data)
+{
+    bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+    if (keyframe && data->spooling == data->spool->online())
+    {
+        data->spooling = !data->spooling;
+        if (!data->spooling)
+        {
+            data->spool->seal();
+        }
+    }
+    if (!data->spooling)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    std::string caps;
+    if (keyframe)
+    {
+        // carries codec_data, the backlog is sent without a parser
+        GstCaps *current = gst_pad_get_current_caps(pad);
+        if (current != NULL)
+        {
+            gchar *text = gst_caps_to_string(current);
+            caps = text;
+            g_free(text);
+            gst_caps_unref(current);
+        }
+    }
+    GstMapInfo map;
+    if (GST_BUFFER_PTS_IS_VALID(buffer) && gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        data->spool->append(caps, GST_BUFFER_PTS(buffer), GST_BUFFER_DURATION_IS_VALID(buffer) ? GST_BUFFER_DURATION(buffer) : 0,
+                            keyframe, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    return GST_PAD_PROBE_DROP;
+}
+
+/// Burn the timestamp into the raw frames ahead of the encoder. The frames of the camera are written in place, the
+/// buffer is only copied if someone else holds a reference.
+static GstPadProbeReturn on_raw_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    static metrics::Histogram &stampUs = metrics::histogram("overlay.stamp_us");
+    static overlay::Clock clock(time_format);
+    KVSCustomData *data = (KVSCustomData *)user_data;
+
+    if (GST_PAD_PROBE_INFO_TYPE(info) & GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM)
+    {
+        GstEvent *event = GST_PAD_PROBE_INFO_EVENT(info);
+        if (GST_EVENT_TYPE(event) == GST_EVENT_CAPS)
+        {
+            GstCaps *caps;
+            gst_event_parse_caps(event, &caps);
+            data->rawInfoValid = gst_video_info_from_caps(&data->rawInfo, caps) && GST_VIDEO_INFO_FORMAT(&data->rawInfo) == GST_VIDEO_FORMAT_NV12;
+        }
+        return GST_PAD_PROBE_OK;
+    }
+    if (!data->rawInfoValid)
+    {
+        return GST_PAD_PROBE_OK;
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+    GST_PAD_PROBE_INFO_DATA(info) = buffer;
+    GstVideoFrame frame;
+    if (gst_video_frame_map(&frame, &data->rawInfo, buffer, GST_MAP_WRITE))
+    {
+        clock.stamp((uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 0), GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 0),
+                    (uint8_t *)GST_VIDEO_FRAME_PLANE_DATA(&frame, 1), GST_VIDEO_FRAME_PLANE_STRIDE(&frame, 1), GST_VIDEO_FRAME_WIDTH(&frame),
+                    GST_VIDEO_FRAME_HEIGHT(&frame), time(NULL));
+        gst_video_frame_unmap(&frame);
+    }
+    stampUs.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+    return GST_PAD_PROBE_OK;
+}
+
+/// Run motion detection on the luma plane of the analytics substream, report the activity to the keyframe policy and
+/// trigger the recorder
+static void on_analytics_frame(KVSCustomData *data, const substream::Frame &frame)
+{
+    static metrics::Histogram &detectUs = metrics::histogram("motion.detect_us");
+    static metrics::Gauge &score = metrics::gauge("motion.score");
+    static metrics::Counter &triggers = metrics::counter("motion.triggers");
+    if (data->motion == NULL)
+    {
+        return;
+    }
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    motion::Result result;
+    data->motion->process(frame.luma, frame.stride, result);
+    detectUs.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+    score.set(result.score);
+    keyframe::stream().onActivity(result.score);
+
+    bool moving = data->motionBlocks != 0 && result.movingBlocks >= data->motionBlocks;
+    if (moving)
+    {
+        triggers.add();
+        recorder::trigger("motion");
+    }
+    if (moving != data->moving)
+    {
+        data->moving = moving;
+        LOG_INFO("[MOTION] " << (moving ? "Started" : "Stopped") << ", " << result.movingBlocks << " blocks in " << result.region.x << ","
+                             << result.region.y << " " << result.region.width << "x" << result.region.height);
+    }
+}
+
+/// Count the encoded frames handed to kvssink, hold them back outside of events and divert them while offline
+static GstPadProbeReturn on_encoded_buffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+{
+    static metrics::Counter &videoFrames = metrics::counter("video.frames");
+    static metrics::Counter &videoBytes = metrics::counter("video.bytes");
+    GstBuffer *buffer = GST_PAD_PROBE_INFO_BUFFER(info);
+    KVSCustomData *data = (KVSCustomData *)user_data;
+
+    // pre-roll chained below comes through here again and was counted already
+    if (!data->replaying)
+    {
+        if (data->supervisor != NULL)
+        {
+            data->supervisor->flowing();
+        }
+        videoFrames.add();
+        videoBytes.add(gst_buffer_get_size(buffer));
+        keyframe::Reason reason = keyframe::stream().onFrame(!GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT), gst_buffer_get_size(buffer));
+        if (reason != keyframe::REASON_NONE)
+        {
+            LOG_DEBUG("[KEYFRAME] Forcing an IDR, " << keyframe::reasonName(reason));
+            encoding::forceKeyframe();
+        }
+
+        if (recorder::enabled())
+        {
+            std::vector<GstBuffer *> preroll;
+            if (!recorder::admit(buffer, preroll))
+            {
+                return GST_PAD_PROBE_DROP;
+            }
+            // an event opened, its pre-roll goes into kvssink ahead of this buffer
+            data->replaying = true;
+            for (size_t i = 0; i < preroll.size(); i++)
+            {
+                gst_pad_chain(pad, preroll[i]);
+            }
+            data->replaying = false;
+        }
+    }
+    if (data->spool != NULL)
+    {
+        return spool_buffer(pad, buffer, data);
+    }
+    return GST_PAD_PROBE_OK;
+}
+
+/// Size and avcC of the recorded stream, which h264parse puts into the caps
+static void nvr_track(GstCaps *caps, nvr::Track &track)
+{
+    GstStructure *structure = gst_caps_get_structure(caps, 0);
+    gst_structure_get_int(structure, "width", &track.width);
+    gst_structure_get_int(structure, "height", &track.height);
+    track.codecPrivate.clear();
+    const GValue *codecData = gst_structure_get_value(structure, "codec_data");
+    GstMapInfo map;
+    if (codecData != NULL && G_VALUE_HOLDS(codecData, GST_TYPE_BUFFER) && gst_buffer_map(gst_value_get_buffer(codecData), &map, GST_MAP_READ))
+    {
+        track.codecPrivate.assign((const char *)map.data, map.size);
+        gst_buffer_unmap(gst_value_get_buffer(codecData), &map);
+    }
+}
+
+/// Record every parsed frame, on the thread of the recording branch. Event mode and the spool only act on the kvssink
+/// branch, so the local recording is continuous.
+static GstFlowReturn on_nvr_sample(GstAppSink *sink, gpointer user_data)
+{
+    // recording branch thread only
+    static nvr::Track track = {0, 0, ""};
+    KVSCustomData *data = (KVSCustomData *)user_data;
+    GstSample *sample = gst_app_sink_pull_sample(sink);
+    if (sample == NULL)
+    {
+        return GST_FLOW_OK;
+    }
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    GstMapInfo map;
+    if (buffer != NULL && GST_BUFFER_PTS_IS_VALID(buffer) && gst_buffer_map(buffer, &map, GST_MAP_READ))
+    {
+        bool keyframe = !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        if (keyframe && gst_sample_get_caps(sample) != NULL)
+        {
+            nvr_track(gst_sample_get_caps(sample), track);
+        }
+        data->nvr->append(track, GST_BUFFER_PTS(buffer), keyframe, map.data, map.size);
+        gst_buffer_unmap(buffer, &map);
+    }
+    gst_sample_unref(sample);
+    return GST_FLOW_OK;
+}
+
+/// Split the parsed stream ahead of kvssink. kvssink stays on the streaming thread of the encoder, the recording
+/// branch gets its own behind a leaky queue, so a slow card never holds back the live stream.
+static bool link_nvr_branch(KVSCustomData *kvsdata)
+{
+    GstElement *tee = gst_element_factory_make("tee", "nvrtee");
+    GstElement *queue = gst_element_factory_make("queue", "nvrqueue");
+    GstElement *sink = gst_element_factory_make("appsink", "nvrsink");
+    if (!tee || !queue || !sink)
+    {
+        LOG_ERROR("[NVR] Not all elements could be created, local recording is off");
+        GstElement *created[] = {tee, queue, sink};
+        for (size_t i = 0; i < sizeof(created) / sizeof(created[0]); i++)
+        {
+            if (created[i] != NULL)
+                gst_object_unref(gst_object_ref_sink(created[i]));
+        }
+        return gst_element_link(kvsdata->parser, kvsdata->kvssink);
+    }
+
+    g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", 0, "max-size-bytes", nvr_queue_bytes, "max-size-time", (guint64)0, NULL);
+    // Matroska takes the length prefixed AVC format kvssink gets as well
+    GstCaps *caps = gst_caps_new_simple("video/x-h264",
+                                        "stream-format", G_TYPE_STRING, "avc",
+                                        "alignment", G_TYPE_STRING, "au",
+                                        NULL);
+    g_object_set(G_OBJECT(sink), "caps", caps, "sync", FALSE, NULL);
+    gst_caps_unref(caps);
+    GstAppSinkCallbacks callbacks;
+    memset(&callbacks, 0, sizeof(callbacks));
+    callbacks.new_sample = on_nvr_sample;
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, kvsdata, NULL);
+
+    gst_bin_add_many(GST_BIN(kvsdata->pipeline), tee, queue, sink, NULL);
+    return gst_element_link_many(kvsdata->parser, tee, kvsdata->kvssink, NULL) && gst_element_link_many(tee, queue, sink, NULL);
+}
+
+/// Credentials and stream of a kvssink, storageMb is the size of its in-memory buffer
+static void configure_kvssink(GstElement *kvssink, Utils::cmdData *cmdData, int storageMb)
+{
+    LOG_DEBUG("Setting IOT Credentials");
+    GstStructure *iot_credentials = gst_structure_new("iot-certificate",
+                                                      "iot-thing-name", G_TYPE_STRING, cmdData->input_thingName.c_str(),
+                                                      "endpoint", G_TYPE_STRING, cmdData->input_credentialEndpoint.c_str(),
+                                                      "cert-path", G_TYPE_STRING, cmdData->input_cert.c_str(),
+                                                      "key-path", G_TYPE_STRING, cmdData->input_key.c_str(),
+                                                      "ca-path", G_TYPE_STRING, cmdData->input_ca.c_str(),
+                                                      "role-aliases", G_TYPE_STRING, cmdData->input_roleAlias.c_str(),
+                                                      NULL);
+    g_object_set(G_OBJECT(kvssink), "iot-certificate", iot_credentials, NULL);
+    gst_structure_free(iot_credentials);
+    g_object_set(G_OBJECT(kvssink),
+                 "stream-name", cmdData->input_thingName.c_str(),
+                 "storage-size", storageMb,
+                 "aws-region", cmdData->input_kvsRegion.c_str(),
+                 "retention-period", 2,
+                 NULL);
+}
+
+/// Process a single bus message, log messages, return false once the pipeline stopped on error or eos
+static bool bus_process_msg(GstElement *pipeline, GstMessage *msg, pipeline::Supervisor *supervisor, const std::string &prefix)
 {
     using namespace std;
 
@@ -17,18 +321,28 @@ static bool bus_process_msg(GstElement *pipeline, GstMessage *msg, const std::st
     switch (mType)
     {
     case (GST_MESSAGE_ERROR):
-        // Parse error and exit program, hard exit
+    {
+        // Parse error and hand the pipeline to the supervisor, the rest of the process keeps running
         GError *err;
         gchar *dbg;
         gst_message_parse_error(msg, &err, &dbg);
         LOG_DEBUG("ERR = " << err->message << " FROM " << GST_OBJECT_NAME(msg->src));
         LOG_DEBUG("DBG = " << dbg);
+        if (supervisor != NULL)
+        {
+            supervisor->failed(std::string(GST_OBJECT_NAME(msg->src)) + ": " + err->message);
+        }
         g_clear_error(&err);
         g_free(dbg);
-        exit(1);
+        return false;
+    }
     case (GST_MESSAGE_EOS):
-        // Soft exit on EOS
+        // A live source only ends when the camera went away
         LOG_DEBUG("EOS !");
+        if (supervisor != NULL)
+        {
+            supervisor->failed("end of stream");
+        }
         return false;
     case (GST_MESSAGE_STATE_CHANGED):
         // Parse state change, print extra info for pipeline only
@@ -56,21 +370,68 @@ static bool bus_process_msg(GstElement *pipeline, GstMessage *msg, const std::st
     return true;
 }
 
-/// Run the message loop for one bus
-void code_thread_bus(GstElement *pipeline, KVSCustomData *data, const std::string &prefix)
+/// Run the message loop until the pipeline stops or has to be rebuilt with new encoding settings, false when the
+/// supervisor stopped first
+static bool run_bus(GstElement *pipeline, pipeline::Supervisor *supervisor, const std::string &prefix)
 {
     GstBus *bus = gst_element_get_bus(pipeline);
 
-    int res;
-    while (true)
+    bool running = true;
+    while (running && (supervisor == NULL || !supervisor->stopping()) && !encoding::rebuildRequested())
     {
-        GstMessage *msg = gst_bus_timed_pop(bus, GST_CLOCK_TIME_NONE);
-        res = bus_process_msg(pipeline, msg, prefix);
+        GstMessage *msg = gst_bus_timed_pop(bus, supervisor == NULL ? GST_CLOCK_TIME_NONE : bus_poll_interval);
+        if (msg == NULL)
+            continue;
+        running = bus_process_msg(pipeline, msg, supervisor, prefix);
         gst_message_unref(msg);
-        if (!res)
-            break;
     }
     gst_object_unref(bus);
+    return supervisor == NULL || !supervisor->stopping();
+}
+
+/// Run the message loop of the pipeline, rebuild it with backoff when it fails, free it and the motion detector once the
+/// supervisor stops
+void code_thread_bus(KVSCustomData *data, Utils::cmdData *cmdData, const std::string &prefix)
+{
+    pipeline::Supervisor *supervisor = data->supervisor;
+
+    while (true)
+    {
+        // a NULL pipeline is one which failed to build, the error was reported already
+        if (data->pipeline != NULL)
+        {
+            if (!run_bus(data->pipeline, supervisor, prefix))
+                break;
+            // only this pipeline goes, the MQTT connection and the actuator are left alone
+            bool rebuild = encoding::rebuildRequested();
+            encoding::unbind();
+            gst_free_resources(data->pipeline);
+            data->pipeline = NULL;
+            if (rebuild)
+            {
+                // not a failure, the new settings take effect right away
+                if (gst_init_resources_kvs(data, cmdData) != 0 && supervisor != NULL)
+                {
+                    supervisor->failed("pipeline could not be built");
+                }
+                continue;
+            }
+        }
+        if (supervisor == NULL || !supervisor->backoff())
+            break;
+        if (gst_init_resources_kvs(data, cmdData) != 0)
+        {
+            supervisor->failed("pipeline could not be built");
+        }
+    }
+    if (data->pipeline != NULL)
+    {
+        encoding::unbind();
+        gst_free_resources(data->pipeline);
+        data->pipeline = NULL;
+    }
+    delete data->motion;
+    data->motion = NULL;
 
     LOG_DEBUG("BUS THREAD FINISHED : " << prefix);
 }
@@ -102,7 +463,6 @@ int gst_init_resources_kvs(KVSCustomData *kvsdata, Utils::cmdData *cmdData)
     // Create elements
     kvsdata->source = gst_element_factory_make("libcamerasrc", "mysource");
     kvsdata->capsfilter = gst_element_factory_make("capsfilter", "mycapsfilter");
-    kvsdata->overlay = gst_element_factory_make("clockoverlay", "myoverlay");
     kvsdata->encoder = gst_element_factory_make("v4l2h264enc", "myencoder");
     kvsdata->encodercapsfilter = gst_element_factory_make("capsfilter", "myencodercapsfilter");
     kvsdata->parser = gst_element_factory_make("h264parse", "myparser");
@@ -110,18 +470,27 @@ int gst_init_resources_kvs(KVSCustomData *kvsdata, Utils::cmdData *cmdData)
     LOG_DEBUG("Finished creating elements... ");
     kvsdata->pipeline = gst_pipeline_new("mypipeline");
     LOG_DEBUG("Finished empty pipeline ... ");
-    if (!kvsdata->pipeline || !kvsdata->source || !kvsdata->capsfilter || !kvsdata->overlay || !kvsdata->encoder || !kvsdata->encodercapsfilter || !kvsdata->parser || !kvsdata->kvssink)
+    if (!kvsdata->pipeline || !kvsdata->source || !kvsdata->capsfilter || !kvsdata->encoder || !kvsdata->encodercapsfilter || !kvsdata->parser || !kvsdata->kvssink)
     {
         LOG_FATAL("Not all elements could be created.\n");
+        // the pipeline is rebuilt from scratch on the next attempt, drop what was created
+        GstElement *created[] = {kvsdata->pipeline, kvsdata->source, kvsdata->capsfilter, kvsdata->encoder, kvsdata->encodercapsfilter, kvsdata->parser, kvsdata->kvssink};
+        for (size_t i = 0; i < sizeof(created) / sizeof(created[0]); i++)
+        {
+            if (created[i] != NULL)
+                gst_object_unref(gst_object_ref_sink(created[i]));
+        }
+        kvsdata->pipeline = NULL;
         return -1;
     }
 
-    // Set caps for capsfilter
+    // Set caps for capsfilter, the settings of the shadow are taken once per build
+    encoding::Settings settings = encoding::current();
     GstCaps *caps = gst_caps_new_simple("video/x-raw",
-                                        "width", G_TYPE_INT, 1280,
-                                        "height", G_TYPE_INT, 720,
+                                        "width", G_TYPE_INT, settings.width,
+                                        "height", G_TYPE_INT, settings.height,
                                         "format", G_TYPE_STRING, "NV12",
-                                        "framerate", GST_TYPE_FRACTION, 30, 1,
+                                        "framerate", GST_TYPE_FRACTION, settings.fps, 1,
                                         "interlace-mode", G_TYPE_STRING, "progressive",
                                         "colorimetry", G_TYPE_STRING, "bt709",
                                         NULL);
@@ -129,21 +498,16 @@ int gst_init_resources_kvs(KVSCustomData *kvsdata, Utils::cmdData *cmdData)
     gst_caps_unref(caps);
     LOG_DEBUG("Created source filter...");
 
-    g_object_set(G_OBJECT(kvsdata->overlay), "time-format", "%d/%m/%y %H:%M:%S", NULL);
-
     /* configure encoder */
     // gst-inspect-1.0 v4l2h264enc
-    GstStructure *extrastruct = gst_structure_new("controls",
-                                                  "h264_profile", G_TYPE_INT, 4,
-                                                  "video_bitrate", G_TYPE_INT, 620000,
-                                                  NULL);
+    GstStructure *extrastruct = encoding::controls(settings);
     g_object_set(G_OBJECT(kvsdata->encoder), "extra-controls", extrastruct, NULL);
     gst_structure_free(extrastruct);
     LOG_DEBUG("Created encoder...");
 
     // Set caps for encodercapsfilter
     GstCaps *h264_caps = gst_caps_new_simple("video/x-h264",
-                                             "profile", G_TYPE_STRING, "high",
+                                             "profile", G_TYPE_STRING, settings.profile.c_str(),
                                              "level", G_TYPE_STRING, "4",
                                              NULL);
     g_object_set(G_OBJECT(kvsdata->encodercapsfilter), "caps", h264_caps, NULL);
@@ -151,46 +515,380 @@ int gst_init_resources_kvs(KVSCustomData *kvsdata, Utils::cmdData *cmdData)
     LOG_DEBUG("Created encoder filter...");
 
     // kvssink
-    LOG_DEBUG("Setting IOT Credentials");
-    GstStructure *iot_credentials = gst_structure_new("iot-certificate",
-                                                      "iot-thing-name", G_TYPE_STRING, cmdData->input_thingName.c_str(),
-                                                      "endpoint", G_TYPE_STRING, cmdData->input_credentialEndpoint.c_str(),
-                                                      "cert-path", G_TYPE_STRING, cmdData->input_cert.c_str(),
-                                                      "key-path", G_TYPE_STRING, cmdData->input_key.c_str(),
-                                                      "ca-path", G_TYPE_STRING, cmdData->input_ca.c_str(),
-                                                      "role-aliases", G_TYPE_STRING, cmdData->input_roleAlias.c_str(),
-                                                      NULL);
-    g_object_set(G_OBJECT(kvsdata->kvssink), "iot-certificate", iot_credentials, NULL);
-    gst_structure_free(iot_credentials);
-    g_object_set(G_OBJECT(kvsdata->kvssink),
-                 "stream-name", cmdData->input_thingName.c_str(),
-                 "storage-size", 1000,
-                 "aws-region", cmdData->input_kvsRegion.c_str(),
-                 "retention-period", 2,
-                 NULL);
+    configure_kvssink(kvsdata->kvssink, cmdData, (int)cmdData->input_kvsStorageMb);
     LOG_DEBUG("About to build pipeline...");
 
     // Add elements to the pipeline
-    gst_bin_add_many(GST_BIN(kvsdata->pipeline), kvsdata->source, kvsdata->capsfilter, kvsdata->overlay, kvsdata->encoder, kvsdata->encodercapsfilter, kvsdata->parser, kvsdata->kvssink, NULL);
+    gst_bin_add_many(GST_BIN(kvsdata->pipeline), kvsdata->source, kvsdata->capsfilter, kvsdata->encoder, kvsdata->encodercapsfilter, kvsdata->parser, kvsdata->kvssink, NULL);
     // Link elements
-    if (!gst_element_link_many(kvsdata->source, kvsdata->capsfilter, kvsdata->overlay, kvsdata->encoder, kvsdata->encodercapsfilter, kvsdata->parser, kvsdata->kvssink, NULL))
+    bool linked = gst_element_link_many(kvsdata->source, kvsdata->capsfilter, kvsdata->encoder, kvsdata->encodercapsfilter, kvsdata->parser, NULL) &&
+                  (kvsdata->nvr != NULL ? link_nvr_branch(kvsdata) : gst_element_link(kvsdata->parser, kvsdata->kvssink));
+    if (!linked)
     {
         LOG_FATAL("Elements could not be linked.");
         gst_object_unref(kvsdata->pipeline);
+        kvsdata->pipeline = NULL;
         return -1;
     }
+    GstPad *encoderpad = gst_element_get_static_pad(kvsdata->encoder, "sink");
+    gst_pad_add_probe(encoderpad, (GstPadProbeType)(GST_PAD_PROBE_TYPE_BUFFER | GST_PAD_PROBE_TYPE_EVENT_DOWNSTREAM), on_raw_buffer, kvsdata, NULL);
+    gst_object_unref(encoderpad);
+    // full frame snapshots are grabbed after the timestamp is drawn
+    snapshot::watch(kvsdata->encoder);
+    GstPad *kvssinkpad = gst_element_get_static_pad(kvsdata->kvssink, "sink");
+    gst_pad_add_probe(kvssinkpad, GST_PAD_PROBE_TYPE_BUFFER, on_encoded_buffer, kvsdata, NULL);
+    gst_object_unref(kvssinkpad);
+    // motion tells the keyframe policy whether the scene is static, and triggers event recording
+    if (kvsdata->motion == NULL)
+    {
+        kvsdata->motion = new motion::Detector(substream::width, substream::height, 1);
+        if (cmdData->input_motionThreshold > 0)
+        {
+            kvsdata->motion->setThreshold((unsigned int)cmdData->input_motionThreshold);
+        }
+        substream::subscribe(std::bind(on_analytics_frame, kvsdata, std::placeholders::_1));
+        LOG_INFO("[MOTION] Detection on " << motion::simdName() << ", threshold " << cmdData->input_motionThreshold << ", "
+                                          << cmdData->input_motionBlocks << " blocks");
+    }
+    kvsdata->motion->reset();
+    kvsdata->motionBlocks = recorder::enabled() && cmdData->input_motionThreshold > 0 ? std::max(1, (int)cmdData->input_motionBlocks) : 0;
+    kvsdata->moving = false;
+    keyframe::stream().configure(settings.fps, settings.gop);
+    // the analytics branch is only worth its camera buffers while someone consumes it
+    if (substream::active())
+    {
+        substream::attach(kvsdata->pipeline, kvsdata->source);
+    }
+    threadstats::nameGstStreamingThreads(kvsdata->pipeline);
+
     // Start playing
     ret = gst_element_set_state(kvsdata->pipeline, GST_STATE_PLAYING);
     if (ret == GST_STATE_CHANGE_FAILURE)
     {
         LOG_FATAL("Unable to set the pipeline to the playing state.\n");
+        gst_element_set_state(kvsdata->pipeline, GST_STATE_NULL);
         gst_object_unref(kvsdata->pipeline);
+        kvsdata->pipeline = NULL;
         return 1;
     }
+    encoding::bind(kvsdata->encoder, settings);
+    LOG_INFO("[ENCODING] " << settings.width << "x" << settings.height << " at " << settings.fps << " fps, " << settings.bitrate << " bps, "
+                           << settings.profile << " profile");
 
     return 0;
 }
 
+/// Start of FragmentAck of the KVS producer client, which kvssink passes to its "fragment-ack" signal
+struct KvsFragmentAck
+{
+    uint32_t version;
+    int32_t ackType;
+    uint64_t timestamp; // fragment timecode in 100 ns
+};
+
+/// Persisted fragments reported by the catch-up kvssink on its callback thread, applied by the uploader
+struct SpoolAcks
+{
+    std::mutex lock;
+    std::condition_variable arrived;
+    std::deque<uint64_t> persistedMs;
+};
+
+static void on_spool_fragment_ack(GstElement *sink, gpointer ack, gpointer user_data)
+{
+    const KvsFragmentAck *fragmentAck = (const KvsFragmentAck *)ack;
+    SpoolAcks *acks = (SpoolAcks *)user_data;
+    if (fragmentAck != NULL && fragmentAck->ackType == kvs_fragment_ack_persisted)
+    {
+        std::lock_guard<std::mutex> lock(acks->lock);
+        acks->persistedMs.push_back(fragmentAck->timestamp / 10000);
+        acks->arrived.notify_all();
+    }
+}
+
+/// Catch-up pipeline, appsrc straight into a second kvssink which keeps the buffer timestamps. acknowledged tells
+/// whether kvssink reports persisted fragments to acks.
+static GstElement *build_spool_pipeline(Utils::cmdData *cmdData, const std::string &caps, GstElement **appsrc, SpoolAcks *acks,
+                                        bool *acknowledged)
+{
+    GstElement *pipeline = gst_pipeline_new("spoolpipeline");
+    GstElement *source = gst_element_factory_make("appsrc", "spoolsource");
+    GstElement *kvssink = gst_element_factory_make("kvssink", "spoolkvssink");
+    GstCaps *sourceCaps = gst_caps_from_string(caps.c_str());
+    if (!pipeline || !source || !kvssink || !sourceCaps)
+    {
+        LOG_ERROR("[SPOOL] Catch-up pipeline could not be created");
+        GstElement *created[] = {pipeline, source, kvssink};
+        for (size_t i = 0; i < sizeof(created) / sizeof(created[0]); i++)
+        {
+            if (created[i] != NULL)
+                gst_object_unref(gst_object_ref_sink(created[i]));
+        }
+        if (sourceCaps != NULL)
+            gst_caps_unref(sourceCaps);
+        return NULL;
+    }
+
+    g_object_set(G_OBJECT(source),
+                 "caps", sourceCaps,
+                 "format", GST_FORMAT_TIME,
+                 "is-live", FALSE,
+                 "max-bytes", (guint64)spool_queue_bytes,
+                 NULL);
+    gst_caps_unref(sourceCaps);
+    configure_kvssink(kvssink, cmdData, spool_kvssink_storage_mb);
+    // the buffers carry the capture time since the epoch
+    g_object_set(G_OBJECT(kvssink), "use-original-pts", TRUE, NULL);
+    // the upload cursor only moves over fragments kvssink reports as persisted
+    *acknowledged = g_signal_lookup("fragment-ack", G_OBJECT_TYPE(kvssink)) != 0;
+    if (*acknowledged)
+    {
+        g_signal_connect(kvssink, "fragment-ack", G_CALLBACK(on_spool_fragment_ack), acks);
+    }
+    else
+    {
+        LOG_WARN("[SPOOL] kvssink reports no fragment acknowledgements, each segment is confirmed by the end of stream");
+    }
+
+    gst_bin_add_many(GST_BIN(pipeline), source, kvssink, NULL);
+    if (!gst_element_link(source, kvssink) || gst_element_set_state(pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+    {
+        LOG_ERROR("[SPOOL] Catch-up pipeline could not be started");
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        gst_object_unref(pipeline);
+        return NULL;
+    }
+    threadstats::nameGstStreamingThreads(pipeline);
+    *appsrc = source;
+    return pipeline;
+}
+
+/// Let kvssink send what it holds, then free the catch-up pipeline, true when the end of stream got through
+static bool finish_spool_pipeline(GstElement *pipeline, GstElement *appsrc)
+{
+    gst_app_src_end_of_stream(GST_APP_SRC(appsrc));
+    GstBus *bus = gst_element_get_bus(pipeline);
+    GstMessage *msg = gst_bus_timed_pop_filtered(bus, spool_drain_timeout, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+    bool drained = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+    if (msg != NULL)
+        gst_message_unref(msg);
+    gst_object_unref(bus);
+    gst_free_resources(pipeline);
+    return drained;
+}
+
+/// Move the upload cursors over the persisted fragments and delete the segments persisted completely
+static void apply_spool_acks(SpoolAcks &acks, std::list<spool::Segment> &inflight, spool::Store *store)
+{
+    std::deque<uint64_t> persisted;
+    {
+        std::lock_guard<std::mutex> lock(acks.lock);
+        persisted.swap(acks.persistedMs);
+    }
+    for (std::list<spool::Segment>::iterator it = inflight.begin(); it != inflight.end();)
+    {
+        for (size_t i = 0; i < persisted.size(); i++)
+        {
+            it->acknowledge(persisted[i]);
+        }
+        if (it->done())
+        {
+            LOG_INFO("[SPOOL] Uploaded " << it->path());
+            store->release(*it);
+            it = inflight.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
+
+/// Free the catch-up pipeline, after letting it send what it holds when drain is set, and hand the segments back to
+/// the store, which gives them out again from the keyframe after their last persisted fragment. True when frames
+/// handed to kvssink were not persisted.
+static bool close_spool_pipeline(spool::Store *store, std::list<spool::Segment> &inflight, SpoolAcks &acks, GstElement *&pipeline,
+                                 GstElement *appsrc, bool drain, bool acknowledged)
+{
+    if (pipeline != NULL)
+    {
+        bool drained = false;
+        if (drain)
+            drained = finish_spool_pipeline(pipeline, appsrc);
+        else
+            gst_free_resources(pipeline);
+        pipeline = NULL;
+        if (drained && !acknowledged)
+        {
+            for (std::list<spool::Segment>::iterator it = inflight.begin(); it != inflight.end(); ++it)
+            {
+                it->acknowledgeAll();
+            }
+        }
+    }
+    apply_spool_acks(acks, inflight, store);
+    bool lost = false;
+    while (!inflight.empty())
+    {
+        lost = lost || inflight.front().pending();
+        store->giveBack(inflight.front());
+        inflight.pop_front();
+    }
+    return lost;
+}
+
+/// Upload the spooled backlog oldest first while the uplink is up, paced to the configured rate
+void code_thread_spool(spool::Store *store, pipeline::Supervisor *supervisor, Utils::cmdData *cmdData)
+{
+    static metrics::Counter &uploadedFrames = metrics::counter("spool.uploaded_frames");
+    static metrics::Counter &uploadedBytes = metrics::counter("spool.uploaded_bytes");
+    // live frames keep priority for the CPU too, the streaming threads of the catch-up pipeline inherit the nice value
+    setpriority(PRIO_PROCESS, (id_t)syscall(SYS_gettid), spool_nice);
+
+    const double bytesPerSecond = cmdData->input_spoolUploadKbps * 1000.0 / 8;
+    // handed out by the store oldest first, frames are read from the last one
+    std::list<spool::Segment> inflight;
+    SpoolAcks acks;
+    GstElement *pipeline = NULL, *appsrc = NULL;
+    bool acknowledged = false;
+    std::string caps;
+
+    while (true)
+    {
+        apply_spool_acks(acks, inflight, store);
+        std::string failure;
+        if (store->stopping())
+        {
+            close_spool_pipeline(store, inflight, acks, pipeline, appsrc, true, acknowledged);
+            break;
+        }
+        if (!store->online())
+        {
+            // kvssink cannot send what it holds, it is sent again from the spool once the uplink is back
+            close_spool_pipeline(store, inflight, acks, pipeline, appsrc, false, acknowledged);
+        }
+        else if (!inflight.empty() && inflight.back().sent())
+        {
+            if (!acknowledged || !store->unread())
+            {
+                // the end of stream closes the last fragment, kvssink waits for its acknowledgement
+                if (close_spool_pipeline(store, inflight, acks, pipeline, appsrc, true, acknowledged))
+                    failure = "catch-up fragments not acknowledged";
+            }
+            else if (inflight.size() >= spool_inflight_segments)
+            {
+                // the keyframe starting the newer segment closed the last fragment of the older one
+                std::unique_lock<std::mutex> lock(acks.lock);
+                if (!acks.arrived.wait_for(lock, spool_ack_timeout, [&acks]()
+                                           { return !acks.persistedMs.empty(); }))
+                    failure = "catch-up fragments not acknowledged";
+            }
+            else
+            {
+                inflight.emplace_back();
+                if (!store->nextSegment(inflight.back()))
+                    inflight.pop_back();
+            }
+            if (!failure.empty())
+            {
+                supervisor->failed(failure);
+                close_spool_pipeline(store, inflight, acks, pipeline, appsrc, false, acknowledged);
+                if (!supervisor->backoff())
+                    break;
+            }
+            continue;
+        }
+        if (inflight.empty())
+        {
+            inflight.emplace_back();
+            if (!store->nextSegment(inflight.back()))
+            {
+                inflight.pop_back();
+                continue;
+            }
+        }
+
+        spool::Segment &segment = inflight.back();
+        if (pipeline != NULL && segment.caps() != caps)
+        {
+            // the stream changed, the segments in flight are settled first
+            close_spool_pipeline(store, inflight, acks, pipeline, appsrc, true, acknowledged);
+            continue;
+        }
+        if (pipeline == NULL)
+        {
+            caps = segment.caps();
+            pipeline = build_spool_pipeline(cmdData, caps, &appsrc, &acks, &acknowledged);
+            if (pipeline == NULL)
+            {
+                close_spool_pipeline(store, inflight, acks, pipeline, appsrc, false, acknowledged);
+                supervisor->failed("catch-up pipeline could not be built");
+                if (!supervisor->backoff())
+                    break;
+                continue;
+            }
+        }
+
+        GstBus *bus = gst_element_get_bus(pipeline);
+        std::chrono::steady_clock::time_point due = std::chrono::steady_clock::now();
+        spool::Frame frame;
+        while (failure.empty() && store->online() && !store->stopping() && segment.next(frame))
+        {
+            // the queue of appsrc fills up while kvssink is behind, wait for it instead of blocking in the push
+            while (gst_app_src_get_current_level_bytes(GST_APP_SRC(appsrc)) >= spool_queue_bytes && store->online() && !store->stopping())
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+
+            GstBuffer *buffer = gst_buffer_new_allocate(NULL, frame.size, NULL);
+            gst_buffer_fill(buffer, 0, frame.data, frame.size);
+            GST_BUFFER_PTS(buffer) = frame.timestampNs;
+            GST_BUFFER_DTS(buffer) = frame.timestampNs;
+            GST_BUFFER_DURATION(buffer) = frame.durationNs != 0 ? frame.durationNs : GST_CLOCK_TIME_NONE;
+            if (!frame.keyframe)
+                GST_BUFFER_FLAG_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+            if (gst_app_src_push_buffer(GST_APP_SRC(appsrc), buffer) != GST_FLOW_OK)
+            {
+                failure = "catch-up push refused";
+                break;
+            }
+            supervisor->flowing();
+            uploadedFrames.add();
+            uploadedBytes.add(frame.size);
+
+            // token bucket without burst credit beyond one second
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            due = std::max(due, now - std::chrono::seconds(1)) +
+                  std::chrono::microseconds((int64_t)(frame.size * 1e6 / bytesPerSecond));
+            if (due > now)
+                std::this_thread::sleep_until(due);
+
+            GstMessage *msg = gst_bus_pop_filtered(bus, GST_MESSAGE_ERROR);
+            if (msg != NULL)
+            {
+                GError *err;
+                gchar *dbg;
+                gst_message_parse_error(msg, &err, &dbg);
+                failure = std::string("catch-up ") + err->message;
+                g_clear_error(&err);
+                g_free(dbg);
+                gst_message_unref(msg);
+            }
+        }
+        gst_object_unref(bus);
+
+        if (!failure.empty())
+        {
+            // the rebuilt pipeline goes on from the keyframe after the last persisted fragment
+            supervisor->failed(failure);
+            close_spool_pipeline(store, inflight, acks, pipeline, appsrc, false, acknowledged);
+            if (!supervisor->backoff())
+                break;
+        }
+    }
+    LOG_DEBUG("SPOOL THREAD FINISHED");
+}
+
 /// clean up GStream resources
 void gst_free_resources(GstElement *pipeline)
 {
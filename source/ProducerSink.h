@@ -5,6 +5,12 @@
 #include <string>
 #include <iostream>
 #include <gst/gst.h>
+#include <gst/video/video.h>
+
+#include "Motion.h"
+#include "Nvr.h"
+#include "PipelineSupervisor.h"
+#include "Spool.h"
 
 #ifndef COMMANDLINE_UTIL_H
 #define COMMANDLINE_UTIL_H
@@ -15,17 +21,31 @@
 typedef struct KVSCustomData
 {
     // GstElement *pipeline, *source, *capsfilter, *videoconvert, *videoscale, *overlay, *sink;
-    GstElement *pipeline, *source, *capsfilter, *overlay, *encoder, *encodercapsfilter, *parser, *kvssink;
+    GstElement *pipeline, *source, *capsfilter, *encoder, *encodercapsfilter, *parser, *kvssink;
 
     GstBus *bus;
     GMainLoop *main_loop; /* GLib's Main Loop */
+    pipeline::Supervisor *supervisor; /* told about errors and flowing buffers, may be NULL */
+    spool::Store *spool;              /* takes the frames while the uplink is down, may be NULL */
+    bool spooling;                    /* frames go to the spool, streaming thread only */
+    nvr::Archive *nvr;                /* records the parsed stream locally on a branch of its own, may be NULL */
+    bool replaying;                   /* the recorder pre-roll is being chained into kvssink, streaming thread only */
+    GstVideoInfo rawInfo;             /* layout of the raw frames which get the timestamp, streaming thread only */
+    bool rawInfoValid;
+    motion::Detector *motion;         /* watches the analytics substream for the keyframe policy and the recorder, may be NULL */
+    unsigned int motionBlocks;        /* moving blocks which trigger the recorder, 0 when motion does not trigger it */
+    bool moving;                      /* the last analytics frame had motion, substream thread only */
 } KVSCustomData;
 
 /// init gstreamer
 int gst_init_resources_kvs(KVSCustomData *kvsdata, Utils::cmdData *cmdData);
 
-/// Run the message loop for one bus
-void code_thread_bus(GstElement *pipeline, KVSCustomData *data, const std::string &prefix);
+/// Run the message loop of the pipeline, rebuild it with backoff when it fails, free it and the motion detector once the
+/// supervisor stops
+void code_thread_bus(KVSCustomData *data, Utils::cmdData *cmdData, const std::string &prefix);
+
+/// Upload the spooled backlog oldest first while the uplink is up, paced to the configured rate
+void code_thread_spool(spool::Store *store, pipeline::Supervisor *supervisor, Utils::cmdData *cmdData);
 
 /// clean up GStream resources
 void gst_free_resources(GstElement *pipeline);
@@ -0,0 +1,121 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "PtzProtocol.h"
+#include "Actuator.h"
+#include "Calibration.h"
+#include "Fov.h"
+#include "Preset.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "Logger.h"
+
+#include <cmath>
+
+LOGGER_TAG("ptz")
+
+namespace ptz
+{
+    namespace
+    {
+        uint16_t readU16(const uint8_t *data)
+        {
+            return (uint16_t)(data[0] | (data[1] << 8));
+        }
+
+        void writeU16(uint8_t *data, uint16_t value)
+        {
+            data[0] = (uint8_t)(value & 0xff);
+            data[1] = (uint8_t)(value >> 8);
+        }
+
+        int16_t centi(double value)
+        {
+            return (int16_t)lround(value * 100);
+        }
+    } // namespace
+
+    bool decode(const uint8_t *data, size_t size, Command &command)
+    {
+        if (data == NULL || size != message_size)
+        {
+            return false;
+        }
+        command.opcode = data[0];
+        command.axes = data[1];
+        command.sequence = readU16(data + 2);
+        command.pan = (int16_t)readU16(data + 4);
+        command.tilt = (int16_t)readU16(data + 6);
+        return true;
+    }
+
+    void encode(const Command &command, uint8_t *data)
+    {
+        data[0] = command.opcode;
+        data[1] = command.axes;
+        writeU16(data + 2, command.sequence);
+        writeU16(data + 4, (uint16_t)command.pan);
+        writeU16(data + 6, (uint16_t)command.tilt);
+    }
+
+    void handle(const uint8_t *data, size_t size, uint8_t *reply)
+    {
+        TRACE_SCOPE("ptz.command");
+        Command command = {0, 0, 0, 0, 0};
+        Status status = STATUS_OK;
+        unsigned int axes = 0;
+
+        if (!decode(data, size, command))
+        {
+            status = STATUS_MALFORMED;
+        }
+        else if (command.opcode < OP_ABSOLUTE || command.opcode > OP_CENTER)
+        {
+            status = STATUS_UNKNOWN_OPCODE;
+        }
+
+        if (status == STATUS_OK)
+        {
+            // the viewer takes over the camera, the tour must not queue its next stop after this command
+            preset::stopTour();
+            axes = command.axes & (actuator::AXIS_PAN | actuator::AXIS_TILT);
+            double pan = command.pan / 100.0;
+            double tilt = command.tilt / 100.0;
+            switch (command.opcode)
+            {
+            case OP_ABSOLUTE:
+                actuator::moveTo(axes, calibration::clamp(calibration::AXIS_PAN, pan), calibration::clamp(calibration::AXIS_TILT, tilt));
+                break;
+            case OP_RELATIVE:
+                actuator::moveBy(axes, pan, tilt);
+                break;
+            case OP_VELOCITY:
+                actuator::moveAt(axes, pan, tilt);
+                break;
+            case OP_CENTER:
+                fov::center((double)command.pan / center_scale, (double)command.tilt / center_scale);
+                break;
+            default:
+                actuator::halt(axes);
+                break;
+            }
+            metrics::counter("ptz.commands").add();
+        }
+        else
+        {
+            metrics::counter("ptz.rejected").add();
+            LOG_DEBUG("[PTZ] Rejected command of " << size << " bytes, opcode " << (unsigned int)command.opcode);
+        }
+
+        double panDeg, tiltDeg;
+        actuator::position(panDeg, tiltDeg);
+        Command ack;
+        ack.opcode = (uint8_t)(command.opcode | OP_ACK);
+        ack.axes = (uint8_t)status;
+        ack.sequence = command.sequence;
+        ack.pan = centi(panDeg);
+        ack.tilt = centi(tiltDeg);
+        encode(ack, reply);
+    }
+} // namespace ptz
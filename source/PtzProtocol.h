@@ -0,0 +1,62 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __PTZ_PROTOCOL_H__
+#define __PTZ_PROTOCOL_H__
+
+#include <stddef.h>
+#include <stdint.h>
+
+/// Binary pan/tilt commands on the WebRTC data channel.
+/// Every message is 8 bytes, little endian:
+///   0  uint8   opcode   1 absolute, 2 relative, 3 velocity, 4 stop, 5 center
+///   1  uint8   axes     bit 0 pan, bit 1 tilt
+///   2  uint16  sequence chosen by the viewer, echoed in the acknowledgement
+///   4  int16   pan      centidegrees, centidegrees per second for velocity, x in 1/10000 of the width for center
+///   6  int16   tilt     y in 1/10000 of the height from the top for center
+/// Commands go straight to the actuator, the same path shadow deltas take after the coalescer. Each one is answered
+/// with an acknowledgement in the same layout: opcode | 0x80, a status in the axes byte, the sequence and the current
+/// position in centidegrees.
+namespace ptz
+{
+    enum
+    {
+        message_size = 8,
+        center_scale = 10000,
+    };
+
+    enum Opcode
+    {
+        OP_ABSOLUTE = 1,
+        OP_RELATIVE = 2,
+        OP_VELOCITY = 3,
+        OP_STOP = 4,
+        OP_CENTER = 5,
+        OP_ACK = 0x80,
+    };
+
+    enum Status
+    {
+        STATUS_OK = 0,
+        STATUS_MALFORMED = 1,
+        STATUS_UNKNOWN_OPCODE = 2,
+    };
+
+    struct Command
+    {
+        uint8_t opcode;
+        uint8_t axes;
+        uint16_t sequence;
+        int16_t pan;
+        int16_t tilt;
+    };
+
+    bool decode(const uint8_t *data, size_t size, Command &command);
+    void encode(const Command &command, uint8_t *data);
+
+    /// Run one message and write the acknowledgement, reply holds message_size bytes
+    void handle(const uint8_t *data, size_t size, uint8_t *reply);
+} // namespace ptz
+
+#endif //__PTZ_PROTOCOL_H__
@@ -0,0 +1,167 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Recorder.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+
+LOGGER_TAG("recorder")
+
+namespace recorder
+{
+    extern const unsigned int max_preroll_ms = 30000;
+    extern const size_t max_preroll_bytes = 8 * 1024 * 1024;
+
+    namespace
+    {
+        std::atomic<bool> s_enabled(false);
+        std::atomic<unsigned int> s_triggers(0);
+        GstClockTime s_preRoll = 0;
+        GstClockTime s_postRoll = 0;
+
+        // streaming thread only
+        std::deque<GstBuffer *> s_ring;
+        size_t s_ringBytes = 0;
+        unsigned int s_seenTriggers = 0;
+        bool s_pending = false;
+        bool s_recording = false;
+        GstClockTime s_until = 0;
+        GstClockTime s_lastTime = 0;
+
+        GstClockTime timeOf(GstBuffer *buffer)
+        {
+            return GST_BUFFER_PTS_IS_VALID(buffer) ? GST_BUFFER_PTS(buffer) : GST_BUFFER_DTS(buffer);
+        }
+
+        bool isKeyframe(GstBuffer *buffer)
+        {
+            return !GST_BUFFER_FLAG_IS_SET(buffer, GST_BUFFER_FLAG_DELTA_UNIT);
+        }
+
+        /// Drop the oldest GOP while the rest still covers the pre-roll, or while the ring is too large
+        void trim(GstClockTime now)
+        {
+            static metrics::Counter &skipped = metrics::counter("recorder.skipped_bytes");
+            while (true)
+            {
+                size_t next = 1;
+                while (next < s_ring.size() && !isKeyframe(s_ring[next]))
+                {
+                    next++;
+                }
+                if (next == s_ring.size() || (now - timeOf(s_ring[next]) < s_preRoll && s_ringBytes <= max_preroll_bytes))
+                {
+                    return;
+                }
+                for (size_t i = 0; i < next; i++)
+                {
+                    size_t size = gst_buffer_get_size(s_ring.front());
+                    skipped.add(size);
+                    s_ringBytes -= size;
+                    gst_buffer_unref(s_ring.front());
+                    s_ring.pop_front();
+                }
+            }
+        }
+
+        void clear()
+        {
+            for (size_t i = 0; i < s_ring.size(); i++)
+            {
+                gst_buffer_unref(s_ring[i]);
+            }
+            s_ring.clear();
+            s_ringBytes = 0;
+        }
+    } // namespace
+
+    void configure(unsigned int preRollMs, unsigned int postRollMs)
+    {
+        s_preRoll = std::min(preRollMs, max_preroll_ms) * GST_MSECOND;
+        s_postRoll = postRollMs * GST_MSECOND;
+        s_enabled = true;
+        LOG_INFO("[RECORDER] Event recording, " << preRollMs << " ms pre-roll, " << postRollMs << " ms post-roll");
+    }
+
+    bool enabled()
+    {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+
+    void trigger(const char *source)
+    {
+        s_triggers.fetch_add(1);
+        LOG_DEBUG("[RECORDER] Triggered by " << source);
+    }
+
+    bool admit(GstBuffer *buffer, std::vector<GstBuffer *> &preroll)
+    {
+        static metrics::Counter &events = metrics::counter("recorder.events");
+        static metrics::Counter &sent = metrics::counter("recorder.sent_bytes");
+        static metrics::Counter &skipped = metrics::counter("recorder.skipped_bytes");
+        static metrics::Histogram &prerollMs = metrics::histogram("recorder.preroll_ms");
+
+        const GstClockTime now = timeOf(buffer);
+        const bool keyframe = isKeyframe(buffer);
+        if (!GST_CLOCK_TIME_IS_VALID(now))
+        {
+            return s_recording;
+        }
+        if (now < s_lastTime)
+        {
+            // the pipeline was rebuilt, its clock starts over
+            clear();
+        }
+        s_lastTime = now;
+
+        unsigned int triggers = s_triggers.load();
+        if (triggers != s_seenTriggers)
+        {
+            s_seenTriggers = triggers;
+            s_until = now + s_postRoll;
+            s_pending = !s_recording;
+        }
+        // the ring always starts on a keyframe, without one the event waits for the next keyframe
+        if (s_pending && (keyframe || !s_ring.empty()))
+        {
+            s_pending = false;
+            s_recording = true;
+            events.add();
+            prerollMs.record(s_ring.empty() ? 0 : (now - timeOf(s_ring.front())) / GST_MSECOND);
+            for (size_t i = 0; i < s_ring.size(); i++)
+            {
+                sent.add(gst_buffer_get_size(s_ring[i]));
+            }
+            preroll.insert(preroll.end(), s_ring.begin(), s_ring.end());
+            s_ring.clear();
+            s_ringBytes = 0;
+            LOG_INFO("[RECORDER] Event started with " << preroll.size() << " buffers of pre-roll");
+        }
+
+        if (s_recording)
+        {
+            if (!(keyframe && now > s_until))
+            {
+                sent.add(gst_buffer_get_size(buffer));
+                return true;
+            }
+            s_recording = false;
+            LOG_INFO("[RECORDER] Event ended");
+        }
+
+        if (s_ring.empty() && !keyframe)
+        {
+            skipped.add(gst_buffer_get_size(buffer));
+            return false;
+        }
+        s_ring.push_back(gst_buffer_ref(buffer));
+        s_ringBytes += gst_buffer_get_size(buffer);
+        trim(now);
+        return false;
+    }
+} // namespace recorder
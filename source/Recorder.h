@@ -0,0 +1,34 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __RECORDER_H__
+#define __RECORDER_H__
+
+#include <gst/gst.h>
+#include <vector>
+
+/// Event recording of the encoded stream.
+/// Outside of events the encoded buffers are held in a ring of whole GOPs covering the pre-roll and are not sent.
+/// A trigger (shadow, motion) opens an event: the ring is released ahead of the current buffer, so the clip starts on
+/// the oldest keyframe of the ring, and buffers are sent until the post-roll after the last trigger has passed. The
+/// event ends on a keyframe, which becomes the start of the next pre-roll. Exported as "recorder.events",
+/// "recorder.sent_bytes", "recorder.skipped_bytes" and "recorder.preroll_ms".
+namespace recorder
+{
+    extern const unsigned int max_preroll_ms;
+    extern const size_t max_preroll_bytes;
+
+    /// Switch to event recording, without this call every buffer is sent
+    void configure(unsigned int preRollMs, unsigned int postRollMs);
+    bool enabled();
+
+    /// Open an event or extend the running one, from any thread
+    void trigger(const char *source);
+
+    /// Streaming thread only. Returns false when the buffer is held back. When an event opens, the pre-roll to send
+    /// ahead of the buffer is appended to preroll, oldest first, each with a reference for the caller.
+    bool admit(GstBuffer *buffer, std::vector<GstBuffer *> &preroll);
+} // namespace recorder
+
+#endif //__RECORDER_H__
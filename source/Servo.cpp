@@ -3,6 +3,10 @@
  * SPDX-License-Identifier: Apache-2.0.
  */
 #include "Servo.h"
+#include "Gpio.h"
+#include "Tracer.h"
+
+#include <cmath>
 
 namespace servo
 {
@@ -16,25 +20,33 @@ namespace servo
 
     int panServo(unsigned int pulsewidth)
     {
+        TRACE_SCOPE("servo.pan");
         int result;
-        result = gpioServo(pan_gpio, pulsewidth);
+        result = gpio::servo(pan_gpio, pulsewidth);
         return result;
     }
 
     int tiltServo(unsigned int pulsewidth)
     {
+        TRACE_SCOPE("servo.tilt");
         int result;
-        result = gpioServo(tilt_gpio, pulsewidth);
+        result = gpio::servo(tilt_gpio, pulsewidth);
         return result;
     }
 
-    unsigned angleToPulsewidth(int angle)
+    unsigned angleToPulsewidth(double angle)
     {
         unsigned int pulsewidth;
-        pulsewidth = pulse_width_0 + (angle * (pulse_width_360 - pulse_width_0) / 360);
+        // fractions of a degree matter for the intermediate steps of a trajectory
+        pulsewidth = (unsigned int)lround(pulse_width_0 + angle * (pulse_width_360 - pulse_width_0) / 360.0);
         return pulsewidth;
     }
 
+    double pulsewidthToAngle(unsigned int pulsewidth)
+    {
+        return ((double)pulsewidth - pulse_width_0) * 360.0 / (pulse_width_360 - pulse_width_0);
+    }
+
     void stop(int signum)
     {
         run = 0;
@@ -9,7 +9,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <signal.h>
-#include <pigpio.h>
 
 namespace servo
 {
@@ -21,7 +20,8 @@ namespace servo
 
     int panServo(unsigned int pulsewidth);
     int tiltServo(unsigned int pulsewidth);
-    unsigned angleToPulsewidth(int angle);
+    unsigned angleToPulsewidth(double angle);
+    double pulsewidthToAngle(unsigned int pulsewidth);
     void stop(int signum);
 } // namespace servo
 
@@ -0,0 +1,223 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "ShadowAgent.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <sstream>
+#include <unistd.h>
+
+LOGGER_TAG("shadow")
+
+namespace shadow
+{
+    extern const char *const null_value = "null";
+
+    namespace
+    {
+        // updates never answered are forgotten after this, e.g. when the connection dropped
+        const std::chrono::seconds inflight_timeout(30);
+    } // namespace
+
+    Agent::Agent(const std::vector<std::string> &properties, const Properties &defaults, Coalescer::Apply apply, Publish publish,
+                 unsigned int reportIntervalMs)
+        : m_properties(properties),
+          m_defaults(defaults),
+          m_apply(apply),
+          m_publish(publish),
+          m_coalescer(std::bind(&Agent::apply, this, std::placeholders::_1), std::bind(&Agent::report, this, std::placeholders::_1),
+                      reportIntervalMs),
+          m_sequence(0)
+    {
+    }
+
+    Agent::~Agent()
+    {
+        // the last report still needs the members below the coalescer
+        stop();
+    }
+
+    void Agent::start()
+    {
+        m_coalescer.start();
+    }
+
+    void Agent::stop()
+    {
+        m_coalescer.stop();
+    }
+
+    const std::vector<std::string> &Agent::properties() const
+    {
+        return m_properties;
+    }
+
+    std::string Agent::current(const std::string &property) const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        Properties::const_iterator it = m_current.find(property);
+        return it == m_current.end() ? "" : it->second;
+    }
+
+    void Agent::restore(const Properties &applied)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_applied = applied;
+    }
+
+    void Agent::onLocalChange(const Properties &applied)
+    {
+        Properties changed;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (Properties::const_iterator it = applied.begin(); it != applied.end(); ++it)
+            {
+                Properties::iterator known = m_applied.find(it->first);
+                if (std::find(m_properties.begin(), m_properties.end(), it->first) != m_properties.end() &&
+                    (known == m_applied.end() || known->second != it->second))
+                {
+                    m_applied[it->first] = it->second;
+                    changed.insert(*it);
+                }
+            }
+        }
+        for (Properties::const_iterator it = changed.begin(); it != changed.end(); ++it)
+        {
+            m_coalescer.applied(it->first, it->second);
+        }
+    }
+
+    void Agent::onDelta(const Properties &state)
+    {
+        bool watched = false;
+        for (size_t i = 0; i < m_properties.size(); i++)
+        {
+            Properties::const_iterator it = state.find(m_properties[i]);
+            if (it == state.end())
+            {
+                LOG_DEBUG("[SHADOW] Delta did not report a change in " << m_properties[i]);
+                continue;
+            }
+            watched = true;
+            if (it->second == null_value)
+            {
+                Properties::const_iterator fallback = m_defaults.find(it->first);
+                if (fallback == m_defaults.end())
+                {
+                    LOG_DEBUG("[SHADOW] Delta reports that " << it->first << " was deleted, it has no default");
+                    continue;
+                }
+                LOG_DEBUG("[SHADOW] Delta reports that " << it->first << " was deleted. Resetting it to " << fallback->second);
+                m_coalescer.submit(it->first, fallback->second);
+            }
+            else
+            {
+                LOG_DEBUG("[SHADOW] Delta reports that " << it->first << " has a desired value of " << it->second);
+                m_coalescer.submit(it->first, it->second);
+            }
+        }
+        if (!watched)
+        {
+            LOG_INFO("[SHADOW] Delta did not report a change in any watched property");
+        }
+    }
+
+    void Agent::onGetAccepted(const Properties &reported)
+    {
+        Properties stale;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (size_t i = 0; i < m_properties.size(); i++)
+            {
+                Properties::const_iterator it = reported.find(m_properties[i]);
+                if (it != reported.end())
+                {
+                    LOG_DEBUG("[SHADOW] Shadow contains " << it->first << ", local value is " << it->second);
+                    m_current[it->first] = it->second == null_value ? "" : it->second;
+                }
+                Properties::const_iterator applied = m_applied.find(m_properties[i]);
+                if (applied != m_applied.end() && (it == reported.end() || it->second != applied->second))
+                {
+                    stale.insert(*applied);
+                }
+            }
+        }
+        // a pending delta of the same property is submitted after this and wins
+        for (Properties::const_iterator it = stale.begin(); it != stale.end(); ++it)
+        {
+            LOG_INFO("[SHADOW] Reporting " << it->first << " " << it->second << " applied while the shadow was unreachable");
+            m_coalescer.submit(it->first, it->second);
+        }
+    }
+
+    void Agent::onUpdateAccepted(const Properties &reported, const std::string &clientToken)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::map<std::string, std::chrono::steady_clock::time_point>::iterator inflight = m_inflight.find(clientToken);
+        if (inflight != m_inflight.end())
+        {
+            uint64_t elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - inflight->second).count();
+            metrics::histogram("shadow.accept_ms").record(elapsed);
+            m_inflight.erase(inflight);
+        }
+        // updates of the desired state by other clients carry no reported state
+        for (size_t i = 0; i < m_properties.size(); i++)
+        {
+            Properties::const_iterator it = reported.find(m_properties[i]);
+            if (it != reported.end())
+            {
+                m_current[it->first] = it->second == null_value ? "" : it->second;
+            }
+        }
+    }
+
+    void Agent::onUpdateRejected(int code, const std::string &message, const std::string &clientToken)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_inflight.erase(clientToken);
+        }
+        metrics::counter("shadow.rejected").add();
+        LOG_INFO("[SHADOW] Update of shadow state failed with message " << message << " and code " << code << ".");
+    }
+
+    Properties Agent::apply(const Properties &properties)
+    {
+        Properties rejected = m_apply(properties);
+        std::lock_guard<std::mutex> lock(m_lock);
+        for (Properties::const_iterator it = properties.begin(); it != properties.end(); ++it)
+        {
+            if (rejected.count(it->first) == 0)
+            {
+                m_applied[it->first] = it->second;
+            }
+        }
+        return rejected;
+    }
+
+    void Agent::report(const Properties &properties)
+    {
+        std::ostringstream token;
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            token << "c3-" << getpid() << "-" << ++m_sequence;
+            for (std::map<std::string, std::chrono::steady_clock::time_point>::iterator it = m_inflight.begin(); it != m_inflight.end();)
+            {
+                if (now - it->second > inflight_timeout)
+                {
+                    m_inflight.erase(it++);
+                }
+                else
+                {
+                    ++it;
+                }
+            }
+            m_inflight[token.str()] = now;
+        }
+        m_publish(properties, token.str());
+    }
+} // namespace shadow
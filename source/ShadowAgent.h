@@ -0,0 +1,81 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SHADOW_AGENT_H__
+#define __SHADOW_AGENT_H__
+
+#include "ShadowCoalescer.h"
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+
+/// Device side of the shadow topics, independent of the MQTT client.
+/// The executables feed it from the AWS IoT shadow client, the load test from the local stand-in in ShadowLocal.h.
+/// Deltas of the watched properties go through the coalescer, its reports are published with a client token so the
+/// time until the shadow service accepts them is measured (shadow.accept_ms).
+namespace shadow
+{
+    /// Value of a property which is null in the shadow document
+    extern const char *const null_value;
+
+    class Agent
+    {
+    public:
+        typedef std::function<void(const Properties &state, const std::string &clientToken)> Publish;
+
+        /// defaults holds the value applied when the desired value of a property is deleted, a property without one
+        /// keeps its value. apply returns the properties it rejected, they are neither recorded nor reported.
+        Agent(const std::vector<std::string> &properties, const Properties &defaults, Coalescer::Apply apply, Publish publish,
+              unsigned int reportIntervalMs);
+        ~Agent();
+
+        void start();
+        void stop();
+
+        const std::vector<std::string> &properties() const;
+        /// Last reported value the shadow service accepted, empty when unknown
+        std::string current(const std::string &property) const;
+
+        /// State applied from the local cache before the shadow service was reachable
+        void restore(const Properties &applied);
+
+        /// Values the device applied without a delta, e.g. a preset or a data channel command, changed ones are reported
+        void onLocalChange(const Properties &applied);
+
+        /// update/delta: state holds the desired values which differ from the reported ones
+        void onDelta(const Properties &state);
+        /// get/accepted: reported state of the document, values the device has applied differently are reported again
+        void onGetAccepted(const Properties &reported);
+        /// update/accepted: state of the accepted update, also for updates from other clients
+        void onUpdateAccepted(const Properties &reported, const std::string &clientToken);
+        /// update/rejected
+        void onUpdateRejected(int code, const std::string &message, const std::string &clientToken);
+
+    private:
+        Agent(const Agent &);
+        Agent &operator=(const Agent &);
+
+        Properties apply(const Properties &properties);
+        void report(const Properties &properties);
+
+        std::vector<std::string> m_properties;
+        Properties m_defaults;
+        Coalescer::Apply m_apply;
+        Publish m_publish;
+        Coalescer m_coalescer;
+
+        mutable std::mutex m_lock;
+        Properties m_current; // accepted by the shadow service
+        Properties m_applied; // applied on the device
+        // client token of the updates in flight and when they were published
+        std::map<std::string, std::chrono::steady_clock::time_point> m_inflight;
+        unsigned long m_sequence;
+    };
+} // namespace shadow
+
+#endif //__SHADOW_AGENT_H__
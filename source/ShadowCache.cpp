@@ -0,0 +1,233 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "ShadowCache.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <errno.h>
+#include <fcntl.h>
+#include <fstream>
+#include <sstream>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+LOGGER_TAG("shadow")
+
+namespace shadow
+{
+    extern const unsigned int cache_write_interval_ms = 1000;
+
+    namespace
+    {
+        const char *checksum_key = "checksum";
+
+        /// FNV-1a, enough to tell a damaged file from a good one
+        uint32_t checksum(const std::string &text)
+        {
+            uint32_t hash = 2166136261u;
+            for (size_t i = 0; i < text.size(); i++)
+            {
+                hash = (hash ^ (uint8_t)text[i]) * 16777619u;
+            }
+            return hash;
+        }
+
+        std::string serialize(const Properties &state)
+        {
+            std::ostringstream text;
+            for (Properties::const_iterator it = state.begin(); it != state.end(); ++it)
+            {
+                text << it->first << "=" << it->second << "\n";
+            }
+            return text.str();
+        }
+
+        bool writeAll(int fd, const std::string &text)
+        {
+            size_t written = 0;
+            while (written < text.size())
+            {
+                ssize_t result = ::write(fd, text.data() + written, text.size() - written);
+                if (result < 0 && errno != EINTR)
+                {
+                    return false;
+                }
+                written += result > 0 ? result : 0;
+            }
+            return true;
+        }
+
+        /// The rename is only durable once the directory entry is on disk
+        void syncDirectory(const std::string &path)
+        {
+            size_t slash = path.find_last_of('/');
+            std::string directory = slash == std::string::npos ? "." : (slash == 0 ? "/" : path.substr(0, slash));
+            int fd = open(directory.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd >= 0)
+            {
+                fsync(fd);
+                close(fd);
+            }
+        }
+    } // namespace
+
+    Cache::Cache(const std::string &path, const std::vector<std::string> &properties)
+        : m_path(path), m_properties(properties), m_dirty(false), m_stopping(false)
+    {
+    }
+
+    Cache::~Cache()
+    {
+        stop();
+    }
+
+    bool Cache::load(Properties &state)
+    {
+        std::ifstream file(m_path.c_str());
+        if (!file)
+        {
+            LOG_INFO("[SHADOW] No cached state in " << m_path);
+            return false;
+        }
+
+        Properties loaded;
+        std::string content;
+        std::string line;
+        bool verified = false;
+        while (std::getline(file, line))
+        {
+            size_t equals = line.find('=');
+            if (equals == std::string::npos)
+            {
+                continue;
+            }
+            std::string key = line.substr(0, equals);
+            std::string value = line.substr(equals + 1);
+            if (key == checksum_key)
+            {
+                verified = strtoul(value.c_str(), NULL, 16) == checksum(content);
+                break;
+            }
+            content += line + "\n";
+            if (std::find(m_properties.begin(), m_properties.end(), key) != m_properties.end())
+            {
+                loaded[key] = value;
+            }
+        }
+        if (!verified)
+        {
+            LOG_ERROR("[SHADOW] Cached state in " << m_path << " is damaged, ignoring it");
+            return false;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_state = loaded;
+        }
+        state = loaded;
+        LOG_INFO("[SHADOW] Restored " << loaded.size() << " properties from " << m_path);
+        return !loaded.empty();
+    }
+
+    void Cache::start()
+    {
+        m_thread = std::thread(&Cache::run, this);
+    }
+
+    void Cache::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void Cache::update(const Properties &applied)
+    {
+        bool changed = false;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            for (size_t i = 0; i < m_properties.size(); i++)
+            {
+                Properties::const_iterator it = applied.find(m_properties[i]);
+                if (it != applied.end() && m_state[it->first] != it->second)
+                {
+                    m_state[it->first] = it->second;
+                    changed = true;
+                }
+            }
+            m_dirty = m_dirty || changed;
+        }
+        if (changed)
+        {
+            m_wakeup.notify_one();
+        }
+    }
+
+    void Cache::run()
+    {
+        threadstats::nameThread("c3-shadow-cache");
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true)
+        {
+            m_wakeup.wait(lock, [this]
+                          { return m_stopping || m_dirty; });
+            if (!m_dirty)
+            {
+                break;
+            }
+
+            Properties state = m_state;
+            m_dirty = false;
+            lock.unlock();
+            write(state);
+            lock.lock();
+
+            // limits the flash wear while a slider is dragged
+            m_wakeup.wait_for(lock, std::chrono::milliseconds(cache_write_interval_ms), [this]
+                              { return m_stopping; });
+        }
+    }
+
+    bool Cache::write(const Properties &state)
+    {
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        std::string content = serialize(state);
+        char line[32];
+        snprintf(line, sizeof(line), "%s=%08x\n", checksum_key, checksum(content));
+        content += line;
+
+        std::string temporary = m_path + ".tmp";
+        int fd = open(temporary.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            LOG_ERROR("[SHADOW] Unable to write " << temporary << ": " << strerror(errno));
+            return false;
+        }
+        bool ok = writeAll(fd, content) && fsync(fd) == 0;
+        close(fd);
+        if (!ok || rename(temporary.c_str(), m_path.c_str()) != 0)
+        {
+            LOG_ERROR("[SHADOW] Unable to update " << m_path << ": " << strerror(errno));
+            unlink(temporary.c_str());
+            return false;
+        }
+        syncDirectory(m_path);
+
+        metrics::histogram("shadow.cache_write_ms").record(
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count());
+        return true;
+    }
+} // namespace shadow
@@ -0,0 +1,60 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SHADOW_CACHE_H__
+#define __SHADOW_CACHE_H__
+
+#include "ShadowCoalescer.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// Last applied shadow state on local storage.
+/// The state is written by a background thread at most once per write interval. Every write goes to a temporary
+/// file which is synced and renamed over the cache, and the content carries a checksum, so a power cut leaves either
+/// the previous or the new state behind.
+namespace shadow
+{
+    extern const unsigned int cache_write_interval_ms;
+
+    class Cache
+    {
+    public:
+        /// Only the listed properties are kept
+        Cache(const std::string &path, const std::vector<std::string> &properties);
+        ~Cache();
+
+        /// Read the cached state, false when there is none or it is damaged
+        bool load(Properties &state);
+
+        void start();
+        /// Write what is still pending, then stop the writer
+        void stop();
+
+        /// Record newly applied values
+        void update(const Properties &applied);
+
+    private:
+        Cache(const Cache &);
+        Cache &operator=(const Cache &);
+
+        void run();
+        bool write(const Properties &state);
+
+        std::string m_path;
+        std::vector<std::string> m_properties;
+
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        Properties m_state;
+        bool m_dirty;
+        bool m_stopping;
+        std::thread m_thread;
+    };
+} // namespace shadow
+
+#endif //__SHADOW_CACHE_H__
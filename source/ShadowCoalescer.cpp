@@ -0,0 +1,136 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "ShadowCoalescer.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Logger.h"
+
+LOGGER_TAG("shadow")
+
+namespace shadow
+{
+    extern const unsigned int debounce_ms = 20;
+    extern const unsigned int default_report_interval_ms = 500;
+
+    Coalescer::Coalescer(Apply apply, Callback report, unsigned int reportIntervalMs)
+        : m_apply(apply), m_report(report), m_reportInterval(reportIntervalMs), m_stopping(false)
+    {
+    }
+
+    Coalescer::~Coalescer()
+    {
+        stop();
+    }
+
+    void Coalescer::start()
+    {
+        m_thread = std::thread(&Coalescer::run, this);
+        LOG_INFO("[SHADOW] Reporting shadow state at most every " << m_reportInterval.count() << "ms");
+    }
+
+    void Coalescer::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void Coalescer::submit(const std::string &property, const std::string &value)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            std::pair<Properties::iterator, bool> inserted = m_pending.insert(std::make_pair(property, value));
+            if (!inserted.second)
+            {
+                inserted.first->second = value;
+                metrics::counter("shadow.coalesced").add();
+            }
+        }
+        metrics::counter("shadow.deltas").add();
+        m_wakeup.notify_one();
+    }
+
+    void Coalescer::applied(const std::string &property, const std::string &value)
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_unreported[property] = value;
+        }
+        m_wakeup.notify_one();
+    }
+
+    void Coalescer::run()
+    {
+        threadstats::nameThread("c3-shadow-sync");
+        // the first change is reported right away
+        std::chrono::steady_clock::time_point lastReport = std::chrono::steady_clock::now() - m_reportInterval;
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true)
+        {
+            if (m_pending.empty() && !m_stopping)
+            {
+                if (m_unreported.empty())
+                {
+                    m_wakeup.wait(lock, [this]
+                                  { return m_stopping || !m_pending.empty() || !m_unreported.empty(); });
+                }
+                else
+                {
+                    m_wakeup.wait_until(lock, lastReport + m_reportInterval, [this]
+                                        { return m_stopping || !m_pending.empty(); });
+                }
+            }
+
+            if (!m_pending.empty() && !m_stopping)
+            {
+                // let the rest of the burst arrive, only its newest values get applied
+                m_wakeup.wait_for(lock, std::chrono::milliseconds(debounce_ms), [this]
+                                  { return m_stopping; });
+            }
+
+            Properties batch;
+            batch.swap(m_pending);
+            if (!batch.empty())
+            {
+                lock.unlock();
+                Properties rejected = m_apply(batch);
+                lock.lock();
+                metrics::counter("shadow.applied").add();
+                for (Properties::const_iterator it = batch.begin(); it != batch.end(); ++it)
+                {
+                    if (rejected.count(it->first) == 0)
+                    {
+                        m_unreported[it->first] = it->second;
+                    }
+                }
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            if (!m_unreported.empty() && (m_stopping || now >= lastReport + m_reportInterval))
+            {
+                Properties report;
+                report.swap(m_unreported);
+                lock.unlock();
+                m_report(report);
+                lock.lock();
+                lastReport = now;
+                metrics::counter("shadow.reports").add();
+                LOG_DEBUG("[SHADOW] Reported " << report.size() << " properties");
+            }
+
+            if (m_stopping && m_pending.empty() && m_unreported.empty())
+            {
+                break;
+            }
+        }
+    }
+} // namespace shadow
@@ -0,0 +1,68 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SHADOW_COALESCER_H__
+#define __SHADOW_COALESCER_H__
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+
+/// Coalescing of bursty shadow deltas.
+/// Deltas only record the latest desired value per property. A worker thread applies the newest values after a
+/// short debounce and reports the applied properties back at most once per report interval, so a slider dragged in
+/// the console turns into a few servo targets and a few reported state updates instead of one QoS1 publish per delta.
+namespace shadow
+{
+    typedef std::map<std::string, std::string> Properties;
+
+    extern const unsigned int debounce_ms;
+    extern const unsigned int default_report_interval_ms;
+
+    class Coalescer
+    {
+    public:
+        typedef std::function<void(const Properties &)> Callback;
+        /// Returns the properties whose values the device rejected
+        typedef std::function<Properties(const Properties &)> Apply;
+
+        /// apply drives the device with the newest values, report publishes the properties changed since the last
+        /// report, rejected values are not reported
+        Coalescer(Apply apply, Callback report, unsigned int reportIntervalMs);
+        ~Coalescer();
+
+        void start();
+        /// Apply and report what is still pending, then stop the worker
+        void stop();
+
+        /// Record the desired value of a property, replacing any value not applied yet
+        void submit(const std::string &property, const std::string &value);
+        /// Record a value the device applied on its own, it is only reported
+        void applied(const std::string &property, const std::string &value);
+
+    private:
+        Coalescer(const Coalescer &);
+        Coalescer &operator=(const Coalescer &);
+
+        void run();
+
+        Apply m_apply;
+        Callback m_report;
+        std::chrono::milliseconds m_reportInterval;
+
+        Properties m_pending;    // desired, not applied yet
+        Properties m_unreported; // applied, not reported yet
+
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        bool m_stopping;
+        std::thread m_thread;
+    };
+} // namespace shadow
+
+#endif //__SHADOW_COALESCER_H__
@@ -0,0 +1,233 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "ShadowLocal.h"
+#include "ShadowAgent.h"
+#include "ThreadStats.h"
+#include "Logger.h"
+
+LOGGER_TAG("shadow")
+
+namespace shadow
+{
+    namespace
+    {
+        void merge(Properties &into, const Properties &from)
+        {
+            for (Properties::const_iterator it = from.begin(); it != from.end(); ++it)
+            {
+                if (it->second == null_value)
+                {
+                    into.erase(it->first);
+                }
+                else
+                {
+                    into[it->first] = it->second;
+                }
+            }
+        }
+
+        Properties delta(const Properties &desired, const Properties &reported)
+        {
+            Properties result;
+            for (Properties::const_iterator it = desired.begin(); it != desired.end(); ++it)
+            {
+                Properties::const_iterator current = reported.find(it->first);
+                if (current == reported.end() || current->second != it->second)
+                {
+                    result.insert(*it);
+                }
+            }
+            return result;
+        }
+    } // namespace
+
+    LocalService::LocalService(const std::string &thingName, unsigned int latencyMs)
+        : m_prefix("$aws/things/" + thingName + "/shadow/"), m_latency(latencyMs), m_stopping(false)
+    {
+        m_document.version = 0;
+        m_document.code = 0;
+    }
+
+    LocalService::~LocalService()
+    {
+        stop();
+    }
+
+    void LocalService::start()
+    {
+        m_thread = std::thread(&LocalService::run, this);
+    }
+
+    void LocalService::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    std::string LocalService::topic(const std::string &suffix) const
+    {
+        return m_prefix + suffix;
+    }
+
+    void LocalService::subscribe(const std::string &topic, Handler handler)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_subscriptions[topic].push_back(handler);
+    }
+
+    void LocalService::publish(const std::string &topic, const Message &message)
+    {
+        enqueue(topic, message, true);
+    }
+
+    Message LocalService::document() const
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_document;
+    }
+
+    void LocalService::enqueue(const std::string &topic, const Message &message, bool request)
+    {
+        Pending pending;
+        pending.due = std::chrono::steady_clock::now() + m_latency;
+        pending.topic = topic;
+        pending.message = message;
+        pending.request = request;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_queue.push_back(pending);
+        }
+        m_wakeup.notify_one();
+    }
+
+    void LocalService::run()
+    {
+        threadstats::nameThread("c3-shadow-local");
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true)
+        {
+            // the latency is the same for every message, so the queue is ordered by due time
+            while (!m_stopping && (m_queue.empty() || m_queue.front().due > std::chrono::steady_clock::now()))
+            {
+                if (m_queue.empty())
+                {
+                    m_wakeup.wait(lock);
+                }
+                else
+                {
+                    m_wakeup.wait_until(lock, m_queue.front().due);
+                }
+            }
+            if (m_stopping)
+            {
+                break;
+            }
+            Pending pending = m_queue.front();
+            m_queue.pop_front();
+            lock.unlock();
+            handle(pending);
+            lock.lock();
+        }
+    }
+
+    void LocalService::handle(const Pending &pending)
+    {
+        if (pending.request)
+        {
+            if (pending.topic == topic("get"))
+            {
+                handleGet(pending.message);
+            }
+            else if (pending.topic == topic("update"))
+            {
+                handleUpdate(pending.message);
+            }
+            else
+            {
+                LOG_ERROR("[SHADOW] Local service ignores a publish to " << pending.topic);
+            }
+            return;
+        }
+
+        std::vector<Handler> handlers;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            std::map<std::string, std::vector<Handler>>::const_iterator it = m_subscriptions.find(pending.topic);
+            if (it != m_subscriptions.end())
+            {
+                handlers = it->second;
+            }
+        }
+        for (size_t i = 0; i < handlers.size(); i++)
+        {
+            handlers[i](pending.message);
+        }
+    }
+
+    void LocalService::handleGet(const Message &request)
+    {
+        Message response;
+        response.clientToken = request.clientToken;
+        response.code = 0;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            response.version = m_document.version;
+            response.desired = m_document.desired;
+            response.reported = m_document.reported;
+        }
+        if (response.version == 0)
+        {
+            response.code = 404;
+            response.error = "No shadow exists with name: '" + m_prefix + "'";
+            enqueue(topic("get/rejected"), response, false);
+            return;
+        }
+        response.delta = delta(response.desired, response.reported);
+        enqueue(topic("get/accepted"), response, false);
+    }
+
+    void LocalService::handleUpdate(const Message &request)
+    {
+        Message response = request;
+        response.delta.clear();
+        response.code = 0;
+        if (request.desired.empty() && request.reported.empty())
+        {
+            response.code = 400;
+            response.error = "Missing required node: state";
+            enqueue(topic("update/rejected"), response, false);
+            return;
+        }
+
+        Message changed;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            merge(m_document.desired, request.desired);
+            merge(m_document.reported, request.reported);
+            response.version = ++m_document.version;
+            changed = m_document;
+        }
+        enqueue(topic("update/accepted"), response, false);
+
+        // like the shadow service, only a change of the desired state produces a delta
+        Properties pending = delta(changed.desired, changed.reported);
+        if (!request.desired.empty() && !pending.empty())
+        {
+            Message event;
+            event.delta = pending;
+            event.version = changed.version;
+            event.clientToken = request.clientToken;
+            event.code = 0;
+            enqueue(topic("update/delta"), event, false);
+        }
+    }
+} // namespace shadow
@@ -0,0 +1,92 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SHADOW_LOCAL_H__
+#define __SHADOW_LOCAL_H__
+
+#include "ShadowCoalescer.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+/// In-process stand-in for the AWS IoT shadow service of one thing.
+/// Clients publish requests on $aws/things/<thing>/shadow/get and .../update and subscribe to get/accepted,
+/// get/rejected, update/accepted, update/rejected and update/delta. The classic shadow document semantics are kept:
+/// every update bumps the version, null values delete properties and update/delta carries the desired values that
+/// differ from the reported ones. Messages are delivered in order on one thread after a configurable one-way latency,
+/// like the callbacks of an MQTT client.
+namespace shadow
+{
+    struct Message
+    {
+        Properties desired;
+        Properties reported;
+        Properties delta;
+        uint64_t version;
+        std::string clientToken;
+        int code; // rejected only
+        std::string error;
+    };
+
+    class LocalService
+    {
+    public:
+        typedef std::function<void(const Message &)> Handler;
+
+        LocalService(const std::string &thingName, unsigned int latencyMs);
+        ~LocalService();
+
+        void start();
+        void stop();
+
+        /// Full topic name for a suffix like "update/delta"
+        std::string topic(const std::string &suffix) const;
+
+        void subscribe(const std::string &topic, Handler handler);
+        void publish(const std::string &topic, const Message &message);
+
+        /// Current document
+        Message document() const;
+
+    private:
+        LocalService(const LocalService &);
+        LocalService &operator=(const LocalService &);
+
+        struct Pending
+        {
+            std::chrono::steady_clock::time_point due;
+            std::string topic;
+            Message message;
+            bool request; // published by a client, otherwise a response for the subscribers
+        };
+
+        void run();
+        void enqueue(const std::string &topic, const Message &message, bool request);
+        void handle(const Pending &pending);
+        void handleGet(const Message &request);
+        void handleUpdate(const Message &request);
+
+        std::string m_prefix;
+        std::chrono::milliseconds m_latency;
+
+        mutable std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        std::deque<Pending> m_queue;
+        std::map<std::string, std::vector<Handler>> m_subscriptions;
+        bool m_stopping;
+        std::thread m_thread;
+
+        // only touched by the service thread, copied under the lock for document()
+        Message m_document;
+    };
+} // namespace shadow
+
+#endif //__SHADOW_LOCAL_H__
@@ -0,0 +1,543 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Snapshot.h"
+#include "Substream.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/video/video.h>
+#include <mutex>
+#include <string.h>
+#include <thread>
+#include <time.h>
+
+LOGGER_TAG("snapshot")
+
+namespace snapshot
+{
+    extern const unsigned int cache_ttl_ms = 2000;
+    extern const unsigned int capture_timeout_ms = 1000;
+    extern const int jpeg_quality = 85;
+
+    namespace
+    {
+        // the first image of an encoder includes building and starting its pipeline
+        const GstClockTime encode_timeout = 2 * GST_SECOND;
+        const char *const hardware_encoder = "v4l2jpegenc";
+        const char *const software_encoder = "jpegenc";
+
+        uint64_t realtimeMs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            return (uint64_t)now.tv_sec * 1000 + now.tv_nsec / 1000000;
+        }
+
+        /// appsrc ! JPEG encoder ! appsink, rebuilt when the caps of the frames change
+        class Encoder
+        {
+        public:
+            Encoder() : m_pipeline(NULL), m_source(NULL), m_sink(NULL), m_caps(NULL), m_hardware(false) {}
+            ~Encoder() { close(); }
+
+            bool encode(GstBuffer *frame, GstCaps *caps, std::vector<uint8_t> &jpeg);
+
+            /// The hardware encoder failed once, every encoder uses the software one from then on
+            static std::atomic<bool> s_noHardware;
+            static std::atomic<const char *> s_name;
+
+        private:
+            Encoder(const Encoder &);
+            Encoder &operator=(const Encoder &);
+
+            bool build(GstCaps *caps, bool hardware);
+            bool run(GstBuffer *frame, std::vector<uint8_t> &jpeg);
+            void close();
+
+            GstElement *m_pipeline;
+            GstElement *m_source;
+            GstElement *m_sink;
+            GstCaps *m_caps;
+            bool m_hardware;
+        };
+
+        std::atomic<bool> Encoder::s_noHardware(false);
+        std::atomic<const char *> Encoder::s_name(NULL);
+
+        bool Encoder::build(GstCaps *caps, bool hardware)
+        {
+            m_pipeline = gst_pipeline_new("snapshot");
+            m_source = gst_element_factory_make("appsrc", NULL);
+            GstElement *encoder = gst_element_factory_make(hardware ? hardware_encoder : software_encoder, NULL);
+            m_sink = gst_element_factory_make("appsink", NULL);
+            if (!m_pipeline || !m_source || !encoder || !m_sink)
+            {
+                GstElement *created[] = {m_pipeline, m_source, encoder, m_sink};
+                for (size_t i = 0; i < sizeof(created) / sizeof(created[0]); i++)
+                {
+                    if (created[i] != NULL)
+                        gst_object_unref(gst_object_ref_sink(created[i]));
+                }
+                m_pipeline = m_source = m_sink = NULL;
+                return false;
+            }
+
+            g_object_set(G_OBJECT(m_source), "caps", caps, "format", GST_FORMAT_TIME, NULL);
+            if (hardware)
+            {
+                GstStructure *controls = gst_structure_new("controls", "compression_quality", G_TYPE_INT, jpeg_quality, NULL);
+                g_object_set(G_OBJECT(encoder), "extra-controls", controls, NULL);
+                gst_structure_free(controls);
+            }
+            else
+            {
+                g_object_set(G_OBJECT(encoder), "quality", jpeg_quality, NULL);
+            }
+            g_object_set(G_OBJECT(m_sink), "sync", FALSE, "max-buffers", 1, NULL);
+
+            gst_bin_add_many(GST_BIN(m_pipeline), m_source, encoder, m_sink, NULL);
+            if (!gst_element_link_many(m_source, encoder, m_sink, NULL) || gst_element_set_state(m_pipeline, GST_STATE_PLAYING) == GST_STATE_CHANGE_FAILURE)
+            {
+                close();
+                return false;
+            }
+            m_caps = gst_caps_ref(caps);
+            m_hardware = hardware;
+            s_name = hardware ? hardware_encoder : software_encoder;
+            gchar *description = gst_caps_to_string(caps);
+            LOG_INFO("[SNAPSHOT] " << s_name.load() << " for " << description);
+            g_free(description);
+            return true;
+        }
+
+        bool Encoder::run(GstBuffer *frame, std::vector<uint8_t> &jpeg)
+        {
+            // the frame stays shared with the camera pipeline, the encoder only reads it
+            if (gst_app_src_push_buffer(GST_APP_SRC(m_source), gst_buffer_ref(frame)) != GST_FLOW_OK)
+            {
+                return false;
+            }
+            GstSample *sample = gst_app_sink_try_pull_sample(GST_APP_SINK(m_sink), encode_timeout);
+            if (sample == NULL)
+            {
+                return false;
+            }
+            GstMapInfo map;
+            GstBuffer *buffer = gst_sample_get_buffer(sample);
+            bool mapped = buffer != NULL && gst_buffer_map(buffer, &map, GST_MAP_READ);
+            if (mapped)
+            {
+                jpeg.assign(map.data, map.data + map.size);
+                gst_buffer_unmap(buffer, &map);
+            }
+            gst_sample_unref(sample);
+            return mapped;
+        }
+
+        bool Encoder::encode(GstBuffer *frame, GstCaps *caps, std::vector<uint8_t> &jpeg)
+        {
+            if (m_caps != NULL && (!gst_caps_is_equal(m_caps, caps) || (m_hardware && s_noHardware)))
+            {
+                close();
+            }
+            bool hardware = !s_noHardware;
+            if (hardware)
+            {
+                GstElementFactory *factory = gst_element_factory_find(hardware_encoder);
+                hardware = factory != NULL;
+                if (factory != NULL)
+                {
+                    gst_object_unref(factory);
+                }
+            }
+            if (m_pipeline == NULL && !build(caps, hardware))
+            {
+                if (!hardware || !build(caps, false))
+                {
+                    LOG_ERROR("[SNAPSHOT] No JPEG encoder could be started");
+                    return false;
+                }
+                LOG_WARN("[SNAPSHOT] " << hardware_encoder << " could not be started, using " << software_encoder);
+                s_noHardware = true;
+            }
+            if (run(frame, jpeg))
+            {
+                return true;
+            }
+            // a hardware encoder which took the frame but gave nothing back is not tried again
+            bool wasHardware = m_hardware;
+            close();
+            if (!wasHardware || !build(caps, false) || !run(frame, jpeg))
+            {
+                close();
+                return false;
+            }
+            LOG_WARN("[SNAPSHOT] " << hardware_encoder << " failed, using " << software_encoder);
+            s_noHardware = true;
+            return true;
+        }
+
+        void Encoder::close()
+        {
+            if (m_pipeline != NULL)
+            {
+                gst_element_set_state(m_pipeline, GST_STATE_NULL);
+                gst_object_unref(m_pipeline);
+                m_pipeline = m_source = m_sink = NULL;
+            }
+            if (m_caps != NULL)
+            {
+                gst_caps_unref(m_caps);
+                m_caps = NULL;
+            }
+        }
+
+        /// Cached image of one size
+        struct Slot
+        {
+            ImagePtr image;
+            std::chrono::steady_clock::time_point at;
+            bool busy; // being captured and encoded
+        };
+
+        std::mutex s_lock;
+        std::condition_variable s_changed;
+        Slot s_slots[2];
+        // a full frame is wanted from the raw input
+        std::atomic<bool> s_wanted(false);
+        GstBuffer *s_raw = NULL;
+        GstCaps *s_rawCaps = NULL;
+        uint64_t s_rawMs = 0;
+        // newest analytics frame, packed NV12
+        GstBuffer *s_thumb = NULL;
+        GstCaps *s_thumbCaps = NULL;
+        uint64_t s_thumbMs = 0;
+
+        // encoders are only used with their slot busy
+        Encoder s_encoders[2];
+
+        /// Snapshot asked for with its own delivery
+        struct Pending
+        {
+            Size size;
+            Delivery delivery;
+        };
+
+        std::mutex s_deliveryLock;
+        std::condition_variable s_deliveryWakeup;
+        Delivery s_delivery;
+        bool s_requested[2] = {false, false};
+        std::deque<Pending> s_pending;
+        bool s_stopping = false;
+        std::thread s_deliveryThread;
+
+        void keepThumbnail(const substream::Frame &frame)
+        {
+            // the chroma plane follows the luma plane, the camera may pad both
+            GstVideoMeta *meta = gst_buffer_get_video_meta(frame.buffer);
+            size_t chromaOffset = meta != NULL ? meta->offset[1] - meta->offset[0] : frame.stride * frame.height;
+            size_t chromaStride = meta != NULL ? meta->stride[1] : frame.stride;
+            size_t lumaOffset = meta != NULL ? meta->offset[0] : 0;
+            if (meta != NULL && meta->n_planes < 2)
+            {
+                return;
+            }
+            if (lumaOffset + chromaOffset + chromaStride * (frame.height / 2) > gst_buffer_get_size(frame.buffer))
+            {
+                return;
+            }
+            const size_t lumaSize = (size_t)frame.width * frame.height;
+            const size_t size = lumaSize + lumaSize / 2;
+
+            std::lock_guard<std::mutex> lock(s_lock);
+            // reused unless an encoder still holds it
+            if (s_thumb == NULL || !gst_buffer_is_writable(s_thumb) || gst_buffer_get_size(s_thumb) != size)
+            {
+                if (s_thumb != NULL)
+                {
+                    gst_buffer_unref(s_thumb);
+                }
+                s_thumb = gst_buffer_new_allocate(NULL, size, NULL);
+            }
+            GstMapInfo map;
+            if (!gst_buffer_map(s_thumb, &map, GST_MAP_WRITE))
+            {
+                return;
+            }
+            for (int row = 0; row < frame.height; row++)
+            {
+                memcpy(map.data + row * frame.width, frame.luma + row * frame.stride, frame.width);
+            }
+            for (int row = 0; row < frame.height / 2; row++)
+            {
+                memcpy(map.data + lumaSize + row * frame.width, frame.luma + chromaOffset + row * chromaStride, frame.width);
+            }
+            gst_buffer_unmap(s_thumb, &map);
+            s_thumbMs = realtimeMs();
+
+            if (s_thumbCaps == NULL)
+            {
+                s_thumbCaps = gst_caps_new_simple("video/x-raw",
+                                                  "format", G_TYPE_STRING, "NV12",
+                                                  "width", G_TYPE_INT, frame.width,
+                                                  "height", G_TYPE_INT, frame.height,
+                                                  "framerate", GST_TYPE_FRACTION, 0, 1,
+                                                  NULL);
+            }
+        }
+
+        GstPadProbeReturn onRawBuffer(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+        {
+            if (s_wanted.load(std::memory_order_relaxed))
+            {
+                GstCaps *caps = gst_pad_get_current_caps(pad);
+                if (caps != NULL)
+                {
+                    offer(GST_PAD_PROBE_INFO_BUFFER(info), caps);
+                    gst_caps_unref(caps);
+                }
+            }
+            return GST_PAD_PROBE_OK;
+        }
+
+        void deliver()
+        {
+            threadstats::nameThread("c3-snapshot");
+            std::unique_lock<std::mutex> lock(s_deliveryLock);
+            while (true)
+            {
+                s_deliveryWakeup.wait(lock, []()
+                                      { return s_stopping || s_requested[SIZE_THUMBNAIL] || s_requested[SIZE_FULL] || !s_pending.empty(); });
+                if (s_stopping)
+                {
+                    // every request with its own delivery is answered, nothing is queued once stopping
+                    std::deque<Pending> dropped;
+                    dropped.swap(s_pending);
+                    lock.unlock();
+                    for (size_t i = 0; i < dropped.size(); i++)
+                    {
+                        dropped[i].delivery(ImagePtr());
+                    }
+                    return;
+                }
+                if (!s_pending.empty())
+                {
+                    Pending pending = s_pending.front();
+                    s_pending.pop_front();
+                    lock.unlock();
+                    ImagePtr image;
+                    if (!take(pending.size, image))
+                    {
+                        image.reset();
+                    }
+                    pending.delivery(image);
+                    lock.lock();
+                    continue;
+                }
+                Size size = s_requested[SIZE_FULL] ? SIZE_FULL : SIZE_THUMBNAIL;
+                s_requested[size] = false;
+                Delivery delivery = s_delivery;
+                lock.unlock();
+                ImagePtr image;
+                if (delivery && take(size, image))
+                {
+                    LOG_INFO("[SNAPSHOT] " << image->width << "x" << image->height << ", " << image->jpeg.size() << " bytes");
+                    delivery(image);
+                }
+                lock.lock();
+            }
+        }
+    } // namespace
+
+    void subscribe()
+    {
+        substream::subscribe(keepThumbnail);
+    }
+
+    void watch(GstElement *encoder)
+    {
+        GstPad *pad = gst_element_get_static_pad(encoder, "sink");
+        if (pad != NULL)
+        {
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, onRawBuffer, NULL, NULL);
+            gst_object_unref(pad);
+        }
+    }
+
+    void offer(GstBuffer *buffer, GstCaps *caps)
+    {
+        if (!s_wanted.load(std::memory_order_relaxed))
+        {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(s_lock);
+        if (s_wanted && s_raw == NULL)
+        {
+            s_raw = gst_buffer_ref(buffer);
+            s_rawCaps = gst_caps_ref(caps);
+            s_rawMs = realtimeMs();
+            s_wanted = false;
+            s_changed.notify_all();
+        }
+    }
+
+    bool take(Size size, ImagePtr &image)
+    {
+        static metrics::Counter &requests = metrics::counter("snapshot.requests");
+        static metrics::Counter &cacheHits = metrics::counter("snapshot.cache_hits");
+        static metrics::Counter &failures = metrics::counter("snapshot.failures");
+        static metrics::Histogram &encodeUs = metrics::histogram("snapshot.encode_us");
+        requests.add();
+
+        Slot &slot = s_slots[size];
+        std::unique_lock<std::mutex> lock(s_lock);
+        // a request arriving while the image is made gets that one
+        s_changed.wait(lock, [&slot]()
+                       { return !slot.busy; });
+        if (slot.image && std::chrono::steady_clock::now() - slot.at < std::chrono::milliseconds(cache_ttl_ms))
+        {
+            cacheHits.add();
+            image = slot.image;
+            return true;
+        }
+        slot.busy = true;
+
+        GstBuffer *frame = NULL;
+        GstCaps *caps = NULL;
+        uint64_t captureMs = 0;
+        if (size == SIZE_THUMBNAIL)
+        {
+            if (s_thumb != NULL)
+            {
+                frame = gst_buffer_ref(s_thumb);
+                caps = gst_caps_ref(s_thumbCaps);
+                captureMs = s_thumbMs;
+            }
+        }
+        else
+        {
+            s_wanted = true;
+            s_changed.wait_for(lock, std::chrono::milliseconds(capture_timeout_ms), []()
+                               { return s_raw != NULL; });
+            s_wanted = false;
+            frame = s_raw;
+            caps = s_rawCaps;
+            captureMs = s_rawMs;
+            s_raw = NULL;
+            s_rawCaps = NULL;
+        }
+        lock.unlock();
+
+        std::shared_ptr<Image> encoded;
+        if (frame != NULL)
+        {
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            encoded = std::make_shared<Image>();
+            GstVideoInfo info;
+            if (gst_video_info_from_caps(&info, caps) && s_encoders[size].encode(frame, caps, encoded->jpeg))
+            {
+                encoded->width = GST_VIDEO_INFO_WIDTH(&info);
+                encoded->height = GST_VIDEO_INFO_HEIGHT(&info);
+                encoded->captureMs = captureMs;
+                encodeUs.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+            }
+            else
+            {
+                encoded.reset();
+            }
+            gst_buffer_unref(frame);
+            gst_caps_unref(caps);
+        }
+
+        lock.lock();
+        slot.busy = false;
+        if (encoded)
+        {
+            slot.image = encoded;
+            slot.at = std::chrono::steady_clock::now();
+            image = encoded;
+        }
+        s_changed.notify_all();
+        if (!encoded)
+        {
+            failures.add();
+            LOG_WARN("[SNAPSHOT] No " << (size == SIZE_FULL ? "frame" : "thumbnail") << (frame != NULL ? " could be encoded" : " available"));
+        }
+        return (bool)encoded;
+    }
+
+    const char *encoderName()
+    {
+        return Encoder::s_name;
+    }
+
+    void startDelivery(Delivery delivery)
+    {
+        std::lock_guard<std::mutex> lock(s_deliveryLock);
+        s_delivery = delivery;
+        // the thread may already run for requests with their own delivery
+        if (!s_stopping && !s_deliveryThread.joinable())
+        {
+            s_deliveryThread = std::thread(deliver);
+        }
+    }
+
+    void stopDelivery()
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_deliveryLock);
+            s_stopping = true;
+            // the delivery may hold the connection, the thread keeps a copy until its call returns
+            s_delivery = Delivery();
+            s_deliveryWakeup.notify_all();
+        }
+        // nobody else touches the thread while stopping
+        if (s_deliveryThread.joinable())
+        {
+            s_deliveryThread.join();
+        }
+        std::lock_guard<std::mutex> lock(s_deliveryLock);
+        s_stopping = false;
+    }
+
+    void request(Size size)
+    {
+        std::lock_guard<std::mutex> lock(s_deliveryLock);
+        if (!s_delivery)
+        {
+            LOG_WARN("[SNAPSHOT] Not connected, the request is dropped");
+            return;
+        }
+        s_requested[size] = true;
+        s_deliveryWakeup.notify_all();
+    }
+
+    void request(Size size, Delivery delivery)
+    {
+        {
+            std::lock_guard<std::mutex> lock(s_deliveryLock);
+            if (!s_stopping)
+            {
+                if (!s_deliveryThread.joinable())
+                {
+                    s_deliveryThread = std::thread(deliver);
+                }
+                Pending pending = {size, delivery};
+                s_pending.push_back(pending);
+                s_deliveryWakeup.notify_all();
+                return;
+            }
+        }
+        delivery(ImagePtr());
+    }
+} // namespace snapshot
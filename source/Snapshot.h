@@ -0,0 +1,67 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SNAPSHOT_H__
+#define __SNAPSHOT_H__
+
+#include <functional>
+#include <gst/gst.h>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+/// JPEG stills of the camera, on demand.
+/// Thumbnails come from the newest frame of the analytics substream, which is kept for them. Full frames are grabbed
+/// from the raw input of the main encoder, the next frame after the request, so nothing is copied while nobody asks.
+/// The hardware JPEG encoder (v4l2jpegenc) is used where the platform has one, jpegenc, which is libjpeg-turbo with its
+/// SIMD code on Raspberry Pi OS, otherwise. Each size has its encoder pipeline, kept from one snapshot to the next.
+/// An image is served from the cache for cache_ttl_ms, and requests arriving while one is encoded wait for it.
+/// Exported as "snapshot.requests", "snapshot.cache_hits", "snapshot.failures" and "snapshot.encode_us".
+namespace snapshot
+{
+    extern const unsigned int cache_ttl_ms;
+    extern const unsigned int capture_timeout_ms;
+    extern const int jpeg_quality;
+
+    enum Size
+    {
+        SIZE_THUMBNAIL,
+        SIZE_FULL,
+    };
+
+    struct Image
+    {
+        std::vector<uint8_t> jpeg;
+        int width;
+        int height;
+        uint64_t captureMs; // since the epoch
+    };
+    typedef std::shared_ptr<const Image> ImagePtr;
+
+    /// Keep the newest analytics frame for thumbnails, before the pipeline carrying the substream is built
+    void subscribe();
+    /// Grab full frames from the raw input of encoder, a frame source of the caps it takes
+    void watch(GstElement *encoder);
+    /// Hand in a raw frame directly, e.g. from a test source, from any thread. Ignored unless a full frame is wanted.
+    void offer(GstBuffer *buffer, GstCaps *caps);
+
+    /// Image of the size from the cache, or encoded now, false when there is no frame or it cannot be encoded
+    bool take(Size size, ImagePtr &image);
+    /// JPEG encoder in use, NULL before the first snapshot
+    const char *encoderName();
+
+    /// Asynchronous snapshots, e.g. for the shadow, are handed to delivery on the snapshot thread
+    typedef std::function<void(const ImagePtr &)> Delivery;
+    void startDelivery(Delivery delivery);
+    /// Also answers the requests with their own delivery which are still queued
+    void stopDelivery();
+    /// Ask for an asynchronous snapshot for the delivery of startDelivery(), from any thread
+    void request(Size size);
+    /// Ask for an asynchronous snapshot handed to its own delivery, e.g. of a data channel, from any thread. The
+    /// snapshot thread is started if needed. delivery is called exactly once, with a NULL image when there is no frame,
+    /// it cannot be encoded or the thread stops.
+    void request(Size size, Delivery delivery);
+} // namespace snapshot
+
+#endif //__SNAPSHOT_H__
@@ -0,0 +1,527 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Spool.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+LOGGER_TAG("spool")
+
+namespace spool
+{
+    namespace
+    {
+        const uint32_t segment_magic = 0x50533343; // "C3SP"
+        const uint32_t segment_version = 1;
+        const uint32_t record_magic = 0x46533343; // "C3SF"
+        const uint32_t flag_keyframe = 1;
+        const size_t header_size = 4096;
+        const char *const segment_suffix = ".c3s";
+
+        struct SegmentHeader
+        {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t written;  // bytes of records behind the header
+            uint64_t uploaded; // bytes of records already sent
+            uint32_t capsLength;
+            uint32_t reserved;
+            char caps[1];
+        };
+
+        struct RecordHeader
+        {
+            uint32_t magic;
+            uint32_t flags;
+            uint32_t size;
+            uint32_t reserved;
+            uint64_t timestampNs;
+            uint64_t durationNs;
+        };
+
+        inline size_t aligned(size_t size)
+        {
+            return (size + 7) & ~(size_t)7;
+        }
+
+        inline SegmentHeader *header(uint8_t *base)
+        {
+            return (SegmentHeader *)base;
+        }
+
+        uint64_t realtimeNs()
+        {
+            struct timespec now;
+            clock_gettime(CLOCK_REALTIME, &now);
+            return (uint64_t)now.tv_sec * 1000000000ull + now.tv_nsec;
+        }
+    } // namespace
+
+    extern const size_t segment_size = 16 * 1024 * 1024;
+    extern const size_t max_caps_length = header_size - offsetof(SegmentHeader, caps);
+
+    Segment::Segment() : m_sequence(0), m_base(NULL), m_next(0)
+    {
+    }
+
+    Segment::~Segment()
+    {
+        unmap();
+    }
+
+    bool Segment::map(const std::string &path)
+    {
+        unmap();
+        int fd = open(path.c_str(), O_RDWR);
+        if (fd < 0)
+        {
+            return false;
+        }
+        struct stat info;
+        void *base = MAP_FAILED;
+        if (fstat(fd, &info) == 0 && (size_t)info.st_size == segment_size)
+        {
+            base = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        close(fd);
+        if (base == MAP_FAILED)
+        {
+            return false;
+        }
+
+        m_base = (uint8_t *)base;
+        SegmentHeader *h = header(m_base);
+        if (h->magic != segment_magic || h->version != segment_version || h->capsLength > max_caps_length ||
+            h->written > segment_size - header_size || h->uploaded > h->written)
+        {
+            unmap();
+            return false;
+        }
+        m_path = path;
+        m_caps.assign(h->caps, h->capsLength);
+        m_next = h->uploaded;
+        m_fragments.clear();
+        return true;
+    }
+
+    void Segment::unmap()
+    {
+        if (m_base != NULL)
+        {
+            munmap(m_base, segment_size);
+            m_base = NULL;
+        }
+        m_fragments.clear();
+    }
+
+    bool Segment::next(Frame &frame)
+    {
+        SegmentHeader *h = header(m_base);
+        if (m_next + sizeof(RecordHeader) > h->written)
+        {
+            return false;
+        }
+        const RecordHeader *record = (const RecordHeader *)(m_base + header_size + m_next);
+        if (record->magic != record_magic || record->size > h->written - m_next - sizeof(RecordHeader))
+        {
+            // torn by a power cut, the rest of the segment is lost
+            LOG_ERROR("[SPOOL] Damaged record at " << m_next << " in " << m_path);
+            h->written = m_next;
+            return false;
+        }
+        frame.timestampNs = record->timestampNs;
+        frame.durationNs = record->durationNs;
+        frame.keyframe = (record->flags & flag_keyframe) != 0;
+        frame.data = (const uint8_t *)(record + 1);
+        frame.size = record->size;
+        if (frame.keyframe)
+        {
+            Fragment fragment = {record->timestampNs / 1000000, m_next, false};
+            m_fragments.push_back(fragment);
+        }
+        m_next += aligned(sizeof(RecordHeader) + record->size);
+        return true;
+    }
+
+    void Segment::acknowledge(uint64_t timestampMs)
+    {
+        SegmentHeader *h = header(m_base);
+        for (size_t i = 0; i < m_fragments.size(); i++)
+        {
+            // the acknowledged timecode has millisecond resolution, keyframes are much further apart
+            if (m_fragments[i].startMs <= timestampMs + 1 && timestampMs <= m_fragments[i].startMs + 1)
+            {
+                m_fragments[i].persisted = true;
+            }
+        }
+        while (!m_fragments.empty() && m_fragments.front().persisted)
+        {
+            // a fragment ends with the next keyframe, the last one of the segment once all of it was read
+            if (m_fragments.size() > 1)
+            {
+                h->uploaded = m_fragments[1].offset;
+            }
+            else if (m_next >= h->written)
+            {
+                h->uploaded = h->written;
+            }
+            else
+            {
+                break;
+            }
+            m_fragments.pop_front();
+        }
+    }
+
+    void Segment::acknowledgeAll()
+    {
+        header(m_base)->uploaded = std::min((uint64_t)m_next, header(m_base)->written);
+        m_fragments.clear();
+    }
+
+    bool Segment::sent() const
+    {
+        return m_next >= header(m_base)->written;
+    }
+
+    bool Segment::pending() const
+    {
+        return m_next > header(m_base)->uploaded;
+    }
+
+    bool Segment::done() const
+    {
+        return header(m_base)->uploaded >= header(m_base)->written;
+    }
+
+    Store::Store(const std::string &directory, uint64_t quotaBytes)
+        : m_directory(directory), m_maxSegments(std::max((uint64_t)2, quotaBytes / segment_size)), m_online(false),
+          m_active(NULL), m_activeSequence(0), m_anchorPts(0), m_anchorEpochNs(0), m_lastPts(0), m_nextSequence(1),
+          m_stopping(false)
+    {
+    }
+
+    Store::~Store()
+    {
+        seal();
+    }
+
+    std::string Store::segmentPath(uint64_t sequence) const
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "/%010llu", (unsigned long long)sequence);
+        return m_directory + name + segment_suffix;
+    }
+
+    bool Store::open()
+    {
+        if (mkdir(m_directory.c_str(), 0755) != 0 && errno != EEXIST)
+        {
+            LOG_ERROR("[SPOOL] Cannot create " << m_directory << ": " << strerror(errno));
+            return false;
+        }
+        DIR *dir = opendir(m_directory.c_str());
+        if (dir == NULL)
+        {
+            LOG_ERROR("[SPOOL] Cannot open " << m_directory << ": " << strerror(errno));
+            return false;
+        }
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            std::string name = entry->d_name;
+            size_t suffix = name.size() > strlen(segment_suffix) ? name.size() - strlen(segment_suffix) : 0;
+            if (suffix == 0 || name.compare(suffix, std::string::npos, segment_suffix) != 0)
+            {
+                continue;
+            }
+            uint64_t sequence = strtoull(name.c_str(), NULL, 10);
+            if (sequence > 0)
+            {
+                m_sealed.push_back(sequence);
+                m_nextSequence = std::max(m_nextSequence, sequence + 1);
+            }
+        }
+        closedir(dir);
+        std::sort(m_sealed.begin(), m_sealed.end());
+        updateBacklog();
+        if (!m_sealed.empty())
+        {
+            LOG_INFO("[SPOOL] " << m_sealed.size() << " segments left to upload in " << m_directory);
+        }
+        return true;
+    }
+
+    void Store::setOnline(bool online)
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        if (m_online.exchange(online) != online)
+        {
+            LOG_INFO("[SPOOL] Uplink " << (online ? "up" : "down"));
+        }
+        m_wakeup.notify_all();
+    }
+
+    bool Store::create(const std::string &caps)
+    {
+        uint64_t sequence;
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            while (m_sealed.size() + 1 > m_maxSegments)
+            {
+                dropOldest();
+            }
+            sequence = m_nextSequence++;
+        }
+
+        std::string path = segmentPath(sequence);
+        int fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0)
+        {
+            LOG_ERROR("[SPOOL] Cannot create " << path << ": " << strerror(errno));
+            return false;
+        }
+        // reserve the blocks now, a full disk must not turn into SIGBUS on a later write to the mapping
+        int result = posix_fallocate(fd, 0, segment_size);
+        if (result == ENOSPC)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            if (!m_sealed.empty())
+            {
+                dropOldest();
+                result = posix_fallocate(fd, 0, segment_size);
+            }
+        }
+        void *base = MAP_FAILED;
+        if (result == 0)
+        {
+            base = mmap(NULL, segment_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        }
+        ::close(fd);
+        if (base == MAP_FAILED)
+        {
+            LOG_ERROR("[SPOOL] Cannot allocate " << path << ": " << strerror(result != 0 ? result : errno));
+            unlink(path.c_str());
+            return false;
+        }
+
+        m_active = (uint8_t *)base;
+        m_activeSequence = sequence;
+        SegmentHeader *h = header(m_active);
+        h->magic = segment_magic;
+        h->version = segment_version;
+        h->written = 0;
+        h->uploaded = 0;
+        h->capsLength = (uint32_t)caps.size();
+        memcpy(h->caps, caps.data(), caps.size());
+        return true;
+    }
+
+    bool Store::append(const std::string &caps, uint64_t ptsNs, uint64_t durationNs, bool keyframe, const uint8_t *data, size_t size)
+    {
+        static metrics::Counter &frames = metrics::counter("spool.frames");
+        static metrics::Counter &dropped = metrics::counter("spool.dropped_frames");
+        const size_t recordSize = aligned(sizeof(RecordHeader) + size);
+        const size_t capacity = segment_size - header_size;
+
+        if (m_active != NULL)
+        {
+            uint64_t written = header(m_active)->written;
+            // a new segment starts on a keyframe once this one is three quarters full, or when the frame does not fit
+            if ((keyframe && written > capacity / 4 * 3) || written + recordSize > capacity)
+            {
+                close();
+            }
+        }
+        if (m_active == NULL && (!keyframe || recordSize > capacity || caps.size() > max_caps_length || !create(caps)))
+        {
+            dropped.add();
+            return false;
+        }
+
+        // capture time: the pipeline clock keeps the spacing, the wall clock is read once per outage or pipeline
+        if (m_anchorEpochNs == 0 || ptsNs < m_lastPts)
+        {
+            m_anchorPts = ptsNs;
+            m_anchorEpochNs = realtimeNs();
+        }
+        m_lastPts = ptsNs;
+
+        SegmentHeader *h = header(m_active);
+        RecordHeader *record = (RecordHeader *)(m_active + header_size + h->written);
+        memcpy(record + 1, data, size);
+        record->flags = keyframe ? flag_keyframe : 0;
+        record->size = (uint32_t)size;
+        record->reserved = 0;
+        record->timestampNs = m_anchorEpochNs + (ptsNs - m_anchorPts);
+        record->durationNs = durationNs;
+        record->magic = record_magic;
+        h->written += recordSize;
+        frames.add();
+        return true;
+    }
+
+    void Store::seal()
+    {
+        close();
+        // the next outage reads the wall clock again
+        m_anchorEpochNs = 0;
+    }
+
+    void Store::close()
+    {
+        if (m_active == NULL)
+        {
+            return;
+        }
+        msync(m_active, segment_size, MS_ASYNC);
+        munmap(m_active, segment_size);
+        m_active = NULL;
+
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_sealed.push_back(m_activeSequence);
+        updateBacklog();
+        m_wakeup.notify_all();
+    }
+
+    void Store::dropOldest()
+    {
+        static metrics::Counter &droppedBytes = metrics::counter("spool.dropped_bytes");
+        // keep the segments being uploaded, the one after them is older than anything still to come
+        std::deque<uint64_t>::iterator victim = m_sealed.begin();
+        while (victim != m_sealed.end() && reading(*victim))
+        {
+            ++victim;
+        }
+        if (victim == m_sealed.end())
+        {
+            victim = m_sealed.begin();
+        }
+        std::string path = segmentPath(*victim);
+        struct stat info;
+        if (stat(path.c_str(), &info) == 0)
+        {
+            droppedBytes.add(info.st_size);
+        }
+        unlink(path.c_str());
+        LOG_ERROR("[SPOOL] Quota reached, dropped " << path);
+        m_sealed.erase(victim);
+        updateBacklog();
+    }
+
+    void Store::updateBacklog()
+    {
+        metrics::gauge("spool.backlog_segments").set((double)m_sealed.size());
+    }
+
+    bool Store::reading(uint64_t sequence) const
+    {
+        return std::find(m_reading.begin(), m_reading.end(), sequence) != m_reading.end();
+    }
+
+    void Store::stopReading(uint64_t sequence)
+    {
+        std::vector<uint64_t>::iterator it = std::find(m_reading.begin(), m_reading.end(), sequence);
+        if (it != m_reading.end())
+        {
+            m_reading.erase(it);
+        }
+    }
+
+    bool Store::nextSegment(Segment &segment)
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (true)
+        {
+            m_wakeup.wait(lock, [this]()
+                          { return m_stopping || (m_online.load(std::memory_order_relaxed) && hasUnread()); });
+            if (m_stopping)
+            {
+                return false;
+            }
+            std::deque<uint64_t>::iterator it = m_sealed.begin();
+            while (reading(*it))
+            {
+                ++it;
+            }
+            uint64_t sequence = *it;
+            if (segment.map(segmentPath(sequence)))
+            {
+                segment.m_sequence = sequence;
+                m_reading.push_back(sequence);
+                return true;
+            }
+            LOG_ERROR("[SPOOL] Discarding unreadable " << segmentPath(sequence));
+            unlink(segmentPath(sequence).c_str());
+            m_sealed.erase(it);
+            updateBacklog();
+        }
+    }
+
+    void Store::release(Segment &segment)
+    {
+        segment.unmap();
+        unlink(segment.path().c_str());
+        std::lock_guard<std::mutex> lock(m_lock);
+        std::deque<uint64_t>::iterator it = std::find(m_sealed.begin(), m_sealed.end(), segment.m_sequence);
+        if (it != m_sealed.end())
+        {
+            m_sealed.erase(it);
+        }
+        stopReading(segment.m_sequence);
+        updateBacklog();
+    }
+
+    void Store::giveBack(Segment &segment)
+    {
+        segment.unmap();
+        std::lock_guard<std::mutex> lock(m_lock);
+        stopReading(segment.m_sequence);
+    }
+
+    bool Store::unread()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return hasUnread();
+    }
+
+    bool Store::hasUnread() const
+    {
+        for (size_t i = 0; i < m_sealed.size(); i++)
+        {
+            if (!reading(m_sealed[i]))
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void Store::stop()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        m_stopping = true;
+        m_wakeup.notify_all();
+    }
+
+    bool Store::stopping()
+    {
+        std::lock_guard<std::mutex> lock(m_lock);
+        return m_stopping;
+    }
+} // namespace spool
@@ -0,0 +1,156 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SPOOL_H__
+#define __SPOOL_H__
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/// Encoded video spooled to local storage while the uplink is down.
+/// Frames go into fixed size segment files which are preallocated and memory mapped, so appending is a copy into the
+/// page cache and a full disk shows up when a segment is created rather than as SIGBUS on a write. Each segment starts
+/// with a keyframe and carries the caps of its stream, frames keep their capture time as nanoseconds since the epoch.
+/// Segments are numbered, the uploader reads them oldest first. The upload cursor stored in the segment only moves over
+/// whole fragments kvssink reported as persisted, so an upload interrupted by another outage, a failed pipeline or a
+/// reboot continues from the keyframe after the last persisted fragment. When the store exceeds its quota the oldest
+/// segment is dropped. Exported as "spool.frames", "spool.uploaded_frames", "spool.dropped_frames",
+/// "spool.dropped_bytes" and the gauge "spool.backlog_segments".
+namespace spool
+{
+    extern const size_t segment_size;
+    extern const size_t max_caps_length;
+
+    struct Frame
+    {
+        uint64_t timestampNs; // capture time since the epoch
+        uint64_t durationNs;
+        bool keyframe;
+        const uint8_t *data; // valid while the segment is mapped
+        uint32_t size;
+    };
+
+    /// Read side of one sealed segment
+    class Segment
+    {
+    public:
+        Segment();
+        ~Segment();
+
+        bool isOpen() const { return m_base != NULL; }
+        const std::string &caps() const { return m_caps; }
+
+        /// Next frame to send, reading starts at the upload cursor, false at the end of the segment
+        bool next(Frame &frame);
+        /// The fragment starting with the keyframe of this capture time was persisted. The upload cursor moves over
+        /// the persisted fragments without a gap before them.
+        void acknowledge(uint64_t timestampMs);
+        /// Everything read so far was persisted
+        void acknowledgeAll();
+        /// All frames were read
+        bool sent() const;
+        /// Frames were read which are not persisted yet
+        bool pending() const;
+        /// All frames were persisted
+        bool done() const;
+
+        const std::string &path() const { return m_path; }
+
+    private:
+        Segment(const Segment &);
+        Segment &operator=(const Segment &);
+
+        friend class Store;
+        bool map(const std::string &path);
+        void unmap();
+
+        /// Read fragment the upload cursor has not passed yet
+        struct Fragment
+        {
+            uint64_t startMs;
+            size_t offset; // of its keyframe
+            bool persisted;
+        };
+
+        std::string m_path;
+        std::string m_caps;
+        uint64_t m_sequence;
+        uint8_t *m_base;
+        size_t m_next;
+        std::deque<Fragment> m_fragments;
+    };
+
+    class Store
+    {
+    public:
+        /// quotaBytes is rounded down to whole segments, at least two
+        Store(const std::string &directory, uint64_t quotaBytes);
+        ~Store();
+
+        /// Pick up the segments of a previous run, false when the directory cannot be used
+        bool open();
+
+        /// Uplink state, the uploader only runs while online
+        void setOnline(bool online);
+        bool online() const { return m_online.load(std::memory_order_relaxed); }
+
+        /// Spool a frame, called from the streaming thread only. ptsNs is the buffer time of the pipeline, caps are
+        /// only needed on keyframes. Delta frames are dropped until a keyframe opens a segment.
+        bool append(const std::string &caps, uint64_t ptsNs, uint64_t durationNs, bool keyframe, const uint8_t *data, size_t size);
+        /// Close the segment being written and hand it to the uploader
+        void seal();
+
+        /// Wait while offline or without unread segments and open the oldest sealed segment not handed out yet, false
+        /// once stopped
+        bool nextSegment(Segment &segment);
+        /// The segment was persisted, delete it
+        void release(Segment &segment);
+        /// Close the segment without deleting it, it is handed out again from its upload cursor
+        void giveBack(Segment &segment);
+        /// Sealed segments which are not handed out are waiting
+        bool unread();
+
+        void stop();
+        bool stopping();
+
+    private:
+        Store(const Store &);
+        Store &operator=(const Store &);
+
+        std::string segmentPath(uint64_t sequence) const;
+        bool create(const std::string &caps);
+        void close();
+        void dropOldest();
+        void updateBacklog();
+        bool reading(uint64_t sequence) const;
+        bool hasUnread() const;
+        void stopReading(uint64_t sequence);
+
+        std::string m_directory;
+        size_t m_maxSegments;
+        std::atomic<bool> m_online;
+
+        // streaming thread only
+        uint8_t *m_active;
+        uint64_t m_activeSequence;
+        uint64_t m_anchorPts;
+        uint64_t m_anchorEpochNs;
+        uint64_t m_lastPts;
+
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        std::deque<uint64_t> m_sealed;
+        uint64_t m_nextSequence;
+        std::vector<uint64_t> m_reading; // handed out to the uploader
+        bool m_stopping;
+    };
+} // namespace spool
+
+#endif //__SPOOL_H__
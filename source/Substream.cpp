@@ -0,0 +1,180 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Substream.h"
+#include "Metrics.h"
+#include "Logger.h"
+
+#include <chrono>
+#include <gst/app/gstappsink.h>
+#include <gst/video/video.h>
+#include <mutex>
+#include <sstream>
+#include <string.h>
+#include <vector>
+
+LOGGER_TAG("substream")
+
+namespace substream
+{
+    extern const int width = 320;
+    extern const int height = 180;
+    extern const int fps = 10;
+
+    namespace
+    {
+        const char *const sink_name = "analyticssink";
+        /// Frames waiting in the branch, older ones are dropped rather than holding camera buffers
+        const guint queue_buffers = 2;
+
+        std::mutex s_lock;
+        std::vector<Consumer> s_consumers;
+
+        GstFlowReturn onNewSample(GstAppSink *sink, gpointer user_data)
+        {
+            static metrics::Counter &frames = metrics::counter("substream.frames");
+            static metrics::Histogram &deliverUs = metrics::histogram("substream.deliver_us");
+
+            GstSample *sample = gst_app_sink_pull_sample(sink);
+            if (sample == NULL)
+            {
+                return GST_FLOW_OK;
+            }
+            GstBuffer *buffer = gst_sample_get_buffer(sample);
+            GstVideoInfo info;
+            GstMapInfo map;
+            if (buffer != NULL && gst_video_info_from_caps(&info, gst_sample_get_caps(sample)) && gst_buffer_map(buffer, &map, GST_MAP_READ))
+            {
+                Frame frame;
+                frame.width = GST_VIDEO_INFO_WIDTH(&info);
+                frame.height = GST_VIDEO_INFO_HEIGHT(&info);
+                frame.stride = GST_VIDEO_INFO_PLANE_STRIDE(&info, 0);
+                size_t offset = 0;
+                // the camera may pad the rows, its meta has the real layout
+                GstVideoMeta *meta = gst_buffer_get_video_meta(buffer);
+                if (meta != NULL)
+                {
+                    offset = meta->offset[0];
+                    frame.stride = meta->stride[0];
+                }
+                if (offset + frame.stride * (frame.height - 1) + frame.width <= map.size)
+                {
+                    frame.luma = map.data + offset;
+                    frame.pts = GST_BUFFER_PTS(buffer);
+                    frame.buffer = buffer;
+
+                    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+                    {
+                        std::lock_guard<std::mutex> lock(s_lock);
+                        for (size_t i = 0; i < s_consumers.size(); i++)
+                        {
+                            s_consumers[i](frame);
+                        }
+                    }
+                    deliverUs.record(std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count());
+                    frames.add();
+                }
+                gst_buffer_unmap(buffer, &map);
+            }
+            gst_sample_unref(sample);
+            return GST_FLOW_OK;
+        }
+
+        void connectSink(GstElement *sink)
+        {
+            GstAppSinkCallbacks callbacks;
+            memset(&callbacks, 0, sizeof(callbacks));
+            callbacks.new_sample = onNewSample;
+            gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, NULL, NULL);
+        }
+    } // namespace
+
+    void subscribe(Consumer consumer)
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        s_consumers.push_back(consumer);
+    }
+
+    bool active()
+    {
+        std::lock_guard<std::mutex> lock(s_lock);
+        return !s_consumers.empty();
+    }
+
+    bool attach(GstElement *pipeline, GstElement *source)
+    {
+        GstPad *output = gst_element_get_request_pad(source, "src_%u");
+        if (output == NULL)
+        {
+            LOG_WARN("[SUBSTREAM] The camera source has no second output, analytics are off");
+            return false;
+        }
+        GstElement *queue = gst_element_factory_make("queue", "analyticsqueue");
+        GstElement *rate = gst_element_factory_make("videorate", "analyticsrate");
+        GstElement *filter = gst_element_factory_make("capsfilter", "analyticscaps");
+        GstElement *sink = gst_element_factory_make("appsink", sink_name);
+        GstElement *created[] = {queue, rate, filter, sink};
+        if (!queue || !rate || !filter || !sink)
+        {
+            LOG_ERROR("[SUBSTREAM] Not all elements could be created");
+            for (size_t i = 0; i < sizeof(created) / sizeof(created[0]); i++)
+            {
+                if (created[i] != NULL)
+                    gst_object_unref(gst_object_ref_sink(created[i]));
+            }
+            gst_element_release_request_pad(source, output);
+            gst_object_unref(output);
+            return false;
+        }
+
+        // leaky downstream, the camera never waits for analytics
+        g_object_set(G_OBJECT(queue), "leaky", 2, "max-size-buffers", queue_buffers, "max-size-bytes", 0, "max-size-time", (guint64)0, NULL);
+        g_object_set(G_OBJECT(rate), "drop-only", TRUE, NULL);
+        GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                            "format", G_TYPE_STRING, "NV12",
+                                            "width", G_TYPE_INT, width,
+                                            "height", G_TYPE_INT, height,
+                                            "framerate", GST_TYPE_FRACTION, fps, 1,
+                                            NULL);
+        g_object_set(G_OBJECT(filter), "caps", caps, NULL);
+        gst_caps_unref(caps);
+        g_object_set(G_OBJECT(sink), "sync", FALSE, "max-buffers", 1, "drop", TRUE, NULL);
+
+        gst_bin_add_many(GST_BIN(pipeline), queue, rate, filter, sink, NULL);
+        GstPad *input = gst_element_get_static_pad(queue, "sink");
+        bool linked = gst_pad_link(output, input) == GST_PAD_LINK_OK && gst_element_link_many(queue, rate, filter, sink, NULL);
+        gst_object_unref(input);
+        if (!linked)
+        {
+            LOG_ERROR("[SUBSTREAM] The analytics branch could not be linked");
+            gst_bin_remove_many(GST_BIN(pipeline), queue, rate, filter, sink, NULL);
+            gst_element_release_request_pad(source, output);
+            gst_object_unref(output);
+            return false;
+        }
+        gst_object_unref(output);
+        connectSink(sink);
+        LOG_INFO("[SUBSTREAM] " << width << "x" << height << " at " << fps << " fps");
+        return true;
+    }
+
+    std::string description(const char *source)
+    {
+        std::ostringstream branch;
+        branch << source << ".src_%u ! queue name=analyticsqueue leaky=downstream max-size-buffers=" << queue_buffers
+               << " max-size-bytes=0 max-size-time=0 ! videorate drop-only=TRUE ! video/x-raw,format=NV12,width=" << width
+               << ",height=" << height << ",framerate=" << fps << "/1 ! appsink name=" << sink_name << " sync=FALSE max-buffers=1 drop=TRUE";
+        return branch.str();
+    }
+
+    void connect(GstElement *pipeline)
+    {
+        GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), sink_name);
+        if (sink != NULL)
+        {
+            connectSink(sink);
+            gst_object_unref(sink);
+        }
+    }
+} // namespace substream
@@ -0,0 +1,52 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __SUBSTREAM_H__
+#define __SUBSTREAM_H__
+
+#include <functional>
+#include <gst/gst.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+/// Low resolution analytics stream of the camera.
+/// libcamerasrc produces it on a second output next to the main stream, so the ISP does the scaling and nothing is
+/// copied or converted on the CPU. The branch drops frames down to the analytics rate and ends in an appsink which
+/// keeps only the newest frame. Consumers get each frame mapped in place on the substream thread. Greyscale consumers
+/// read the luma plane, which is the first plane of the NV12 frame. The branch is only built while there are
+/// consumers. Exported as "substream.frames" and "substream.deliver_us".
+namespace substream
+{
+    extern const int width;
+    extern const int height;
+    extern const int fps;
+
+    struct Frame
+    {
+        const uint8_t *luma; // valid during the call only
+        size_t stride;
+        int width;
+        int height;
+        GstClockTime pts;
+        GstBuffer *buffer; // take a reference to keep the frame
+    };
+
+    /// Called on the substream thread for every frame, in the order of subscription
+    typedef std::function<void(const Frame &)> Consumer;
+    /// Add a consumer, before the pipeline carrying the substream is built
+    void subscribe(Consumer consumer);
+    bool active();
+
+    /// Link a second output of the libcamerasrc source into the analytics branch of pipeline, false when the source
+    /// has no second output
+    bool attach(GstElement *pipeline, GstElement *source);
+
+    /// The branch for gst_parse_launch, fed from the libcamerasrc named source
+    std::string description(const char *source);
+    /// Deliver the frames of a pipeline built from description()
+    void connect(GstElement *pipeline);
+} // namespace substream
+
+#endif //__SUBSTREAM_H__
@@ -0,0 +1,306 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Telemetry.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Logger.h"
+
+#include <chrono>
+#include <fstream>
+#include <string.h>
+#include <time.h>
+
+LOGGER_TAG("telemetry")
+
+namespace telemetry
+{
+    extern const unsigned int sample_period_ms = 1000;
+    extern const unsigned int default_interval = 60;
+
+    namespace
+    {
+        const char *cpu_temperature_path = "/sys/class/thermal/thermal_zone0/temp";
+
+        // CBOR major types (RFC 8949)
+        enum CborType
+        {
+            CBOR_UNSIGNED = 0,
+            CBOR_TEXT = 3,
+            CBOR_ARRAY = 4,
+            CBOR_MAP = 5,
+        };
+
+        void cborHead(std::vector<uint8_t> &out, CborType type, uint64_t value)
+        {
+            uint8_t major = (uint8_t)(type << 5);
+            int bytes;
+            if (value < 24)
+            {
+                out.push_back(major | (uint8_t)value);
+                return;
+            }
+            else if (value <= 0xff)
+            {
+                out.push_back(major | 24);
+                bytes = 1;
+            }
+            else if (value <= 0xffff)
+            {
+                out.push_back(major | 25);
+                bytes = 2;
+            }
+            else if (value <= 0xffffffffULL)
+            {
+                out.push_back(major | 26);
+                bytes = 4;
+            }
+            else
+            {
+                out.push_back(major | 27);
+                bytes = 8;
+            }
+            for (int i = bytes - 1; i >= 0; i--)
+            {
+                out.push_back((uint8_t)(value >> (8 * i)));
+            }
+        }
+
+        void cborText(std::vector<uint8_t> &out, const char *text)
+        {
+            size_t len = strlen(text);
+            cborHead(out, CBOR_TEXT, len);
+            out.insert(out.end(), text, text + len);
+        }
+
+        // Single precision is plenty for telemetry and half the size of a double
+        void cborFloat(std::vector<uint8_t> &out, float value)
+        {
+            uint32_t bits;
+            memcpy(&bits, &value, sizeof(bits));
+            out.push_back(0xfa);
+            for (int i = 3; i >= 0; i--)
+            {
+                out.push_back((uint8_t)(bits >> (8 * i)));
+            }
+        }
+
+        void sampleCpuTemperature()
+        {
+            std::ifstream file(cpu_temperature_path);
+            long milliCelsius;
+            if (file >> milliCelsius)
+            {
+                metrics::gauge("device.cpu_temp_c").set(milliCelsius / 1000.0);
+            }
+        }
+    } // namespace
+
+    Publisher::Publisher(std::shared_ptr<Aws::Crt::Mqtt::MqttConnection> connection, const std::string &thingName, unsigned int intervalSeconds)
+        : m_connection(connection), m_topic("c3/" + thingName + "/telemetry"), m_intervalSeconds(intervalSeconds), m_windowSamples(0),
+          m_stopping(false)
+    {
+        // key on the wire, metric in the registry, rate of a counter or gauge, scale
+        const struct
+        {
+            const char *key;
+            const char *metric;
+            bool rate;
+            double scale;
+        } channels[] = {
+            {"fps", "video.frames", true, 1.0},
+            {"kbps", "video.bytes", true, 8.0 / 1000.0},
+            {"viewers", "webrtc.viewers", false, 1.0},
+            {"rtt_ms", "webrtc.qoe.rtt_ms", false, 1.0},
+            {"send_kbps", "webrtc.qoe.send_kbps", false, 1.0},
+            {"discard_pps", "webrtc.qoe.discard_pps", false, 1.0},
+            {"cpu_c", "device.cpu_temp_c", false, 1.0},
+            {"cpu_pct", "process.cpu_pct", false, 1.0},
+            {"rss_kb", "process.rss_kb", false, 1.0},
+            {"pan", "servo.pan_deg", false, 1.0},
+            {"tilt", "servo.tilt_deg", false, 1.0},
+        };
+
+        for (size_t i = 0; i < sizeof(channels) / sizeof(channels[0]); i++)
+        {
+            Channel channel;
+            memset(&channel, 0, sizeof(channel));
+            channel.key = channels[i].key;
+            channel.metric = channels[i].metric;
+            channel.rate = channels[i].rate;
+            channel.scale = channels[i].scale;
+            m_channels.push_back(channel);
+        }
+        resetWindow();
+    }
+
+    Publisher::~Publisher()
+    {
+        stop();
+    }
+
+    void Publisher::start()
+    {
+        m_thread = std::thread(&Publisher::run, this);
+        LOG_INFO("[TELEMETRY] Publishing every " << m_intervalSeconds << "s to " << m_topic);
+    }
+
+    void Publisher::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void Publisher::run()
+    {
+        threadstats::nameThread("c3-telemetry");
+        std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+        std::chrono::steady_clock::time_point windowEnd = last + std::chrono::seconds(m_intervalSeconds);
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (!m_stopping)
+        {
+            m_wakeup.wait_for(lock, std::chrono::milliseconds(sample_period_ms));
+            if (m_stopping)
+            {
+                break;
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            sample(std::chrono::duration<double>(now - last).count());
+            last = now;
+
+            if (now >= windowEnd)
+            {
+                publish();
+                resetWindow();
+                windowEnd += std::chrono::seconds(m_intervalSeconds);
+            }
+        }
+    }
+
+    void Publisher::sample(double elapsedSeconds)
+    {
+        sampleCpuTemperature();
+        m_windowSamples++;
+
+        for (size_t i = 0; i < m_channels.size(); i++)
+        {
+            Channel &channel = m_channels[i];
+            double value;
+
+            if (channel.rate)
+            {
+                metrics::Counter *counter = metrics::findCounter(channel.metric);
+                if (counter == NULL)
+                {
+                    continue;
+                }
+                uint64_t current = counter->value();
+                bool first = !channel.seen;
+                uint64_t delta = current - channel.lastCounter;
+                channel.lastCounter = current;
+                channel.seen = true;
+                // the first reading only establishes the base of the rate
+                if (first || elapsedSeconds <= 0)
+                {
+                    continue;
+                }
+                value = delta / elapsedSeconds * channel.scale;
+            }
+            else
+            {
+                metrics::Gauge *gauge = metrics::findGauge(channel.metric);
+                if (gauge == NULL)
+                {
+                    continue;
+                }
+                value = gauge->value() * channel.scale;
+            }
+
+            channel.min = channel.samples == 0 || value < channel.min ? value : channel.min;
+            channel.max = channel.samples == 0 || value > channel.max ? value : channel.max;
+            channel.sum += value;
+            channel.samples++;
+        }
+    }
+
+    std::vector<uint8_t> Publisher::encodeWindow(uint64_t timestamp)
+    {
+        std::vector<uint8_t> out;
+        size_t active = 0;
+        out.reserve(256);
+
+        for (size_t i = 0; i < m_channels.size(); i++)
+        {
+            active += m_channels[i].samples > 0 ? 1 : 0;
+        }
+
+        // {"v":1,"ts":<unix s>,"win":<s>,"n":<samples>,"m":{<key>:[min,mean,max],...}}
+        cborHead(out, CBOR_MAP, 5);
+        cborText(out, "v");
+        cborHead(out, CBOR_UNSIGNED, 1);
+        cborText(out, "ts");
+        cborHead(out, CBOR_UNSIGNED, timestamp);
+        cborText(out, "win");
+        cborHead(out, CBOR_UNSIGNED, m_intervalSeconds);
+        cborText(out, "n");
+        cborHead(out, CBOR_UNSIGNED, m_windowSamples);
+        cborText(out, "m");
+        cborHead(out, CBOR_MAP, active);
+        for (size_t i = 0; i < m_channels.size(); i++)
+        {
+            const Channel &channel = m_channels[i];
+            if (channel.samples == 0)
+            {
+                continue;
+            }
+            cborText(out, channel.key);
+            cborHead(out, CBOR_ARRAY, 3);
+            cborFloat(out, (float)channel.min);
+            cborFloat(out, (float)(channel.sum / channel.samples));
+            cborFloat(out, (float)channel.max);
+        }
+        return out;
+    }
+
+    void Publisher::publish()
+    {
+        // The payload has to outlive the asynchronous publish, the completion callback owns it
+        std::shared_ptr<std::vector<uint8_t>> payload = std::make_shared<std::vector<uint8_t>>(encodeWindow((uint64_t)time(NULL)));
+        Aws::Crt::ByteBuf buffer = Aws::Crt::ByteBufFromArray(payload->data(), payload->size());
+
+        auto onPublishComplete = [payload](Aws::Crt::Mqtt::MqttConnection &, uint16_t, int errorCode)
+        {
+            if (errorCode != AWS_OP_SUCCESS)
+            {
+                metrics::counter("telemetry.publish_errors").add();
+                LOG_ERROR("[TELEMETRY] Publish failed with error " << Aws::Crt::ErrorDebugString(errorCode));
+            }
+        };
+
+        m_connection->Publish(m_topic.c_str(), AWS_MQTT_QOS_AT_MOST_ONCE, false, buffer, std::move(onPublishComplete));
+        metrics::counter("telemetry.bytes").add(payload->size());
+        LOG_DEBUG("[TELEMETRY] Published " << payload->size() << " bytes to " << m_topic);
+    }
+
+    void Publisher::resetWindow()
+    {
+        m_windowSamples = 0;
+        for (size_t i = 0; i < m_channels.size(); i++)
+        {
+            m_channels[i].samples = 0;
+            m_channels[i].min = 0;
+            m_channels[i].max = 0;
+            m_channels[i].sum = 0;
+        }
+    }
+} // namespace telemetry
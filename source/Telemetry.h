@@ -0,0 +1,74 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __TELEMETRY_H__
+#define __TELEMETRY_H__
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <aws/crt/mqtt/MqttConnection.h>
+
+/// Device telemetry published on the shadow MQTT connection.
+/// Metrics are sampled every second from the metrics registry, aggregated to min/mean/max over the window and
+/// sent as one CBOR message per window at QoS0 on c3/<thing name>/telemetry.
+namespace telemetry
+{
+    extern const unsigned int sample_period_ms;
+
+    /// Default window in seconds
+    extern const unsigned int default_interval;
+
+    class Publisher
+    {
+    public:
+        Publisher(std::shared_ptr<Aws::Crt::Mqtt::MqttConnection> connection, const std::string &thingName, unsigned int intervalSeconds);
+        ~Publisher();
+
+        void start();
+        void stop();
+
+    private:
+        Publisher(const Publisher &);
+        Publisher &operator=(const Publisher &);
+
+        /// Aggregation of one metric over the current window
+        struct Channel
+        {
+            const char *key;
+            const char *metric;
+            bool rate;   // true: per second rate of a counter, false: gauge value
+            double scale;
+            bool seen;
+            uint64_t lastCounter;
+            uint32_t samples;
+            double min;
+            double max;
+            double sum;
+        };
+
+        void run();
+        void sample(double elapsedSeconds);
+        void publish();
+        std::vector<uint8_t> encodeWindow(uint64_t timestamp);
+        void resetWindow();
+
+        std::shared_ptr<Aws::Crt::Mqtt::MqttConnection> m_connection;
+        std::string m_topic;
+        unsigned int m_intervalSeconds;
+        std::vector<Channel> m_channels;
+        uint32_t m_windowSamples;
+
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        bool m_stopping;
+        std::thread m_thread;
+    };
+} // namespace telemetry
+
+#endif //__TELEMETRY_H__
@@ -0,0 +1,244 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "ThreadStats.h"
+#include "Metrics.h"
+#include "Tracer.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <chrono>
+#include <dirent.h>
+#include <fstream>
+#include <gst/gst.h>
+#include <pthread.h>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <vector>
+
+LOGGER_TAG("threadstats")
+
+namespace threadstats
+{
+    extern const unsigned int sample_period_ms = 5000;
+
+    namespace
+    {
+        // Linux limits thread names to 16 bytes including the terminator
+        const size_t max_thread_name = 16;
+
+        /// Name and utime + stime of one /proc/.../stat file
+        bool readStat(const std::string &path, std::string &name, unsigned long long &ticks)
+        {
+            std::ifstream file(path.c_str());
+            std::string line;
+            if (!std::getline(file, line))
+            {
+                return false;
+            }
+
+            // the name is enclosed in parentheses and may itself contain spaces and parentheses
+            size_t open = line.find('(');
+            size_t close = line.rfind(')');
+            if (open == std::string::npos || close == std::string::npos || close < open)
+            {
+                return false;
+            }
+            name = line.substr(open + 1, close - open - 1);
+
+            // fields after the name start with the state (field 3), utime and stime are fields 14 and 15
+            std::istringstream fields(line.substr(close + 2));
+            std::string field;
+            unsigned long long utime = 0, stime = 0;
+            for (int index = 3; index <= 15 && fields >> field; index++)
+            {
+                if (index == 14)
+                {
+                    utime = strtoull(field.c_str(), NULL, 10);
+                }
+                else if (index == 15)
+                {
+                    stime = strtoull(field.c_str(), NULL, 10);
+                }
+            }
+            ticks = utime + stime;
+            return true;
+        }
+
+        long residentKilobytes()
+        {
+            std::ifstream file("/proc/self/statm");
+            long size, resident;
+            if (file >> size >> resident)
+            {
+                return resident * (sysconf(_SC_PAGESIZE) / 1024);
+            }
+            return 0;
+        }
+
+        GstBusSyncReply onBusSyncMessage(GstBus *bus, GstMessage *msg, gpointer data)
+        {
+            // ENTER is posted synchronously from the new streaming thread itself
+            if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_STREAM_STATUS)
+            {
+                GstStreamStatusType type;
+                GstElement *owner = NULL;
+                gst_message_parse_stream_status(msg, &type, &owner);
+                if (type == GST_STREAM_STATUS_TYPE_ENTER && owner != NULL)
+                {
+                    gchar *ownerName = gst_element_get_name(owner);
+                    char name[max_thread_name];
+                    snprintf(name, sizeof(name), "gst-%s", ownerName);
+                    nameThread(name);
+                    g_free(ownerName);
+                }
+            }
+            return GST_BUS_PASS;
+        }
+    } // namespace
+
+    void nameThread(const char *name)
+    {
+        char osName[max_thread_name];
+        snprintf(osName, sizeof(osName), "%s", name);
+        pthread_setname_np(pthread_self(), osName);
+        trace::setThreadName(name);
+    }
+
+    void nameGstStreamingThreads(GstElement *pipeline)
+    {
+        GstBus *bus = gst_element_get_bus(pipeline);
+        gst_bus_set_sync_handler(bus, onBusSyncMessage, NULL, NULL);
+        gst_object_unref(bus);
+    }
+
+    Sampler::Sampler()
+        : m_lastProcessTicks(0), m_stopping(false)
+    {
+    }
+
+    Sampler::~Sampler()
+    {
+        stop();
+    }
+
+    void Sampler::start()
+    {
+        m_thread = std::thread(&Sampler::run, this);
+        LOG_INFO("[THREADSTATS] Sampling thread CPU usage every " << sample_period_ms << "ms");
+    }
+
+    void Sampler::stop()
+    {
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_stopping = true;
+        }
+        m_wakeup.notify_all();
+        if (m_thread.joinable())
+        {
+            m_thread.join();
+        }
+    }
+
+    void Sampler::run()
+    {
+        nameThread("c3-threadstats");
+        std::chrono::steady_clock::time_point last = std::chrono::steady_clock::now();
+        // the first pass only establishes the tick baseline of every thread
+        sample(0);
+
+        std::unique_lock<std::mutex> lock(m_lock);
+        while (!m_stopping)
+        {
+            m_wakeup.wait_for(lock, std::chrono::milliseconds(sample_period_ms));
+            if (m_stopping)
+            {
+                break;
+            }
+
+            std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+            sample(std::chrono::duration<double>(now - last).count());
+            last = now;
+        }
+    }
+
+    void Sampler::sample(double elapsedSeconds)
+    {
+        const double ticksPerSecond = (double)sysconf(_SC_CLK_TCK);
+        std::map<pid_t, unsigned long long> ticks;
+        std::map<std::string, double> usage;
+
+        DIR *tasks = opendir("/proc/self/task");
+        if (tasks == NULL)
+        {
+            LOG_ERROR("[THREADSTATS] Unable to open /proc/self/task");
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(tasks)) != NULL)
+        {
+            if (entry->d_name[0] < '0' || entry->d_name[0] > '9')
+            {
+                continue;
+            }
+            pid_t tid = (pid_t)atoi(entry->d_name);
+            std::string name;
+            unsigned long long current;
+            if (!readStat(std::string("/proc/self/task/") + entry->d_name + "/stat", name, current))
+            {
+                // the thread exited while walking the directory
+                continue;
+            }
+            ticks[tid] = current;
+
+            // a thread started since the last sample is accounted from its start
+            std::map<pid_t, unsigned long long>::const_iterator previous = m_lastTicks.find(tid);
+            unsigned long long delta = previous == m_lastTicks.end() ? current : current - previous->second;
+            usage[name] += elapsedSeconds > 0 ? delta / ticksPerSecond / elapsedSeconds * 100.0 : 0.0;
+        }
+        closedir(tasks);
+        m_lastTicks.swap(ticks);
+
+        std::string processName;
+        unsigned long long processTicks = 0;
+        if (readStat("/proc/self/stat", processName, processTicks) && elapsedSeconds > 0)
+        {
+            metrics::gauge("process.cpu_pct").set((processTicks - m_lastProcessTicks) / ticksPerSecond / elapsedSeconds * 100.0);
+        }
+        m_lastProcessTicks = processTicks;
+        metrics::gauge("process.rss_kb").set((double)residentKilobytes());
+        metrics::gauge("process.threads").set((double)m_lastTicks.size());
+
+        if (elapsedSeconds <= 0)
+        {
+            return;
+        }
+
+        for (std::map<std::string, double>::const_iterator it = m_lastUsage.begin(); it != m_lastUsage.end(); ++it)
+        {
+            if (usage.find(it->first) == usage.end())
+            {
+                metrics::gauge("thread." + it->first + ".cpu_pct").set(0);
+            }
+        }
+        std::vector<std::pair<double, std::string>> busiest;
+        for (std::map<std::string, double>::const_iterator it = usage.begin(); it != usage.end(); ++it)
+        {
+            metrics::gauge("thread." + it->first + ".cpu_pct").set(it->second);
+            busiest.push_back(std::make_pair(it->second, it->first));
+        }
+        m_lastUsage.swap(usage);
+
+        std::sort(busiest.rbegin(), busiest.rend());
+        std::ostringstream top;
+        for (size_t i = 0; i < busiest.size() && i < 5; i++)
+        {
+            top << (i == 0 ? "" : ", ") << busiest[i].second << " " << busiest[i].first << "%";
+        }
+        LOG_DEBUG("[THREADSTATS] Busiest threads: " << top.str());
+    }
+} // namespace threadstats
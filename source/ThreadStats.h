@@ -0,0 +1,61 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __THREAD_STATS_H__
+#define __THREAD_STATS_H__
+
+#include <condition_variable>
+#include <map>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+// only the GStreamer helper takes an element, users without GStreamer do not need its headers
+typedef struct _GstElement GstElement;
+
+/// Per-thread CPU accounting.
+/// Application threads are named so that top -H, perf and the trace output show what they are, the sampler reads
+/// /proc/self/task/<tid>/stat and exports the CPU usage grouped by thread name into the metrics registry
+/// ("thread.<name>.cpu_pct", "process.cpu_pct", "process.rss_kb", "process.threads").
+namespace threadstats
+{
+    extern const unsigned int sample_period_ms;
+
+    /// Name the calling thread for the OS (truncated to 15 characters) and for the tracer
+    void nameThread(const char *name);
+
+    /// Name the GStreamer streaming threads of the pipeline after the element owning them
+    void nameGstStreamingThreads(GstElement *pipeline);
+
+    class Sampler
+    {
+    public:
+        Sampler();
+        ~Sampler();
+
+        void start();
+        void stop();
+
+    private:
+        Sampler(const Sampler &);
+        Sampler &operator=(const Sampler &);
+
+        void run();
+        void sample(double elapsedSeconds);
+
+        // cpu ticks per thread at the previous sample
+        std::map<pid_t, unsigned long long> m_lastTicks;
+        unsigned long long m_lastProcessTicks;
+        // names seen at the previous sample, their gauges are zeroed once the threads are gone
+        std::map<std::string, double> m_lastUsage;
+
+        std::mutex m_lock;
+        std::condition_variable m_wakeup;
+        bool m_stopping;
+        std::thread m_thread;
+    };
+} // namespace threadstats
+
+#endif //__THREAD_STATS_H__
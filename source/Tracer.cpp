@@ -0,0 +1,269 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#include "Tracer.h"
+#include "Logger.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+LOGGER_TAG("trace")
+
+namespace trace
+{
+    extern const unsigned int ring_size = 4096;
+
+    namespace
+    {
+        /// One slot of a ring buffer, guarded by a per slot sequence number so a concurrent dump can skip torn slots
+        struct Event
+        {
+            std::atomic<uint64_t> seq; // 2 * index + 1 while being written, 2 * index + 2 once complete
+            std::atomic<uint64_t> ts;
+            std::atomic<const char *> name;
+            std::atomic<uint32_t> tid;
+            std::atomic<char> phase;
+        };
+
+        /// Ring buffer owned by exactly one live thread, rings of finished threads are recycled
+        struct Ring
+        {
+            std::atomic<bool> inUse;
+            std::atomic<uint64_t> head;
+            uint32_t tid;
+            Event *events;
+        };
+
+        /// Copy of an event taken while dumping
+        struct Record
+        {
+            uint64_t ts;
+            const char *name;
+            uint32_t tid;
+            char phase;
+        };
+
+        std::mutex s_lock;
+        std::vector<Ring *> s_rings;
+        std::map<uint32_t, std::string> s_threadNames;
+
+        std::atomic<bool> s_dumpRequested(false);
+        std::atomic<unsigned int> s_dumpCount(0);
+        std::string s_pathPrefix;
+
+        uint64_t nowNs()
+        {
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+        }
+
+        Ring *acquireRing()
+        {
+            std::lock_guard<std::mutex> lock(s_lock);
+            Ring *ring = NULL;
+            for (size_t i = 0; i < s_rings.size() && ring == NULL; i++)
+            {
+                bool expected = false;
+                if (s_rings[i]->inUse.compare_exchange_strong(expected, true))
+                {
+                    ring = s_rings[i];
+                }
+            }
+            if (ring == NULL)
+            {
+                ring = new Ring();
+                ring->events = new Event[ring_size]();
+                ring->head.store(0);
+                ring->inUse.store(true);
+                s_rings.push_back(ring);
+            }
+            ring->tid = (uint32_t)syscall(SYS_gettid);
+
+            char name[16] = {0};
+            if (pthread_getname_np(pthread_self(), name, sizeof(name)) == 0)
+            {
+                s_threadNames[ring->tid] = name;
+            }
+            return ring;
+        }
+
+        /// Hands the ring back to the pool when the owning thread exits
+        struct RingOwner
+        {
+            Ring *ring;
+            RingOwner() : ring(acquireRing()) {}
+            ~RingOwner() { ring->inUse.store(false, std::memory_order_release); }
+        };
+
+        Ring &localRing()
+        {
+            static thread_local RingOwner owner;
+            return *owner.ring;
+        }
+
+        void snapshotRing(Ring *ring, std::vector<Record> &records)
+        {
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t first = head > ring_size ? head - ring_size : 0;
+            for (uint64_t i = first; i < head; i++)
+            {
+                Event &event = ring->events[i % ring_size];
+                uint64_t seq = event.seq.load(std::memory_order_acquire);
+                if (seq != 2 * i + 2)
+                {
+                    continue;
+                }
+                Record record;
+                record.ts = event.ts.load(std::memory_order_relaxed);
+                record.name = event.name.load(std::memory_order_relaxed);
+                record.tid = event.tid.load(std::memory_order_relaxed);
+                record.phase = event.phase.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (event.seq.load(std::memory_order_relaxed) == seq)
+                {
+                    records.push_back(record);
+                }
+            }
+        }
+
+        void writeJsonString(FILE *file, const char *str)
+        {
+            fputc('"', file);
+            for (; *str != '\0'; str++)
+            {
+                if (*str == '"' || *str == '\\')
+                {
+                    fputc('\\', file);
+                }
+                fputc(*str, file);
+            }
+            fputc('"', file);
+        }
+
+        void dumpThreadRoutine()
+        {
+            pthread_setname_np(pthread_self(), "c3-trace-dump");
+            setThreadName("c3-trace-dump");
+            while (true)
+            {
+                std::this_thread::sleep_for(std::chrono::milliseconds(200));
+                if (s_dumpRequested.exchange(false))
+                {
+                    char path[512];
+                    snprintf(path, sizeof(path), "%s-%d-%u.json", s_pathPrefix.c_str(), (int)getpid(), s_dumpCount.fetch_add(1));
+                    dumpChromeJson(path);
+                }
+            }
+        }
+    } // namespace
+
+    void record(const char *name, char phase)
+    {
+        Ring &ring = localRing();
+        uint64_t index = ring.head.load(std::memory_order_relaxed);
+        Event &event = ring.events[index % ring_size];
+
+        event.seq.store(2 * index + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        event.ts.store(nowNs(), std::memory_order_relaxed);
+        event.name.store(name, std::memory_order_relaxed);
+        event.tid.store(ring.tid, std::memory_order_relaxed);
+        event.phase.store(phase, std::memory_order_relaxed);
+        event.seq.store(2 * index + 2, std::memory_order_release);
+        ring.head.store(index + 1, std::memory_order_release);
+    }
+
+    void setThreadName(const char *name)
+    {
+        uint32_t tid = localRing().tid;
+        std::lock_guard<std::mutex> lock(s_lock);
+        s_threadNames[tid] = name;
+    }
+
+    bool dumpChromeJson(const std::string &path)
+    {
+        std::vector<Record> records;
+        std::map<uint32_t, std::string> threadNames;
+        {
+            std::lock_guard<std::mutex> lock(s_lock);
+            records.reserve(s_rings.size() * ring_size);
+            for (size_t i = 0; i < s_rings.size(); i++)
+            {
+                snapshotRing(s_rings[i], records);
+            }
+            threadNames = s_threadNames;
+        }
+        std::sort(records.begin(), records.end(), [](const Record &a, const Record &b)
+                  { return a.ts < b.ts; });
+
+        FILE *file = fopen(path.c_str(), "w");
+        if (file == NULL)
+        {
+            LOG_ERROR("[TRACE] Unable to open " << path);
+            return false;
+        }
+
+        int pid = (int)getpid();
+        bool first = true;
+        fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+        for (std::map<uint32_t, std::string>::const_iterator it = threadNames.begin(); it != threadNames.end(); ++it)
+        {
+            fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":", first ? "" : ",\n", pid, it->first);
+            writeJsonString(file, it->second.c_str());
+            fprintf(file, "}}");
+            first = false;
+        }
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            fprintf(file, "%s{\"name\":", first ? "" : ",\n");
+            writeJsonString(file, records[i].name);
+            fprintf(file, ",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u%s}", records[i].phase, records[i].ts / 1000.0, pid, records[i].tid,
+                    records[i].phase == PHASE_INSTANT ? ",\"s\":\"t\"" : "");
+            first = false;
+        }
+        fprintf(file, "\n]}\n");
+        fclose(file);
+
+        LOG_INFO("[TRACE] Wrote " << records.size() << " events to " << path);
+        return true;
+    }
+
+    void installDumpSignal(const std::string &pathPrefix, int signum)
+    {
+        s_pathPrefix = pathPrefix;
+
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = onDumpSignal;
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESTART;
+        sigaction(signum, &action, NULL);
+
+        std::thread(dumpThreadRoutine).detach();
+        LOG_INFO("[TRACE] Send signal " << signum << " to write a trace to " << pathPrefix << "-" << getpid() << "-<n>.json");
+    }
+
+    void requestDump()
+    {
+        s_dumpRequested.store(true);
+    }
+
+    void onDumpSignal(int signum)
+    {
+        (void)signum;
+        requestDump();
+    }
+} // namespace trace
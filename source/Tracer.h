@@ -0,0 +1,73 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __TRACER_H__
+#define __TRACER_H__
+
+#include <signal.h>
+#include <stdint.h>
+#include <string>
+
+/// Low overhead event tracer.
+/// Every thread records into its own lock-free ring buffer, so recording never blocks and never allocates
+/// after the first event of a thread. Event names must be string literals (or any other static storage),
+/// only the pointer is stored.
+namespace trace
+{
+    // Number of events kept per thread, older events are overwritten
+    extern const unsigned int ring_size;
+
+    enum Phase
+    {
+        PHASE_BEGIN = 'B',
+        PHASE_END = 'E',
+        PHASE_INSTANT = 'i',
+    };
+
+    /// Record one event into the ring buffer of the calling thread
+    void record(const char *name, char phase);
+
+    inline void begin(const char *name) { record(name, PHASE_BEGIN); }
+    inline void end(const char *name) { record(name, PHASE_END); }
+    inline void instant(const char *name) { record(name, PHASE_INSTANT); }
+
+    /// Name the calling thread in the trace output
+    void setThreadName(const char *name);
+
+    /// Write the content of all ring buffers as Chrome/Perfetto trace event JSON
+    bool dumpChromeJson(const std::string &path);
+
+    /// Start the dump thread and route the given signal to it, dumps are written to <pathPrefix>-<pid>-<n>.json
+    void installDumpSignal(const std::string &pathPrefix, int signum = SIGUSR1);
+
+    /// Ask the dump thread to write a trace, safe to call from a signal handler
+    void requestDump();
+
+    /// Signal handler requesting a dump, re-register it with gpioSetSignalFunc() once pigpio took over the signals
+    void onDumpSignal(int signum);
+
+    /// Begin/end pair bound to a C++ scope
+    class Scope
+    {
+    public:
+        explicit Scope(const char *name) : m_name(name) { begin(m_name); }
+        ~Scope() { end(m_name); }
+
+    private:
+        Scope(const Scope &);
+        Scope &operator=(const Scope &);
+        const char *m_name;
+    };
+} // namespace trace
+
+#define _TRACE_CONCAT_INNER(a, b) a##b
+#define _TRACE_CONCAT(a, b) _TRACE_CONCAT_INNER(a, b)
+
+// trace the enclosing scope as one span
+#define TRACE_SCOPE(name) trace::Scope _TRACE_CONCAT(_traceScope, __LINE__)(name)
+#define TRACE_BEGIN(name) trace::begin(name)
+#define TRACE_END(name) trace::end(name)
+#define TRACE_INSTANT(name) trace::instant(name)
+
+#endif //__TRACER_H__
@@ -4,6 +4,13 @@
  */
 #define LOG_CLASS "WebRtcSamples"
 #include "WebRtcCommon.h"
+#include "Tracer.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "Preset.h"
+#include "PtzProtocol.h"
+#include "Keyframe.h"
+#include "Snapshot.h"
 
 PSampleConfiguration gSampleConfiguration = NULL;
 
@@ -37,20 +44,82 @@ STATUS signalingCallFailed(STATUS status)
             STATUS_SIGNALING_GET_ICE_CONFIG_CALL_FAILED == status || STATUS_SIGNALING_CONNECT_CALL_FAILED == status);
 }
 
+// binary data channel messages above about 16 kB are not delivered by every browser
+#define SNAPSHOT_CHUNK_SIZE (16 * 1024)
+
+/// Send "snapshot <bytes> <width>x<height> <capture ms>" and the JPEG in binary chunks, or "snapshot unavailable"
+static STATUS sendSnapshot(PRtcDataChannel pDataChannel, const snapshot::ImagePtr &image)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    CHAR header[64];
+    if (!image)
+    {
+        return dataChannelSend(pDataChannel, FALSE, (PBYTE) "snapshot unavailable", STRLEN("snapshot unavailable"));
+    }
+    SNPRINTF(header, SIZEOF(header), "snapshot %zu %dx%d %llu", image->jpeg.size(), image->width, image->height, (unsigned long long) image->captureMs);
+    retStatus = dataChannelSend(pDataChannel, FALSE, (PBYTE) header, (UINT32) STRLEN(header));
+    for (size_t offset = 0; retStatus == STATUS_SUCCESS && offset < image->jpeg.size(); offset += SNAPSHOT_CHUNK_SIZE)
+    {
+        UINT32 size = (UINT32) MIN((size_t) SNAPSHOT_CHUNK_SIZE, image->jpeg.size() - offset);
+        retStatus = dataChannelSend(pDataChannel, TRUE, (PBYTE) &image->jpeg[offset], size);
+    }
+    return retStatus;
+}
+
+/// Answer "snapshot", "snapshot thumbnail" or "snapshot full" from the snapshot thread. A full frame waits for the next
+/// frame of the camera and each encode may fall back to another encoder, which must not hold up the receive thread.
+static VOID requestSnapshot(PSampleStreamingSession pSampleStreamingSession, PRtcDataChannel pDataChannel, const std::string &command)
+{
+    // viewers may end the command with a newline
+    std::string trimmed = command;
+    trimmed.erase(trimmed.find_last_not_of(" \t\r\n") + 1);
+    trimmed.erase(0, trimmed.find_first_not_of(" \t\r\n"));
+
+    ATOMIC_INCREMENT(&pSampleStreamingSession->pendingSnapshots);
+    snapshot::request(trimmed == "snapshot full" ? snapshot::SIZE_FULL : snapshot::SIZE_THUMBNAIL,
+                      [pSampleStreamingSession, pDataChannel](const snapshot::ImagePtr &image)
+                      {
+                          // the data channel stays valid until the session saw the count drop
+                          if (!ATOMIC_LOAD_BOOL(&pSampleStreamingSession->terminateFlag))
+                          {
+                              STATUS retStatus = sendSnapshot(pDataChannel, image);
+                              if (retStatus != STATUS_SUCCESS)
+                              {
+                                  DLOGI("[KVS Master] dataChannelSend(): operation returned status code: 0x%08x \n", retStatus);
+                              }
+                          }
+                          ATOMIC_DECREMENT(&pSampleStreamingSession->pendingSnapshots);
+                      });
+}
+
 VOID onDataChannelMessage(UINT64 customData, PRtcDataChannel pDataChannel, BOOL isBinary, PBYTE pMessage, UINT32 pMessageLen)
 {
-    UNUSED_PARAM(customData);
+    PSampleStreamingSession pSampleStreamingSession = (PSampleStreamingSession) customData;
+    STATUS retStatus = STATUS_SUCCESS;
+    std::string reply;
+    BYTE ptzReply[ptz::message_size];
+
     if (isBinary)
     {
-        DLOGI("DataChannel Binary Message");
+        // binary messages are PTZ commands, handled on this thread without a cloud round trip
+        ptz::handle(pMessage, pMessageLen, ptzReply);
+        retStatus = dataChannelSend(pDataChannel, TRUE, ptzReply, SIZEOF(ptzReply));
+    }
+    else if (preset::execute(std::string((PCHAR) pMessage, pMessageLen), reply))
+    {
+        // PTZ preset and tour commands are answered with their result
+        retStatus = dataChannelSend(pDataChannel, FALSE, (PBYTE) reply.c_str(), (UINT32) reply.size());
+    }
+    else if (pMessageLen >= STRLEN("snapshot") && MEMCMP(pMessage, "snapshot", STRLEN("snapshot")) == 0)
+    {
+        requestSnapshot(pSampleStreamingSession, pDataChannel, std::string((PCHAR) pMessage, pMessageLen));
     }
     else
     {
         DLOGI("DataChannel String Message: %.*s\n", pMessageLen, pMessage);
+        // Send a response to the message sent by the viewer
+        retStatus = dataChannelSend(pDataChannel, FALSE, (PBYTE)MASTER_DATA_CHANNEL_MESSAGE, STRLEN(MASTER_DATA_CHANNEL_MESSAGE));
     }
-    // Send a response to the message sent by the viewer
-    STATUS retStatus = STATUS_SUCCESS;
-    retStatus = dataChannelSend(pDataChannel, FALSE, (PBYTE)MASTER_DATA_CHANNEL_MESSAGE, STRLEN(MASTER_DATA_CHANNEL_MESSAGE));
     if (retStatus != STATUS_SUCCESS)
     {
         DLOGI("[KVS Master] dataChannelSend(): operation returned status code: 0x%08x \n", retStatus);
@@ -78,6 +147,10 @@ VOID onConnectionStateChange(UINT64 customData, RTC_PEER_CONNECTION_STATE newSta
     case RTC_PEER_CONNECTION_STATE_CONNECTED:
         ATOMIC_STORE_BOOL(&pSampleConfiguration->connected, TRUE);
         CVAR_BROADCAST(pSampleConfiguration->cvar);
+        // reached once ICE is connected and the DTLS handshake is done
+        recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_CONNECTED, GETTIME());
+        // the new viewer can only decode from the next keyframe
+        keyframe::stream().request(keyframe::REASON_VIEWER);
 
         CHK_STATUS(peerConnectionGetMetrics(pSampleStreamingSession->pPeerConnection, &pSampleStreamingSession->peerConnectionMetrics));
         CHK_STATUS(iceAgentGetMetrics(pSampleStreamingSession->pPeerConnection, &pSampleStreamingSession->iceMetrics));
@@ -87,6 +160,12 @@ VOID onConnectionStateChange(UINT64 customData, RTC_PEER_CONNECTION_STATE newSta
             DLOGW("Failed to get information about selected Ice candidates: 0x%08x", retStatus);
         }
         break;
+    case RTC_PEER_CONNECTION_STATE_CONNECTING:
+        // the ICE agent starts the connectivity checks once it has candidate pairs
+        recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_ICE_CHECKING, GETTIME());
+        ATOMIC_STORE_BOOL(&pSampleConfiguration->connected, FALSE);
+        CVAR_BROADCAST(pSampleConfiguration->cvar);
+        break;
     case RTC_PEER_CONNECTION_STATE_FAILED:
         // explicit fallthrough
     case RTC_PEER_CONNECTION_STATE_CLOSED:
@@ -188,6 +267,8 @@ PVOID mediaSenderRoutine(PVOID customData)
 {
     STATUS retStatus = STATUS_SUCCESS;
     PSampleConfiguration pSampleConfiguration = (PSampleConfiguration)customData;
+    threadstats::nameThread("c3-media-send");
+    ALLOC_STATS_SUBSYSTEM("media");
     CHK(pSampleConfiguration != NULL, STATUS_NULL_ARG);
     pSampleConfiguration->videoSenderTid = INVALID_TID_VALUE;
     pSampleConfiguration->audioSenderTid = INVALID_TID_VALUE;
@@ -234,6 +315,7 @@ STATUS handleOffer(PSampleConfiguration pSampleConfiguration, PSampleStreamingSe
     RtcSessionDescriptionInit offerSessionDescriptionInit;
     NullableBool canTrickle;
     BOOL mediaThreadStarted;
+    TRACE_SCOPE("handleOffer");
 
     CHK(pSampleConfiguration != NULL && pSignalingMessage != NULL, STATUS_NULL_ARG);
 
@@ -295,6 +377,7 @@ STATUS sendSignalingMessage(PSampleStreamingSession pSampleStreamingSession, PSi
     CHK_STATUS(signalingClientSendMessageSync(pSampleConfiguration->signalingClientHandle, pMessage));
     if (pMessage->messageType == SIGNALING_MESSAGE_TYPE_ANSWER)
     {
+        recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_ANSWER_SENT, GETTIME());
         CHK_STATUS(signalingClientGetMetrics(pSampleConfiguration->signalingClientHandle, &pSampleConfiguration->signalingClientMetrics));
         DLOGP("[Signaling offer to answer] %" PRIu64 " ms", pSampleConfiguration->signalingClientMetrics.signalingClientStats.offerToAnswerTime);
     }
@@ -458,6 +541,8 @@ STATUS initializePeerConnection(PSampleConfiguration pSampleConfiguration, PRtcP
 
     if (retStatus == STATUS_NOT_FOUND)
     {
+        // The certificate is generated inside createPeerConnection(), on the path of the joining viewer
+        metrics::counter("webrtc.join.cert_generated_inline").add();
         retStatus = STATUS_SUCCESS;
     }
     else
@@ -467,7 +552,10 @@ STATUS initializePeerConnection(PSampleConfiguration pSampleConfiguration, PRtcP
         configuration.certificates[0] = *pRtcCertificate;
     }
 
-    CHK_STATUS(createPeerConnection(&configuration, ppRtcPeerConnection));
+    TRACE_BEGIN("createPeerConnection");
+    retStatus = createPeerConnection(&configuration, ppRtcPeerConnection);
+    TRACE_END("createPeerConnection");
+    CHK_STATUS(retStatus);
 CleanUp:
 
     CHK_LOG_ERR(retStatus);
@@ -520,9 +608,12 @@ STATUS createSampleStreamingSession(PSampleConfiguration pSampleConfiguration, P
     CHK((isMaster && peerId != NULL) || !isMaster, STATUS_INVALID_ARG);
 
     pSampleStreamingSession = (PSampleStreamingSession)MEMCALLOC(1, SIZEOF(SampleStreamingSession));
+    CHK(pSampleStreamingSession != NULL, STATUS_NOT_ENOUGH_MEMORY);
+    pSampleStreamingSession->joinPhaseLock = MUTEX_CREATE(FALSE);
+    CHK(IS_VALID_MUTEX_VALUE(pSampleStreamingSession->joinPhaseLock), STATUS_INVALID_OPERATION);
     pSampleStreamingSession->firstFrame = TRUE;
     pSampleStreamingSession->offerReceiveTime = GETTIME();
-    CHK(pSampleStreamingSession != NULL, STATUS_NOT_ENOUGH_MEMORY);
+    recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_OFFER_RECEIVED, pSampleStreamingSession->offerReceiveTime);
 
     if (isMaster)
     {
@@ -590,6 +681,7 @@ STATUS createSampleStreamingSession(PSampleConfiguration pSampleConfiguration, P
     CHK_STATUS(peerConnectionOnSenderBandwidthEstimation(pSampleStreamingSession->pPeerConnection, (UINT64)pSampleStreamingSession,
                                                          sampleSenderBandwidthEstimationHandler));
     pSampleStreamingSession->startUpLatency = 0;
+    recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_PEER_CONNECTION_CREATED, GETTIME());
 CleanUp:
 
     if (STATUS_FAILED(retStatus) && pSampleStreamingSession != NULL)
@@ -611,6 +703,7 @@ STATUS freeSampleStreamingSession(PSampleStreamingSession *ppSampleStreamingSess
     STATUS retStatus = STATUS_SUCCESS;
     PSampleStreamingSession pSampleStreamingSession = NULL;
     PSampleConfiguration pSampleConfiguration;
+    BOOL incomplete = FALSE;
 
     CHK(ppSampleStreamingSession != NULL, STATUS_NULL_ARG);
     pSampleStreamingSession = *ppSampleStreamingSession;
@@ -619,6 +712,17 @@ STATUS freeSampleStreamingSession(PSampleStreamingSession *ppSampleStreamingSess
 
     DLOGD("Freeing streaming session with peer id: %s ", pSampleStreamingSession->peerId);
 
+    if (IS_VALID_MUTEX_VALUE(pSampleStreamingSession->joinPhaseLock))
+    {
+        MUTEX_LOCK(pSampleStreamingSession->joinPhaseLock);
+        incomplete = pSampleStreamingSession->joinPhaseTime[JOIN_PHASE_FIRST_KEYFRAME] == 0;
+        MUTEX_UNLOCK(pSampleStreamingSession->joinPhaseLock);
+    }
+    if (incomplete)
+    {
+        metrics::counter("webrtc.join.incomplete").add();
+    }
+
     ATOMIC_STORE_BOOL(&pSampleStreamingSession->terminateFlag, TRUE);
 
     if (pSampleStreamingSession->shutdownCallback != NULL)
@@ -631,6 +735,12 @@ STATUS freeSampleStreamingSession(PSampleStreamingSession *ppSampleStreamingSess
         THREAD_JOIN(pSampleStreamingSession->receiveAudioVideoSenderTid, NULL);
     }
 
+    // queued snapshots see the terminate flag and skip the data channel, one being taken finishes first
+    while (ATOMIC_LOAD(&pSampleStreamingSession->pendingSnapshots) != 0)
+    {
+        THREAD_SLEEP(10 * HUNDREDS_OF_NANOS_IN_A_MILLISECOND);
+    }
+
     // De-initialize the session stats timer if there are no active sessions
     // NOTE: we need to perform this under the lock which might be acquired by
     // the running thread but it's OK as it's re-entrant
@@ -646,6 +756,10 @@ STATUS freeSampleStreamingSession(PSampleStreamingSession *ppSampleStreamingSess
 
     CHK_LOG_ERR(closePeerConnection(pSampleStreamingSession->pPeerConnection));
     CHK_LOG_ERR(freePeerConnection(&pSampleStreamingSession->pPeerConnection));
+    if (IS_VALID_MUTEX_VALUE(pSampleStreamingSession->joinPhaseLock))
+    {
+        MUTEX_FREE(pSampleStreamingSession->joinPhaseLock);
+    }
     SAFE_MEMFREE(pSampleStreamingSession);
 
 CleanUp:
@@ -670,6 +784,75 @@ CleanUp:
     return retStatus;
 }
 
+VOID recordJoinPhase(PSampleStreamingSession pSampleStreamingSession, JOIN_PHASE phase, UINT64 time)
+{
+    UINT64 times[JOIN_PHASE_COUNT];
+    BOOL complete = FALSE;
+
+    // Only the first occurrence of a milestone counts, e.g. the connected state after an ICE restart does not
+    MUTEX_LOCK(pSampleStreamingSession->joinPhaseLock);
+    if (pSampleStreamingSession->joinPhaseTime[phase] == 0)
+    {
+        pSampleStreamingSession->joinPhaseTime[phase] = time;
+        if (phase == JOIN_PHASE_FIRST_KEYFRAME)
+        {
+            MEMCPY(times, pSampleStreamingSession->joinPhaseTime, SIZEOF(times));
+            complete = TRUE;
+        }
+    }
+    MUTEX_UNLOCK(pSampleStreamingSession->joinPhaseLock);
+
+    if (complete)
+    {
+        reportJoinLatency(pSampleStreamingSession, times);
+    }
+}
+
+VOID reportJoinLatency(PSampleStreamingSession pSampleStreamingSession, PUINT64 pTimes)
+{
+    static const PCHAR phaseNames[JOIN_PHASE_COUNT] = {
+        (PCHAR) "offer",    (PCHAR) "peer_connection", (PCHAR) "answer",         (PCHAR) "candidates",
+        (PCHAR) "ice_dtls", (PCHAR) "first_frame",     (PCHAR) "first_keyframe",
+    };
+    UINT64 phaseMs[JOIN_PHASE_COUNT] = {0};
+    UINT64 previous = pTimes[JOIN_PHASE_OFFER_RECEIVED], totalMs, sloMs = pSampleStreamingSession->pSampleConfiguration->joinSloMs;
+    UINT32 i, slowest = JOIN_PHASE_PEER_CONNECTION_CREATED;
+
+    for (i = JOIN_PHASE_PEER_CONNECTION_CREATED; i < JOIN_PHASE_COUNT; i++)
+    {
+        // A milestone which was not observed (e.g. answer failed to send) adds its time to the next phase
+        if (pTimes[i] == 0)
+        {
+            continue;
+        }
+        phaseMs[i] = pTimes[i] > previous ? (pTimes[i] - previous) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND : 0;
+        previous = MAX(previous, pTimes[i]);
+        metrics::histogram(std::string("webrtc.join.") + phaseNames[i] + "_ms").record(phaseMs[i]);
+        if (phaseMs[i] > phaseMs[slowest])
+        {
+            slowest = i;
+        }
+    }
+
+    totalMs = (pTimes[JOIN_PHASE_FIRST_KEYFRAME] - pTimes[JOIN_PHASE_OFFER_RECEIVED]) / HUNDREDS_OF_NANOS_IN_A_MILLISECOND;
+    metrics::histogram("webrtc.join.total_ms").record(totalMs);
+    metrics::counter("webrtc.join.sessions").add();
+
+    DLOGP("[Time to first keyframe] %s %" PRIu64 " ms: peer connection %" PRIu64 " ms, answer %" PRIu64 " ms, candidates %" PRIu64
+          " ms, ICE and DTLS %" PRIu64 " ms, first frame %" PRIu64 " ms, first keyframe %" PRIu64 " ms",
+          pSampleStreamingSession->peerId, totalMs, phaseMs[JOIN_PHASE_PEER_CONNECTION_CREATED], phaseMs[JOIN_PHASE_ANSWER_SENT],
+          phaseMs[JOIN_PHASE_ICE_CHECKING], phaseMs[JOIN_PHASE_CONNECTED], phaseMs[JOIN_PHASE_FIRST_FRAME], phaseMs[JOIN_PHASE_FIRST_KEYFRAME]);
+
+    if (sloMs != 0 && totalMs > sloMs)
+    {
+        // Violations are also counted against the phase which took the longest to tell where slow joins come from
+        metrics::counter("webrtc.join.slo_violations").add();
+        metrics::counter(std::string("webrtc.join.slo_violations.") + phaseNames[slowest]).add();
+        DLOGW("Viewer %s took %" PRIu64 " ms to the first keyframe, objective is %" PRIu64 " ms, slowest phase %s (%" PRIu64 " ms)",
+              pSampleStreamingSession->peerId, totalMs, sloMs, phaseNames[slowest], phaseMs[slowest]);
+    }
+}
+
 VOID sampleVideoFrameHandler(UINT64 customData, PFrame pFrame)
 {
     UNUSED_PARAM(customData);
@@ -883,6 +1066,8 @@ STATUS createSampleConfiguration(PCHAR channelName, IotCoreCredential *pIotCoreC
     pSampleConfiguration->cvar = CVAR_CREATE();
     pSampleConfiguration->streamingSessionListReadLock = MUTEX_CREATE(FALSE);
     pSampleConfiguration->signalingSendMessageLock = MUTEX_CREATE(FALSE);
+    LOCK_PROFILER_REGISTER(pSampleConfiguration->sampleConfigurationObjLock, "sampleConfigurationObjLock");
+    LOCK_PROFILER_REGISTER(pSampleConfiguration->streamingSessionListReadLock, "streamingSessionListReadLock");
     /* This is ignored for master. Master can extract the info from offer. Viewer has to know if peer can trickle or
      * not ahead of time. */
     pSampleConfiguration->trickleIce = trickleIce;
@@ -922,6 +1107,9 @@ STATUS createSampleConfiguration(PCHAR channelName, IotCoreCredential *pIotCoreC
     pSampleConfiguration->clientInfo.signalingMessagesMaximumThreads = KVS_SIGNALING_THREADPOOL_MAX;
     pSampleConfiguration->iceCandidatePairStatsTimerId = MAX_UINT32;
     pSampleConfiguration->pregenerateCertTimerId = MAX_UINT32;
+    pSampleConfiguration->lockProfilerTimerId = MAX_UINT32;
+    pSampleConfiguration->allocStatsTimerId = MAX_UINT32;
+    pSampleConfiguration->joinSloMs = SAMPLE_JOIN_SLO_DEFAULT_MS;
     pSampleConfiguration->signalingClientMetrics.version = SIGNALING_CLIENT_METRICS_CURRENT_VERSION;
 
     ATOMIC_STORE_BOOL(&pSampleConfiguration->interrupted, FALSE);
@@ -942,6 +1130,18 @@ STATUS createSampleConfiguration(PCHAR channelName, IotCoreCredential *pIotCoreC
                                            (UINT64)pSampleConfiguration, &pSampleConfiguration->pregenerateCertTimerId));
     }
 
+#ifdef KVS_ENABLE_LOCK_PROFILER
+    CHK_LOG_ERR(retStatus = timerQueueAddTimer(pSampleConfiguration->timerQueueHandle, LOCK_PROFILER_REPORT_PERIOD, LOCK_PROFILER_REPORT_PERIOD,
+                                               lockProfilerReportTimerCallback, (UINT64)pSampleConfiguration,
+                                               &pSampleConfiguration->lockProfilerTimerId));
+#endif
+
+#ifdef KVS_ENABLE_ALLOC_STATS
+    CHK_LOG_ERR(retStatus = timerQueueAddTimer(pSampleConfiguration->timerQueueHandle, ALLOC_STATS_REPORT_PERIOD, ALLOC_STATS_REPORT_PERIOD,
+                                               allocStatsReportTimerCallback, (UINT64)pSampleConfiguration,
+                                               &pSampleConfiguration->allocStatsTimerId));
+#endif
+
     pSampleConfiguration->iceUriCount = 0;
 
     CHK_STATUS(stackQueueCreate(&pSampleConfiguration->pPendingSignalingMessageForRemoteClient));
@@ -1031,7 +1231,12 @@ STATUS getIceCandidatePairStatsCallback(UINT32 timerId, UINT64 currentTime, UINT
     DOUBLE averageNumberOfPacketsReceivedPerSecond = 0.0;
     DOUBLE outgoingBitrate = 0.0;
     DOUBLE incomingBitrate = 0.0;
+    // Worst values over all viewers, exported for telemetry
+    DOUBLE worstRoundTripTime = 0.0;
+    DOUBLE worstOutgoingBitrate = -1.0;
+    DOUBLE worstPacketsDiscardedOnSend = 0.0;
     BOOL locked = FALSE;
+    ALLOC_STATS_SCOPE("stats");
 
     CHK_WARN(pSampleConfiguration != NULL, STATUS_NULL_ARG, "[KVS Master] getPeriodicStats(): Passed argument is NULL");
 
@@ -1102,6 +1307,11 @@ STATUS getIceCandidatePairStatsCallback(UINT32 timerId, UINT64 currentTime, UINT
                 DLOGD("Number of STUN responses received: %llu",
                       pSampleConfiguration->rtcIceCandidatePairMetrics.rtcStatsObject.iceCandidatePairStats.responsesReceived);
 
+                worstRoundTripTime =
+                    MAX(worstRoundTripTime, pSampleConfiguration->rtcIceCandidatePairMetrics.rtcStatsObject.iceCandidatePairStats.currentRoundTripTime);
+                worstOutgoingBitrate = worstOutgoingBitrate < 0.0 ? outgoingBitrate : MIN(worstOutgoingBitrate, outgoingBitrate);
+                worstPacketsDiscardedOnSend = MAX(worstPacketsDiscardedOnSend, averagePacketsDiscardedOnSend);
+
                 pSampleConfiguration->sampleStreamingSessionList[i]->rtcMetricsHistory.prevTs =
                     pSampleConfiguration->rtcIceCandidatePairMetrics.timestamp;
                 pSampleConfiguration->sampleStreamingSessionList[i]->rtcMetricsHistory.prevNumberOfPacketsSent =
@@ -1118,6 +1328,13 @@ STATUS getIceCandidatePairStatsCallback(UINT32 timerId, UINT64 currentTime, UINT
         }
     }
 
+    if (worstOutgoingBitrate >= 0.0)
+    {
+        metrics::gauge("webrtc.qoe.rtt_ms").set(worstRoundTripTime * 1000.0);
+        metrics::gauge("webrtc.qoe.send_kbps").set(worstOutgoingBitrate / 1000.0);
+        metrics::gauge("webrtc.qoe.discard_pps").set(worstPacketsDiscardedOnSend);
+    }
+
 CleanUp:
 
     if (locked)
@@ -1221,6 +1438,28 @@ STATUS freeSampleConfiguration(PSampleConfiguration *ppSampleConfiguration)
             pSampleConfiguration->pregenerateCertTimerId = MAX_UINT32;
         }
 
+        if (pSampleConfiguration->lockProfilerTimerId != MAX_UINT32)
+        {
+            retStatus = timerQueueCancelTimer(pSampleConfiguration->timerQueueHandle, pSampleConfiguration->lockProfilerTimerId,
+                                              (UINT64)pSampleConfiguration);
+            if (STATUS_FAILED(retStatus))
+            {
+                DLOGE("Failed to cancel lock profiler timer with: 0x%08x", retStatus);
+            }
+            pSampleConfiguration->lockProfilerTimerId = MAX_UINT32;
+        }
+
+        if (pSampleConfiguration->allocStatsTimerId != MAX_UINT32)
+        {
+            retStatus = timerQueueCancelTimer(pSampleConfiguration->timerQueueHandle, pSampleConfiguration->allocStatsTimerId,
+                                              (UINT64)pSampleConfiguration);
+            if (STATUS_FAILED(retStatus))
+            {
+                DLOGE("Failed to cancel allocation stats timer with: 0x%08x", retStatus);
+            }
+            pSampleConfiguration->allocStatsTimerId = MAX_UINT32;
+        }
+
         timerQueueFree(&pSampleConfiguration->timerQueueHandle);
     }
 
@@ -1276,11 +1515,13 @@ STATUS freeSampleConfiguration(PSampleConfiguration *ppSampleConfiguration)
 
     if (IS_VALID_MUTEX_VALUE(pSampleConfiguration->sampleConfigurationObjLock))
     {
+        LOCK_PROFILER_UNREGISTER(pSampleConfiguration->sampleConfigurationObjLock);
         MUTEX_FREE(pSampleConfiguration->sampleConfigurationObjLock);
     }
 
     if (IS_VALID_MUTEX_VALUE(pSampleConfiguration->streamingSessionListReadLock))
     {
+        LOCK_PROFILER_UNREGISTER(pSampleConfiguration->streamingSessionListReadLock);
         MUTEX_FREE(pSampleConfiguration->streamingSessionListReadLock);
     }
 
@@ -1357,6 +1598,7 @@ STATUS sessionCleanupWait(PSampleConfiguration pSampleConfiguration)
                 pSampleConfiguration->streamingSessionCount--;
                 pSampleConfiguration->sampleStreamingSessionList[i] =
                     pSampleConfiguration->sampleStreamingSessionList[pSampleConfiguration->streamingSessionCount];
+                metrics::gauge("webrtc.viewers").set(pSampleConfiguration->streamingSessionCount);
 
                 // Remove from the hash table
                 clientIdHash = COMPUTE_CRC32((PBYTE)pSampleStreamingSession->peerId, (UINT32)STRLEN(pSampleStreamingSession->peerId));
@@ -1474,6 +1716,8 @@ STATUS signalingMessageReceived(UINT64 customData, PReceivedSignalingMessage pRe
     PPendingMessageQueue pPendingMessageQueue = NULL;
     PSampleStreamingSession pSampleStreamingSession = NULL;
     PReceivedSignalingMessage pReceivedSignalingMessageCopy = NULL;
+    TRACE_SCOPE("signalingMessageReceived");
+    ALLOC_STATS_SCOPE("signaling");
 
     CHK(pSampleConfiguration != NULL, STATUS_NULL_ARG);
 
@@ -1519,6 +1763,7 @@ STATUS signalingMessageReceived(UINT64 customData, PReceivedSignalingMessage pRe
                                                 &pSampleStreamingSession));
         MUTEX_LOCK(pSampleConfiguration->streamingSessionListReadLock);
         pSampleConfiguration->sampleStreamingSessionList[pSampleConfiguration->streamingSessionCount++] = pSampleStreamingSession;
+        metrics::gauge("webrtc.viewers").set(pSampleConfiguration->streamingSessionCount);
         MUTEX_UNLOCK(pSampleConfiguration->streamingSessionListReadLock);
 
         CHK_STATUS(handleOffer(pSampleConfiguration, pSampleStreamingSession, &pReceivedSignalingMessage->signalingMessage));
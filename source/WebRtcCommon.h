@@ -34,6 +34,9 @@ extern "C"
 
 #define SAMPLE_PENDING_MESSAGE_CLEANUP_DURATION (20 * HUNDREDS_OF_NANOS_IN_A_SECOND)
 
+// Default objective for the time between the offer and the first keyframe sent to a viewer
+#define SAMPLE_JOIN_SLO_DEFAULT_MS 2000
+
 #define CA_CERT_PEM_FILE_EXTENSION ".pem"
 
 #define FILE_LOGGING_BUFFER_SIZE (10 * 1024)
@@ -44,6 +47,9 @@ extern "C"
 
 #define RTSP_PIPELINE_MAX_CHAR_COUNT 1000
 
+// how often the sender thread looks at the terminate flag while its pipeline runs
+#define SENDER_BUS_POLL_INTERVAL (100 * GST_MSECOND)
+
 #define IOT_CORE_CREDENTIAL_ENDPOINT ((PCHAR) "AWS_IOT_CORE_CREDENTIAL_ENDPOINT")
 #define IOT_CORE_CERT ((PCHAR) "AWS_IOT_CORE_CERT")
 #define IOT_CORE_PRIVATE_KEY ((PCHAR) "AWS_IOT_CORE_PRIVATE_KEY")
@@ -61,6 +67,12 @@ extern "C"
 // comment out this line to disable the feature
 #define KVS_USE_SIGNALING_CHANNEL_THREADPOOL 1
 
+// Lock contention profiler for the sample configuration locks, comment out this line to disable the feature
+#define KVS_ENABLE_LOCK_PROFILER 1
+
+// Per subsystem accounting of the SDK allocations, comment out this line to disable the feature
+#define KVS_ENABLE_ALLOC_STATS 1
+
 /* Uncomment the following line in order to enable IoT credentials checks in the provided samples */
 #define IOT_CORE_ENABLE_CREDENTIALS 1
 
@@ -152,10 +164,31 @@ extern "C"
         UINT32 pregenerateCertTimerId;
         PStackQueue pregeneratedCertificates; // Max MAX_RTCCONFIGURATION_CERTIFICATES certificates
 
+        UINT32 lockProfilerTimerId;
+        UINT32 allocStatsTimerId;
+        UINT64 joinSloMs;
+
         PCHAR rtspUri;
         UINT32 logLevel;
     } SampleConfiguration, *PSampleConfiguration;
 
+    /*
+     * Milestones of a viewer joining, from the offer to the first keyframe written to its transceiver.
+     * Each phase is the time between the previous milestone and this one.
+     */
+    typedef enum
+    {
+        JOIN_PHASE_OFFER_RECEIVED,
+        JOIN_PHASE_PEER_CONNECTION_CREATED,
+        JOIN_PHASE_ANSWER_SENT,
+        // the SDK reports ICE connected and DTLS done as one state, the connectivity checks starting is the state before
+        JOIN_PHASE_ICE_CHECKING,
+        JOIN_PHASE_CONNECTED,
+        JOIN_PHASE_FIRST_FRAME,
+        JOIN_PHASE_FIRST_KEYFRAME,
+        JOIN_PHASE_COUNT,
+    } JOIN_PHASE;
+
     typedef struct
     {
         UINT64 hashValue;
@@ -172,6 +205,8 @@ extern "C"
         volatile ATOMIC_BOOL peerIdReceived;
         volatile ATOMIC_BOOL firstFrame;
         volatile SIZE_T frameIndex;
+        // data channel snapshots queued on the snapshot thread, the session is freed once they were sent
+        volatile SIZE_T pendingSnapshots;
         PRtcPeerConnection pPeerConnection;
         PRtcRtpTransceiver pVideoRtcRtpTransceiver;
         PRtcRtpTransceiver pAudioRtcRtpTransceiver;
@@ -191,6 +226,9 @@ extern "C"
         UINT64 offerReceiveTime;
         PeerConnectionMetrics peerConnectionMetrics;
         KvsIceAgentMetrics iceMetrics;
+        // milestones are recorded from the signaling, SDK and media threads
+        MUTEX joinPhaseLock;
+        UINT64 joinPhaseTime[JOIN_PHASE_COUNT];
     };
 
     VOID sigintHandler(INT32);
@@ -226,6 +264,8 @@ extern "C"
     STATUS logSignalingClientStats(PSignalingClientMetrics);
     STATUS logSelectedIceCandidatesInformation(PSampleStreamingSession);
     STATUS logStartUpLatency(PSampleConfiguration);
+    VOID recordJoinPhase(PSampleStreamingSession, JOIN_PHASE, UINT64);
+    VOID reportJoinLatency(PSampleStreamingSession, PUINT64);
     STATUS createMessageQueue(UINT64, PPendingMessageQueue *);
     STATUS freeMessageQueue(PPendingMessageQueue);
     STATUS submitPendingIceCandidate(PPendingMessageQueue, PSampleStreamingSession);
@@ -238,4 +278,34 @@ extern "C"
 #ifdef __cplusplus
 }
 #endif
+
+#ifdef KVS_ENABLE_LOCK_PROFILER
+#include "LockProfiler.h"
+
+#undef MUTEX_LOCK
+#undef MUTEX_UNLOCK
+#undef MUTEX_TRYLOCK
+#undef CVAR_WAIT
+#define MUTEX_LOCK(m)          lockProfilerLock((m), (PCHAR) __FILE__, __LINE__, (PCHAR) __FUNCTION__)
+#define MUTEX_UNLOCK(m)        lockProfilerUnlock((m))
+#define MUTEX_TRYLOCK(m)       lockProfilerTryLock((m), (PCHAR) __FILE__, __LINE__, (PCHAR) __FUNCTION__)
+#define CVAR_WAIT(cv, m, t)    lockProfilerConditionWait((cv), (m), (t), (PCHAR) __FILE__, __LINE__, (PCHAR) __FUNCTION__)
+#define LOCK_PROFILER_REGISTER(m, name) lockProfilerRegister((m), (PCHAR) (name))
+#define LOCK_PROFILER_UNREGISTER(m)     lockProfilerUnregister((m))
+#else
+#define LOCK_PROFILER_REGISTER(m, name)
+#define LOCK_PROFILER_UNREGISTER(m)
+#endif
+
+#ifdef KVS_ENABLE_ALLOC_STATS
+#include "AllocStats.h"
+
+// attribute the allocations of the calling thread, or of the enclosing C++ scope, to a subsystem
+#define ALLOC_STATS_SUBSYSTEM(name) allocStatsSetSubsystem((PCHAR) (name))
+#define ALLOC_STATS_SCOPE(name)     AllocStatsScope _allocStatsScope((PCHAR) (name))
+#else
+#define ALLOC_STATS_SUBSYSTEM(name)
+#define ALLOC_STATS_SCOPE(name)
+#endif
+
 #endif /* __KINESIS_WEBRTC_COMMON_INCLUDE__ */
\ No newline at end of file
@@ -3,6 +3,14 @@
  * SPDX-License-Identifier: Apache-2.0.
  */
 #include "WebRtcCommon.h"
+#include "Tracer.h"
+#include "Metrics.h"
+#include "ThreadStats.h"
+#include "PipelineSupervisor.h"
+#include "Substream.h"
+#include "Encoding.h"
+#include "Keyframe.h"
+#include "Snapshot.h"
 
 #ifndef GST_H
 #define GST_H
@@ -12,6 +20,9 @@
 
 extern PSampleConfiguration gSampleConfiguration;
 
+/// Restarts the sender pipeline, shared by every streaming session
+static pipeline::Supervisor s_senderSupervisor("webrtc");
+
 // #define VERBOSE
 
 /// Pull new GstSample from App Sink and write frame to RtcRtpTransceiver
@@ -34,6 +45,7 @@ GstFlowReturn on_new_sample(GstElement *sink, gpointer data, UINT64 trackid)
     PSampleStreamingSession pSampleStreamingSession = NULL;
     PRtcRtpTransceiver pRtcRtpTransceiver = NULL;
     UINT32 i;
+    ALLOC_STATS_SCOPE("media");
 
     CHK_ERR(pSampleConfiguration != NULL, STATUS_NULL_ARG, "NULL sample configuration");
 
@@ -73,6 +85,22 @@ GstFlowReturn on_new_sample(GstElement *sink, gpointer data, UINT64 trackid)
         frame.size = (UINT32)info.size;
         frame.frameData = (PBYTE)info.data;
 
+        if (trackid == DEFAULT_VIDEO_TRACK_ID)
+        {
+            s_senderSupervisor.flowing();
+            static metrics::Counter &videoFrames = metrics::counter("video.frames");
+            static metrics::Counter &videoBytes = metrics::counter("video.bytes");
+            videoFrames.add();
+            videoBytes.add(info.size);
+            keyframe::Reason reason = keyframe::stream().onFrame(!delta, info.size);
+            if (reason != keyframe::REASON_NONE)
+            {
+                DLOGD("[KVS GStreamer Master] Forcing an IDR, %s", keyframe::reasonName(reason));
+                encoding::forceKeyframe();
+            }
+        }
+
+        TRACE_BEGIN("writeFrameFanout");
         MUTEX_LOCK(pSampleConfiguration->streamingSessionListReadLock);
         for (i = 0; i < pSampleConfiguration->streamingSessionCount; ++i)
         {
@@ -101,13 +129,22 @@ GstFlowReturn on_new_sample(GstElement *sink, gpointer data, UINT64 trackid)
                 DLOGE("writeFrame() failed with 0x%08x", status);
 #endif
             }
-            else if (status == STATUS_SUCCESS && pSampleStreamingSession->firstFrame)
+            else if (status == STATUS_SUCCESS && trackid == DEFAULT_VIDEO_TRACK_ID)
             {
-                PROFILE_WITH_START_TIME(pSampleStreamingSession->offerReceiveTime, "Time to first frame");
-                pSampleStreamingSession->firstFrame = FALSE;
+                if (pSampleStreamingSession->firstFrame)
+                {
+                    PROFILE_WITH_START_TIME(pSampleStreamingSession->offerReceiveTime, "Time to first frame");
+                    pSampleStreamingSession->firstFrame = FALSE;
+                    recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_FIRST_FRAME, GETTIME());
+                }
+                if (frame.flags == FRAME_FLAG_KEY_FRAME)
+                {
+                    recordJoinPhase(pSampleStreamingSession, JOIN_PHASE_FIRST_KEYFRAME, GETTIME());
+                }
             }
         }
         MUTEX_UNLOCK(pSampleConfiguration->streamingSessionListReadLock);
+        TRACE_END("writeFrameFanout");
     }
 
 CleanUp:
@@ -142,17 +179,25 @@ GstFlowReturn on_new_sample_audio(GstElement *sink, gpointer data)
     return on_new_sample(sink, data, DEFAULT_AUDIO_TRACK_ID);
 }
 
-/// Capture audio/video stream from Camera and send it App Sink using GStreamer pipeline
-PVOID sendGstreamerAudioVideo(PVOID args)
+/// Raspberry Pi capture and hardware encode of the video, from the settings of the shadow
+static std::string rpiVideoDescription(const char *source, const encoding::Settings &settings)
 {
-    STATUS retStatus = STATUS_SUCCESS;
-    GstElement *appsinkVideo = NULL, *appsinkAudio = NULL, *pipeline = NULL;
-    GstBus *bus;
-    GstMessage *msg;
-    GError *error = NULL;
-    PSampleConfiguration pSampleConfiguration = (PSampleConfiguration)args;
+    char caps[128];
+    snprintf(caps, sizeof(caps), "width=%d,height=%d,framerate=%d/1", settings.width, settings.height, settings.fps);
+    return std::string(source) + " ! queue ! v4l2convert ! video/x-raw,format=I420," + caps + " ! "
+           "v4l2h264enc name=encoder extra-controls=\"" + encoding::describeControls(settings) + "\" ! "
+           "h264parse ! "
+           "video/x-h264,stream-format=byte-stream,alignment=au," + caps + ",profile=" + settings.profile + ",level=(string)4 ! "
+           "appsink sync=TRUE emit-signals=TRUE name=appsink-video";
+}
 
-    CHK_ERR(pSampleConfiguration != NULL, STATUS_NULL_ARG, "[KVS Gstreamer Master] Streaming session is NULL");
+/// Build the sender pipeline for the configured media and source type, settings apply to RPI_SOURCE.
+/// Fails only on configuration errors, a pipeline which cannot be created is returned as NULL with the GStreamer error.
+static STATUS buildSenderPipeline(PSampleConfiguration pSampleConfiguration, const encoding::Settings &settings, GstElement **ppPipeline,
+                                  GError **ppError)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    *ppPipeline = NULL;
 
     /**
      * Use x264enc as its available on mac, pi, ubuntu and windows
@@ -185,32 +230,32 @@ PVOID sendGstreamerAudioVideo(PVOID args)
         {
         case TEST_SOURCE:
         {
-            pipeline =
+            *ppPipeline =
                 gst_parse_launch("videotestsrc is-live=TRUE ! queue ! videoconvert ! video/x-raw,width=1280,height=720,framerate=25/1 ! "
                                  "x264enc bframes=0 speed-preset=veryfast bitrate=512 byte-stream=TRUE tune=zerolatency ! "
                                  "video/x-h264,stream-format=byte-stream,alignment=au,profile=baseline ! appsink sync=TRUE emit-signals=TRUE "
                                  "name=appsink-video",
-                                 &error);
+                                 ppError);
             break;
         }
         case DEVICE_SOURCE:
         {
-            pipeline = gst_parse_launch("autovideosrc ! queue ! videoconvert ! video/x-raw,width=1280,height=720,framerate=25/1 ! "
+            *ppPipeline = gst_parse_launch("autovideosrc ! queue ! videoconvert ! video/x-raw,width=1280,height=720,framerate=25/1 ! "
                                         "x264enc bframes=0 speed-preset=veryfast bitrate=512 byte-stream=TRUE tune=zerolatency ! "
                                         "video/x-h264,stream-format=byte-stream,alignment=au,profile=baseline ! appsink sync=TRUE "
                                         "emit-signals=TRUE name=appsink-video",
-                                        &error);
+                                        ppError);
             break;
         }
         case RPI_SOURCE:
         {
-            // Raspberry Pi Hardware Encode
-            pipeline = gst_parse_launch("libcamerasrc ! queue ! v4l2convert ! video/x-raw,format=I420,width=1280,height=720,framerate=25/1 ! "
-                                        "v4l2h264enc extra-controls=\"controls,h264_profile=4,video_bitrate=620000\" ! "
-                                        "h264parse ! "
-                                        "video/x-h264,stream-format=byte-stream,alignment=au,width=1280,height=720,framerate=25/1,profile=baseline,level=(string)4 ! "
-                                        "appsink sync=TRUE emit-signals=TRUE name=appsink-video",
-                                        &error);
+            // Raspberry Pi Hardware Encode, the analytics substream comes from a second output of the camera
+            std::string launch = rpiVideoDescription("libcamerasrc name=camera", settings);
+            if (substream::active())
+            {
+                launch += " " + substream::description("camera");
+            }
+            *ppPipeline = gst_parse_launch(launch.c_str(), ppError);
             break;
         }
         case RTSP_SOURCE:
@@ -226,9 +271,9 @@ PVOID sendGstreamerAudioVideo(PVOID args)
             if (stringOutcome > RTSP_PIPELINE_MAX_CHAR_COUNT)
             {
                 printf("[KVS GStreamer Master] ERROR: rtsp uri entered exceeds maximum allowed length set by RTSP_PIPELINE_MAX_CHAR_COUNT\n");
-                goto CleanUp;
+                CHK(FALSE, STATUS_INVALID_ARG);
             }
-            pipeline = gst_parse_launch(rtspPipeLineBuffer, &error);
+            *ppPipeline = gst_parse_launch(rtspPipeLineBuffer, ppError);
 
             break;
         }
@@ -240,40 +285,35 @@ PVOID sendGstreamerAudioVideo(PVOID args)
         {
         case TEST_SOURCE:
         {
-            pipeline =
+            *ppPipeline =
                 gst_parse_launch("videotestsrc is-live=TRUE ! queue ! videoconvert ! video/x-raw,width=1280,height=720,framerate=25/1 ! "
                                  "x264enc bframes=0 speed-preset=veryfast bitrate=512 byte-stream=TRUE tune=zerolatency ! "
                                  "video/x-h264,stream-format=byte-stream,alignment=au,profile=baseline ! appsink sync=TRUE "
                                  "emit-signals=TRUE name=appsink-video audiotestsrc is-live=TRUE ! "
                                  "queue leaky=2 max-size-buffers=400 ! audioconvert ! audioresample ! opusenc ! "
                                  "audio/x-opus,rate=48000,channels=2 ! appsink sync=TRUE emit-signals=TRUE name=appsink-audio",
-                                 &error);
+                                 ppError);
             break;
         }
         case DEVICE_SOURCE:
         {
-            pipeline =
+            *ppPipeline =
                 gst_parse_launch("autovideosrc ! queue ! videoconvert ! video/x-raw,width=1280,height=720,framerate=25/1 ! "
                                  "x264enc bframes=0 speed-preset=veryfast bitrate=512 byte-stream=TRUE tune=zerolatency ! "
                                  "video/x-h264,stream-format=byte-stream,alignment=au,profile=baseline ! appsink sync=TRUE emit-signals=TRUE "
                                  "name=appsink-video autoaudiosrc ! "
                                  "queue leaky=2 max-size-buffers=400 ! audioconvert ! audioresample ! opusenc ! "
                                  "audio/x-opus,rate=48000,channels=2 ! appsink sync=TRUE emit-signals=TRUE name=appsink-audio",
-                                 &error);
+                                 ppError);
             break;
         }
         case RPI_SOURCE:
         {
             // Raspberry Pi Hardware Encode
-            pipeline =
-                gst_parse_launch("autovideosrc ! queue ! v4l2convert ! video/x-raw,format=I420,width=1280,height=720,framerate=25/1 ! "
-                                 "v4l2h264enc ! "
-                                 "h264parse ! "
-                                 "video/x-h264,stream-format=byte-stream,alignment=au,width=1280,height=720,framerate=25/1,profile=baseline,level=(string)4 ! "
-                                 "appsink sync=TRUE emit-signals=TRUE name=appsink-video name=appsink-video autoaudiosrc ! "
+            std::string launch = rpiVideoDescription("autovideosrc", settings) + " autoaudiosrc ! "
                                  "queue leaky=2 max-size-buffers=400 ! audioconvert ! audioresample ! opusenc ! "
-                                 "audio/x-opus,rate=48000,channels=2 ! appsink sync=TRUE emit-signals=TRUE name=appsink-audio",
-                                 &error);
+                                 "audio/x-opus,rate=48000,channels=2 ! appsink sync=TRUE emit-signals=TRUE name=appsink-audio";
+            *ppPipeline = gst_parse_launch(launch.c_str(), ppError);
             break;
         }
         case RTSP_SOURCE:
@@ -291,9 +331,9 @@ PVOID sendGstreamerAudioVideo(PVOID args)
             if (stringOutcome > RTSP_PIPELINE_MAX_CHAR_COUNT)
             {
                 printf("[KVS GStreamer Master] ERROR: rtsp uri entered exceeds maximum allowed length set by RTSP_PIPELINE_MAX_CHAR_COUNT\n");
-                goto CleanUp;
+                CHK(FALSE, STATUS_INVALID_ARG);
             }
-            pipeline = gst_parse_launch(rtspPipeLineBuffer, &error);
+            *ppPipeline = gst_parse_launch(rtspPipeLineBuffer, ppError);
 
             break;
         }
@@ -301,48 +341,143 @@ PVOID sendGstreamerAudioVideo(PVOID args)
         break;
     }
 
-    CHK_ERR(pipeline != NULL, STATUS_NULL_ARG, "[KVS Gstreamer Master] Pipeline is NULL");
+CleanUp:
 
-    appsinkVideo = gst_bin_get_by_name(GST_BIN(pipeline), "appsink-video");
-    appsinkAudio = gst_bin_get_by_name(GST_BIN(pipeline), "appsink-audio");
+    return retStatus;
+}
 
-    if (!(appsinkVideo != NULL || appsinkAudio != NULL))
-    {
-        printf("[KVS GStreamer Master] sendGstreamerAudioVideo(): cant find appsink, operation returned status code: 0x%08x \n",
-               STATUS_INTERNAL_ERROR);
-        goto CleanUp;
-    }
+/// Capture audio/video stream from Camera and send it App Sink using GStreamer pipeline.
+/// A pipeline which stops on error or end of stream is rebuilt by the supervisor with backoff, the streaming sessions
+/// stay connected and get frames again from the next keyframe.
+PVOID sendGstreamerAudioVideo(PVOID args)
+{
+    STATUS retStatus = STATUS_SUCCESS;
+    GstElement *appsinkVideo = NULL, *appsinkAudio = NULL, *pipeline = NULL;
+    GstBus *bus;
+    GstMessage *msg;
+    GError *error = NULL;
+    gchar *dbg = NULL;
+    PSampleConfiguration pSampleConfiguration = (PSampleConfiguration)args;
 
-    // You can extract data from appsink by using either: Signals or direct C API
-    // Signals will be used here
-    if (appsinkVideo != NULL)
-    {
-        g_signal_connect(appsinkVideo, "new-sample", G_CALLBACK(on_new_sample_video), (gpointer)pSampleConfiguration);
-    }
-    if (appsinkAudio != NULL)
+    threadstats::nameThread("c3-gst-send");
+    CHK_ERR(pSampleConfiguration != NULL, STATUS_NULL_ARG, "[KVS Gstreamer Master] Streaming session is NULL");
+
+    while (!ATOMIC_LOAD_BOOL(&pSampleConfiguration->appTerminateFlag))
     {
-        g_signal_connect(appsinkAudio, "new-sample", G_CALLBACK(on_new_sample_audio), (gpointer)pSampleConfiguration);
-    }
-    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        // the settings of the shadow are taken once per build
+        encoding::Settings settings = encoding::current();
+        BOOL rebuild = FALSE;
+        CHK_STATUS(buildSenderPipeline(pSampleConfiguration, settings, &pipeline, &error));
+        if (error != NULL)
+        {
+            DLOGE("%s", error->message);
+        }
 
-    /* block until error or EOS */
-    bus = gst_element_get_bus(pipeline);
-    msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+        if (pipeline == NULL)
+        {
+            s_senderSupervisor.failed(error != NULL ? error->message : "pipeline could not be built");
+        }
+        if (error != NULL)
+        {
+            g_clear_error(&error);
+        }
 
-    /* Free resources */
-    if (msg != NULL)
-    {
-        gst_message_unref(msg);
-    }
-    if (bus != NULL)
-    {
-        gst_object_unref(bus);
-    }
-    gst_element_set_state(pipeline, GST_STATE_NULL);
-    if (pipeline != NULL)
-    {
-        gst_object_unref(pipeline);
+        if (pipeline != NULL)
+        {
+            appsinkVideo = gst_bin_get_by_name(GST_BIN(pipeline), "appsink-video");
+            appsinkAudio = gst_bin_get_by_name(GST_BIN(pipeline), "appsink-audio");
+            substream::connect(pipeline);
+
+            if (!(appsinkVideo != NULL || appsinkAudio != NULL))
+            {
+                printf("[KVS GStreamer Master] sendGstreamerAudioVideo(): cant find appsink, operation returned status code: 0x%08x \n",
+                       STATUS_INTERNAL_ERROR);
+                gst_object_unref(pipeline);
+                pipeline = NULL;
+                goto CleanUp;
+            }
+
+            // You can extract data from appsink by using either: Signals or direct C API
+            // Signals will be used here
+            if (appsinkVideo != NULL)
+            {
+                g_signal_connect(appsinkVideo, "new-sample", G_CALLBACK(on_new_sample_video), (gpointer)pSampleConfiguration);
+            }
+            if (appsinkAudio != NULL)
+            {
+                g_signal_connect(appsinkAudio, "new-sample", G_CALLBACK(on_new_sample_audio), (gpointer)pSampleConfiguration);
+            }
+            // only the hardware encoder takes new settings and forced IDRs, the other sources keep their fixed pipelines
+            GstElement *encoder = gst_bin_get_by_name(GST_BIN(pipeline), "encoder");
+            keyframe::stream().configure(encoder != NULL ? settings.fps : 0, settings.gop);
+            threadstats::nameGstStreamingThreads(pipeline);
+            gst_element_set_state(pipeline, GST_STATE_PLAYING);
+            encoding::bind(encoder, settings);
+            if (encoder != NULL)
+            {
+                snapshot::watch(encoder);
+                gst_object_unref(encoder);
+            }
+
+            /* block until error, EOS, shutdown or new capture settings */
+            bus = gst_element_get_bus(pipeline);
+            msg = NULL;
+            while (msg == NULL && !ATOMIC_LOAD_BOOL(&pSampleConfiguration->appTerminateFlag) && !rebuild)
+            {
+                msg = gst_bus_timed_pop_filtered(bus, SENDER_BUS_POLL_INTERVAL, (GstMessageType)(GST_MESSAGE_ERROR | GST_MESSAGE_EOS));
+                rebuild = encoding::rebuildRequested();
+            }
+
+            /* Only the pipeline is freed, the signaling client and the peer connections are left alone */
+            if (msg != NULL && !ATOMIC_LOAD_BOOL(&pSampleConfiguration->appTerminateFlag))
+            {
+                if (GST_MESSAGE_TYPE(msg) == GST_MESSAGE_ERROR)
+                {
+                    gst_message_parse_error(msg, &error, &dbg);
+                    DLOGE("[KVS GStreamer Master] %s: %s (%s)", GST_OBJECT_NAME(GST_MESSAGE_SRC(msg)), error->message, dbg != NULL ? dbg : "");
+                    s_senderSupervisor.failed(std::string(GST_OBJECT_NAME(GST_MESSAGE_SRC(msg))) + ": " + error->message);
+                    g_free(dbg);
+                    dbg = NULL;
+                }
+                else
+                {
+                    s_senderSupervisor.failed("end of stream");
+                }
+            }
+            if (msg != NULL)
+            {
+                gst_message_unref(msg);
+            }
+            gst_object_unref(bus);
+            encoding::unbind();
+            gst_element_set_state(pipeline, GST_STATE_NULL);
+            gst_object_unref(pipeline);
+            pipeline = NULL;
+            if (appsinkAudio != NULL)
+            {
+                gst_object_unref(appsinkAudio);
+                appsinkAudio = NULL;
+            }
+            if (appsinkVideo != NULL)
+            {
+                gst_object_unref(appsinkVideo);
+                appsinkVideo = NULL;
+            }
+        }
+
+        if (error != NULL)
+        {
+            g_clear_error(&error);
+        }
+        // a rebuild for new settings is no failure, the sessions get the new stream from its first keyframe
+        if (ATOMIC_LOAD_BOOL(&pSampleConfiguration->appTerminateFlag) || (!rebuild && !s_senderSupervisor.backoff()))
+        {
+            break;
+        }
     }
+
+CleanUp:
+
     if (appsinkAudio != NULL)
     {
         gst_object_unref(appsinkAudio);
@@ -351,9 +486,6 @@ PVOID sendGstreamerAudioVideo(PVOID args)
     {
         gst_object_unref(appsinkVideo);
     }
-
-CleanUp:
-
     if (error != NULL)
     {
         DLOGE("%s", error->message);
@@ -402,6 +534,7 @@ PVOID receiveGstreamerAudioVideo(PVOID args)
     PSampleStreamingSession pSampleStreamingSession = (PSampleStreamingSession)args;
     gchar *videoDescription = "", *audioDescription = "", *audioVideoDescription;
 
+    threadstats::nameThread("c3-gst-recv");
     CHK_ERR(pSampleStreamingSession != NULL, STATUS_NULL_ARG, "[KVS Gstreamer Master] Sample streaming session is NULL");
 
     // TODO: For video
@@ -433,6 +566,7 @@ PVOID receiveGstreamerAudioVideo(PVOID args)
 
     CHK_ERR(pipeline != NULL, STATUS_INTERNAL_ERROR, "[KVS Gstreamer Master] Pipeline is NULL");
 
+    threadstats::nameGstStreamingThreads(pipeline);
     gst_element_set_state(pipeline, GST_STATE_PLAYING);
 
     /* block until error or EOS */
@@ -479,6 +613,7 @@ void cleanUpKVSResources(
     {
         // Kick of the termination sequence
         ATOMIC_STORE_BOOL(&pSampleConfiguration->appTerminateFlag, TRUE);
+        s_senderSupervisor.stop();
 
         if (pSampleConfiguration->mediaSenderTid != INVALID_TID_VALUE)
         {
@@ -500,8 +635,13 @@ void cleanUpKVSResources(
         {
             DLOGE("[KVS GStreamer Master] freeSampleConfiguration(): operation returned status code: 0x%08x", retStatus);
         }
+        // data channel snapshots may have started the snapshot thread, every session that used it is gone
+        snapshot::stopDelivery();
     }
     DLOGI("[KVS Gstreamer Master] Cleanup done");
 
+#ifdef KVS_ENABLE_ALLOC_STATS
+    allocStatsUninstall();
+#endif
     RESET_INSTRUMENTED_ALLOCATORS();
 }
\ No newline at end of file
@@ -0,0 +1,21 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <stdio.h>
+
+/// Helpers shared by the benchmarks
+namespace bench
+{
+    /// Print one line of the verdict, "ok" or "FAIL" followed by what was checked, and return ok
+    inline bool check(bool ok, const char *what)
+    {
+        printf("%-4s %s\n", ok ? "ok" : "FAIL", what);
+        return ok;
+    }
+} // namespace bench
+
+#endif //__BENCH_H__
@@ -0,0 +1,146 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Click-to-center math benchmark.
+/// Checks the table driven pixel to pan/tilt conversion of Fov.h against the closed form with libm, for the nominal
+/// lens and for a lens with barrel distortion, then times it on random points. It fails when the conversion is off
+/// by more than the error bound, allocates memory or takes a microsecond or more per point.
+///
+/// usage: c3-fov-bench [points]
+/// The default is 1000000 points.
+#include "../Fov.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const double max_error_deg = 0.01;
+    const double max_ns_per_point = 1000;
+    const unsigned int grid_steps = 64;
+
+    unsigned long s_allocations = 0;
+
+    double undistort(double distorted, double k1)
+    {
+        double u = distorted;
+        for (int i = 0; i < 50; i++)
+        {
+            u -= (u * (1 + k1 * u * u) - distorted) / (1 + 3 * k1 * u * u);
+        }
+        return u;
+    }
+
+    /// Closed form of the model
+    void reference(const fov::Model &model, double x, double y, double &panDeg, double &tiltDeg)
+    {
+        const double deg = 180.0 / M_PI;
+        double u = undistort((2 * x - 1) * tan(model.hfovDeg / 2 / deg), model.k1);
+        double v = undistort((1 - 2 * y) * tan(model.vfovDeg / 2 / deg), model.k1);
+        panDeg = model.panSign * atan(u) * deg;
+        tiltDeg = model.tiltSign * atan(v / sqrt(1 + u * u)) * deg;
+    }
+
+    double maxError(const fov::Model &model)
+    {
+        double worst = 0;
+        for (unsigned int i = 0; i <= grid_steps; i++)
+        {
+            for (unsigned int j = 0; j <= grid_steps; j++)
+            {
+                // off the pixel grid on purpose, the tables interpolate between columns and rows
+                double x = (i + 0.37) / (grid_steps + 1);
+                double y = (j + 0.61) / (grid_steps + 1);
+                double pan, tilt, panRef, tiltRef;
+                fov::offset(x, y, pan, tilt);
+                reference(model, x, y, panRef, tiltRef);
+                worst = std::max(worst, std::max(fabs(pan - panRef), fabs(tilt - tiltRef)));
+            }
+        }
+        return worst;
+    }
+} // namespace
+
+void *operator new(size_t size)
+{
+    s_allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+int main(int argc, char **argv)
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+
+    const size_t points = argc > 1 ? strtoul(argv[1], NULL, 10) : 1000000;
+    if (points == 0)
+    {
+        fprintf(stderr, "usage: %s [points]\n", argv[0]);
+        return 1;
+    }
+
+    bool ok = true;
+    fov::Model nominal = fov::defaultModel();
+    fov::Model barrel = nominal;
+    barrel.k1 = -0.08;
+    barrel.tiltSign = -1;
+
+    fov::install(barrel);
+    double barrelError = maxError(barrel);
+    fov::install(nominal);
+    double nominalError = maxError(nominal);
+
+    double pan, tilt;
+    fov::offset(0.5, 0.5, pan, tilt);
+    double centerError = std::max(fabs(pan), fabs(tilt));
+    fov::offset(1.0, 0.5, pan, tilt);
+    double edgeError = fabs(pan - nominal.hfovDeg / 2);
+
+    std::vector<double> xs(points), ys(points);
+    srand(1);
+    for (size_t i = 0; i < points; i++)
+    {
+        xs[i] = (double)rand() / RAND_MAX;
+        ys[i] = (double)rand() / RAND_MAX;
+    }
+
+    unsigned long allocations = s_allocations;
+    double sink = 0;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < points; i++)
+    {
+        fov::offset(xs[i], ys[i], pan, tilt);
+        sink += pan + tilt;
+    }
+    double ns = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count() / (double)points;
+    allocations = s_allocations - allocations;
+
+    printf("model %.1fx%.1f deg on %ux%u\n", nominal.hfovDeg, nominal.vfovDeg, fov::frame_width, fov::frame_height);
+    printf("max error      nominal %.5f deg  barrel k1 %.2f %.5f deg\n", nominalError, barrel.k1, barrelError);
+    printf("conversion     %.1f ns per point over %zu points (checksum %.3f)\n", ns, points, sink);
+
+    ok = bench::check(nominalError < max_error_deg && barrelError < max_error_deg, "conversion matches the closed form") && ok;
+    ok = bench::check(centerError < 1e-9 && edgeError < 1e-9, "center maps to no move, frame edge to half the field of view") && ok;
+    ok = bench::check(allocations == 0, "no allocation per conversion") && ok;
+    ok = bench::check(ns < max_ns_per_point, "conversion takes less than a microsecond") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,156 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Keyframe policy benchmark.
+/// Plays 100 s of a 30 fps camera through the policy of Keyframe.h and through a fixed GOP of the same base length.
+/// A simulated encoder honours forced IDRs two frames late. The scene is busy for 20 s, then static, cut at 60 s,
+/// static again with a 30 degree servo move coming to rest at 75 s, busy again from 90 s, and a viewer joins at 95 s.
+/// It fails when the GOP is not stretched to the maximum while static or grows beyond it, when the cut, the servo
+/// move, the viewer or the returning activity do not get an IDR within a second, when IDRs are closer than the minimum
+/// spacing, when the policy does not save bytes over the fixed GOP, or when its estimate of the saving is off by more
+/// than a quarter.
+///
+/// usage: c3-keyframe-bench
+#include "../Keyframe.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <algorithm>
+#include <math.h>
+#include <stdio.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const unsigned int fps = 30;
+    const unsigned int seconds = 100;
+    const unsigned int encoder_latency = 2;
+    const size_t keyframe_bytes = 40000;
+    const size_t busy_delta_bytes = 4000;
+    const size_t static_delta_bytes = 800;
+
+    const unsigned int static_from_s = 20;
+    const unsigned int cut_s = 60;
+    const unsigned int cut_length_s = 3;
+    const unsigned int servo_s = 75;
+    const unsigned int busy_from_s = 90;
+    const unsigned int viewer_s = 95;
+
+    bool busy(unsigned int frame)
+    {
+        return frame < static_from_s * fps || frame >= busy_from_s * fps;
+    }
+
+    /// Share of changed blocks reported by the analytics substream at a third of the frame rate
+    float activity(unsigned int frame)
+    {
+        if (busy(frame))
+        {
+            return 0.1f;
+        }
+        if (frame >= cut_s * fps && frame < (cut_s + cut_length_s) * fps)
+        {
+            return 0.9f;
+        }
+        return 0.0f;
+    }
+
+    /// First IDR at or after a frame, in frames from it
+    unsigned int idrAfter(const std::vector<unsigned int> &idrs, unsigned int frame)
+    {
+        for (size_t i = 0; i < idrs.size(); i++)
+        {
+            if (idrs[i] >= frame)
+            {
+                return idrs[i] - frame;
+            }
+        }
+        return fps * seconds;
+    }
+} // namespace
+
+int main()
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+
+    keyframe::Policy policy;
+    policy.configure(fps, 0);
+    policy.onServoRest(90, 90);
+
+    std::vector<unsigned int> idrs;
+    unsigned int dueAt = 0;
+    bool forced = false;
+    size_t policyBytes = 0, fixedBytes = 0;
+    unsigned int base = 0;
+    for (unsigned int frame = 0; frame < fps * seconds; frame++)
+    {
+        if (frame % 3 == 0)
+        {
+            policy.onActivity(activity(frame));
+        }
+        if (frame == servo_s * fps)
+        {
+            policy.onServoRest(120, 90);
+        }
+        if (frame == viewer_s * fps)
+        {
+            policy.request(keyframe::REASON_VIEWER);
+        }
+
+        size_t delta = busy(frame) ? busy_delta_bytes : static_delta_bytes;
+        bool keyframe = frame == 0 || (forced && frame >= dueAt);
+        if (keyframe)
+        {
+            forced = false;
+            idrs.push_back(frame);
+        }
+        policyBytes += keyframe ? keyframe_bytes : delta;
+        if (policy.onFrame(keyframe, keyframe ? keyframe_bytes : delta) != keyframe::REASON_NONE)
+        {
+            forced = true;
+            dueAt = frame + encoder_latency;
+        }
+        if (frame == 0)
+        {
+            base = policy.gopFrames();
+        }
+        fixedBytes += frame % base == 0 ? keyframe_bytes : delta;
+    }
+
+    unsigned int longest = 0, shortest = fps * seconds, longestBusy = 0;
+    for (size_t i = 1; i < idrs.size(); i++)
+    {
+        unsigned int gop = idrs[i] - idrs[i - 1];
+        longest = std::max(longest, gop);
+        shortest = std::min(shortest, gop);
+        if (busy(idrs[i - 1]) && busy(idrs[i]))
+        {
+            longestBusy = std::max(longestBusy, gop);
+        }
+    }
+    const unsigned int maxGop = keyframe::max_gop_ms * fps / 1000;
+    const unsigned int slack = encoder_latency + 1;
+    double saved = (double)fixedBytes - policyBytes;
+    double estimate = policy.savedBytes();
+
+    printf("%u fps, base GOP %u frames, %zu IDRs against %u with the fixed GOP\n", fps, base, idrs.size(), (fps * seconds + base - 1) / base);
+    printf("gop            %u to %u frames, %u while busy\n", shortest, longest, longestBusy);
+    printf("idr after      cut %u, servo %u, activity %u, viewer %u frames\n", idrAfter(idrs, cut_s * fps), idrAfter(idrs, servo_s * fps),
+           idrAfter(idrs, busy_from_s * fps), idrAfter(idrs, viewer_s * fps));
+    printf("saved          %.0f bytes of %zu, %.1f%%, estimated %.0f\n", saved, fixedBytes, saved * 100 / fixedBytes, estimate);
+
+    bool ok = true;
+    ok = bench::check(longest >= maxGop && longest <= maxGop + slack, "static scenes stretch the GOP to the maximum") && ok;
+    ok = bench::check(longestBusy <= base + slack, "busy scenes keep the base GOP") && ok;
+    ok = bench::check(idrAfter(idrs, cut_s * fps) <= fps + slack, "a scene cut gets an IDR within a second") && ok;
+    ok = bench::check(idrAfter(idrs, servo_s * fps) <= fps + slack, "a servo move gets an IDR within a second") && ok;
+    ok = bench::check(idrAfter(idrs, busy_from_s * fps) <= fps + slack, "returning activity gets an IDR within a second") && ok;
+    ok = bench::check(idrAfter(idrs, viewer_s * fps) <= fps + slack, "a viewer gets an IDR within a second") && ok;
+    ok = bench::check(shortest >= keyframe::min_spacing_ms * fps / 1000, "IDRs keep the minimum spacing") && ok;
+    ok = bench::check(saved > 0, "fewer bytes than the fixed GOP") && ok;
+    ok = bench::check(fabs(estimate - saved) <= saved / 4, "the estimated saving is within a quarter") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Motion detection benchmark.
+/// Runs the SIMD kernels of Motion.h and the scalar reference side by side on synthetic luma planes with sensor noise
+/// and a bright square crossing the frame halfway through: 1280x720 planes decimated by 4, and 320x180 planes of the
+/// analytics substream read in place. It fails when the SIMD results differ from the reference in any decimated pixel,
+/// background pixel or block difference, when the static frames report motion or the square is missed, when a frame
+/// allocates memory or when the SIMD path takes 2 ms or more per 1280x720 frame.
+///
+/// usage: c3-motion-bench [frames]
+/// The default is 600 frames.
+#include "../Motion.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <chrono>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const double max_ms_per_frame = 2.0;
+
+    unsigned long s_allocations = 0;
+
+    struct Plane
+    {
+        unsigned int width;
+        unsigned int height;
+        // padded like the buffers of most camera sources, the detector has to honour the stride
+        unsigned int stride;
+        unsigned int decimation;
+    };
+
+    struct Outcome
+    {
+        bool identical;
+        unsigned int falseAlarms;
+        unsigned int missed;
+        double scalarMs;
+        double simdMs;
+        unsigned long allocations;
+    };
+
+    /// Static scene with noise, a square of an eighth of the width moves along the diagonal from the middle frame on
+    void render(const Plane &plane, std::vector<uint8_t> &pixels, const std::vector<uint8_t> &scene, unsigned int frame, unsigned int frames)
+    {
+        for (size_t i = 0; i < pixels.size(); i++)
+        {
+            int value = scene[i] + (rand() % 7) - 3;
+            pixels[i] = (uint8_t)(value < 0 ? 0 : value > 255 ? 255 : value);
+        }
+        if (frame < frames / 2)
+        {
+            return;
+        }
+        unsigned int size = plane.width / 8;
+        unsigned int step = frame - frames / 2;
+        unsigned int x = (step * plane.width / 160) % (plane.width - size);
+        unsigned int y = (step * plane.height / 180) % (plane.height - size);
+        for (unsigned int row = y; row < y + size; row++)
+        {
+            memset(&pixels[row * plane.stride + x], 250, size);
+        }
+    }
+
+    bool run(const Plane &plane, unsigned int frames, Outcome &outcome)
+    {
+        std::vector<uint8_t> scene(plane.stride * plane.height), pixels(scene.size());
+        srand(1);
+        for (unsigned int y = 0; y < plane.height; y++)
+        {
+            for (unsigned int x = 0; x < plane.stride; x++)
+            {
+                scene[y * plane.stride + x] = (uint8_t)(40 + (x * 7 + y * 3) % 120 + rand() % 16);
+            }
+        }
+
+        motion::Detector scalar(plane.width, plane.height, plane.decimation, motion::IMPL_SCALAR);
+        motion::Detector simd(plane.width, plane.height, plane.decimation, motion::IMPL_SIMD);
+        if (!scalar.valid() || !simd.valid())
+        {
+            fprintf(stderr, "%ux%u decimated by %u is not supported\n", plane.width, plane.height, plane.decimation);
+            return false;
+        }
+
+        outcome.identical = true;
+        outcome.falseAlarms = outcome.missed = 0;
+        double scalarNs = 0, simdNs = 0;
+        unsigned long allocations = s_allocations;
+        for (unsigned int frame = 0; frame < frames; frame++)
+        {
+            render(plane, pixels, scene, frame, frames);
+
+            motion::Result expected, result;
+            std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+            scalar.process(pixels.data(), plane.stride, expected);
+            std::chrono::steady_clock::time_point middle = std::chrono::steady_clock::now();
+            simd.process(pixels.data(), plane.stride, result);
+            std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+            scalarNs += std::chrono::duration_cast<std::chrono::nanoseconds>(middle - begin).count();
+            simdNs += std::chrono::duration_cast<std::chrono::nanoseconds>(end - middle).count();
+
+            outcome.identical = outcome.identical && scalar.decimated() == simd.decimated() && scalar.background() == simd.background() &&
+                                scalar.differences() == simd.differences() && expected.movingBlocks == result.movingBlocks;
+            if (frame < frames / 2)
+            {
+                outcome.falseAlarms += result.movingBlocks != 0;
+            }
+            else
+            {
+                outcome.missed += result.movingBlocks == 0;
+            }
+        }
+        outcome.allocations = s_allocations - allocations;
+        outcome.scalarMs = scalarNs / frames / 1e6;
+        outcome.simdMs = simdNs / frames / 1e6;
+
+        printf("%ux%u stride %u decimated by %u, %ux%u blocks, %s\n", plane.width, plane.height, plane.stride, plane.decimation,
+               simd.blockColumns(), simd.blockRows(), motion::simdName());
+        printf("  scalar       %.3f ms per frame\n", outcome.scalarMs);
+        printf("  simd         %.3f ms per frame, %.1fx\n", outcome.simdMs, outcome.scalarMs / outcome.simdMs);
+        printf("  frames       %u static with motion, %u moving without\n", outcome.falseAlarms, outcome.missed);
+        return true;
+    }
+} // namespace
+
+void *operator new(size_t size)
+{
+    s_allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+int main(int argc, char **argv)
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+
+    const unsigned int frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 600;
+    if (frames < 2)
+    {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+
+    const Plane full = {1280, 720, 1344, 4};
+    const Plane substream = {320, 180, 384, 1};
+    Outcome fullOutcome, subOutcome;
+    if (!run(full, frames, fullOutcome) || !run(substream, frames, subOutcome))
+    {
+        return 1;
+    }
+
+    bool ok = true;
+    ok = bench::check(fullOutcome.identical && subOutcome.identical, "simd matches the scalar reference") && ok;
+    ok = bench::check(fullOutcome.falseAlarms == 0 && subOutcome.falseAlarms == 0, "no motion in the static frames") && ok;
+    ok = bench::check(fullOutcome.missed == 0 && subOutcome.missed == 0, "the moving square is detected in every frame") && ok;
+    ok = bench::check(fullOutcome.allocations == 0 && subOutcome.allocations == 0, "no allocation per frame") && ok;
+    ok = bench::check(fullOutcome.simdMs < max_ms_per_frame, "simd takes less than 2 ms per 1280x720 frame") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,230 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Local recording benchmark.
+/// Records 30 minutes of a synthetic 30 fps stream of about 1 Mbit/s with a 2 s GOP into one minute segments under a
+/// 64 MB quota, as fast as the disk takes it, then seeks to 500 random times of what is left. A power cut is simulated
+/// by dropping the index of the newest segment and tearing its end, and the seeks are repeated on a reopened archive.
+/// It fails when the recordings exceed the quota, when the oldest minutes were not dropped, when writes are not
+/// batched to at least half of nvr::batch_size on average, when a seek does not return the cluster of the GOP covering
+/// its time, starting with the keyframe, or when the rebuilt index gives other answers.
+///
+/// usage: c3-nvr-bench [directory, default /tmp/c3-nvr-bench]
+#include "../Nvr.h"
+#include "../Metrics.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <chrono>
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const unsigned int fps = 30;
+    const unsigned int gop = 60;
+    const unsigned int seconds = 30 * 60;
+    const uint64_t segment_ms = 60000;
+    const uint64_t quota_bytes = 64ull * 1024 * 1024;
+    const size_t keyframe_bytes = 40000;
+    const size_t delta_bytes = 3000;
+    const unsigned int seeks = 500;
+
+    struct Answer
+    {
+        bool found;
+        uint64_t timeMs;
+        uint64_t offset;
+        uint32_t size;
+    };
+
+    void clear(const std::string &directory)
+    {
+        DIR *dir = opendir(directory.c_str());
+        if (dir == NULL)
+        {
+            return;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            if (entry->d_name[0] != '.')
+            {
+                unlink((directory + "/" + entry->d_name).c_str());
+            }
+        }
+        closedir(dir);
+    }
+
+    /// Size of the recordings, and the names of the oldest and the newest segment
+    uint64_t directoryBytes(const std::string &directory, std::string &oldest, std::string &newest)
+    {
+        uint64_t total = 0;
+        DIR *dir = opendir(directory.c_str());
+        if (dir == NULL)
+        {
+            return 0;
+        }
+        struct dirent *entry;
+        while ((entry = readdir(dir)) != NULL)
+        {
+            struct stat info;
+            std::string name = entry->d_name;
+            if (name[0] != '.' && stat((directory + "/" + name).c_str(), &info) == 0)
+            {
+                total += info.st_size;
+                if (name.size() > 4 && name.compare(name.size() - 4, 4, ".mkv") == 0)
+                {
+                    oldest = oldest.empty() || name < oldest ? name : oldest;
+                    newest = name > newest ? name : newest;
+                }
+            }
+        }
+        closedir(dir);
+        return total;
+    }
+
+    /// The GOP starts with a cluster whose first block is the keyframe
+    bool startsWithKeyframe(const std::vector<uint8_t> &data)
+    {
+        static const uint8_t cluster[] = {0x1F, 0x43, 0xB6, 0x75, 0x01, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
+        if (data.size() < sizeof(cluster) + 2 || memcmp(&data[0], cluster, sizeof(cluster)) != 0 || data[sizeof(cluster)] != 0xE7)
+        {
+            return false;
+        }
+        size_t block = sizeof(cluster) + 2 + (data[sizeof(cluster) + 1] & 0x7F);
+        if (block + 2 > data.size() || data[block] != 0xA3 || data[block + 1] == 0)
+        {
+            return false;
+        }
+        // behind the size of the block are its track, its time and its flags
+        size_t sizeLength = 1;
+        while ((data[block + 1] & (0x80 >> (sizeLength - 1))) == 0)
+        {
+            sizeLength++;
+        }
+        size_t flags = block + 1 + sizeLength + 3;
+        return flags < data.size() && (data[flags] & 0x80) != 0;
+    }
+
+    void seekAll(nvr::Archive &archive, const std::vector<uint64_t> &targets, std::vector<Answer> &answers, double &averageUs, bool &valid)
+    {
+        std::vector<uint8_t> data;
+        valid = true;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < targets.size(); i++)
+        {
+            nvr::Span span;
+            Answer answer = {false, 0, 0, 0};
+            if (archive.locate(targets[i], span) && archive.read(span, data))
+            {
+                answer.found = true;
+                answer.timeMs = span.timeMs;
+                answer.offset = span.offset;
+                answer.size = span.size;
+                // the keyframe of the GOP is at most a GOP before the time
+                valid = valid && startsWithKeyframe(data) && span.timeMs <= targets[i] && targets[i] < span.timeMs + gop * 1000 / fps + 1000;
+            }
+            answers.push_back(answer);
+        }
+        averageUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / (double)targets.size();
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+    std::string directory = argc > 1 ? argv[1] : "/tmp/c3-nvr-bench";
+    mkdir(directory.c_str(), 0755);
+    clear(directory);
+
+    nvr::Track track;
+    track.width = 1280;
+    track.height = 720;
+    track.codecPrivate = std::string("\x01\x64\x00\x28\xff\xe1\x00\x04\x67\x64\x00\x28\x01\x00\x04\x68\xee\x3c\x80", 19);
+
+    std::vector<uint8_t> frame(keyframe_bytes, 0x55);
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    {
+        nvr::Archive archive(directory, quota_bytes, segment_ms);
+        if (!archive.open())
+        {
+            return 1;
+        }
+        for (unsigned int i = 0; i < fps * seconds; i++)
+        {
+            bool keyframe = i % gop == 0;
+            archive.append(track, (uint64_t)i * 1000000000ull / fps, keyframe, &frame[0], keyframe ? keyframe_bytes : delta_bytes);
+        }
+        archive.close();
+    }
+    double recordS = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - begin).count() / 1000.0;
+
+    std::string oldest, newest;
+    uint64_t used = directoryBytes(directory, oldest, newest);
+    uint64_t writes = metrics::counter("nvr.writes").value();
+    uint64_t written = metrics::counter("nvr.written_bytes").value();
+    uint64_t droppedSegments = metrics::counter("nvr.dropped_segments").value();
+
+    nvr::Archive archive(directory, quota_bytes, segment_ms);
+    archive.open();
+    // segments are named after their first frame, the last complete GOP ends the archive
+    nvr::Span span;
+    uint64_t oldestMs = strtoull(oldest.c_str(), NULL, 10);
+    uint64_t lastMs = archive.locate(~0ull, span) ? span.timeMs : oldestMs + 1;
+
+    srand(7);
+    std::vector<uint64_t> targets;
+    for (unsigned int i = 0; i < seeks; i++)
+    {
+        targets.push_back(oldestMs + (uint64_t)rand() % (lastMs - oldestMs));
+    }
+    std::vector<Answer> before, after;
+    double seekUs = 0, recoveredUs = 0;
+    bool valid = false, recoveredValid = false;
+    seekAll(archive, targets, before, seekUs, valid);
+
+    // power cut: the index of the newest segment was never written and its end is torn
+    std::string newestPath = directory + "/" + newest;
+    unlink((newestPath.substr(0, newestPath.size() - 4) + ".idx").c_str());
+    struct stat info;
+    stat(newestPath.c_str(), &info);
+    int torn = truncate(newestPath.c_str(), info.st_size - 1000);
+    nvr::Archive reopened(directory, quota_bytes, segment_ms);
+    reopened.open();
+    seekAll(reopened, targets, after, recoveredUs, recoveredValid);
+    size_t same = 0, found = 0;
+    for (size_t i = 0; i < targets.size(); i++)
+    {
+        found += before[i].found ? 1 : 0;
+        // the last GOP lost its torn end
+        same += before[i].found == after[i].found && before[i].timeMs == after[i].timeMs && before[i].offset == after[i].offset &&
+                        (before[i].size == after[i].size || before[i].timeMs == lastMs)
+                    ? 1
+                    : 0;
+    }
+
+    uint64_t keptMs = lastMs - oldestMs;
+    printf("recorded       %u s in %.2f s, %llu segments dropped, %.1f of %.1f MB kept\n", seconds, recordS, (unsigned long long)droppedSegments,
+           used / 1048576.0, quota_bytes / 1048576.0);
+    printf("writes         %llu of %.0f kB on average\n", (unsigned long long)writes, writes != 0 ? written / 1024.0 / writes : 0.0);
+    printf("kept           %.1f minutes, %zu segments\n", keptMs / 60000.0, archive.segments());
+    printf("seek           %zu of %u found, %.1f us each, %.1f us after rebuilding the index\n", found, seeks, seekUs, recoveredUs);
+
+    bool ok = true;
+    ok = bench::check(used <= quota_bytes, "the recordings stay within the quota") && ok;
+    ok = bench::check(droppedSegments > 0 && keptMs < seconds * 1000ull && keptMs > seconds * 1000ull / 4, "the oldest segments make room") && ok;
+    ok = bench::check(writes != 0 && written / writes >= nvr::batch_size / 2, "writes are batched") && ok;
+    ok = bench::check(found == seeks && valid, "every seek returns the GOP covering its time") && ok;
+    ok = bench::check(torn == 0 && same == seeks && recoveredValid, "a rebuilt index gives the same answers") && ok;
+    clear(directory);
+    return ok ? 0 : 1;
+}
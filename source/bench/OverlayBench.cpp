@@ -0,0 +1,213 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Timestamp overlay benchmark.
+/// Stamps 1280x720 NV12 frames with the SIMD and the scalar blend of Overlay.h and checks that the pixels are the same,
+/// that only the changed characters are redrawn and that stamping never allocates. It then runs the same frames from
+/// videotestsrc through clockoverlay and through the overlay in a pad probe, and compares the CPU time they add to a
+/// pipeline without overlay. It fails when the blends differ, when more cells are redrawn than characters changed, when
+/// a stamp allocates or takes 100 us or more, or when the overlay costs more than a tenth of clockoverlay. Without the
+/// pango plugins clockoverlay is skipped.
+///
+/// usage: c3-overlay-bench [frames]
+/// The default is 900 frames, 30 s of video.
+#include "../Overlay.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <chrono>
+#include <gst/gst.h>
+#include <new>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const int frame_width = 1280;
+    const int frame_height = 720;
+    const char *const time_format = "%d/%m/%y %H:%M:%S";
+    const double max_us_per_stamp = 100;
+    const double max_share_of_clockoverlay = 0.1;
+
+    unsigned long s_allocations = 0;
+
+    double cpuSeconds()
+    {
+        struct timespec now;
+        clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &now);
+        return now.tv_sec + now.tv_nsec / 1e9;
+    }
+
+    /// The frames of videotestsrc are tightly packed, the chroma plane follows the luma plane
+    GstPadProbeReturn stampProbe(GstPad *pad, GstPadProbeInfo *info, gpointer user_data)
+    {
+        overlay::Clock *clock = (overlay::Clock *)user_data;
+        GstBuffer *buffer = gst_buffer_make_writable(GST_PAD_PROBE_INFO_BUFFER(info));
+        GST_PAD_PROBE_INFO_DATA(info) = buffer;
+        GstMapInfo map;
+        if (gst_buffer_map(buffer, &map, GST_MAP_WRITE))
+        {
+            if (map.size >= (size_t)frame_width * frame_height * 3 / 2)
+            {
+                clock->stamp(map.data, frame_width, map.data + frame_width * frame_height, frame_width, frame_width, frame_height, time(NULL));
+            }
+            gst_buffer_unmap(buffer, &map);
+        }
+        return GST_PAD_PROBE_OK;
+    }
+
+    /// CPU seconds of running frames through the pipeline, negative when it cannot be built
+    double runPipeline(unsigned int frames, const char *stage, overlay::Clock *clock)
+    {
+        char description[512];
+        snprintf(description, sizeof(description),
+                 "videotestsrc num-buffers=%u pattern=ball ! video/x-raw,format=NV12,width=%d,height=%d,framerate=30/1 ! %s ! "
+                 "fakesink sync=FALSE",
+                 frames, frame_width, frame_height, stage);
+        GError *error = NULL;
+        GstElement *pipeline = gst_parse_launch(description, &error);
+        if (pipeline == NULL || error != NULL)
+        {
+            if (error != NULL)
+            {
+                g_clear_error(&error);
+            }
+            if (pipeline != NULL)
+            {
+                gst_object_unref(pipeline);
+            }
+            return -1;
+        }
+        if (clock != NULL)
+        {
+            GstElement *stamp = gst_bin_get_by_name(GST_BIN(pipeline), "stamp");
+            GstPad *pad = gst_element_get_static_pad(stamp, "sink");
+            gst_pad_add_probe(pad, GST_PAD_PROBE_TYPE_BUFFER, stampProbe, clock, NULL);
+            gst_object_unref(pad);
+            gst_object_unref(stamp);
+        }
+
+        double begin = cpuSeconds();
+        gst_element_set_state(pipeline, GST_STATE_PLAYING);
+        GstBus *bus = gst_element_get_bus(pipeline);
+        GstMessage *msg = gst_bus_timed_pop_filtered(bus, GST_CLOCK_TIME_NONE, (GstMessageType)(GST_MESSAGE_EOS | GST_MESSAGE_ERROR));
+        bool ok = msg != NULL && GST_MESSAGE_TYPE(msg) == GST_MESSAGE_EOS;
+        if (msg != NULL)
+        {
+            gst_message_unref(msg);
+        }
+        gst_object_unref(bus);
+        gst_element_set_state(pipeline, GST_STATE_NULL);
+        double cpu = cpuSeconds() - begin;
+        gst_object_unref(pipeline);
+        return ok ? cpu : -1;
+    }
+} // namespace
+
+void *operator new(size_t size)
+{
+    s_allocations++;
+    void *p = malloc(size ? size : 1);
+    if (p == NULL)
+    {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    free(p);
+}
+
+int main(int argc, char **argv)
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+    gst_init(&argc, &argv);
+    // the expected redraws assume whole hours between local time and UTC
+    setenv("TZ", "UTC", 1);
+    tzset();
+
+    const unsigned int frames = argc > 1 ? strtoul(argv[1], NULL, 10) : 900;
+    if (frames == 0)
+    {
+        fprintf(stderr, "usage: %s [frames]\n", argv[0]);
+        return 1;
+    }
+
+    // same frames through both blends, one second of stamps after the other
+    const size_t frameSize = frame_width * frame_height * 3 / 2;
+    std::vector<uint8_t> scene(frameSize), simdFrame(frameSize), scalarFrame(frameSize);
+    srand(1);
+    for (size_t i = 0; i < frameSize; i++)
+    {
+        scene[i] = (uint8_t)rand();
+    }
+    overlay::Clock simd(time_format, overlay::IMPL_SIMD);
+    overlay::Clock scalar(time_format, overlay::IMPL_SCALAR);
+    const time_t start = 1700000000;
+    bool identical = true;
+    for (unsigned int i = 0; i < 120; i++)
+    {
+        simdFrame = scene;
+        scalarFrame = scene;
+        simd.stamp(simdFrame.data(), frame_width, simdFrame.data() + frame_width * frame_height, frame_width, frame_width, frame_height, start + i);
+        scalar.stamp(scalarFrame.data(), frame_width, scalarFrame.data() + frame_width * frame_height, frame_width, frame_width, frame_height,
+                     start + i);
+        identical = identical && simdFrame == scalarFrame;
+    }
+    bool changed = simdFrame != scene;
+
+    // 120 seconds from start: every second redraws the last digit, the tens every ten seconds, the minutes twice
+    const unsigned long expectedCells = strlen("dd/mm/yy hh:mm:ss") + 119 + 11 + 2;
+    unsigned long redrawn = simd.redrawnCells();
+
+    overlay::Clock timed(time_format);
+    timed.stamp(simdFrame.data(), frame_width, simdFrame.data() + frame_width * frame_height, frame_width, frame_width, frame_height, start);
+    unsigned long allocations = s_allocations;
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < frames; i++)
+    {
+        timed.stamp(simdFrame.data(), frame_width, simdFrame.data() + frame_width * frame_height, frame_width, frame_width, frame_height,
+                    start + i / 30);
+    }
+    double us = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count() / 1e3 / frames;
+    allocations = s_allocations - allocations;
+
+    printf("%dx%d NV12, \"%s\"\n", frame_width, frame_height, time_format);
+    printf("stamp          %.2f us per frame, %lu cells redrawn in 120 s\n", us, redrawn);
+
+    overlay::Clock piped(time_format);
+    double base = runPipeline(frames, "identity", NULL);
+    double ours = runPipeline(frames, "identity name=stamp", &piped);
+    double clockoverlay = runPipeline(frames, "clockoverlay time-format=\"%d/%m/%y %H:%M:%S\"", NULL);
+    bool compared = base >= 0 && ours >= 0 && clockoverlay >= 0;
+    if (compared)
+    {
+        printf("pipeline       %.1f us per frame without overlay\n", base * 1e6 / frames);
+        printf("overlay        +%.1f us per frame\n", (ours - base) * 1e6 / frames);
+        printf("clockoverlay   +%.1f us per frame\n", (clockoverlay - base) * 1e6 / frames);
+    }
+    else
+    {
+        printf("clockoverlay   skipped, the comparison pipelines could not run\n");
+    }
+
+    bool ok = true;
+    ok = bench::check(identical && changed, "simd blend matches the scalar reference") && ok;
+    ok = bench::check(redrawn == expectedCells, "only changed characters are redrawn") && ok;
+    ok = bench::check(allocations == 0, "no allocation per stamp") && ok;
+    ok = bench::check(us < max_us_per_stamp, "stamp takes less than 100 us per frame") && ok;
+    if (compared)
+    {
+        ok = bench::check(ours - base < (clockoverlay - base) * max_share_of_clockoverlay, "overlay costs less than a tenth of clockoverlay") && ok;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,330 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Servo control path benchmark.
+/// Replays shadow delta traces through the shadow coalescer and the actuator into the simulated GPIO backend and
+/// reports command-to-actuation latency, overshoot of the simulated servo horn and command throughput. It also checks
+/// that the pulses of each servo are switched off once its last target was held for the settle time, and reports
+/// how long the pulses were on and the duty cycle of the pins.
+///
+/// usage: c3-servo-bench [trace file]...
+/// A trace file has one delta per line: <milliseconds since start> <property> <value>, e.g. "120 pan 97.5".
+/// Lines starting with # are comments. Without trace files the built-in slider drag and step traces are replayed.
+#include "../Actuator.h"
+#include "../Calibration.h"
+#include "../GpioSim.h"
+#include "../Metrics.h"
+#include "../Servo.h"
+#include "../ShadowCoalescer.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <sstream>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    // a move counts as settled when the next delta of the axis comes this much later
+    const uint64_t settled_gap_ms = 500;
+    // replay ends once no pulse was commanded for this long
+    const uint64_t idle_ms = 300;
+    const uint64_t sample_step_ns = 1000000;
+    // shorter than idle_ms, so the pulses are off before a replay ends
+    const unsigned int settle_ms = 200;
+    // the settle time starts after the last control step
+    const uint64_t settle_slack_ms = 50;
+
+    struct Delta
+    {
+        uint64_t offsetMs;
+        std::string property;
+        std::string value;
+        uint64_t submitNs;
+    };
+
+    struct Trace
+    {
+        std::string name;
+        std::vector<Delta> deltas;
+    };
+
+    Delta makeDelta(uint64_t offsetMs, const std::string &property, double value)
+    {
+        std::ostringstream text;
+        text << value;
+        Delta delta = {offsetMs, property, text.str(), 0};
+        return delta;
+    }
+
+    /// A pan and tilt slider dragged across the range with 100 deltas per second
+    Trace dragTrace()
+    {
+        Trace trace;
+        trace.name = "drag";
+        for (uint64_t ms = 0; ms <= 2000; ms += 10)
+        {
+            trace.deltas.push_back(makeDelta(ms, "pan", 180.0 * ms / 2000));
+            trace.deltas.push_back(makeDelta(ms, "tilt", 90.0 + 30.0 * sin(ms / 300.0)));
+        }
+        return trace;
+    }
+
+    /// Large steps which are allowed to settle, the first one interrupted half way
+    Trace stepTrace()
+    {
+        Trace trace;
+        trace.name = "steps";
+        const double targets[] = {0, 180, 45, 135, 90};
+        trace.deltas.push_back(makeDelta(0, "pan", 180));
+        for (size_t i = 0; i < sizeof(targets) / sizeof(targets[0]); i++)
+        {
+            trace.deltas.push_back(makeDelta(500 + 3000 * i, "pan", targets[i]));
+            trace.deltas.push_back(makeDelta(500 + 3000 * i, "tilt", 180 - targets[i]));
+        }
+        return trace;
+    }
+
+    bool loadTrace(const char *path, Trace &trace)
+    {
+        std::ifstream file(path);
+        std::string line;
+        if (!file)
+        {
+            return false;
+        }
+        trace.name = path;
+        while (std::getline(file, line))
+        {
+            std::istringstream fields(line);
+            Delta delta = {0, "", "", 0};
+            if (line.empty() || line[0] == '#' || !(fields >> delta.offsetMs >> delta.property >> delta.value))
+            {
+                continue;
+            }
+            trace.deltas.push_back(delta);
+        }
+        std::stable_sort(trace.deltas.begin(), trace.deltas.end(), [](const Delta &a, const Delta &b)
+                         { return a.offsetMs < b.offsetMs; });
+        return true;
+    }
+
+    /// Same conversion as the shadow delta handler of the executables, every angle is taken
+    shadow::Properties apply(const shadow::Properties &properties)
+    {
+        unsigned int axes = 0;
+        double panTarget = 0, tiltTarget = 0;
+        for (shadow::Properties::const_iterator it = properties.begin(); it != properties.end(); ++it)
+        {
+            if (it->first != "pan" && it->first != "tilt")
+            {
+                continue;
+            }
+            calibration::Axis axis = it->first == "pan" ? calibration::AXIS_PAN : calibration::AXIS_TILT;
+            double angle = calibration::clamp(axis, atof(it->second.c_str()));
+            if (axis == calibration::AXIS_PAN)
+            {
+                axes |= actuator::AXIS_PAN;
+                panTarget = angle;
+            }
+            else
+            {
+                axes |= actuator::AXIS_TILT;
+                tiltTarget = angle;
+            }
+        }
+        if (axes != 0)
+        {
+            actuator::moveTo(axes, panTarget, tiltTarget);
+        }
+        return shadow::Properties();
+    }
+
+    double percentile(std::vector<double> values, double p)
+    {
+        if (values.empty())
+        {
+            return 0;
+        }
+        std::sort(values.begin(), values.end());
+        return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+    }
+
+    /// Pulses of the pin switched off once the actuator held its last target for the settle time, and nothing
+    /// generated after that. An axis which arrived early keeps its pulses until both axes are at rest.
+    bool detached(const std::vector<gpio::SimulatedBackend::Pulse> &pulses, gpio::SimulatedBackend &backend, unsigned int pin, uint64_t endNs)
+    {
+        uint64_t rest = 0, lastOn = 0, off = 0;
+        for (size_t i = 0; i < pulses.size(); i++)
+        {
+            if (pulses[i].pulsewidth != 0)
+            {
+                rest = pulses[i].timeNs;
+            }
+            if (pulses[i].gpio == pin)
+            {
+                (pulses[i].pulsewidth != 0 ? lastOn : off) = pulses[i].timeNs;
+            }
+        }
+        if (lastOn == 0)
+        {
+            return true;
+        }
+        return off > lastOn && off - rest >= settle_ms * 1000000ULL && off - rest <= (settle_ms + settle_slack_ms) * 1000000ULL &&
+               backend.dutyCycle(pin, off, endNs) == 0;
+    }
+
+    bool replay(Trace &trace, gpio::SimulatedBackend &backend)
+    {
+        shadow::Coalescer coalescer(apply, [](const shadow::Properties &) {}, shadow::default_report_interval_ms);
+        uint64_t applied = metrics::counter("shadow.applied").value();
+        backend.clear();
+        actuator::start();
+        coalescer.start();
+
+        uint64_t start = gpio::SimulatedBackend::now();
+        for (size_t i = 0; i < trace.deltas.size(); i++)
+        {
+            uint64_t due = start + trace.deltas[i].offsetMs * 1000000ULL;
+            struct timespec ts = {(time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL)};
+            clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+            trace.deltas[i].submitNs = gpio::SimulatedBackend::now();
+            coalescer.submit(trace.deltas[i].property, trace.deltas[i].value);
+        }
+        uint64_t replayed = gpio::SimulatedBackend::now();
+
+        // wait for the actuator to come to rest
+        size_t count = 0;
+        uint64_t lastChange = gpio::SimulatedBackend::now();
+        while (gpio::SimulatedBackend::now() - lastChange < idle_ms * 1000000ULL)
+        {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            if (backend.pulses().size() != count)
+            {
+                count = backend.pulses().size();
+                lastChange = gpio::SimulatedBackend::now();
+            }
+        }
+        coalescer.stop();
+        actuator::stop();
+
+        std::vector<gpio::SimulatedBackend::Pulse> pulses = backend.pulses();
+        std::vector<double> latencies;
+        double maxOvershoot = 0, sumOvershoot = 0;
+        size_t settledMoves = 0;
+
+        for (size_t i = 0; i < trace.deltas.size(); i++)
+        {
+            const Delta &delta = trace.deltas[i];
+            if (delta.property != "pan" && delta.property != "tilt")
+            {
+                continue;
+            }
+            calibration::Axis axis = delta.property == "pan" ? calibration::AXIS_PAN : calibration::AXIS_TILT;
+            unsigned int pin = axis == calibration::AXIS_PAN ? servo::pan_gpio : servo::tilt_gpio;
+
+            // latency to the first pulse of the axis after the delta
+            for (size_t j = 0; j < pulses.size(); j++)
+            {
+                if (pulses[j].gpio == pin && pulses[j].pulsewidth != 0 && pulses[j].timeNs >= delta.submitNs)
+                {
+                    latencies.push_back((pulses[j].timeNs - delta.submitNs) / 1e6);
+                    break;
+                }
+            }
+
+            // overshoot of the horn for moves that had time to settle
+            uint64_t until = lastChange + idle_ms * 1000000ULL;
+            for (size_t j = i + 1; j < trace.deltas.size(); j++)
+            {
+                if (trace.deltas[j].property == delta.property)
+                {
+                    until = trace.deltas[j].submitNs;
+                    break;
+                }
+            }
+            if (until - delta.submitNs < settled_gap_ms * 1000000ULL)
+            {
+                continue;
+            }
+            double target = calibration::clamp(axis, atof(delta.value.c_str()));
+            double from = backend.angleAt(pin, delta.submitNs);
+            double direction = target >= from ? 1.0 : -1.0;
+            double overshoot = 0;
+            for (uint64_t t = delta.submitNs; t < until; t += sample_step_ns)
+            {
+                overshoot = std::max(overshoot, (backend.angleAt(pin, t) - target) * direction);
+            }
+            maxOvershoot = std::max(maxOvershoot, overshoot);
+            sumOvershoot += overshoot;
+            settledMoves++;
+        }
+
+        double seconds = (replayed - start) / 1e9;
+        uint64_t end = lastChange + idle_ms * 1000000ULL;
+        printf("%-12s deltas %5zu  pulses %5zu  applied %5llu\n", trace.name.c_str(), trace.deltas.size(), pulses.size(),
+               (unsigned long long)(metrics::counter("shadow.applied").value() - applied));
+        printf("%-12s latency ms   p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f\n", "", percentile(latencies, 0.5),
+               percentile(latencies, 0.95), percentile(latencies, 0.99), percentile(latencies, 1.0));
+        printf("%-12s overshoot deg  mean %5.2f  max %5.2f  (%zu settled moves)\n", "", settledMoves ? sumOvershoot / settledMoves : 0.0,
+               maxOvershoot, settledMoves);
+        printf("%-12s throughput   %7.1f deltas/s  %7.1f pulses/s\n", "", seconds > 0 ? trace.deltas.size() / seconds : 0.0,
+               seconds > 0 ? pulses.size() / seconds : 0.0);
+        printf("%-12s pulses on    pan %5.1f%%  tilt %5.1f%%  duty cycle pan %5.2f%%  tilt %5.2f%%\n", "",
+               100.0 * backend.pulseOnNs(servo::pan_gpio, start, end) / (end - start), 100.0 * backend.pulseOnNs(servo::tilt_gpio, start, end) / (end - start),
+               100.0 * backend.dutyCycle(servo::pan_gpio, start, end), 100.0 * backend.dutyCycle(servo::tilt_gpio, start, end));
+        char what[64];
+        snprintf(what, sizeof(what), "pulses off %ums after the last target", settle_ms);
+        bool off = bench::check(detached(pulses, backend, servo::pan_gpio, end) && detached(pulses, backend, servo::tilt_gpio, end), what);
+        printf("\n");
+        return off;
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+
+    std::vector<Trace> traces;
+    for (int i = 1; i < argc; i++)
+    {
+        Trace trace;
+        if (!loadTrace(argv[i], trace))
+        {
+            fprintf(stderr, "unable to read %s\n", argv[i]);
+            return 1;
+        }
+        traces.push_back(trace);
+    }
+    if (traces.empty())
+    {
+        traces.push_back(dragTrace());
+        traces.push_back(stepTrace());
+    }
+
+    gpio::SimulatedBackend backend;
+    gpio::install(&backend);
+    gpio::initialise();
+    calibration::install(calibration::defaultProfile());
+    actuator::setSettleTime(settle_ms);
+
+    bool ok = true;
+    for (size_t i = 0; i < traces.size(); i++)
+    {
+        ok = replay(traces[i], backend) && ok;
+    }
+
+    gpio::terminate();
+    return ok ? 0 : 1;
+}
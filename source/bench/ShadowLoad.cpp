@@ -0,0 +1,345 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Shadow command path load test.
+/// A console publishes desired pan values to the local shadow service stand-in at a fixed rate. The device side is
+/// the shadow agent of the executables with the actuator and simulated servos. The test measures the latency from
+/// the desired update to the servo command and to the acceptance of the reported state, and fails unless the shadow
+/// converges on the last desired value without rejected updates.
+///
+/// usage: c3-shadow-load [deltas per second] [seconds] [one-way latency ms]
+/// The defaults are 100 deltas per second for 5 seconds with 10ms latency.
+#include "../Actuator.h"
+#include "../Calibration.h"
+#include "../GpioSim.h"
+#include "../Metrics.h"
+#include "../Servo.h"
+#include "../ShadowAgent.h"
+#include "../ShadowLocal.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <future>
+#include <map>
+#include <mutex>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <thread>
+#include <time.h>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const char *thing_name = "c3-load";
+    const uint64_t settle_timeout_ms = 10000;
+    const double position_tolerance = 0.5;
+
+    /// Follows every desired value from publish to the servo and back to the accepted reported state
+    class Tracker
+    {
+    public:
+        Tracker() : m_applied(0), m_accepted(0) {}
+
+        void published(const std::string &value, uint64_t timeNs)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            m_index[value] = m_published.size();
+            m_published.push_back(timeNs);
+            m_applyNs.push_back(0);
+        }
+
+        /// A value applied or accepted also covers every value published before it
+        void applied(const std::string &value, uint64_t timeNs)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            size_t upto = lookup(value);
+            for (; m_applied < upto; m_applied++)
+            {
+                m_applyNs[m_applied] = timeNs;
+                m_applyLatency.push_back((timeNs - m_published[m_applied]) / 1e6);
+            }
+        }
+
+        void accepted(const std::string &value, uint64_t timeNs)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            size_t upto = lookup(value);
+            for (; m_accepted < upto; m_accepted++)
+            {
+                m_acceptLatency.push_back((timeNs - m_published[m_accepted]) / 1e6);
+            }
+        }
+
+        size_t publishedCount()
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_published.size();
+        }
+
+        size_t acceptedCount()
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_accepted;
+        }
+
+        /// Latency to the first pulse on the pin after each value was applied
+        std::vector<double> servoLatency(const std::vector<gpio::SimulatedBackend::Pulse> &pulses, unsigned int pin)
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            std::vector<double> latency;
+            size_t j = 0;
+            for (size_t i = 0; i < m_applied; i++)
+            {
+                while (j < pulses.size() && (pulses[j].gpio != pin || pulses[j].pulsewidth == 0 || pulses[j].timeNs < m_applyNs[i]))
+                {
+                    j++;
+                }
+                if (j == pulses.size())
+                {
+                    break;
+                }
+                latency.push_back((pulses[j].timeNs - m_published[i]) / 1e6);
+            }
+            return latency;
+        }
+
+        std::vector<double> applyLatency()
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_applyLatency;
+        }
+
+        std::vector<double> acceptLatency()
+        {
+            std::lock_guard<std::mutex> lock(m_lock);
+            return m_acceptLatency;
+        }
+
+    private:
+        size_t lookup(const std::string &value)
+        {
+            std::map<std::string, size_t>::const_iterator it = m_index.find(value);
+            return it == m_index.end() ? 0 : it->second + 1;
+        }
+
+        std::mutex m_lock;
+        std::map<std::string, size_t> m_index;
+        std::vector<uint64_t> m_published;
+        std::vector<uint64_t> m_applyNs;
+        std::vector<double> m_applyLatency;
+        std::vector<double> m_acceptLatency;
+        size_t m_applied;
+        size_t m_accepted;
+    };
+
+    Tracker s_tracker;
+
+    /// Slow triangle wave over the pan range, distinct values for thousands of deltas
+    std::string desiredValue(size_t i)
+    {
+        double phase = fmod(i * 0.0137, 2.0);
+        char text[16];
+        snprintf(text, sizeof(text), "%.4f", 180.0 * (phase < 1.0 ? phase : 2.0 - phase));
+        return text;
+    }
+
+    /// Same conversion as the shadow delta handler of the executables, every angle is taken
+    shadow::Properties apply(const shadow::Properties &properties)
+    {
+        unsigned int axes = 0;
+        double panTarget = 0, tiltTarget = 0;
+        for (shadow::Properties::const_iterator it = properties.begin(); it != properties.end(); ++it)
+        {
+            if (it->first != "pan" && it->first != "tilt")
+            {
+                continue;
+            }
+            calibration::Axis axis = it->first == "pan" ? calibration::AXIS_PAN : calibration::AXIS_TILT;
+            double angle = calibration::clamp(axis, atof(it->second.c_str()));
+            if (axis == calibration::AXIS_PAN)
+            {
+                axes |= actuator::AXIS_PAN;
+                panTarget = angle;
+                s_tracker.applied(it->second, gpio::SimulatedBackend::now());
+            }
+            else
+            {
+                axes |= actuator::AXIS_TILT;
+                tiltTarget = angle;
+            }
+        }
+        if (axes != 0)
+        {
+            actuator::moveTo(axes, panTarget, tiltTarget);
+        }
+        return shadow::Properties();
+    }
+
+    void printLatency(const char *name, std::vector<double> values)
+    {
+        std::sort(values.begin(), values.end());
+        if (values.empty())
+        {
+            printf("%-26s no samples\n", name);
+            return;
+        }
+        printf("%-26s p50 %7.2f  p95 %7.2f  p99 %7.2f  max %7.2f ms\n", name, values[values.size() / 2],
+               values[std::min(values.size() - 1, values.size() * 95 / 100)], values[std::min(values.size() - 1, values.size() * 99 / 100)],
+               values.back());
+    }
+} // namespace
+
+int main(int argc, char **argv)
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+
+    const unsigned int rate = argc > 1 ? atoi(argv[1]) : 100;
+    const unsigned int seconds = argc > 2 ? atoi(argv[2]) : 5;
+    const unsigned int latencyMs = argc > 3 ? atoi(argv[3]) : 10;
+    if (rate == 0)
+    {
+        fprintf(stderr, "usage: %s [deltas per second] [seconds] [one-way latency ms]\n", argv[0]);
+        return 1;
+    }
+
+    gpio::SimulatedBackend backend;
+    gpio::install(&backend);
+    gpio::initialise();
+    calibration::install(calibration::defaultProfile());
+    actuator::start();
+
+    shadow::LocalService service(thing_name, latencyMs);
+    std::vector<std::string> properties;
+    properties.push_back("pan");
+    properties.push_back("tilt");
+    shadow::Properties defaults;
+    defaults["pan"] = "90";
+    defaults["tilt"] = "90";
+    shadow::Agent agent(
+        properties,
+        defaults,
+        apply,
+        [&service](const shadow::Properties &state, const std::string &clientToken)
+        {
+            shadow::Message update;
+            update.reported = state;
+            update.clientToken = clientToken;
+            update.version = 0;
+            update.code = 0;
+            service.publish(service.topic("update"), update);
+        },
+        shadow::default_report_interval_ms);
+
+    std::promise<void> gotInitialShadow;
+    uint64_t deltas = 0;
+    uint64_t rejected = 0;
+    service.subscribe(service.topic("update/delta"), [&agent, &deltas](const shadow::Message &message)
+                      {
+                          deltas++;
+                          agent.onDelta(message.delta); });
+    service.subscribe(service.topic("update/accepted"), [&agent](const shadow::Message &message)
+                      {
+                          agent.onUpdateAccepted(message.reported, message.clientToken);
+                          shadow::Properties::const_iterator pan = message.reported.find("pan");
+                          if (pan != message.reported.end())
+                          {
+                              s_tracker.accepted(pan->second, gpio::SimulatedBackend::now());
+                          } });
+    service.subscribe(service.topic("update/rejected"), [&agent, &rejected](const shadow::Message &message)
+                      {
+                          rejected++;
+                          agent.onUpdateRejected(message.code, message.error, message.clientToken); });
+    service.subscribe(service.topic("get/accepted"), [&agent, &gotInitialShadow](const shadow::Message &message)
+                      {
+                          agent.onGetAccepted(message.reported);
+                          agent.onDelta(message.delta);
+                          gotInitialShadow.set_value(); });
+    service.subscribe(service.topic("get/rejected"), [&gotInitialShadow](const shadow::Message &)
+                      { gotInitialShadow.set_value(); });
+    service.start();
+    agent.start();
+
+    // the thing starts with both axes reported at home
+    shadow::Message seed;
+    seed.desired["pan"] = seed.reported["pan"] = "90";
+    seed.desired["tilt"] = seed.reported["tilt"] = "90";
+    seed.version = 0;
+    seed.code = 0;
+    service.publish(service.topic("update"), seed);
+    shadow::Message get;
+    get.version = 0;
+    get.code = 0;
+    service.publish(service.topic("get"), get);
+    gotInitialShadow.get_future().wait();
+
+    const size_t total = (size_t)rate * seconds;
+    const uint64_t period = 1000000000ULL / rate;
+    uint64_t start = gpio::SimulatedBackend::now();
+    std::string last;
+    for (size_t i = 0; i < total; i++)
+    {
+        uint64_t due = start + i * period;
+        struct timespec ts = {(time_t)(due / 1000000000ULL), (long)(due % 1000000000ULL)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+
+        shadow::Message update;
+        last = desiredValue(i);
+        update.desired["pan"] = last;
+        update.version = 0;
+        update.code = 0;
+        s_tracker.published(last, gpio::SimulatedBackend::now());
+        service.publish(service.topic("update"), update);
+    }
+    double achieved = total / ((gpio::SimulatedBackend::now() - start) / 1e9);
+
+    // wait until the reported state caught up and the servo came to rest
+    uint64_t deadline = gpio::SimulatedBackend::now() + settle_timeout_ms * 1000000ULL;
+    while (gpio::SimulatedBackend::now() < deadline && s_tracker.acceptedCount() < total)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+    double panTarget = atof(last.c_str());
+    double panHorn = 0;
+    while (gpio::SimulatedBackend::now() < deadline)
+    {
+        double pan, tilt;
+        actuator::position(pan, tilt);
+        panHorn = backend.angleAt(servo::pan_gpio, gpio::SimulatedBackend::now());
+        if (fabs(pan - panTarget) < 1e-9 && fabs(panHorn - panTarget) < position_tolerance)
+        {
+            break;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    agent.stop();
+    service.stop();
+    actuator::stop();
+    gpio::terminate();
+
+    shadow::Message document = service.document();
+    metrics::Counter *applied = metrics::findCounter("shadow.applied");
+    metrics::Counter *reports = metrics::findCounter("shadow.reports");
+    printf("published %zu desired updates at %.1f/s (requested %u/s), one-way latency %ums\n", total, achieved, rate, latencyMs);
+    printf("device received %llu deltas, applied %llu batches, sent %llu reports, shadow version %llu\n",
+           (unsigned long long)deltas, (unsigned long long)(applied ? applied->value() : 0),
+           (unsigned long long)(reports ? reports->value() : 0), (unsigned long long)document.version);
+    printLatency("delta publish -> apply", s_tracker.applyLatency());
+    printLatency("delta publish -> servo", s_tracker.servoLatency(backend.pulses(), servo::pan_gpio));
+    printLatency("delta publish -> accepted", s_tracker.acceptLatency());
+
+    bool ok = true;
+    ok = bench::check(achieved >= 0.95 * rate, "publish rate sustained") && ok;
+    ok = bench::check(rejected == 0, "no rejected updates") && ok;
+    ok = bench::check(s_tracker.acceptedCount() == s_tracker.publishedCount(), "every desired value covered by an accepted report") && ok;
+    ok = bench::check(document.desired["pan"] == last && document.reported["pan"] == last, "shadow converged on the last desired value") && ok;
+    ok = bench::check(fabs(panHorn - panTarget) < position_tolerance, "servo at the last desired value") && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,152 @@
+/**
+ * Copyright Amazon.com, Inc. or its affiliates. All Rights Reserved.
+ * SPDX-License-Identifier: Apache-2.0.
+ */
+/// Snapshot benchmark.
+/// Offers synthetic 1280x720 NV12 frames at 30 fps the way the raw probe of the main encoder does, and takes full frame
+/// snapshots through the encoder the platform has. It fails when the image is not a JPEG of the frame size, when a
+/// request within snapshot::cache_ttl_ms is not served from the cache in under 1 ms, when concurrent requests for an
+/// expired image encode more than once, when an expired image is not replaced by a newer one, or when a thumbnail is
+/// returned although there is no analytics substream.
+///
+/// usage: c3-snapshot-bench [cache reads, default 1000]
+#include "../Snapshot.h"
+#include "../Metrics.h"
+#include "../Logger.h"
+#include "Bench.h"
+
+#include <atomic>
+#include <chrono>
+#include <gst/gst.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+LOGGER_TAG("bench")
+
+namespace
+{
+    const int width = 1280;
+    const int height = 720;
+    const unsigned int fps = 30;
+    const unsigned int concurrent = 8;
+
+    bool isJpeg(const snapshot::ImagePtr &image)
+    {
+        const std::vector<uint8_t> &jpeg = image->jpeg;
+        return jpeg.size() > 4 && jpeg[0] == 0xFF && jpeg[1] == 0xD8 && jpeg[jpeg.size() - 2] == 0xFF && jpeg[jpeg.size() - 1] == 0xD9;
+    }
+
+    /// Gradient with a moving bar, so the encoder does not get a flat frame
+    GstBuffer *makeFrame(unsigned int n)
+    {
+        const size_t lumaSize = (size_t)width * height;
+        GstBuffer *buffer = gst_buffer_new_allocate(NULL, lumaSize + lumaSize / 2, NULL);
+        GstMapInfo map;
+        gst_buffer_map(buffer, &map, GST_MAP_WRITE);
+        for (int y = 0; y < height; y++)
+        {
+            for (int x = 0; x < width; x++)
+            {
+                map.data[y * width + x] = (uint8_t)((x + y) / 8 + ((unsigned int)x / 40 == n % (width / 40) ? 128 : 0));
+            }
+        }
+        memset(map.data + lumaSize, 128, lumaSize / 2);
+        gst_buffer_unmap(buffer, &map);
+        return buffer;
+    }
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    LOG_CONFIGURE_STDOUT("WARN");
+    gst_init(&argc, &argv);
+    unsigned int reads = argc > 1 ? atoi(argv[1]) : 1000;
+    reads = reads != 0 ? reads : 1;
+
+    GstCaps *caps = gst_caps_new_simple("video/x-raw",
+                                        "format", G_TYPE_STRING, "NV12",
+                                        "width", G_TYPE_INT, width,
+                                        "height", G_TYPE_INT, height,
+                                        "framerate", GST_TYPE_FRACTION, fps, 1,
+                                        NULL);
+    std::vector<GstBuffer *> frames;
+    for (unsigned int i = 0; i < fps; i++)
+    {
+        frames.push_back(makeFrame(i));
+    }
+    std::atomic<bool> running(true);
+    std::thread camera([&]()
+                       {
+                           for (unsigned int n = 0; running; n++)
+                           {
+                               snapshot::offer(frames[n % frames.size()], caps);
+                               std::this_thread::sleep_for(std::chrono::microseconds(1000000 / fps));
+                           } });
+
+    metrics::Histogram &encodeUs = metrics::histogram("snapshot.encode_us");
+
+    // the first snapshot builds the encoder pipeline
+    snapshot::ImagePtr first;
+    bool taken = snapshot::take(snapshot::SIZE_FULL, first);
+    bool valid = taken && isJpeg(first) && first->width == width && first->height == height;
+
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    bool cached = taken;
+    for (unsigned int i = 0; i < reads && cached; i++)
+    {
+        snapshot::ImagePtr image;
+        cached = snapshot::take(snapshot::SIZE_FULL, image) && image == first;
+    }
+    double cachedUs = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - begin).count() / (double)reads;
+    cached = cached && std::chrono::steady_clock::now() - begin < std::chrono::milliseconds(snapshot::cache_ttl_ms);
+
+    // requests after the image expired wait for one new encode
+    std::this_thread::sleep_for(std::chrono::milliseconds(snapshot::cache_ttl_ms + 100));
+    uint64_t encodesBefore = encodeUs.count();
+    std::vector<snapshot::ImagePtr> images(concurrent);
+    std::vector<std::thread> viewers;
+    for (unsigned int i = 0; i < concurrent; i++)
+    {
+        viewers.push_back(std::thread([&images, i]()
+                                      { snapshot::take(snapshot::SIZE_FULL, images[i]); }));
+    }
+    for (size_t i = 0; i < viewers.size(); i++)
+    {
+        viewers[i].join();
+    }
+    bool shared = encodeUs.count() == encodesBefore + 1;
+    for (unsigned int i = 0; i < concurrent; i++)
+    {
+        shared = shared && images[i] && images[i] == images[0];
+    }
+    bool replaced = taken && images[0] && images[0] != first && images[0]->captureMs > first->captureMs && isJpeg(images[0]);
+
+    snapshot::ImagePtr thumbnail;
+    bool noThumbnail = !snapshot::take(snapshot::SIZE_THUMBNAIL, thumbnail);
+
+    running = false;
+    camera.join();
+    for (size_t i = 0; i < frames.size(); i++)
+    {
+        gst_buffer_unref(frames[i]);
+    }
+    gst_caps_unref(caps);
+
+    const char *encoder = snapshot::encoderName();
+    printf("encoder        %s\n", encoder != NULL ? encoder : "none");
+    printf("image          %zu bytes, %dx%d\n", taken ? first->jpeg.size() : 0, taken ? first->width : 0, taken ? first->height : 0);
+    printf("encode         %llu images, %llu us on average, %llu us at most\n", (unsigned long long)encodeUs.count(),
+           (unsigned long long)encodeUs.mean(), (unsigned long long)encodeUs.max());
+    printf("cache          %u reads, %.2f us each\n", reads, cachedUs);
+
+    bool ok = true;
+    ok = bench::check(valid, "a full frame snapshot is a JPEG of the frame size") && ok;
+    ok = bench::check(cached && cachedUs < 1000, "requests within the TTL are served from the cache") && ok;
+    ok = bench::check(shared, "concurrent requests share one encode") && ok;
+    ok = bench::check(replaced, "an expired image is replaced by a newer one") && ok;
+    ok = bench::check(noThumbnail, "no thumbnail without the analytics substream") && ok;
+    return ok ? 0 : 1;
+}
@@ -3,9 +3,16 @@
  * SPDX-License-Identifier: Apache-2.0.
  */
 #include "CommandLineUtils.h"
+#include "../ShadowCoalescer.h"
+#include "../Telemetry.h"
 #include <aws/crt/Api.h>
 #include <aws/crt/Types.h>
 #include <aws/crt/UUID.h>
+#include <cerrno>
+#include <cstdio>
+#include <climits>
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <iostream>
 
@@ -32,6 +39,29 @@ namespace Utils
     static const char *m_cmd_rtsp_uri = "rspt_uri";
     static const char *m_cmd_verbosity = "verbosity";
     static const char *m_cmd_log_file = "log_file";
+    static const char *m_cmd_trace_file = "trace_file";
+    static const char *m_cmd_ttff_slo = "ttff_slo_ms";
+    static const char *m_cmd_telemetry_interval = "telemetry_interval";
+    static const char *m_cmd_shadow_report_interval = "shadow_report_interval";
+    static const char *m_cmd_shadow_cache = "shadow_cache";
+    static const char *m_cmd_kvs_storage = "kvs_storage_mb";
+    static const char *m_cmd_spool_dir = "spool_dir";
+    static const char *m_cmd_spool_size = "spool_size_mb";
+    static const char *m_cmd_spool_upload = "spool_upload_kbps";
+    static const char *m_cmd_nvr_dir = "nvr_dir";
+    static const char *m_cmd_nvr_size = "nvr_size_mb";
+    static const char *m_cmd_nvr_segment = "nvr_segment_s";
+    static const char *m_cmd_record_mode = "record_mode";
+    static const char *m_cmd_preroll = "preroll_s";
+    static const char *m_cmd_postroll = "postroll_s";
+    static const char *m_cmd_motion_threshold = "motion_threshold";
+    static const char *m_cmd_motion_blocks = "motion_blocks";
+    static const char *m_cmd_servo_profile = "servo_profile";
+    static const char *m_cmd_ptz_presets = "ptz_presets";
+    static const char *m_cmd_servo_settle = "servo_settle_ms";
+    static const char *m_cmd_camera_model = "camera_model";
+    static const char *m_cmd_calibrate = "calibrate";
+    static const char *m_cmd_gpio_sim = "gpio_sim";
 
     CommandLineUtils::CommandLineUtils()
     {
@@ -267,6 +297,29 @@ namespace Utils
         }
     }
 
+    /// A whole number above 0 and up to maximum, anything else prints the help and exits
+    static uint64_t s_getPositiveCommand(
+        CommandLineUtils *cmdUtils,
+        const char *command,
+        const Aws::Crt::String &defaultValue,
+        const char *unit,
+        uint64_t maximum = UINT64_MAX)
+    {
+        Aws::Crt::String value = cmdUtils->GetCommandOrDefault(command, defaultValue);
+        char *end = NULL;
+        errno = 0;
+        unsigned long long parsed = strtoull(value.c_str(), &end, 10);
+        // strtoull takes a minus sign and wraps the value around
+        if (value.empty() || value.find('-') != Aws::Crt::String::npos || *end != '\0' || errno == ERANGE || parsed == 0 ||
+            parsed > maximum)
+        {
+            cmdUtils->PrintHelp();
+            fprintf(stderr, "--%s must be a number of %s from 1 to %llu\n", command, unit, (unsigned long long)maximum);
+            exit(-1);
+        }
+        return parsed;
+    }
+
     static void s_parseCommonMQTTCommands(CommandLineUtils *cmdUtils, cmdData *cmdData)
     {
         cmdData->input_endpoint = cmdUtils->GetCommandRequired(m_cmd_endpoint);
@@ -294,6 +347,29 @@ namespace Utils
         // m_cmd_channel_name, m_cmd_media_type, m_cmd_media_source_type, m_cmd_rtsp_uri
         cmdUtils.AddCommonKeyMediaCommands();
         cmdUtils.RegisterCommand(m_cmd_client_id, "<str>", "Client id to use (optional, default='test-*')");
+        cmdUtils.RegisterCommand(m_cmd_trace_file, "<path>", "Path prefix of the trace dumps written on SIGUSR1 (optional, default='/tmp/c3-trace')");
+        cmdUtils.RegisterCommand(m_cmd_telemetry_interval, "<int>", "Telemetry window in seconds, above 0 (optional, default=60)");
+        cmdUtils.RegisterCommand(m_cmd_shadow_report_interval, "<int>", "Minimum interval between reported shadow state updates in ms, above 0 (optional, default=500)");
+        cmdUtils.RegisterCommand(m_cmd_shadow_cache, "<path>", "Last applied shadow state, restored at boot (optional, default='../shadow_cache')");
+        cmdUtils.RegisterCommand(m_cmd_kvs_storage, "<int>", "In-memory buffer of kvssink in MB (optional, default=128)");
+        cmdUtils.RegisterCommand(m_cmd_spool_dir, "<path>", "Directory of the video spooled while the uplink is down (optional, default='../spool')");
+        cmdUtils.RegisterCommand(m_cmd_spool_size, "<int>", "Disk quota of the spool in MB, 0 disables spooling (optional, default=2048)");
+        cmdUtils.RegisterCommand(m_cmd_spool_upload, "<int>", "Upload rate of the spooled backlog in kbit/s (optional, default=2000)");
+        cmdUtils.RegisterCommand(m_cmd_nvr_dir, "<path>", "Directory of the local recordings (optional, default='../nvr')");
+        cmdUtils.RegisterCommand(m_cmd_nvr_size, "<int>", "Disk quota of the local recordings in MB, 0 disables them (optional, default=0)");
+        cmdUtils.RegisterCommand(m_cmd_nvr_segment, "<int>", "Duration of a local recording segment in seconds (optional, default=60)");
+        cmdUtils.RegisterCommand(m_cmd_record_mode, "<str>", "continuous, or event to send video only around triggers (optional, default='continuous')");
+        cmdUtils.RegisterCommand(m_cmd_preroll, "<int>", "Seconds of video sent ahead of an event trigger (optional, default=5)");
+        cmdUtils.RegisterCommand(m_cmd_postroll, "<int>", "Seconds of video sent after the last event trigger (optional, default=10)");
+        cmdUtils.RegisterCommand(m_cmd_motion_threshold, "<int>", "Mean luma difference of a moving block in event mode, 0 disables motion triggers (optional, default=12)");
+        cmdUtils.RegisterCommand(m_cmd_motion_blocks, "<int>", "Moving blocks out of 300 which trigger an event (optional, default=2)");
+        cmdUtils.RegisterCommand(m_cmd_servo_profile, "<path>", "Servo calibration profile (optional, default='../servo_calibration')");
+        cmdUtils.RegisterCommand(m_cmd_servo_settle, "<int>", "Hold time in ms after which the servo pulses are switched off, 0 keeps them on (optional, default=1000)");
+        cmdUtils.RegisterCommand(m_cmd_ptz_presets, "<path>", "Named pan/tilt presets (optional, default='../ptz_presets')");
+        cmdUtils.RegisterCommand(m_cmd_camera_model, "<path>", "Camera field of view for click-to-center (optional, default='../camera_model')");
+        cmdUtils.RegisterCommand(m_cmd_calibrate, "", "If present the servos are calibrated interactively and the profile is written.");
+        cmdUtils.RegisterCommand(m_cmd_gpio_sim, "", "If present the servos are simulated instead of driven through pigpio.");
+        cmdUtils.RegisterCommand(m_cmd_ttff_slo, "<int>", "Time to first keyframe objective of a WebRTC viewer in ms (optional, default=2000)");
 
         s_addLoggingSendArgumentsStartLogging(argc, argv, api_handle, &cmdUtils);
 
@@ -312,6 +388,43 @@ namespace Utils
         returnData.input_rtspUri = cmdUtils.GetCommandOrDefault(m_cmd_rtsp_uri, "");
         returnData.input_clientId =
             cmdUtils.GetCommandOrDefault(m_cmd_client_id, Aws::Crt::String("test-") + Aws::Crt::UUID().ToString());
+        returnData.input_traceFile = cmdUtils.GetCommandOrDefault(m_cmd_trace_file, "/tmp/c3-trace");
+        // both end up as unsigned int in the telemetry publisher and the coalescer
+        returnData.input_telemetryInterval = s_getPositiveCommand(
+            &cmdUtils, m_cmd_telemetry_interval, std::to_string(telemetry::default_interval).c_str(), "seconds", UINT_MAX);
+        returnData.input_shadowReportInterval = s_getPositiveCommand(
+            &cmdUtils,
+            m_cmd_shadow_report_interval,
+            std::to_string(shadow::default_report_interval_ms).c_str(),
+            "milliseconds",
+            UINT_MAX);
+        returnData.input_shadowCache = cmdUtils.GetCommandOrDefault(m_cmd_shadow_cache, "../shadow_cache");
+        returnData.input_kvsStorageMb = atoi(cmdUtils.GetCommandOrDefault(m_cmd_kvs_storage, "128").c_str());
+        returnData.input_spoolDir = cmdUtils.GetCommandOrDefault(m_cmd_spool_dir, "../spool");
+        returnData.input_spoolSizeMb = atoi(cmdUtils.GetCommandOrDefault(m_cmd_spool_size, "2048").c_str());
+        int spoolUploadKbps = atoi(cmdUtils.GetCommandOrDefault(m_cmd_spool_upload, "2000").c_str());
+        if (spoolUploadKbps <= 0)
+        {
+            cmdUtils.PrintHelp();
+            fprintf(stderr, "--%s must be a positive rate in kbit/s\n", m_cmd_spool_upload);
+            exit(-1);
+        }
+        returnData.input_spoolUploadKbps = spoolUploadKbps;
+        returnData.input_nvrDir = cmdUtils.GetCommandOrDefault(m_cmd_nvr_dir, "../nvr");
+        returnData.input_nvrSizeMb = atoi(cmdUtils.GetCommandOrDefault(m_cmd_nvr_size, "0").c_str());
+        returnData.input_nvrSegmentS = atoi(cmdUtils.GetCommandOrDefault(m_cmd_nvr_segment, "60").c_str());
+        returnData.input_recordMode = cmdUtils.GetCommandOrDefault(m_cmd_record_mode, "continuous");
+        returnData.input_prerollS = atoi(cmdUtils.GetCommandOrDefault(m_cmd_preroll, "5").c_str());
+        returnData.input_postrollS = atoi(cmdUtils.GetCommandOrDefault(m_cmd_postroll, "10").c_str());
+        returnData.input_motionThreshold = atoi(cmdUtils.GetCommandOrDefault(m_cmd_motion_threshold, "12").c_str());
+        returnData.input_motionBlocks = atoi(cmdUtils.GetCommandOrDefault(m_cmd_motion_blocks, "2").c_str());
+        returnData.input_servoProfile = cmdUtils.GetCommandOrDefault(m_cmd_servo_profile, "../servo_calibration");
+        returnData.input_servoSettleMs = atoi(cmdUtils.GetCommandOrDefault(m_cmd_servo_settle, "1000").c_str());
+        returnData.input_ptzPresets = cmdUtils.GetCommandOrDefault(m_cmd_ptz_presets, "../ptz_presets");
+        returnData.input_cameraModel = cmdUtils.GetCommandOrDefault(m_cmd_camera_model, "../camera_model");
+        returnData.input_calibrate = cmdUtils.HasCommand(m_cmd_calibrate);
+        returnData.input_gpioSim = cmdUtils.HasCommand(m_cmd_gpio_sim);
+        returnData.input_ttffSloMs = s_getPositiveCommand(&cmdUtils, m_cmd_ttff_slo, "2000", "milliseconds");
         return returnData;
     }
 
@@ -215,6 +215,35 @@ namespace Utils
         Aws::Crt::String input_mediaType;
         Aws::Crt::String input_mediaSourceType;
         Aws::Crt::String input_rtspUri;
+        uint64_t input_ttffSloMs;
+        // Diagnostics
+        Aws::Crt::String input_traceFile;
+        uint64_t input_telemetryInterval;
+        // Device shadow
+        uint64_t input_shadowReportInterval;
+        Aws::Crt::String input_shadowCache;
+        // KVS producer buffering
+        uint64_t input_kvsStorageMb;
+        Aws::Crt::String input_spoolDir;
+        uint64_t input_spoolSizeMb;
+        uint64_t input_spoolUploadKbps;
+        // Local recording
+        Aws::Crt::String input_nvrDir;
+        uint64_t input_nvrSizeMb;
+        uint64_t input_nvrSegmentS;
+        // Event recording
+        Aws::Crt::String input_recordMode;
+        uint64_t input_prerollS;
+        uint64_t input_postrollS;
+        uint64_t input_motionThreshold;
+        uint64_t input_motionBlocks;
+        // Servo
+        Aws::Crt::String input_servoProfile;
+        uint64_t input_servoSettleMs;
+        Aws::Crt::String input_ptzPresets;
+        Aws::Crt::String input_cameraModel;
+        bool input_calibrate;
+        bool input_gpioSim;
     };
 
     cmdData parseSampleInputShadow(int argc, char *argv[], Aws::Crt::ApiHandle *api_handle);